@@ -661,6 +661,13 @@ int main(int argc, char *argv[])
 	 */
 	if (paircmp_init() < 0) EXIT_WITH_FAILURE;
 
+#ifdef HAVE_REGEX
+	/*
+	 *	Register the radmin commands for the regex cache
+	 */
+	if (regex_cache_stats_register() < 0) EXIT_WITH_FAILURE;
+#endif
+
 	/*
 	 *  Everything seems to have loaded OK, exit gracefully.
 	 */
@@ -697,8 +704,15 @@ int main(int argc, char *argv[])
 	{
 		int networks = config->num_networks;
 		int workers = config->num_workers;
+		int worker_select;
 		fr_event_list_t *el = NULL;
 
+		worker_select = fr_str2int(fr_network_worker_select_table, config->worker_select, -1);
+		if (worker_select < 0) {
+			ERROR("Unknown value for thread.worker_select '%s'", config->worker_select);
+			EXIT_WITH_FAILURE;
+		}
+
 		/*
 		 *	Single server mode: use the global event list.
 		 *	Otherwise, each network thread will create
@@ -711,7 +725,7 @@ int main(int argc, char *argv[])
 		}
 
 		sc = fr_schedule_create(NULL, el, &default_log, rad_debug_lvl,
-					networks, workers,
+					networks, workers, worker_select,
 					thread_instantiate,
 					config->root_cs);
 		if (!sc) {
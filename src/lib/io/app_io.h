@@ -44,11 +44,15 @@ typedef struct {
 	fr_io_open_t			open;		//!< Open a new socket for listening, or accept/connect a new
 							//!< connection.
 	fr_io_get_fd_t			fd;		//!< Return the file descriptor from the instance.
+	fr_io_get_fd_t			read_fd;	//!< Return the file descriptor to watch for reads, if
+							//!< it isn't the one returned by fd.
 	fr_io_set_fd_t			fd_set;		//!< Set the file descriptor to the instance.
 
 	fr_io_data_read_t		read;		//!< Read from a socket to a data buffer
 	fr_io_data_write_t		write;		//!< Write from a data buffer to a socket
 
+	fr_io_data_pending_t		pending;	//!< Number of packets buffered by a batched read.
+
 	fr_io_data_inject_t		inject;		//!< Inject a packet into a socket.
 
 	fr_io_data_vnode_t		vnode;		//!< Handle notifications that the VNODE has changed
@@ -56,7 +60,8 @@ typedef struct {
 	fr_io_decode_t			decode;		//!< Translate raw bytes into VALUE_PAIRs and metadata.
 	fr_io_encode_t			encode;		//!< Pack VALUE_PAIRs back into a byte array.
 
-	fr_io_signal_t			flush;		//!< Flush the data when the socket is ready for writing.
+	fr_io_signal_t			flush;		//!< Write any packets queued by a batched write.
+	fr_io_batch_stats_get_t		batch_stats;	//!< Get batched read / write statistics.
 
 	fr_io_signal_t			error;		//!< There was an error on the socket.
 	fr_io_close_t			close;		//!< Close the transport.
@@ -64,6 +69,7 @@ typedef struct {
 	fr_io_nak_t			nak;		//!< Function to send a NAK.
 
 	fr_io_data_cmp_t		compare;	//!< compare two packets
+	fr_io_data_hash_t		hash;		//!< hash the fields of a packet used by compare
 
 	fr_io_connection_set_t		connection_set;	//!< set src/dst IP/port of a connection
 	fr_io_network_get_t		network_get;	//!< get dynamic network information
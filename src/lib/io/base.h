@@ -304,6 +304,49 @@ typedef void (*fr_io_data_vnode_t)(void *instance, uint32_t fflags);
  */
 typedef int (*fr_io_data_cmp_t)(void const *instance, void const *packet1, void const *packet2);
 
+/** Hash a packet for storing in a duplicate detection table.
+ *
+ * The hash MUST only cover the fields which are checked by the
+ * corresponding #fr_io_data_cmp_t function.  i.e. any two packets
+ * which compare as identical MUST have the same hash.
+ *
+ * @param[in] instance		the context for this function
+ * @param[in] packet		the packet to hash
+ * @return the hash of the packet.
+ */
+typedef uint32_t (*fr_io_data_hash_t)(void const *instance, void const *packet);
+
+/** Return the number of packets which have been read, but not yet returned
+ *
+ *  Transports which read multiple packets with one system call buffer
+ *  the extra packets internally.  The caller MUST keep calling read()
+ *  while this function returns non-zero, as the socket may no longer
+ *  be readable.
+ *
+ * @param[in] instance		the context for this function
+ * @return
+ *	- 0 if there are no buffered packets
+ *	- >0 the number of buffered packets
+ */
+typedef int (*fr_io_data_pending_t)(void const *instance);
+
+/** Statistics for transports which read and write multiple packets per system call
+ *
+ */
+typedef struct {
+	uint64_t	read_calls;		//!< Number of batched reads.
+	uint64_t	read_packets;		//!< Number of packets returned by those reads.
+	uint64_t	write_calls;		//!< Number of batched writes.
+	uint64_t	write_packets;		//!< Number of packets written by those writes.
+} fr_io_batch_stats_t;
+
+/** Get the batched I/O statistics for a socket
+ *
+ * @param[in] instance		the context for this function
+ * @param[out] stats		where the statistics are written.
+ */
+typedef void (*fr_io_batch_stats_get_t)(void const *instance, fr_io_batch_stats_t *stats);
+
 /**  Handle an error on the socket.
  *
  *  In general, the only thing to do on errors is to close the
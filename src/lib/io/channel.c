@@ -38,18 +38,9 @@ RCSID("$Id$")
 #define MPRINT(...)
 #endif
 
-/*
- *	We disable this until we fix all of the signaling issues...
- */
-#define ENABLE_SKIPS (0)
-
 #define TO_WORKER (0)
 #define FROM_WORKER (1)
 
-#if 0
-#define SIGNAL_INTERVAL (1000000)	//!< The minimum interval between worker signals.
-#endif
-
 /** Size of the atomic queues
  *
  * The queue reader MUST service the queue occasionally,
@@ -73,9 +64,6 @@ typedef enum fr_channel_signal_t {
 	/*
 	 *	The preceding MUST be in the same order as fr_channel_event_t
 	 */
-
-	FR_CHANNEL_SIGNAL_DATA_DONE_WORKER,
-	FR_CHANNEL_SIGNAL_WORKER_SLEEPING,
 } fr_channel_signal_t;
 
 typedef struct fr_channel_control_t {
@@ -89,6 +77,14 @@ typedef struct fr_channel_control_t {
  * Consists of a kqueue descriptor, and an atomic queue.
  * The atomic queue is there to get bulk data through, because it's more efficient
  * than pushing 1M+ events per second through a kqueue.
+ *
+ * The writer only signals the reader when the reader has said it
+ * needs a signal, by setting must_signal.  The reader sets the flag
+ * when it finds the queue empty, and then checks the queue once more.
+ * The writer pushes a message, and then checks the flag.  With a full
+ * fence on each side, either the reader sees the message, or the
+ * writer sees the flag.  So wakeups are never lost, and while the
+ * reader is busy, writes are pure atomic queue operations.
  */
 typedef struct fr_channel_end_t {
 	fr_control_t		*control;	//!< The control plane, consisting of an atomic queue and kqueue.
@@ -98,11 +94,11 @@ typedef struct fr_channel_end_t {
 	void			*ctx;		//!< Worker context.
 
 	int			num_outstanding; //!< Number of outstanding requests with no reply.
-	bool			must_signal;	//!< we need to signal the other end
+	atomic_bool		must_signal;	//!< Set by the reader of our queue when it goes idle.
 
 	size_t			num_signals;	//!< Number of kevent signals we've sent.
 
-	size_t			num_resignals;	//!< Number of signals resent.
+	size_t			num_skipped;	//!< Number of signals skipped because the reader was busy.
 
 	size_t			num_kevents;	//!< Number of times we've looked at kevents.
 
@@ -213,6 +209,13 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *master, fr_contro
 	ch->end[FROM_WORKER].last_read_other = when;
 	ch->end[FROM_WORKER].last_sent_signal = when;
 
+	/*
+	 *	Neither end has read anything yet, so the first
+	 *	message in each direction has to be signalled.
+	 */
+	atomic_init(&ch->end[TO_WORKER].must_signal, true);
+	atomic_init(&ch->end[FROM_WORKER].must_signal, true);
+
 	ch->active = true;
 
 	return ch;
@@ -245,7 +248,7 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 
 	end->last_sent_signal = when;
 	end->num_signals++;
-	end->must_signal = false;
+	end->sequence_at_last_signal = end->sequence;
 
 	cc.signal = which;
 	cc.ack = end->ack;
@@ -254,6 +257,73 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 	return fr_control_message_send(end->control, end->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+/** Signal the reader of a queue, but only if it's idle
+ *
+ * Called by the writer after it has pushed a message onto the queue.
+ * If the reader is still busy, it will find the message on its own,
+ * and we skip the signal.  Multiple messages written while the
+ * reader is idle result in only one signal, as the first one clears
+ * must_signal.
+ *
+ * @param[in] ch	the channel.
+ * @param[in] when	the data was ready.  Typically taken from the message.
+ * @param[in] end	of the channel that the message was written to.
+ * @param[in] which	end of the channel (0/1).
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int fr_channel_data_ready_idle(fr_channel_t *ch, fr_time_t when, fr_channel_end_t *end, fr_channel_signal_t which)
+{
+	/*
+	 *	Order the push of the message before the read of the
+	 *	flag.  This pairs with the fence in fr_channel_pop().
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (!atomic_load_explicit(&end->must_signal, memory_order_relaxed) ||
+	    !atomic_exchange_explicit(&end->must_signal, false, memory_order_relaxed)) {
+		end->num_skipped++;
+		return 0;
+	}
+
+	return fr_channel_data_ready(ch, when, end, which);
+}
+
+/** Pop a message from a queue, telling the writer if we're going idle
+ *
+ * If the queue is empty, the reader is about to go do something else,
+ * or sleep.  So we set must_signal on the writers end, and look at the
+ * queue one more time, in case the writer pushed a message before it
+ * saw the flag.
+ *
+ * @param[in] aq	the queue to read from.
+ * @param[in] end	the writers end of the channel.
+ * @return
+ *	- NULL on no data to receive.
+ *	- The message we received (on success).
+ */
+static fr_channel_data_t *fr_channel_pop(fr_atomic_queue_t *aq, fr_channel_end_t *end)
+{
+	fr_channel_data_t *cd;
+
+	if (fr_atomic_queue_pop(aq, (void **) &cd)) return cd;
+
+	/*
+	 *	The flag is still set from the last time we went
+	 *	idle, so the writer will signal us for the next
+	 *	message.
+	 */
+	if (atomic_load_explicit(&end->must_signal, memory_order_relaxed)) return NULL;
+
+	atomic_store_explicit(&end->must_signal, true, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return NULL;
+
+	return cd;
+}
+
 #define IALPHA (8)
 #define RTT(_old, _new) ((_new + ((IALPHA - 1) * _old)) / IALPHA)
 
@@ -314,42 +384,15 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd, fr_channel_
 
 	MPRINT("MASTER requests %zd, num_outstanding %zd\n", master->num_packets, master->num_outstanding);
 
-#if ENABLE_SKIPS
 	/*
-	 *	We just sent the first packet.  There can't possibly be a reply, so don't bother looking.
-	 */
-	if (master->num_outstanding == 1) {
-		*p_reply = NULL;
-
-
-		/*
-		 *	There is at least one old packet which is
-		 *	outstanding, look for a reply.
-		 */
-	} else if (master->num_outstanding > 1) {
-		*p_reply = fr_channel_recv_reply(ch);
-
-		/*
-		 *	There's no reply yet, so we still have packets outstanding.
-		 *	Or, there is a reply, and there are more packets outstanding.
-		 *	Skip the signal.
-		 */
-		if (!master->must_signal && (!*p_reply || (*p_reply && (master->num_outstanding > 1)))) {
-			MPRINT("MASTER SKIPS signal\n");
-			return 0;
-		}
-	}
-#endif
-
-	/*
-	 *	Tell the other end that there is new data ready.
+	 *	Tell the other end that there is new data ready, if
+	 *	it's idle.
 	 *
 	 *	Ignore errors on signalling.  The worker already has
 	 *	the packet in its inbound queue, so at some point, it
 	 *	will pick up the message.
 	 */
-	MPRINT("MASTER SIGNALS\n");
-	(void) fr_channel_data_ready(ch, when, master, FR_CHANNEL_SIGNAL_DATA_TO_WORKER);
+	(void) fr_channel_data_ready_idle(ch, when, master, FR_CHANNEL_SIGNAL_DATA_TO_WORKER);
 	return 0;
 }
 
@@ -372,7 +415,8 @@ fr_channel_data_t *fr_channel_recv_reply(fr_channel_t *ch)
 	/*
 	 *	It's OK for the queue to be empty.
 	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return NULL;
+	cd = fr_channel_pop(aq, &ch->end[FROM_WORKER]);
+	if (!cd) return NULL;
 
 	/*
 	 *	We want an exponential moving average for round trip
@@ -432,7 +476,8 @@ fr_channel_data_t *fr_channel_recv_request(fr_channel_t *ch)
 	/*
 	 *	It's OK for the queue to be empty.
 	 */
-	if (!fr_atomic_queue_pop(aq, (void **) &cd)) return NULL;
+	cd = fr_channel_pop(aq, &ch->end[TO_WORKER]);
+	if (!cd) return NULL;
 
 	rad_assert(cd->live.sequence > worker->ack);
 	rad_assert(cd->live.sequence >= worker->sequence); /* must have more requests than replies */
@@ -496,59 +541,17 @@ int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd, fr_channel_da
 	rad_assert(worker->last_write <= when);
 	worker->last_write = when;
 
+	/*
+	 *	Wake up the master if it's idle.
+	 */
+	(void) fr_channel_data_ready_idle(ch, when, worker, FR_CHANNEL_SIGNAL_DATA_FROM_WORKER);
+
 	/*
 	 *	Even if we think we have no more packets to process,
 	 *	the caller may have sent us one.  Go check the input
 	 *	channel.
 	 */
 	*p_request = fr_channel_recv_request(ch);
-
-	/*
-	 *	No packets outstanding, we HAVE to signal the master
-	 *	thread.
-	 */
-	if (worker->num_outstanding == 0) {
-		(void) fr_channel_data_ready(ch, when, worker, FR_CHANNEL_SIGNAL_DATA_DONE_WORKER);
-		return 0;
-	}
-
-	MPRINT("\twhen - last_read_other = %zd - %zd = %zd\n", when, worker->last_read_other, when - worker->last_read_other);
-	MPRINT("\twhen - last signal = %zd - %zd = %zd\n", when, worker->last_sent_signal, when - worker->last_sent_signal);
-	MPRINT("\tsequence - ack = %zd - %zd = %zd\n", worker->sequence, worker->their_view_of_my_sequence, worker->sequence - worker->their_view_of_my_sequence);
-
-#ifdef __APPLE__
-	/*
-	 *	If we've sent them a signal since the last ACK, they
-	 *	will receive it, and process the packets.  So we don't
-	 *	need to signal them again.
-	 *
-	 *	But... this doesn't appear to work on the Linux
-	 *	libkqueue implementation.
-	 */
-	if (worker->sequence_at_last_signal > worker->their_view_of_my_sequence) return 0;
-#endif
-
-	/*
-	 *	If we've received a new packet in the last while, OR
-	 *	we've sent a signal in the last while, then we don't
-	 *	need to send a new signal.  But we DO send a signal if
-	 *	we haven't seen an ACK for a few packets.
-	 *
-	 *	FIXME: make these limits configurable, or include
-	 *	predictions about packet processing time?
-	 */
-	rad_assert(worker->their_view_of_my_sequence <= worker->sequence);
-#if 0
-	if (((worker->sequence - worker->their_view_of_my_sequence) <= 1000) &&
-	    ((when - worker->last_read_other < SIGNAL_INTERVAL) ||
-	     ((when - worker->last_sent_signal) < SIGNAL_INTERVAL))) {
-		MPRINT("\tWORKER SKIPS signal\n");
-		return 0;
-	}
-#endif
-
-	MPRINT("\tWORKER SIGNALS num_outstanding %zd\n", worker->num_outstanding);
-	(void) fr_channel_data_ready(ch, when, worker, FR_CHANNEL_SIGNAL_DATA_FROM_WORKER);
 	return 0;
 }
 
@@ -568,48 +571,32 @@ int fr_channel_null_reply(fr_channel_t *ch)
 
 	worker = &(ch->end[FROM_WORKER]);
 
+	rad_assert(worker->num_outstanding > 0);
+	worker->num_outstanding--;
 	worker->sequence++;
 	return 0;
 }
 
-
-
-/** Signal a channel that the worker is sleeping
+/** Get the number of requests which the worker hasn't replied to
  *
- * This function should be called from the workers idle loop.
- * i.e. only when it has nothing else to do.
+ * The workers sequence number counts replies, and requests it
+ * dropped via fr_channel_null_reply().  So the difference between our
+ * sequence number and the last one the worker sent back is the
+ * workers backlog.  Dropped requests are only counted once the worker
+ * sends another reply.
  *
- * @param[in] ch	the channel to signal we're no longer listening on.
- * @return
- *	- <0 on error
- *	- 0 on success
+ * May only be called by the master.
+ *
+ * @param[in] ch	the channel.
+ * @return the number of outstanding requests.
  */
-int fr_channel_worker_sleeping(fr_channel_t *ch)
+uint64_t fr_channel_requests_outstanding(fr_channel_t const *ch)
 {
-	fr_channel_end_t *worker;
-	fr_channel_control_t cc;
-
-	worker = &(ch->end[FROM_WORKER]);
-
-	/*
-	 *	We don't have any outstanding requests to process for
-	 *	this channel, don't signal the network thread that
-	 *	we're sleeping.  It already knows.
-	 */
-	if (worker->num_outstanding == 0) return 0;
-
-	worker->num_signals++;
-
-	cc.signal = FR_CHANNEL_SIGNAL_WORKER_SLEEPING;
-	cc.ack = worker->ack;
-	cc.ch = ch;
-
-	MPRINT("\tWORKER SLEEPING num_outstanding %zd, packets in %zd, packets out %zd\n", worker->num_outstanding,
-	       ch->end[TO_WORKER].num_packets, worker->num_packets);
-	return fr_control_message_send(worker->control, worker->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
+	return ch->end[TO_WORKER].sequence - ch->end[TO_WORKER].ack;
 }
 
 
+
 /** Service a control-plane message
  *
  * @param[in] when		The current time.
@@ -623,93 +610,24 @@ int fr_channel_worker_sleeping(fr_channel_t *ch)
  *	- FR_CHANNEL_OPEN when a channel has been opened and sent to us
  *	- FR_CHANNEL_CLOSE when a channel should be closed
  */
-fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size)
+fr_channel_event_t fr_channel_service_message(UNUSED fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size)
 {
-	int rcode;
-#if ENABLE_SKIPS
-	uint64_t ack;
-#endif
 	fr_channel_control_t cc;
 	fr_channel_signal_t cs;
-	fr_channel_event_t ce = FR_CHANNEL_ERROR;
-	fr_channel_end_t *master;
-	fr_channel_t *ch;
 
 	rad_assert(data_size == sizeof(cc));
 	memcpy(&cc, data, data_size);
 
 	cs = cc.signal;
-#if ENABLE_SKIPS
-	ack = cc.ack;
-#endif
-	*p_channel = ch = cc.ch;
+	*p_channel = cc.ch;
 
-	switch (cs) {
 	/*
 	 *	These all have the same numbers as the channel
 	 *	events, and have no extra processing.  We just
 	 *	return them as-is.
 	 */
-	case FR_CHANNEL_SIGNAL_ERROR:
-	case FR_CHANNEL_SIGNAL_DATA_TO_WORKER:
-	case FR_CHANNEL_SIGNAL_DATA_FROM_WORKER:
-	case FR_CHANNEL_SIGNAL_OPEN:
-	case FR_CHANNEL_SIGNAL_CLOSE:
-		MPRINT("channel got %d\n", cs);
-		return (fr_channel_event_t) cs;
-
-	/*
-	 *	Only sent by the worker.  Both of these
-	 *	situations are largely the same, except for
-	 *	return codes.
-	 */
-	case FR_CHANNEL_SIGNAL_DATA_DONE_WORKER:
-		MPRINT("channel got data_done_worker\n");
-		ce = FR_CHANNEL_DATA_READY_NETWORK;
-		ch->end[TO_WORKER].must_signal = true;
-		break;
-
-	case FR_CHANNEL_SIGNAL_WORKER_SLEEPING:
-		MPRINT("channel got worker_sleeping\n");
-		ce = FR_CHANNEL_NOOP;
-		ch->end[TO_WORKER].must_signal = true;
-		break;
-	}
-
-	/*
-	 *	Compare their ACK to the last sequence we
-	 *	sent.  If it's different, we signal the worker
-	 *	to wake up.
-	 */
-	master = &ch->end[TO_WORKER];
-#if ENABLE_SKIPS
-	if (!master->must_signal && (ack == master->sequence)) {
-		MPRINT("MASTER SKIPS signal AFTER CE %d num_outstanding %zd\n", cs, master->num_outstanding);
-		MPRINT("MASTER has ack %zd, my seq %zd my_view %zd\n", ack, master->sequence, master->their_view_of_my_sequence);
-		return ce;
-	}
-
-	/*
-	 *	The worker is sleeping or done.  There are more
-	 *	packets available, so we signal it to wake up again.
-	 */
-	rad_assert(ack <= master->sequence);
-#endif
-
-	/*
-	 *	We're signaling it again...
-	 */
-	master->num_resignals++;
-
-	/*
-	 *	The worker hasn't seen our last few packets.  Signal
-	 *	that there is data ready.
-	 */
-	MPRINT("MASTER SIGNALS AFTER CE %d\n", cs);
-	rcode = fr_channel_data_ready(ch, when, master, FR_CHANNEL_SIGNAL_DATA_TO_WORKER);
-	if (rcode < 0) return FR_CHANNEL_ERROR;
-
-	return ce;
+	MPRINT("channel got %d\n", cs);
+	return (fr_channel_event_t) cs;
 }
 
 
@@ -867,17 +785,42 @@ int fr_channel_signal_open(fr_channel_t *ch)
 	return fr_control_message_send(ch->end[TO_WORKER].control, ch->end[TO_WORKER].rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+/** Get the signalling statistics for a channel
+ *
+ * May only be called by the master, or after both ends have stopped
+ * using the channel.
+ *
+ * @param[in] ch		The channel.
+ * @param[out] to_worker	Statistics for requests sent to the worker.
+ * @param[out] from_worker	Statistics for replies sent by the worker.
+ */
+void fr_channel_stats(fr_channel_t *ch, fr_channel_stats_t *to_worker, fr_channel_stats_t *from_worker)
+{
+	int i;
+	fr_channel_stats_t *stats[2] = { to_worker, from_worker };
+
+	for (i = TO_WORKER; i <= FROM_WORKER; i++) {
+		stats[i]->packets = ch->end[i].num_packets;
+		stats[i]->signals = ch->end[i].num_signals;
+		stats[i]->skipped = ch->end[i].num_skipped;
+		stats[i]->kevents = ch->end[i].num_kevents;
+	}
+}
+
 void fr_channel_debug(fr_channel_t *ch, FILE *fp)
 {
 	fprintf(fp, "to worker\n");
+	fprintf(fp, "\tnum_packets sent = %"PRIu64"\n", ch->end[TO_WORKER].num_packets);
 	fprintf(fp, "\tnum_signals sent = %zu\n", ch->end[TO_WORKER].num_signals);
-	fprintf(fp, "\tnum_signals re-sent = %zu\n", ch->end[TO_WORKER].num_resignals);
+	fprintf(fp, "\tnum_signals skipped = %zu\n", ch->end[TO_WORKER].num_skipped);
 	fprintf(fp, "\tnum_kevents checked = %zu\n", ch->end[TO_WORKER].num_kevents);
 	fprintf(fp, "\tsequence = %"PRIu64"\n", ch->end[TO_WORKER].sequence);
 	fprintf(fp, "\tack = %"PRIu64"\n", ch->end[TO_WORKER].ack);
 
 	fprintf(fp, "to receive\n");
+	fprintf(fp, "\tnum_packets sent = %"PRIu64"\n", ch->end[FROM_WORKER].num_packets);
 	fprintf(fp, "\tnum_signals sent = %zu\n", ch->end[FROM_WORKER].num_signals);
+	fprintf(fp, "\tnum_signals skipped = %zu\n", ch->end[FROM_WORKER].num_skipped);
 	fprintf(fp, "\tnum_kevents checked = %zu\n", ch->end[FROM_WORKER].num_kevents);
 	fprintf(fp, "\tsequence = %"PRIu64"\n", ch->end[FROM_WORKER].sequence);
 	fprintf(fp, "\tack = %"PRIu64"\n", ch->end[FROM_WORKER].ack);
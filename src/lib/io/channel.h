@@ -123,6 +123,16 @@ typedef struct fr_channel_data_t {
 
 extern const FR_NAME_NUMBER channel_packet_priority[];
 
+/**
+ *  Signalling statistics for one direction of a channel.
+ */
+typedef struct fr_channel_stats_t {
+	uint64_t	packets;			//!< Messages written to the queue.
+	uint64_t	signals;			//!< Wakeups sent to the reader.
+	uint64_t	skipped;			//!< Wakeups skipped because the reader was busy.
+	uint64_t	kevents;			//!< Control-plane events serviced.
+} fr_channel_stats_t;
+
 fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *master, fr_control_t *worker) CC_HINT(nonnull);
 
 int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cm, fr_channel_data_t **p_reply) CC_HINT(nonnull);
@@ -130,11 +140,10 @@ fr_channel_data_t *fr_channel_recv_request(fr_channel_t *ch) CC_HINT(nonnull);
 
 int fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cm, fr_channel_data_t **p_request) CC_HINT(nonnull);
 int fr_channel_null_reply(fr_channel_t *ch) CC_HINT(nonnull);
+uint64_t fr_channel_requests_outstanding(fr_channel_t const *ch) CC_HINT(nonnull);
 
 fr_channel_data_t *fr_channel_recv_reply(fr_channel_t *ch) CC_HINT(nonnull);
 
-int fr_channel_worker_sleeping(fr_channel_t *ch) CC_HINT(nonnull);
-
 int fr_channel_service_kevent(fr_channel_t *ch, fr_control_t *c, struct kevent const *kev) CC_HINT(nonnull);
 fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_channel, void const *data, size_t data_size) CC_HINT(nonnull);
 
@@ -150,6 +159,7 @@ void *fr_channel_worker_ctx_get(fr_channel_t *ch) CC_HINT(nonnull);
 void fr_channel_master_ctx_add(fr_channel_t *ch, void *ctx) CC_HINT(nonnull);
 void *fr_channel_master_ctx_get(fr_channel_t *ch) CC_HINT(nonnull);
 
+void fr_channel_stats(fr_channel_t *ch, fr_channel_stats_t *to_worker, fr_channel_stats_t *from_worker) CC_HINT(nonnull);
 
 void fr_channel_debug(fr_channel_t *ch, FILE *fp);
 
@@ -26,6 +26,7 @@
 #include <freeradius-devel/server/modules.h>
 #include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/io/master.h>
+#include <freeradius-devel/util/ohash.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/server/rad_assert.h>
 
@@ -78,7 +79,7 @@ typedef struct fr_io_client_t {
 
 	struct fr_io_instance_t		*inst;		//!< parent instance for master IO handler
 	fr_event_timer_t const		*ev;		//!< when we clean up the client
-	rbtree_t			*table;		//!< tracking table for packets
+	fr_ohash_t			*table;		//!< tracking table for packets
 
 	fr_heap_t			*pending;	//!< pending packets for this client
 	fr_hash_table_t			*addresses;	//!< list of src/dst addresses used by this client
@@ -226,6 +227,34 @@ static int connection_cmp(void const *one, void const *two)
 }
 
 
+static uint32_t track_hash(void const *data)
+{
+	fr_io_track_t const *track = data;
+	uint32_t hash;
+
+	rad_assert(track->client->inst->app_io->hash != NULL);
+
+	/*
+	 *	Call the per-protocol hash function.  It covers the
+	 *	same fields as the comparison function.
+	 */
+	hash = track->client->inst->app_io->hash(track->client->inst->app_io_instance, track->packet);
+
+	/*
+	 *	Connected sockets MUST have all tracking entries use
+	 *	the same client definition.
+	 */
+	if (track->client->connected) return hash;
+
+	/*
+	 *	The ports vary the most for packets from one client.
+	 *	The IP addresses are checked by track_cmp().
+	 */
+	hash = fr_hash_update(&track->address->src_port, sizeof(track->address->src_port), hash);
+	hash = fr_hash_update(&track->address->dst_port, sizeof(track->address->dst_port), hash);
+	return fr_hash_update(&track->address->if_index, sizeof(track->address->if_index), hash);
+}
+
 static int track_cmp(void const *one, void const *two)
 {
 	fr_io_track_t const *a = one;
@@ -456,8 +485,9 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t *inst, fr_io_
 	 *	#todo - unify the code with static clients?
 	 */
 	if (inst->app_io->track_duplicates) {
-		MEM(connection->client->table = rbtree_talloc_create(client, track_cmp, fr_io_track_t,
-								     NULL, RBTREE_FLAG_NONE));
+		rad_assert(inst->app_io->compare != NULL);
+		rad_assert(inst->app_io->hash != NULL);
+		MEM(connection->client->table = fr_ohash_create(client, track_hash, track_cmp, 0));
 	}
 
 	/*
@@ -765,7 +795,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	my_track.client = client;
 	memcpy(my_track.packet, packet, sizeof(my_track.packet));
 
-	if (client->inst->app_io->track_duplicates) track = rbtree_finddata(client->table, &my_track);
+	if (client->inst->app_io->track_duplicates) track = fr_ohash_find(client->table, &my_track);
 	if (!track) {
 		MEM(track = talloc_zero(client, fr_io_track_t));
 		talloc_get_type_abort(track, fr_io_track_t);
@@ -784,6 +814,12 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 		memcpy(track->packet, packet, sizeof(track->packet));
 		track->timestamp = recv_time;
 		track->packets = 1;
+
+		if (client->inst->app_io->track_duplicates && (fr_ohash_insert(client->table, track) < 0)) {
+			talloc_free(track);
+			return NULL;
+		}
+
 		return track;
 	}
 
@@ -862,7 +898,7 @@ static int pending_free(fr_io_pending_packet_t *pending)
 	if (track->packets == 0) {
 		if (track->client->inst->app_io->track_duplicates) {
 			rad_assert(track->client->table != NULL);
-			(void) rbtree_deletebydata(track->client->table, track);
+			(void) fr_ohash_remove(track->client->table, track);
 		}
 
 		// @todo - put this into a slab allocator
@@ -1281,8 +1317,8 @@ do_read:
 		 */
 		if (inst->app_io->track_duplicates) {
 			rad_assert(inst->app_io->compare != NULL);
-			MEM(client->table = rbtree_talloc_create(client, track_cmp, fr_io_track_t,
-								 NULL, RBTREE_FLAG_NONE));
+			rad_assert(inst->app_io->hash != NULL);
+			MEM(client->table = fr_ohash_create(client, track_hash, track_cmp, 0));
 		}
 
 		/*
@@ -1604,6 +1640,95 @@ static int mod_fd(void const *const_instance)
 	return inst->app_io->fd(app_io_instance);
 }
 
+/** Get the file descriptor to watch for reads
+ *
+ * @param[in] const_instance of the IO path.
+ * @return the file descriptor
+ */
+static int mod_read_fd(void const *const_instance)
+{
+	fr_io_instance_t *inst;
+	fr_io_connection_t *connection;
+	void *app_io_instance;
+	void *instance;
+
+	memcpy(&instance, &const_instance, sizeof(const_instance)); /* const issues */
+
+	get_inst((void *) instance, &inst, &connection, &app_io_instance);
+
+	if (!inst->app_io->read_fd) return inst->app_io->fd(app_io_instance);
+
+	return inst->app_io->read_fd(app_io_instance);
+}
+
+/** Get the number of packets buffered by a batched read
+ *
+ * @param[in] const_instance of the IO path.
+ * @return the number of buffered packets.
+ */
+static int mod_pending(void const *const_instance)
+{
+	fr_io_instance_t *inst;
+	fr_io_connection_t *connection;
+	void *app_io_instance;
+	void *instance;
+
+	memcpy(&instance, &const_instance, sizeof(const_instance)); /* const issues */
+
+	get_inst((void *) instance, &inst, &connection, &app_io_instance);
+
+	if (!inst->app_io->pending) return 0;
+
+	return inst->app_io->pending(app_io_instance);
+}
+
+/** Write any packets queued by a batched write
+ *
+ * @param[in] const_instance of the IO path.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int mod_flush(void const *const_instance)
+{
+	fr_io_instance_t *inst;
+	fr_io_connection_t *connection;
+	void *app_io_instance;
+	void *instance;
+
+	memcpy(&instance, &const_instance, sizeof(const_instance)); /* const issues */
+
+	get_inst((void *) instance, &inst, &connection, &app_io_instance);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(app_io_instance);
+}
+
+/** Get the batched read / write statistics
+ *
+ * @param[in] const_instance of the IO path.
+ * @param[out] stats where the statistics are written.
+ */
+static void mod_batch_stats(void const *const_instance, fr_io_batch_stats_t *stats)
+{
+	fr_io_instance_t *inst;
+	fr_io_connection_t *connection;
+	void *app_io_instance;
+	void *instance;
+
+	memcpy(&instance, &const_instance, sizeof(const_instance)); /* const issues */
+
+	get_inst((void *) instance, &inst, &connection, &app_io_instance);
+
+	if (!inst->app_io->batch_stats) {
+		memset(stats, 0, sizeof(*stats));
+		return;
+	}
+
+	inst->app_io->batch_stats(app_io_instance, stats);
+}
+
 /** Set the event list for a new socket
  *
  * @param[in] instance of the IO path.
@@ -1909,7 +2034,7 @@ static void packet_expiry_timer(fr_event_list_t *el, struct timeval *now, void *
 	track->packets--;
 
 	if (track->packets == 0) {
-		if (inst->app_io->track_duplicates) (void) rbtree_deletebydata(client->table, track);
+		if (inst->app_io->track_duplicates) (void) fr_ohash_remove(client->table, track);
 		talloc_free(track);
 
 	} else {
@@ -2624,9 +2749,14 @@ fr_app_io_t fr_master_app_io = {
 	.write			= mod_write,
 	.inject			= mod_inject,
 
+	.pending		= mod_pending,
+	.flush			= mod_flush,
+	.batch_stats		= mod_batch_stats,
+
 	.open			= mod_open,
 	.close			= mod_close,
 	.fd			= mod_fd,
+	.read_fd		= mod_read_fd,
 	.event_list_set		= mod_event_list_set,
 	.get_name		= mod_name,
 };
@@ -63,6 +63,7 @@ typedef struct fr_network_worker_t {
 	int32_t			heap_id;		//!< workers are in a heap
 	fr_time_t		cpu_time;		//!< how much CPU time this worker has spent
 	fr_time_t		predicted;		//!< predicted processing time for one packet
+	fr_time_t		latency;		//!< moving average of the time from receive to reply
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
@@ -72,12 +73,17 @@ typedef struct fr_network_worker_t {
 typedef struct fr_network_socket_t {
 	fr_network_t		*nr;			//!< O(N) issues in talloc
 	int			fd;			//!< file descriptor
+	int			read_fd;		//!< file descriptor to watch for reads.  Usually
+							///< the same as fd.
 	int			number;			//!< unique ID
 	int			heap_id;		//!< for the sockets_by_num heap
 
 	fr_event_filter_t	filter;			//!< what type of filter it is
 
 	bool			dead;			//!< is it dead?
+	bool			write_watched;		//!< is fd watched for writes, separately from read_fd?
+	bool			needs_flush;		//!< is it in the list of sockets to flush?
+	fr_dlist_t		flush_entry;		//!< entry in the list of sockets to flush
 
 	size_t			outstanding;		//!< number of outstanding packets sent to the worker
 	fr_listen_t const	*listen;		//!< I/O ctx and functions.
@@ -104,7 +110,14 @@ typedef struct fr_network_socket_t {
  *	"Power of Two-Choices" and
  *	https://www.eecs.harvard.edu/~michaelm/postscripts/mythesis.pdf
  *	https://www.eecs.harvard.edu/~michaelm/postscripts/tpds2001.pdf
+ *
+ *	CPU time doesn't account for requests which are yielded, and
+ *	waiting on a slow database.  So the comparison is pluggable,
+ *	and can instead use the number of outstanding requests, or the
+ *	time the worker takes to reply.
  */
+typedef fr_network_worker_t *(*fr_network_select_t)(fr_network_t *nr);
+
 struct fr_network_t {
 	int			kq;			//!< our KQ
 
@@ -122,6 +135,7 @@ struct fr_network_t {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		flush;			//!< sockets with queued replies to write
 
 	fr_io_stats_t		stats;
 
@@ -132,10 +146,24 @@ struct fr_network_t {
 	int			max_workers;		//!< maximum number of allowed workers
 	int			num_sockets;		//!< actually a counter...
 
+	fr_network_worker_select_t worker_select;	//!< how we choose a worker
+	fr_network_select_t	select;			//!< function which chooses a worker
+
 	fr_network_worker_t	*workers[MAX_WORKERS]; 	//!< each worker
 };
 
+const FR_NAME_NUMBER fr_network_worker_select_table[] = {
+	{ "cpu-time",		FR_NETWORK_WORKER_SELECT_CPU_TIME },
+	{ "outstanding",	FR_NETWORK_WORKER_SELECT_OUTSTANDING },
+	{ "latency",		FR_NETWORK_WORKER_SELECT_LATENCY },
+	{ "least-loaded",	FR_NETWORK_WORKER_SELECT_LEAST_LOADED },
+	{ NULL,			-1 }
+};
+
 static void fr_network_post_event(fr_event_list_t *el, struct timeval *now, void *uctx);
+static void fr_network_read(fr_event_list_t *el, int sockfd, int flags, void *ctx);
+static void fr_network_write(fr_event_list_t *el, int sockfd, int flags, void *ctx);
+static void fr_network_error(fr_event_list_t *el, int sockfd, int flags, int fd_errno, void *ctx);
 
 static int reply_cmp(void const *one, void const *two)
 {
@@ -241,6 +269,20 @@ static void fr_network_drain_input(fr_network_t *nr, fr_channel_t *ch, fr_channe
 			worker->predicted = RTT(worker->predicted, cd->reply.processing_time);
 		}
 
+		/*
+		 *	The latency includes time spent in the
+		 *	workers queues, and time spent yielded.
+		 */
+		if (cd->m.when > cd->reply.request_time) {
+			fr_time_t latency = cd->m.when - cd->reply.request_time;
+
+			if (!worker->latency) {
+				worker->latency = latency;
+			} else {
+				worker->latency = RTT(worker->latency, latency);
+			}
+		}
+
 		(void) fr_heap_insert(nr->replies, cd);
 	} while ((cd = fr_channel_recv_reply(ch)) != NULL);
 }
@@ -295,6 +337,124 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 	}
 }
 
+/** Pick two different workers at random
+ *
+ */
+static inline void worker_pick_two(fr_network_t *nr, fr_network_worker_t **one, fr_network_worker_t **two)
+{
+	uint32_t a, b;
+
+	if (nr->num_workers == 2) {
+		a = 0;
+		b = 1;
+	} else {
+		a = fr_rand() % nr->num_workers;
+		do {
+			b = fr_rand() % nr->num_workers;
+		} while (b == a);
+	}
+
+	*one = nr->workers[a];
+	*two = nr->workers[b];
+}
+
+/** Choose the worker with the least predicted CPU time
+ *
+ */
+static fr_network_worker_t *worker_select_cpu_time(fr_network_t *nr)
+{
+	fr_network_worker_t *one, *two;
+
+	worker_pick_two(nr, &one, &two);
+
+	if (one->cpu_time < two->cpu_time) return one;
+
+	return two;
+}
+
+/** Choose the worker with the fewest outstanding requests
+ *
+ */
+static fr_network_worker_t *worker_select_outstanding(fr_network_t *nr)
+{
+	fr_network_worker_t *one, *two;
+
+	worker_pick_two(nr, &one, &two);
+
+	if (fr_channel_requests_outstanding(one->channel) < fr_channel_requests_outstanding(two->channel)) return one;
+
+	return two;
+}
+
+/** Choose the worker which should reply first
+ *
+ *  Each outstanding request is assumed to take the average
+ *  latency.  Workers which haven't replied yet have no latency, and
+ *  are compared by their backlog.
+ */
+static fr_network_worker_t *worker_select_latency(fr_network_t *nr)
+{
+	fr_network_worker_t *one, *two;
+	fr_time_t cost_one, cost_two;
+
+	worker_pick_two(nr, &one, &two);
+
+	cost_one = (fr_channel_requests_outstanding(one->channel) + 1) * (one->latency + 1);
+	cost_two = (fr_channel_requests_outstanding(two->channel) + 1) * (two->latency + 1);
+
+	if (cost_one < cost_two) return one;
+
+	return two;
+}
+
+/** Choose the worker with the fewest outstanding requests, out of all of them
+ *
+ *  We start at a random worker, so that ties are spread across the
+ *  workers.
+ */
+static fr_network_worker_t *worker_select_least_loaded(fr_network_t *nr)
+{
+	int i, start;
+	uint64_t outstanding, least = UINT64_MAX;
+	fr_network_worker_t *worker, *best = NULL;
+
+	start = fr_rand() % nr->num_workers;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		worker = nr->workers[(start + i) % nr->num_workers];
+
+		outstanding = fr_channel_requests_outstanding(worker->channel);
+		if (outstanding == 0) return worker;
+
+		if (outstanding < least) {
+			least = outstanding;
+			best = worker;
+		}
+	}
+
+	return best;
+}
+
+static fr_network_select_t const worker_select_func[] = {
+	[FR_NETWORK_WORKER_SELECT_CPU_TIME]	= worker_select_cpu_time,
+	[FR_NETWORK_WORKER_SELECT_OUTSTANDING]	= worker_select_outstanding,
+	[FR_NETWORK_WORKER_SELECT_LATENCY]	= worker_select_latency,
+	[FR_NETWORK_WORKER_SELECT_LEAST_LOADED]	= worker_select_least_loaded,
+};
+
+/** Set the policy used to choose a worker for new requests
+ *
+ * @param[in] nr		the network
+ * @param[in] worker_select	the policy to use.
+ */
+void fr_network_worker_select_set(fr_network_t *nr, fr_network_worker_select_t worker_select)
+{
+	rad_assert(worker_select <= FR_NETWORK_WORKER_SELECT_LEAST_LOADED);
+
+	nr->worker_select = worker_select;
+	nr->select = worker_select_func[worker_select];
+}
+
 /** Send a message on the "best" channel.
  *
  * @param nr the network
@@ -309,25 +469,8 @@ static bool fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 
 	if (nr->num_workers == 1) {
 		worker = nr->workers[0];
-
 	} else {
-		uint32_t one, two;
-
-		if (nr->num_workers == 2) {
-			one = 0;
-			two = 1;
-		} else {
-			one = fr_rand() % nr->num_workers;
-			do {
-				two = fr_rand() % nr->num_workers;
-			} while (two == one);
-		}
-
-		if (nr->workers[one]->cpu_time < nr->workers[two]->cpu_time) {
-			worker = nr->workers[one];
-		} else {
-			worker = nr->workers[two];
-		}
+		worker = nr->select(nr);
 	}
 
 	(void) talloc_get_type_abort(worker, fr_network_worker_t);
@@ -374,7 +517,11 @@ static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s)
 
 	s->dead = true;
 
-	fr_event_fd_delete(nr->el, s->fd, s->filter);
+	fr_event_fd_delete(nr->el, s->read_fd, s->filter);
+	if (s->write_watched) {
+		fr_event_fd_delete(nr->el, s->fd, FR_EVENT_FILTER_IO);
+		s->write_watched = false;
+	}
 
 	/*
 	 *	If there are no outstanding packets, then we can free
@@ -394,6 +541,79 @@ static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s)
 }
 
 
+/** Check if the transport has buffered packets from a batched read
+ *
+ * @param[in] s		the network socket.
+ * @return true if read() should be called again.
+ */
+static inline bool fr_network_read_pending(fr_network_socket_t const *s)
+{
+	if (!s->listen->app_io->pending) return false;
+
+	return (s->listen->app_io->pending(s->listen->app_io_instance) > 0);
+}
+
+
+/** Wait for the socket to become writable
+ *
+ * @param[in] nr	the network.
+ * @param[in] s		the network socket.
+ * @return
+ *	- 0 on success.
+ *	- <0 on error.
+ */
+static int fr_network_write_watch(fr_network_t *nr, fr_network_socket_t *s)
+{
+	if (s->read_fd == s->fd) {
+		return fr_event_fd_insert(nr, nr->el, s->fd,
+					  fr_network_read,
+					  fr_network_write,
+					  fr_network_error,
+					  s);
+	}
+
+	/*
+	 *	Reads are signalled on a different FD, so we only
+	 *	watch this one while there are replies to write.
+	 */
+	if (fr_event_fd_insert(nr, nr->el, s->fd,
+			       NULL,
+			       fr_network_write,
+			       fr_network_error,
+			       s) < 0) return -1;
+
+	s->write_watched = true;
+
+	return 0;
+}
+
+
+/** Stop waiting for the socket to become writable
+ *
+ * @param[in] nr	the network.
+ * @param[in] s		the network socket.
+ * @return
+ *	- 0 on success.
+ *	- <0 on error.
+ */
+static int fr_network_write_unwatch(fr_network_t *nr, fr_network_socket_t *s)
+{
+	if (s->read_fd == s->fd) {
+		return fr_event_fd_insert(nr, nr->el, s->fd,
+					  fr_network_read,
+					  NULL,
+					  fr_network_error,
+					  s);
+	}
+
+	if (!s->write_watched) return 0;
+
+	s->write_watched = false;
+
+	return fr_event_fd_delete(nr->el, s->fd, FR_EVENT_FILTER_IO);
+}
+
+
 /** Read a packet from the network.
  *
  * @param[in] el	the event list.
@@ -410,7 +630,7 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 	fr_channel_data_t *cd, *next;
 	fr_time_t *recv_time;
 
-	if (!fr_cond_assert(s->fd == sockfd)) return;
+	if (!fr_cond_assert(s->read_fd == sockfd)) return;
 
 	DEBUG3("network read");
 
@@ -438,6 +658,7 @@ next_message:
 		return;
 	}
 
+read_pending:
 	cd->request.is_dup = false;
 	cd->priority = PRIORITY_NORMAL;
 
@@ -454,6 +675,12 @@ next_message:
 	data_size = s->listen->app_io->read(s->listen->app_io_instance, &cd->packet_ctx, &recv_time,
 					    cd->m.data, cd->m.rb_size, &s->leftover, &cd->priority, &cd->request.is_dup);
 	if (data_size == 0) {
+		/*
+		 *	The transport read a batch of packets, and
+		 *	discarded this one.  Go get the next one.
+		 */
+		if (fr_network_read_pending(s)) goto read_pending;
+
 		/*
 		 *	Cache the message for later.  This is
 		 *	important for stream sockets, which can do
@@ -542,6 +769,23 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	The transport has more packets from a batched read.
+	 *	The socket may no longer be readable, so we have to
+	 *	drain them now, even if we're over the limit above.
+	 */
+	if (fr_network_read_pending(s)) {
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		if (!cd) {
+			fr_log(nr->log, L_ERR, "Failed allocating message size %zd! - Closing socket", s->listen->default_message_size);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+
+		num_messages++;
+		goto read_pending;
+	}
 }
 
 
@@ -686,15 +930,20 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		}
 	}
 
+	/*
+	 *	Write any replies which the transport has queued.
+	 */
+	if (listen->app_io->flush && (listen->app_io->flush(listen->app_io_instance) < 0)) {
+		PERROR("Failed writing to socket %d", s->fd);
+		fr_network_socket_dead(nr, s);
+		return;
+	}
+
 	/*
 	 *	We've successfully written all of the packets.  Remove
 	 *	the write callback.
 	 */
-	if (fr_event_fd_insert(nr, nr->el, s->fd,
-			       fr_network_read,
-			       NULL,
-			       fr_network_error,
-			       s) < 0) {
+	if (fr_network_write_unwatch(nr, s) < 0) {
 		PERROR("Failed adding new socket to event loop");
 		fr_network_socket_dead(nr, s);
 	}
@@ -706,15 +955,19 @@ static int _network_socket_free(fr_network_socket_t *s)
 	fr_channel_data_t *cd;
 
 	if (!s->dead) {
-		if (fr_event_fd_delete(nr->el, s->fd, s->filter) < 0) {
+		if (fr_event_fd_delete(nr->el, s->read_fd, s->filter) < 0) {
 			PERROR("Failed deleting socket from event loop in _network_socket_free");
 			rad_assert("Failed removing socket FD from event loop in _network_socket_free" == NULL);
 		}
+
+		if (s->write_watched) (void) fr_event_fd_delete(nr->el, s->fd, FR_EVENT_FILTER_IO);
 	}
 
 	rbtree_deletebydata(nr->sockets, s);
 	rbtree_deletebydata(nr->sockets_by_num, s);
 
+	if (s->needs_flush) fr_dlist_remove(&nr->flush, s);
+
 	if (s->listen->app_io->close) {
 		s->listen->app_io->close(s->listen->app_io_instance);
 	} else {
@@ -795,9 +1048,10 @@ static void fr_network_socket_callback(void *ctx, void const *data, size_t data_
 
 	rad_assert(app_io->fd);
 	s->fd = app_io->fd(s->listen->app_io_instance);
+	s->read_fd = app_io->read_fd ? app_io->read_fd(s->listen->app_io_instance) : s->fd;
 	s->filter = FR_EVENT_FILTER_IO;
 
-	if (fr_event_fd_insert(nr, nr->el, s->fd,
+	if (fr_event_fd_insert(nr, nr->el, s->read_fd,
 			       fr_network_read,
 			       NULL,
 			       fr_network_error,
@@ -866,6 +1120,7 @@ static void fr_network_directory_callback(void *ctx, void const *data, size_t da
 
 	rad_assert(app_io->fd);
 	s->fd = app_io->fd(s->listen->app_io_instance);
+	s->read_fd = s->fd;
 	s->filter = FR_EVENT_FILTER_VNODE;
 
 	if (fr_event_filter_insert(nr, nr->el, s->fd, s->filter,
@@ -958,7 +1213,7 @@ static void fr_network_inject_callback(void *ctx, void const *data, size_t data_
 	 *	network.
 	 */
 	if (s->listen->app_io->inject(s->listen->app_io_instance, my_inject.packet, my_inject.packet_len, my_inject.recv_time) == 0) {
-		fr_network_read(nr->el, s->fd, 0, s);
+		fr_network_read(nr->el, s->read_fd, 0, s);
 	}
 
 	talloc_free(my_inject.packet);
@@ -1011,6 +1266,7 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 	nr->lvl = lvl;
 	nr->max_workers = MAX_WORKERS;
 	nr->num_workers = 0;
+	fr_network_worker_select_set(nr, FR_NETWORK_WORKER_SELECT_CPU_TIME);
 
 	nr->kq = fr_event_list_kq(nr->el);
 	rad_assert(nr->kq >= 0);
@@ -1097,6 +1353,8 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t c
 		goto fail2;
 	}
 
+	fr_dlist_init(&nr->flush, fr_network_socket_t, flush_entry);
+
 	if (fr_event_post_insert(nr->el, fr_network_post_event, nr) < 0) {
 		fr_strerror_printf("Failed inserting post-processing event");
 		goto fail2;
@@ -1164,12 +1422,13 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 {
 	fr_channel_data_t *cd;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
+	fr_network_socket_t *s;
 
 	while ((cd = fr_heap_pop(nr->replies)) != NULL) {
 		ssize_t rcode;
 		fr_listen_t const *listen;
 		fr_message_t *lm;
-		fr_network_socket_t my_socket, *s;
+		fr_network_socket_t my_socket;
 
 		listen = cd->listen;
 
@@ -1251,11 +1510,7 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 
 			if (errno == EWOULDBLOCK) {
 			save_pending:
-				if (fr_event_fd_insert(nr, nr->el, s->fd,
-						       fr_network_read,
-						       fr_network_write,
-						       fr_network_error,
-						       s) < 0) {
+				if (fr_network_write_watch(nr, s) < 0) {
 					PERROR("Failed adding write callback to event loop");
 					goto error;
 				}
@@ -1306,12 +1561,39 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED struct time
 		s->pending = NULL;
 		s->written = 0;
 
+		/*
+		 *	The transport may have queued the reply.  Write
+		 *	it out once we've processed all of the replies.
+		 */
+		if (listen->app_io->flush && !s->needs_flush) {
+			s->needs_flush = true;
+			fr_dlist_insert_tail(&nr->flush, s);
+		}
+
 		/*
 		 *	As a special case, allow write() to return
 		 *	"0", which means "close the socket".
 		 */
 		if (rcode == 0) fr_network_socket_dead(nr, s);
 	}
+
+	/*
+	 *	Write all of the replies which the transports have
+	 *	queued, with as few system calls as possible.
+	 */
+	while ((s = fr_dlist_head(&nr->flush)) != NULL) {
+		fr_dlist_remove(&nr->flush, s);
+		s->needs_flush = false;
+
+		if (s->dead) continue;
+
+		if (s->listen->app_io->flush(s->listen->app_io_instance) < 0) {
+			PERROR("Failed writing to socket %d", s->fd);
+			if (s->listen->app_io->error) s->listen->app_io->error(s->listen->app_io_instance);
+
+			fr_network_socket_dead(nr, s);
+		}
+	}
 }
 
 
@@ -1449,7 +1731,7 @@ void fr_network_listen_read(fr_network_t *nr, fr_listen_t const *listen)
 	/*
 	 *	Go read the socket.
 	 */
-	fr_network_read(nr->el, s->fd, 0, s);
+	fr_network_read(nr->el, s->read_fd, 0, s);
 }
 
 /** Inject a packet for a listener
@@ -1487,8 +1769,21 @@ int fr_network_listen_inject(fr_network_t *nr, fr_listen_t *listen, uint8_t cons
 	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_INJECT, &my_inject, sizeof(my_inject));
 }
 
+/** Get statistics for a network thread
+ *
+ * @param[in] nr	the network
+ * @param[in] num	number of entries in the stats array.
+ * @param[out] stats	FR_NETWORK_STATS_NUM global statistics, followed
+ *			by FR_NETWORK_WORKER_STATS_NUM statistics for each
+ *			worker.
+ * @return
+ *	- <0 on error
+ *	- the number of entries written to the stats array.
+ */
 int fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats)
 {
+	int i, j;
+
 	if (num < 0) return -1;
 	if (num == 0) return 0;
 
@@ -1498,9 +1793,24 @@ int fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats)
 	if (num >= 4) stats[3] = nr->stats.dropped;
 	if (num >= 5) stats[4] = nr->num_workers;
 
-	if (num <= 5) return num;
+	if (num <= FR_NETWORK_STATS_NUM) return num;
+
+	/*
+	 *	Only return complete sets of worker statistics.
+	 */
+	j = FR_NETWORK_STATS_NUM;
+	for (i = 0; i < nr->num_workers; i++) {
+		fr_network_worker_t const *worker = nr->workers[i];
+
+		if ((j + FR_NETWORK_WORKER_STATS_NUM) > num) break;
+
+		stats[j++] = fr_channel_requests_outstanding(worker->channel);
+		stats[j++] = worker->stats.in;
+		stats[j++] = worker->stats.out;
+		stats[j++] = worker->latency;
+	}
 
-	return 5;
+	return j;
 }
 
 static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
@@ -1512,6 +1822,26 @@ static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cm
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", nr->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
 	fprintf(fp, "count.sockets\t%d\n", rbtree_num_elements(nr->sockets));
+	fprintf(fp, "worker_select\t%s\n", fr_int2str(fr_network_worker_select_table, nr->worker_select, "<INVALID>"));
+
+	return 0;
+}
+
+static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	int i;
+	fr_network_t const *nr = ctx;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		fr_network_worker_t const *worker = nr->workers[i];
+
+		fprintf(fp, "worker.%d.count.in\t%" PRIu64 "\n", i, worker->stats.in);
+		fprintf(fp, "worker.%d.count.out\t%" PRIu64 "\n", i, worker->stats.out);
+		fprintf(fp, "worker.%d.count.dropped\t%" PRIu64 "\n", i, worker->stats.dropped);
+		fprintf(fp, "worker.%d.outstanding\t%" PRIu64 "\n", i, fr_channel_requests_outstanding(worker->channel));
+		fprintf(fp, "worker.%d.latency_usec\t%" PRIu64 "\n", i, worker->latency / 1000);
+		fprintf(fp, "worker.%d.cpu_time_usec\t%" PRIu64 "\n", i, worker->cpu_time / 1000);
+	}
 
 	return 0;
 }
@@ -1558,6 +1888,21 @@ static int cmd_stats_socket(FILE *fp, FILE *fp_err, void *ctx, fr_cmd_info_t con
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", s->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", s->stats.dropped);
 
+	if (s->listen->app_io->batch_stats) {
+		fr_io_batch_stats_t batch;
+
+		s->listen->app_io->batch_stats(s->listen->app_io_instance, &batch);
+
+		fprintf(fp, "batch.read.calls\t%" PRIu64 "\n", batch.read_calls);
+		fprintf(fp, "batch.read.packets\t%" PRIu64 "\n", batch.read_packets);
+		fprintf(fp, "batch.read.fill\t%.2f\n",
+			batch.read_calls ? (double) batch.read_packets / batch.read_calls : 0.0);
+		fprintf(fp, "batch.write.calls\t%" PRIu64 "\n", batch.write_calls);
+		fprintf(fp, "batch.write.packets\t%" PRIu64 "\n", batch.write_packets);
+		fprintf(fp, "batch.write.fill\t%.2f\n",
+			batch.write_calls ? (double) batch.write_packets / batch.write_calls : 0.0);
+	}
+
 	return 0;
 }
 
@@ -1579,6 +1924,15 @@ fr_cmd_table_t cmd_network_table[] = {
 		.read_only = true
 	},
 
+	{
+		.parent = "stats network",
+		.add_name = true,
+		.name = "worker",
+		.func = cmd_stats_worker,
+		.help = "Show the backlog and latency of each worker, as seen by a specific network thread.",
+		.read_only = true
+	},
+
 	{
 		.parent = "stats network",
 		.add_name = true,
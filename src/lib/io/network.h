@@ -33,6 +33,27 @@ extern "C" {
 
 typedef struct fr_network_t fr_network_t;
 
+/**
+ *  How the network picks a worker for a new request.
+ */
+typedef enum fr_network_worker_select_t {
+	FR_NETWORK_WORKER_SELECT_CPU_TIME = 0,		//!< Two random workers, least predicted CPU time.
+	FR_NETWORK_WORKER_SELECT_OUTSTANDING,		//!< Two random workers, fewest outstanding requests.
+	FR_NETWORK_WORKER_SELECT_LATENCY,		//!< Two random workers, lowest latency * backlog.
+	FR_NETWORK_WORKER_SELECT_LEAST_LOADED,		//!< The worker with the fewest outstanding requests.
+} fr_network_worker_select_t;
+
+extern const FR_NAME_NUMBER fr_network_worker_select_table[];
+
+/*
+ *	fr_network_stats() returns FR_NETWORK_STATS_NUM entries (in,
+ *	out, dup, dropped, number of workers), followed by
+ *	FR_NETWORK_WORKER_STATS_NUM entries for each worker
+ *	(outstanding, in, out, latency in nanoseconds).
+ */
+#define FR_NETWORK_STATS_NUM		(5)
+#define FR_NETWORK_WORKER_STATS_NUM	(4)
+
 fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t const *logger, fr_log_lvl_t lvl) CC_HINT(nonnull(2,3));
 void fr_network_exit(fr_network_t *nr) CC_HINT(nonnull);
 int fr_network_destroy(fr_network_t *nr) CC_HINT(nonnull);
@@ -44,6 +65,7 @@ int fr_network_directory_add(fr_network_t *nr, fr_listen_t const *listen) CC_HIN
 int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
 void fr_network_listen_read(fr_network_t *nr, fr_listen_t const *listen) CC_HINT(nonnull);
 int fr_network_listen_inject(fr_network_t *nr, fr_listen_t *listen, uint8_t const *packet, size_t packet_len, fr_time_t recv_time);
+void fr_network_worker_select_set(fr_network_t *nr, fr_network_worker_select_t worker_select) CC_HINT(nonnull);
 int fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats) CC_HINT(nonnull);
 extern fr_cmd_table_t cmd_network_table[];
 
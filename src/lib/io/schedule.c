@@ -26,6 +26,12 @@ RCSID("$Id$")
 
 #include <freeradius-devel/autoconf.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/rbtree.h>
@@ -110,6 +116,9 @@ typedef struct fr_schedule_network_t {
 	pthread_t	pthread_id;		//!< the thread of this network
 
 	int		id;			//!< a unique ID
+
+	fr_dlist_t	entry;			//!< our entry into the linked list of networks
+
 	fr_schedule_t	*sc;			//!< the scheduler we are running under
 
 	fr_schedule_child_status_t status;	//!< status of the worker
@@ -131,6 +140,9 @@ struct fr_schedule_t {
 	int		max_networks;		//!< number of network threads
 	int		max_workers;		//!< max number of worker threads
 
+	fr_network_worker_select_t worker_select; //!< how network threads choose a worker
+
+	int		num_networks;		//!< number of running network threads
 	int		num_workers;		//!< number of worker threads
 	int		num_workers_exited;	//!< number of exited workers
 
@@ -142,11 +154,11 @@ struct fr_schedule_t {
 	void					*worker_instantiate_ctx;	//!< thread instantiation context
 
 	fr_dlist_head_t	workers;		//!< list of workers
+	fr_dlist_head_t	networks;		//!< list of networks
+	atomic_uint	next_network;		//!< round-robin counter for assigning listeners to networks
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
-
-	fr_schedule_network_t *sn;		//!< pointer to the (one) network thread
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
@@ -169,6 +181,7 @@ static void *fr_schedule_worker_thread(void *arg)
 {
 	TALLOC_CTX			*ctx;
 	fr_schedule_worker_t		*sw = talloc_get_type_abort(arg, fr_schedule_worker_t);
+	fr_schedule_network_t		*sn;
 	fr_schedule_t			*sc = sw->sc;
 	fr_schedule_child_status_t	status = FR_CHILD_FAIL;
 	char buffer[32];
@@ -211,7 +224,16 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	sw->status = FR_CHILD_RUNNING;
 
-	(void) fr_network_worker_add(sc->sn->nr, sw->worker);
+	/*
+	 *	Every network thread gets a channel to every worker,
+	 *	so that packets read by any network can be processed
+	 *	by any worker.
+	 */
+	for (sn = fr_dlist_head(&sc->networks);
+	     sn != NULL;
+	     sn = fr_dlist_next(&sc->networks, sn)) {
+		(void) fr_network_worker_add(sn->nr, sw->worker);
+	}
 
 	DEBUG3("Spawned async worker %d", sw->id);
 
@@ -283,6 +305,7 @@ static void *fr_schedule_network_thread(void *arg)
 		fr_log(sc->log, L_ERR, "Network %d - Failed creating network: %s", sn->id, fr_strerror());
 		goto fail;
 	}
+	fr_network_worker_select_set(sn->nr, sc->worker_select);
 
 	sn->status = FR_CHILD_RUNNING;
 
@@ -291,7 +314,7 @@ static void *fr_schedule_network_thread(void *arg)
 	 */
 	sem_post(&sc->semaphore);
 
-	DEBUG3("Spawned asycn network 0");
+	DEBUG3("Spawned async network %d", sn->id);
 
 	/*
 	 *	Do all of the work.
@@ -303,7 +326,7 @@ static void *fr_schedule_network_thread(void *arg)
 fail:
 	sn->status = status;
 
-	DEBUG3("Network exiting");
+	DEBUG3("Network %d exiting", sn->id);
 
 	/*
 	 *	Tell the scheduler we're done.
@@ -358,6 +381,7 @@ int fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *a
  * @param[in] lvl		log level.
  * @param[in] max_networks	number of network threads.
  * @param[in] max_workers	number of worker threads.
+ * @param[in] worker_select	how network threads choose a worker.
  * @param[in] worker_thread_instantiate		callback for new worker threads.
  * @param[in] worker_thread_ctx	context for callback.
  * @return
@@ -367,12 +391,14 @@ int fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *a
 fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 				  fr_log_t *logger, fr_log_lvl_t lvl,
 				  int max_networks, int max_workers,
+				  fr_network_worker_select_t worker_select,
 				  fr_schedule_thread_instantiate_t worker_thread_instantiate,
 				  void *worker_thread_ctx)
 {
 #ifdef HAVE_PTHREAD_H
 	int i;
 	fr_schedule_worker_t *sw, *next;
+	fr_schedule_network_t *sn, *next_sn;
 #endif
 	fr_schedule_t *sc;
 
@@ -404,6 +430,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	sc->el = el;
 	sc->max_networks = max_networks;
 	sc->max_workers = max_workers;
+	sc->worker_select = worker_select;
 	sc->num_workers = 0;
 	sc->log = logger;
 	sc->lvl = lvl;
@@ -458,9 +485,10 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 
 #ifdef HAVE_PTHREAD_H
 	/*
-	 *	Create the list which holds the workers.
+	 *	Create the lists which hold the workers and networks.
 	 */
 	fr_dlist_init(&sc->workers, fr_schedule_worker_t, entry);
+	fr_dlist_init(&sc->networks, fr_schedule_network_t, entry);
 
 	memset(&sc->semaphore, 0, sizeof(sc->semaphore));
 	if (sem_init(&sc->semaphore, 0, SEMAPHORE_LOCKED) != 0) {
@@ -470,23 +498,69 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	}
 
 	/*
-	 *	Create the network thread first.
-	 *	@todo - create multiple network threads
+	 *	Create the network threads first.  The workers add
+	 *	themselves to every network when they start.
 	 */
-	sc->sn = talloc_zero(sc, fr_schedule_network_t);
-	sc->sn->sc = sc;
-	sc->sn->id = 0;
+	for (i = 0; i < sc->max_networks; i++) {
+		DEBUG3("Creating %d/%d networks\n", i, sc->max_networks);
 
-	if (fr_schedule_pthread_create(&sc->sn->pthread_id, fr_schedule_network_thread, sc->sn) < 0) {
-		fr_log(sc->log, L_ERR, "Failed creating network thread %s", fr_strerror());
-		goto fail;
+		/*
+		 *	Create a network "glue" structure
+		 */
+		sn = talloc_zero(sc, fr_schedule_network_t);
+		if (!sn) {
+			fr_log(sc->log, L_ERR, "Network %d - Failed allocating memory", i);
+			break;
+		}
+
+		sn->id = i;
+		sn->sc = sc;
+		sn->status = FR_CHILD_INITIALIZING;
+		fr_dlist_insert_tail(&sc->networks, sn);
+
+		if (fr_schedule_pthread_create(&sn->pthread_id, fr_schedule_network_thread, sn) < 0) {
+			fr_log(sc->log, L_ERR, "Failed creating network %d: %s", i, fr_strerror());
+			fr_dlist_remove(&sc->networks, sn);
+			talloc_free(sn);
+			break;
+		}
+
+		sc->num_networks++;
+	}
+
+	/*
+	 *	Wait for all of the networks to signal us that either
+	 *	they've started, OR there's been a problem and they
+	 *	can't start.
+	 */
+	for (i = 0; i < sc->num_networks; i++) {
+		DEBUG3("Waiting for semaphore from network %d/%d\n", i, sc->num_networks);
+		SEM_WAIT_INTR(&sc->semaphore);
 	}
 
-	SEM_WAIT_INTR(&sc->semaphore);
-	if (sc->sn->status != FR_CHILD_RUNNING) {
-	fail:
-		if (sc->sn->ctx) TALLOC_FREE(sc->sn->ctx);
-		TALLOC_FREE(sc->sn);
+	/*
+	 *	See if all of the networks have started.  Ones which
+	 *	failed have already exited, so we just clean them up.
+	 */
+	for (sn = fr_dlist_head(&sc->networks);
+	     sn != NULL;
+	     sn = next_sn) {
+
+		next_sn = fr_dlist_next(&sc->networks, sn);
+
+		if (sn->status == FR_CHILD_RUNNING) continue;
+
+		(void) pthread_join(sn->pthread_id, NULL);
+		sc->num_networks--;
+		fr_dlist_remove(&sc->networks, sn);
+		TALLOC_FREE(sn->ctx);
+		talloc_free(sn);
+	}
+
+	/*
+	 *	Failed to start some networks, refuse to do anything!
+	 */
+	if (sc->num_networks < sc->max_networks) {
 		fr_schedule_destroy(sc);
 		return NULL;
 	}
@@ -551,7 +625,7 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 	 */
 	if (sc->num_workers < sc->max_workers) {
 		fr_schedule_destroy(sc);
-		sc = NULL;
+		return NULL;
 	}
 #endif
 
@@ -569,13 +643,20 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		}
 	}
 
-	if (fr_command_register_hook(NULL, "0", sc->sn->nr, cmd_network_table) < 0) {
-		fr_log(sc->log, L_ERR, "Failed adding network commands: %s", fr_strerror());
-		goto st_fail;
+	for (sn = fr_dlist_head(&sc->networks);
+	     sn != NULL;
+	     sn = fr_dlist_next(&sc->networks, sn)) {
+		char buffer[32];
+
+		snprintf(buffer, sizeof(buffer), "%d", sn->id);
+		if (fr_command_register_hook(NULL, buffer, sn->nr, cmd_network_table) < 0) {
+			fr_log(sc->log, L_ERR, "Failed adding network commands: %s", fr_strerror());
+			goto st_fail;
+		}
 	}
 
-	if (sc) fr_log(sc->log, L_INFO, "Scheduler created successfully with %d networks and %d workers",
-		       sc->max_networks, sc->num_workers);
+	fr_log(sc->log, L_INFO, "Scheduler created successfully with %d networks and %d workers",
+	       sc->num_networks, sc->num_workers);
 
 	return sc;
 }
@@ -591,6 +672,7 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 {
 	int i;
 	fr_schedule_worker_t *sw;
+	fr_schedule_network_t *sn;
 
 	sc->running = false;
 
@@ -608,18 +690,20 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 		goto done;
 	}
 
-	rad_assert(sc->num_workers > 0);
-
 	/*
-	 *	If the network thread is running, tell it to exit, and
-	 *	wait for it to do so.  Once it's exited, we know that
-	 *	this thread can use the network channels to tell the
-	 *	workers that the network side is going away.
+	 *	If the network threads are running, tell them to exit,
+	 *	and wait for them to do so.  Once they've exited, we
+	 *	know that this thread can use the network channels to
+	 *	tell the workers that the network side is going away.
 	 */
-	if (sc->sn->status == FR_CHILD_RUNNING) {
-		fr_network_exit(sc->sn->nr);
+	for (sn = fr_dlist_head(&sc->networks);
+	     sn != NULL;
+	     sn = fr_dlist_next(&sc->networks, sn)) {
+		if (sn->status != FR_CHILD_RUNNING) continue;
+
+		fr_network_exit(sn->nr);
 		SEM_WAIT_INTR(&sc->semaphore);
-		fr_network_destroy(sc->sn->nr);
+		fr_network_destroy(sn->nr);
 	}
 
 	/*
@@ -665,7 +749,21 @@ int fr_schedule_destroy(fr_schedule_t *sc)
 		talloc_free(sw->ctx);
 	}
 
-	TALLOC_FREE(sc->sn->ctx);
+	/*
+	 *	Clean up the exited networks.
+	 */
+	while ((sn = fr_dlist_head(&sc->networks)) != NULL) {
+		sc->num_networks--;
+
+		fr_dlist_remove(&sc->networks, sn);
+
+		if (pthread_join(sn->pthread_id, NULL) != 0) {
+			fr_log(sc->log, L_ERR, "Failed joining network %i: %s", sn->id, fr_syserror(errno));
+		} else {
+			DEBUG3("Network %i exited", sn->id);
+		}
+		talloc_free(sn->ctx);
+	}
 
 	sem_destroy(&sc->semaphore);
 #endif	/* HAVE_PTHREAD_H */
@@ -681,7 +779,43 @@ done:
 	return 0;
 }
 
+/** Pick the network which should service a new listener
+ *
+ *  Listeners are spread round-robin across the network threads.  This
+ *  function may be called from any thread, e.g. when a network thread
+ *  accepts a new connection and adds it to the scheduler.
+ *
+ * @param[in] sc the scheduler
+ * @return the network which should service the listener.
+ */
+static fr_network_t *fr_schedule_network_next(fr_schedule_t *sc)
+{
+	unsigned int		i, num;
+	fr_schedule_network_t	*sn;
+
+	if (sc->el) return sc->single_network;
+
+	rad_assert(sc->num_networks > 0);
+
+	num = atomic_fetch_add_explicit(&sc->next_network, 1, memory_order_relaxed) % sc->num_networks;
+
+	for (sn = fr_dlist_head(&sc->networks), i = 0;
+	     (sn != NULL) && (i < num);
+	     sn = fr_dlist_next(&sc->networks, sn), i++);
+
+	rad_assert(sn != NULL);
+
+	return sn->nr;
+}
+
 /** Add a fr_listen_t to a scheduler.
+ *
+ *  When there are multiple network threads, each listener is
+ *  serviced by exactly one of them.  Sockets which are opened
+ *  multiple times with SO_REUSEPORT (e.g. multiple "listen" sections
+ *  for the same UDP address and port) will therefore be spread across
+ *  the network threads, with the kernel distributing packets between
+ *  the sockets.
  *
  * @param[in] sc the scheduler
  * @param[in] io the ctx and callbacks for the transport.
@@ -695,11 +829,7 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t const *io)
 
 	(void) talloc_get_type_abort(sc, fr_schedule_t);
 
-	if (sc->el) {
-		nr = sc->single_network;
-	} else {
-		nr = sc->sn->nr;
-	}
+	nr = fr_schedule_network_next(sc);
 
 	if (fr_network_listen_add(nr, io) < 0) return NULL;
 
@@ -720,11 +850,7 @@ fr_network_t *fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t const *io
 
 	(void) talloc_get_type_abort(sc, fr_schedule_t);
 
-	if (sc->el) {
-		nr = sc->single_network;
-	} else {
-		nr = sc->sn->nr;
-	}
+	nr = fr_schedule_network_next(sc);
 
 	if (fr_network_directory_add(nr, io) < 0) return NULL;
 
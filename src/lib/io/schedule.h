@@ -50,7 +50,8 @@ int			fr_schedule_worker_id(void);
 
 int			fr_schedule_pthread_create(pthread_t *thread, void *(*func)(void *), void *arg);
 fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_t *log, fr_log_lvl_t lvl,
-					    int max_inputs, int max_workers,
+					    int max_networks, int max_workers,
+					    fr_network_worker_select_t worker_select,
 					    fr_schedule_thread_instantiate_t worker_thread_instantiate,
 					    void *worker_thread_ctx) CC_HINT(nonnull(3));
 /* schedulers are async, so there's no fr_schedule_run() */
@@ -67,6 +67,7 @@ RCSID("$Id$")
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/ohash.h>
 
 /**
  *  Track things by priority and time.
@@ -99,7 +100,7 @@ DIAG_OFF(unused-macros)
 #define DEBUG2(fmt, ...) if (worker->lvl >= L_DBG_LVL_2) fr_log(worker->log, L_DBG, fmt, ## __VA_ARGS__)
 #define DEBUG3(fmt, ...) if (worker->lvl >= L_DBG_LVL_3) fr_log(worker->log, L_DBG, fmt, ## __VA_ARGS__)
 #define ERROR(fmt, ...) fr_log(worker->log, L_ERR, fmt, ## __VA_ARGS__)
-#define RDEBUG(fmt, ...) if (worker->lvl) fr_log(worker->log, L_DBG, "(%s)  " fmt, request->name, ## __VA_ARGS__)
+#define RDEBUG(fmt, ...) if (worker->lvl) fr_log(worker->log, L_DBG, "(%s)  " fmt, request_name(request), ## __VA_ARGS__)
 DIAG_ON(unused-macros)
 
 /**
@@ -133,13 +134,20 @@ struct fr_worker_t {
 
 	size_t			talloc_pool_size; //!< for each REQUEST
 
+	struct {
+		REQUEST		**free;		//!< requests which have been reset, and are ready for re-use
+		uint32_t	num;		//!< number of requests in the pool
+		uint32_t	max;		//!< maximum number of requests we keep
+		uint64_t	hits;		//!< requests taken from the pool
+		uint64_t	misses;		//!< requests which had to be allocated
+	} request_pool;
 
 	fr_worker_heap_t	to_decode;	//!< messages from the master, to be decoded or localized
 	fr_worker_heap_t       	localized;	//!< localized messages to be decoded
 
 	fr_heap_t      		*runnable;	//!< current runnable requests which we've spent time processing
 	fr_heap_t		*time_order;	//!< time ordered heap of requests
-	rbtree_t		*dedup;		//!< de-dup tree
+	fr_ohash_t		*dedup;		//!< de-dup table
 
 	fr_io_stats_t		stats;		//!< input / output stats
 	fr_time_elapsed_t	cpu_time;	//!< histogram of total CPU time per request
@@ -151,7 +159,6 @@ struct fr_worker_t {
 
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
 
-	bool			was_sleeping;	//!< used to suppress multiple sleep signals in a row
 	bool			exiting;	//!< are we exiting?
 
 	fr_time_t		checked_timeout; //!< when we last checked the tails of the queues
@@ -232,19 +239,12 @@ static bool fr_worker_drain_input(fr_worker_t *worker, fr_channel_t *ch, fr_chan
 static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_size, fr_time_t now)
 {
 	int i;
-	bool ok, was_sleeping;
+	bool ok;
 	fr_channel_t *ch;
 	fr_message_set_t *ms;
 	fr_channel_event_t ce;
 	fr_worker_t *worker = ctx;
 
-	was_sleeping = worker->was_sleeping;
-	worker->was_sleeping = false;
-
-	/*
-	 *	We were woken up by a signal to do something.  We're
-	 *	not sleeping.
-	 */
 	ce = fr_channel_service_message(now, &ch, data, data_size);
 	switch (ce) {
 	case FR_CHANNEL_ERROR:
@@ -267,9 +267,7 @@ static void fr_worker_channel_callback(void *ctx, void const *data, size_t data_
 	case FR_CHANNEL_DATA_READY_WORKER:
 		rad_assert(ch != NULL);
 		DEBUG3("\t--> data");
-		if (!fr_worker_drain_input(worker, ch, NULL)) {
-			worker->was_sleeping = was_sleeping;
-		}
+		(void) fr_worker_drain_input(worker, ch, NULL);
 		break;
 
 	case FR_CHANNEL_OPEN:
@@ -441,6 +439,64 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 
 static void worker_reset_timer(fr_worker_t *worker);
 
+/** Get a REQUEST for a new packet
+ *
+ *  Requests are taken from the pool if possible.  Otherwise we
+ *  allocate a new one.
+ *
+ * @param[in] worker the worker
+ * @return
+ *	- NULL on error
+ *	- REQUEST with packet, reply and async data allocated.
+ */
+static REQUEST *worker_request_alloc(fr_worker_t *worker)
+{
+	REQUEST *request;
+
+	if (worker->request_pool.num > 0) {
+		request = worker->request_pool.free[--worker->request_pool.num];
+		worker->request_pool.hits++;
+	} else {
+		request = request_alloc(NULL);
+		if (!request) return NULL;
+		worker->request_pool.misses++;
+	}
+
+	/*
+	 *	Recycled requests have these already, unless a module
+	 *	replaced them with its own.
+	 */
+	if (!request->packet) request->packet = fr_radius_alloc(request, false);
+	if (!request->reply) request->reply = fr_radius_alloc(request, false);
+	if (!request->async) request->async = talloc_zero(request, fr_async_t);
+
+	if (!request->packet || !request->reply || !request->async) {
+		talloc_free(request);
+		return NULL;
+	}
+
+	return request;
+}
+
+/** Return a REQUEST to the pool
+ *
+ *  If the pool is full, or the request can't be reset, it is freed.
+ *
+ * @param[in] worker the worker
+ * @param[in] request the request to release
+ */
+static void worker_request_release(fr_worker_t *worker, REQUEST *request)
+{
+	if ((worker->request_pool.num >= worker->request_pool.max) || (request_reset(request) < 0)) {
+		talloc_free(request);
+		return;
+	}
+
+	if (request->async) memset(request->async, 0, sizeof(*request->async));
+
+	worker->request_pool.free[worker->request_pool.num++] = request;
+}
+
 
 /** Reply to a request
  *
@@ -566,10 +622,6 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	 */
 	if (cd) (void) fr_worker_drain_input(worker, ch, cd);
 
-	/*
-	 *	@todo Use a talloc pool for the request.  Clean it up,
-	 *	and insert it back into a slab allocator.
-	 */
 	if (request->time_order_id >= 0) (void) fr_heap_extract(worker->time_order, request);
 	if (request->runnable_id >= 0) (void) fr_heap_extract(worker->runnable, request);
 
@@ -587,8 +639,8 @@ finished:
 	request->async->listen = NULL;
 #endif
 
-	DEBUG3("freeing request");
-	talloc_free(request);
+	DEBUG3("releasing request");
+	worker_request_release(worker, request);
 }
 
 
@@ -607,7 +659,7 @@ static void worker_stop_request(fr_worker_t *worker, REQUEST *request, fr_time_t
 	 */
 	if (request->time_order_id >= 0) (void) fr_heap_extract(worker->time_order, request);
 	if (request->runnable_id >= 0) (void) fr_heap_extract(worker->runnable, request);
-	(void) rbtree_deletebydata(worker->dedup, request);
+	(void) fr_ohash_remove(worker->dedup, request);
 
 #ifndef NDEBUG
 	request->async->process = NULL;
@@ -783,9 +835,6 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	fr_channel_data_t	*cd;
 	REQUEST			*request;
 	fr_listen_t const	*listen;
-#ifndef HAVE_TALLOC_POOLED_OBJECT
-	TALLOC_CTX		*ctx;
-#endif
 
 	/*
 	 *	Grab a runnable request, and resume it.
@@ -817,18 +866,12 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 		worker->num_decoded++;
 	} while (!cd);
 
-	ctx = request = request_alloc(NULL);
+	request = worker_request_alloc(worker);
 	if (!request) goto nak;
 
 	request->el = worker->el;
 	request->backlog = worker->runnable;
-	request->packet = fr_radius_alloc(request, false);
 	fr_time_to_timeval(&request->packet->timestamp, *cd->request.recv_time); /* Legacy - Remove once everything looks at request->async */
-	rad_assert(request->packet != NULL);
-	request->reply = fr_radius_alloc(request, false);
-	rad_assert(request->reply != NULL);
-
-	request->async = talloc_zero(request, fr_async_t);
 	request->server_cs = cd->listen->server_cs;
 
 	/*
@@ -851,8 +894,7 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	request->async->original_recv_time = cd->request.recv_time;
 	request->async->recv_time = *request->async->original_recv_time;
 	request->async->el = worker->el;
-	request->number = worker->number++;
-	request->name = talloc_typed_asprintf(request, "%" PRIu64 , request->number);
+	request->number = worker->number++;	/* name is formatted on demand by request_name() */
 
 	request->async->listen = cd->listen;
 	request->async->packet_ctx = cd->packet_ctx;
@@ -870,7 +912,7 @@ static REQUEST *fr_worker_get_request(fr_worker_t *worker, fr_time_t now)
 	}
 
 	if (ret < 0) {
-		talloc_free(ctx);
+		worker_request_release(worker, request);
 nak:
 		fr_worker_nak(worker, cd, now);
 		return NULL;
@@ -884,6 +926,7 @@ nak:
 
 	if (!request->async->process) {
 		RERROR("Protocol failed to set 'process' function");
+		worker_request_release(worker, request);
 		fr_worker_nak(worker, cd, now);
 		return NULL;
 	}
@@ -901,7 +944,7 @@ nak:
 	if (request->async->listen->app_io->track_duplicates) {
 		REQUEST *old;
 
-		old = rbtree_finddata(worker->dedup, request);
+		old = fr_ohash_find(worker->dedup, request);
 		if (!old) {
 			/*
 			 *	Ignore duplicate packets where we've
@@ -910,6 +953,7 @@ nak:
 			if (is_dup) {
 				RDEBUG("Got duplicate packet notice after we had sent a reply - ignoring");
 				fr_channel_null_reply(request->async->channel);
+				worker_request_release(worker, request);
 				return NULL;
 			}
 			goto insert_new;
@@ -939,7 +983,7 @@ nak:
 			RWARN("Discarding duplicate of request (%"PRIu64")", old->number);
 
 			fr_channel_null_reply(request->async->channel);
-			talloc_free(request);
+			worker_request_release(worker, request);
 
 			/*
 			 *	Signal there's a dup, and ignore the
@@ -952,7 +996,7 @@ nak:
 			 *	running, but is yielded.  It MAY clean
 			 *	itself up, or do something...
 			 */
-			(void) old->async->process(request->async->process_inst, old, FR_IO_ACTION_DUP);
+			(void) old->async->process(old->async->process_inst, old, FR_IO_ACTION_DUP);
 			worker->stats.dup++;
 			return NULL;
 		}
@@ -967,10 +1011,10 @@ nak:
 		rad_assert(worker->num_active > 0);
 		worker->num_active--;
 		worker->stats.dropped++;
-		talloc_free(old);
+		worker_request_release(worker, old);
 
 	insert_new:
-		(void) rbtree_insert(worker->dedup, request);
+		(void) fr_ohash_insert(worker->dedup, request);
 	}
 
 	/*
@@ -1061,7 +1105,7 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 
 	RDEBUG("done request");
 
-	(void) rbtree_deletebydata(worker->dedup, request);
+	(void) fr_ohash_remove(worker->dedup, request);
 
 	fr_worker_send_reply(worker, request, size);
 	if (!worker->num_active) worker_reset_timer(worker);
@@ -1079,15 +1123,15 @@ static void fr_worker_run_request(fr_worker_t *worker, REQUEST *request)
 static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 {
 	bool sleeping;
-	int i;
 	fr_worker_t *worker = ctx;
 
 	WORKER_VERIFY;
 
 	/*
-	 *	See if we need to sleep, because if there's nothing
-	 *	more to do, we need to tell the other end of the
-	 *	channels that we're sleeping.
+	 *	See if we need to sleep.  We don't need to tell the
+	 *	other end of the channels that we're sleeping.  The
+	 *	channel takes care of that when we find our input
+	 *	queues empty.
 	 */
 	sleeping = (fr_heap_num_elements(worker->runnable) == 0);
 	if (sleeping) sleeping = (fr_heap_num_elements(worker->localized.heap) == 0);
@@ -1098,10 +1142,7 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 	 *	don't want to wait for events, but instead check them,
 	 *	and start processing packets immediately.
 	 */
-	if (!sleeping) {
-		worker->was_sleeping = false;
-		return 1;
-	}
+	if (!sleeping) return 1;
 
 	/*
 	 *	The application is polling the event loop, but has
@@ -1122,29 +1163,6 @@ static int fr_worker_pre_event(void *ctx, struct timeval *wake)
 	       worker->name, worker->stats.in, worker->num_decoded,
 	       worker->stats.out, worker->num_active);
 
-	/*
-	 *	We were sleeping, don't send another signal that we
-	 *	are still sleeping.
-	 */
-	if (worker->was_sleeping) {
-		DEBUG3("Worker %i was sleeping, not re-signaling", fr_schedule_worker_id());
-		return 0;
-	}
-
-	/*
-	 *	Nothing more to do, and the event loop has us sleeping
-	 *	for a period of time.  Signal the producers that we're
-	 *	sleeping.  The fr_channel_worker_sleeping() function
-	 *	will take care of skipping the signal if there are no
-	 *	outstanding requests for it.
-	 */
-	for (i = 0; i < worker->max_channels; i++) {
-		if (!worker->channel[i]) continue;
-
-		(void) fr_channel_worker_sleeping(worker->channel[i]);
-	}
-	worker->was_sleeping = true;
-
 	return 0;
 }
 
@@ -1187,7 +1205,19 @@ static int worker_time_order_cmp(void const *one, void const *two)
 }
 
 /**
- *  Track a REQUEST in the "dedup" tree
+ *  Track a REQUEST in the "dedup" table
+ */
+static uint32_t worker_dedup_hash(void const *data)
+{
+	uint32_t hash;
+	REQUEST const *request = data;
+
+	hash = fr_hash(&request->async->listen, sizeof(request->async->listen));
+	return fr_hash_update(&request->async->packet_ctx, sizeof(request->async->packet_ctx), hash);
+}
+
+/**
+ *  Compare two REQUESTs in the "dedup" table
  */
 static int worker_dedup_cmp(void const *one, void const *two)
 {
@@ -1243,6 +1273,8 @@ void fr_worker_destroy(fr_worker_t *worker)
 	}
 	rad_assert(fr_heap_num_elements(worker->runnable) == 0);
 
+	while (worker->request_pool.num > 0) talloc_free(worker->request_pool.free[--worker->request_pool.num]);
+
 #if 0
 	/*
 	 *	Signal the channels that we're closing.
@@ -1307,10 +1339,17 @@ nomem:
 	 */
 	worker->max_channels = max_channels;
 	worker->talloc_pool_size = 4096; /* at least enough for a REQUEST */
+	worker->request_pool.max = 256;
 	worker->message_set_size = 1024;
 	worker->ring_buffer_size = (1 << 16);
 	worker->max_request_time = 30;
 
+	worker->request_pool.free = talloc_zero_array(worker, REQUEST *, worker->request_pool.max);
+	if (!worker->request_pool.free) {
+		talloc_free(worker);
+		goto nomem;
+	}
+
 	if (fr_event_pre_insert(worker->el, fr_worker_pre_event, worker) < 0) {
 		fr_strerror_printf("Failed adding pre-check to event list");
 		talloc_free(worker);
@@ -1370,7 +1409,7 @@ nomem:
 		goto fail;
 	}
 
-	worker->dedup = rbtree_talloc_create(worker, worker_dedup_cmp, REQUEST, NULL, RBTREE_FLAG_NONE);
+	worker->dedup = fr_ohash_create(worker, worker_dedup_hash, worker_dedup_cmp, 0);
 	if (!worker->dedup) {
 		fr_strerror_printf("Failed creating de_dup tree");
 		goto fail;
@@ -1611,7 +1650,7 @@ static void fr_worker_verify(fr_worker_t *worker)
 	(void) talloc_get_type_abort(worker->runnable, fr_heap_t);
 
 	rad_assert(worker->dedup != NULL);
-	(void) talloc_get_type_abort(worker->dedup, rbtree_t);
+	(void) talloc_get_type_abort(worker->dedup, fr_ohash_t);
 
 	for (i = 0; i < worker->max_channels; i++) {
 		if (!worker->channel[i]) continue;
@@ -1633,10 +1672,12 @@ int fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats)
 	if (num >= 5) stats[4] = worker->num_decoded;
 	if (num >= 6) stats[5] = worker->num_timeouts;
 	if (num >= 7) stats[6] = worker->num_active;
+	if (num >= 8) stats[7] = worker->request_pool.hits;
+	if (num >= 9) stats[8] = worker->request_pool.misses;
 
-	if (num <= 7) return num;
+	if (num <= 9) return num;
 
-	return 7;
+	return 9;
 }
 
 static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
@@ -1655,6 +1696,12 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
 	}
 
+	if ((info->argc == 0) || (strcmp(info->argv[0], "pool") == 0)) {
+		fprintf(fp, "pool.hits\t\t\t%" PRIu64 "\n", worker->request_pool.hits);
+		fprintf(fp, "pool.misses\t\t\t%" PRIu64 "\n", worker->request_pool.misses);
+		fprintf(fp, "pool.free\t\t\t%u\n", worker->request_pool.num);
+	}
+
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
 		when = worker->tracking.predicted;
 		fprintf(fp, "cpu.average_request_time\t%u.%03u\n", (unsigned int) (when / NANOSEC), (unsigned int) (when % NANOSEC) / 1000000);
@@ -1687,7 +1734,7 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.parent = "stats worker",
 		.add_name = true,
 		.name = "self",
-		.syntax = "[(count|cpu)]",
+		.syntax = "[(count|pool|cpu)]",
 		.func = cmd_stats_worker,
 		.help = "Show statistics for a specific worker thread.",
 		.read_only = true
@@ -359,6 +359,37 @@ process_error:
 	return status;
 }
 
+/** Check each message in a result for errors
+ *
+ * @param[in] result	The caller's result pointer, if NULL, or there's an error
+ *			the result is freed.
+ * @param[out] ctrls	Server ctrls returned to the client.  May be NULL if not required.
+ * @param[in] conn	the result was received on.
+ * @param[in] result_p	Where the result was written.
+ * @param[in] dn	Last search or bind DN.  May be NULL.
+ * @return One of the LDAP_PROC_* (#fr_ldap_rcode_t) values.
+ */
+static fr_ldap_rcode_t ldap_result_check(LDAPMessage **result, LDAPControl ***ctrls,
+					 fr_ldap_connection_t const *conn, LDAPMessage **result_p, char const *dn)
+{
+	fr_ldap_rcode_t	status = LDAP_PROC_SUCCESS;
+	LDAPMessage	*msg;
+
+	for (msg = ldap_first_message(conn->handle, *result_p);
+	     msg;
+	     msg = ldap_next_message(conn->handle, msg)) {
+		status = fr_ldap_error_check(ctrls, conn, msg, dn);
+		if (status != LDAP_PROC_SUCCESS) break;
+	}
+
+	if (*result_p && ((status < 0) || !result)) {
+		ldap_msgfree(*result_p);
+		*result_p = NULL;
+	}
+
+	return status;
+}
+
 /** Parse response from LDAP server dealing with any errors
  *
  * Should be called after an LDAP operation. Will check result of operation and if
@@ -391,12 +422,11 @@ fr_ldap_rcode_t fr_ldap_result(LDAPMessage **result, LDAPControl ***ctrls,
 			       char const *dn,
 			       struct timeval const *timeout)
 {
-	fr_ldap_rcode_t	status = LDAP_PROC_SUCCESS;
 	int		lib_errno;
 
 	struct timeval	tv;			/* Holds timeout values */
 
-	LDAPMessage	*tmp_msg = NULL, *msg;	/* Temporary message pointer storage if we weren't provided with one */
+	LDAPMessage	*tmp_msg = NULL;	/* Temporary message pointer storage if we weren't provided with one */
 	LDAPMessage	**result_p = result;
 
 	if (result) *result = NULL;
@@ -437,19 +467,49 @@ fr_ldap_rcode_t fr_ldap_result(LDAPMessage **result, LDAPControl ***ctrls,
 		break;
 	}
 
-	for (msg = ldap_first_message(conn->handle, *result_p);
-	     msg;
-	     msg = ldap_next_message(conn->handle, msg)) {
-		status = fr_ldap_error_check(ctrls, conn, msg, dn);
-		if (status != LDAP_PROC_SUCCESS) break;
-	}
+	return ldap_result_check(result, ctrls, conn, result_p, dn);
+}
 
-	if (*result_p && ((status < 0) || !result)) {
-		ldap_msgfree(*result_p);
-		*result_p = NULL;
+/** Retrieve the result of an operation without waiting for it
+ *
+ * Should be called when the connection's file descriptor becomes readable.
+ * Any messages which are available are read from the connection, and if
+ * all the messages for msgid have arrived, they're checked for errors in
+ * the same way as #fr_ldap_result.
+ *
+ * @note Only suitable for searches and simple binds.  SASL binds also
+ *	use LDAP_PROC_CONTINUE, to indicate another round trip is needed.
+ *
+ * @param[out] result	Where to write result, if NULL result will be freed.  If not NULL caller
+ *			must free with ldap_msgfree().
+ * @param[in] conn	the operation was sent on.
+ * @param[in] msgid	returned when the operation was sent.
+ * @param[in] dn	Last search or bind DN.  May be NULL.
+ * @return
+ *	- LDAP_PROC_CONTINUE if the result hasn't arrived yet.
+ *	- One of the other LDAP_PROC_* (#fr_ldap_rcode_t) values.
+ */
+fr_ldap_rcode_t fr_ldap_result_poll(LDAPMessage **result, fr_ldap_connection_t const *conn, int msgid,
+				    char const *dn)
+{
+	struct timeval	tv = { 0, 0 };		/* Don't block */
+	LDAPMessage	*tmp_msg = NULL;
+	LDAPMessage	**result_p = result ? result : &tmp_msg;
+
+	if (result) *result = NULL;
+
+	switch (ldap_result(conn->handle, msgid, LDAP_MSG_ALL, &tv, result_p)) {
+	case 0:
+		return LDAP_PROC_CONTINUE;
+
+	case -1:
+		return fr_ldap_error_check(NULL, conn, NULL, dn);
+
+	default:
+		break;
 	}
 
-	return status;
+	return ldap_result_check(result, NULL, conn, result_p, dn);
 }
 
 /** Bind to the LDAP directory as a user
@@ -551,6 +611,59 @@ fr_ldap_rcode_t fr_ldap_bind(REQUEST *request,
 	return status; /* caller closes the connection */
 }
 
+/** Send a simple bind request, without waiting for the result
+ *
+ * The result should be retrieved with #fr_ldap_result_poll when the
+ * connection becomes readable.
+ *
+ * @param[out] msgid		to match response to request.
+ * @param[in] request		Current request, this may be NULL, in which case all
+ *				debug logging is done with log.
+ * @param[in] conn		to send the bind on.
+ * @param[in] dn		of the user, may be NULL to bind anonymously.
+ * @param[in] password		of the user, may be NULL if no password is specified.
+ * @param[in] serverctrls	Controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Client controls.  May be NULL.
+ * @return
+ *	- LDAP_PROC_SUCCESS if the bind was sent.
+ *	- One of the other LDAP_PROC_* (#fr_ldap_rcode_t) values on failure.
+ */
+fr_ldap_rcode_t fr_ldap_bind_send(int *msgid, REQUEST *request, fr_ldap_connection_t *conn,
+				  char const *dn, char const *password,
+				  LDAPControl **serverctrls, LDAPControl **clientctrls)
+{
+	fr_ldap_config_t const	*handle_config = conn->config;
+	struct berval		cred;
+
+	rad_assert(conn->handle);
+
+	if (!dn) dn = "";
+
+	if (password) {
+		memcpy(&cred.bv_val, &password, sizeof(cred.bv_val));
+		cred.bv_len = talloc_array_length(password) - 1;
+	} else {
+		cred.bv_val = NULL;
+		cred.bv_len = 0;
+	}
+
+	if (ldap_sasl_bind(conn->handle, dn, LDAP_SASL_SIMPLE, &cred,
+			   serverctrls, clientctrls, msgid) != LDAP_SUCCESS) {
+		fr_ldap_rcode_t status;
+
+		status = fr_ldap_error_check(NULL, conn, NULL, dn);
+		ROPTIONAL(RPEDEBUG, PERROR, "Failed sending bind as \"%s\" to \"%s\"",
+			  *dn ? dn : "(anonymous)", handle_config->server);
+		if ((status == LDAP_PROC_SUCCESS) || (status == LDAP_PROC_NO_RESULT)) status = LDAP_PROC_ERROR;
+
+		return status;
+	}
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Waiting for bind result...");
+
+	return LDAP_PROC_SUCCESS;
+}
+
 /** Search for something in the LDAP directory
  *
  * Binds as the administrative user and performs a search, dealing with any errors.
@@ -757,12 +870,16 @@ fr_ldap_rcode_t fr_ldap_search_async(int *msgid, REQUEST *request,
 
 	if (ldap_search_ext((*pconn)->handle, dn, scope, filter, search_attrs,
 			    0, our_serverctrls, our_clientctrls, NULL, 0, msgid) != LDAP_SUCCESS) {
-		int ldap_errno;
+		status = fr_ldap_error_check(NULL, *pconn, NULL, dn);
+		ROPTIONAL(RPEDEBUG, PERROR, "Failed performing search");
 
-		ldap_get_option((*pconn)->handle, LDAP_OPT_ERROR_NUMBER, &ldap_errno);
-		ERROR("Failed performing search: %s", ldap_err2string(ldap_errno));
+		/*
+		 *	LDAP_PROC_BAD_CONN tells the caller
+		 *	the connection should be closed.
+		 */
+		if ((status == LDAP_PROC_SUCCESS) || (status == LDAP_PROC_NO_RESULT)) status = LDAP_PROC_ERROR;
 
-		return LDAP_PROC_ERROR;
+		return status;
 	}
 
 	return LDAP_PROC_SUCCESS;
@@ -398,6 +398,10 @@ fr_ldap_rcode_t	fr_ldap_bind(REQUEST *request,
 
 char const	*fr_ldap_error_str(fr_ldap_connection_t const *conn);
 
+fr_ldap_rcode_t	fr_ldap_bind_send(int *msgid, REQUEST *request, fr_ldap_connection_t *conn,
+				  char const *dn, char const *password,
+				  LDAPControl **serverctrls, LDAPControl **clientctrls);
+
 fr_ldap_rcode_t	fr_ldap_search(LDAPMessage **result, REQUEST *request,
 			       fr_ldap_connection_t **pconn,
 			       char const *dn, int scope, char const *filter, char const * const * attrs,
@@ -420,6 +424,9 @@ fr_ldap_rcode_t	fr_ldap_result(LDAPMessage **result, LDAPControl ***ctrls,
 			       char const *dn,
 			       struct timeval const *timeout);
 
+fr_ldap_rcode_t	fr_ldap_result_poll(LDAPMessage **result, fr_ldap_connection_t const *conn, int msgid,
+				    char const *dn);
+
 int		fr_ldap_global_config(int debug_level, char const *tls_random_file);
 
 int		fr_ldap_init(void);
@@ -125,6 +125,7 @@ typedef struct {
 
 	uint32_t	num_networks;			//!< number of network threads
 	uint32_t	num_workers;			//!< number of network threads
+	char const	*worker_select;			//!< how network threads choose a worker
 
 	bool		drop_requests;			//!< Administratively disable request processing.
 
@@ -390,6 +391,8 @@ size_t		rad_filename_escape(UNUSED REQUEST *request, char *out, size_t outlen,
 ssize_t		rad_filename_unescape(char *out, size_t outlen, char const *in, size_t inlen);
 char		*rad_ajoin(TALLOC_CTX *ctx, char const **argv, int argc, char c);
 REQUEST		*request_alloc(TALLOC_CTX *ctx);
+int		request_reset(REQUEST *request);
+char const	*request_name(REQUEST *request);
 REQUEST		*request_alloc_fake(REQUEST *oldreq);
 REQUEST		*request_alloc_proxy(REQUEST *request);
 REQUEST		*request_alloc_detachable(REQUEST *request);
@@ -467,6 +470,11 @@ void	regex_sub_to_request(REQUEST *request, regex_t **preg, char const *value,
 
 int	regex_request_to_sub(TALLOC_CTX *ctx, char **out, REQUEST *request, uint32_t num);
 
+ssize_t	regex_cache_compile(REQUEST *request, regex_t **out, char const *pattern, size_t len,
+			    bool iflag, bool mflag);
+
+int	regex_cache_stats_register(void);
+
 /*
  *	Named capture groups only supported by PCRE.
  */
@@ -168,7 +168,7 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 	ssize_t		slen;
 	int		ret;
 
-	regex_t		*preg, *rreg = NULL;
+	regex_t		*preg;
 	regmatch_t	rxmatch[REQUEST_MAX_REGEX + 1];	/* +1 for %{0} (whole match) capture group */
 	size_t		nmatch = sizeof(rxmatch) / sizeof(regmatch_t);
 
@@ -187,15 +187,19 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 	default:
 		if (!fr_cond_assert(rhs && rhs->type == FR_TYPE_STRING)) return -1;
 		if (!fr_cond_assert(rhs && rhs->vb_strvalue)) return -1;
-		slen = regex_compile(request, &rreg, rhs->vb_strvalue, rhs->datum.length,
-				     map->rhs->tmpl_iflag, map->rhs->tmpl_mflag, true, true);
+
+		/*
+		 *	Dynamically expanded patterns are cached by
+		 *	each worker, and are owned by the cache.
+		 */
+		slen = regex_cache_compile(request, &preg, rhs->vb_strvalue, rhs->datum.length,
+					   map->rhs->tmpl_iflag, map->rhs->tmpl_mflag);
 		if (slen <= 0) {
 			REMARKER(rhs->vb_strvalue, -slen, fr_strerror());
 			EVAL_DEBUG("FAIL %d", __LINE__);
 
 			return -1;
 		}
-		preg = rreg;
 		break;
 	}
 
@@ -220,8 +224,6 @@ static int cond_do_regex(REQUEST *request, fr_cond_t const *c,
 		break;
 	}
 
-	if (preg) talloc_free(rreg);
-
 	return ret;
 }
 #endif
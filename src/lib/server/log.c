@@ -359,10 +359,10 @@ print_msg:
 	 *	(0) <msg>
 	 */
 	if ((request->seq_start == 0) || (request->number == request->seq_start)) {
-		msg_prefix = talloc_typed_asprintf(request, "(%s)  ", request->name);
+		msg_prefix = talloc_typed_asprintf(request, "(%s)  ", request_name(request));
 	} else {
 		msg_prefix = talloc_typed_asprintf(request, "(%s,%" PRIu64 ")  ",
-					     request->name, request->seq_start);
+					     request_name(request), request->seq_start);
 	}
 
 	/*
@@ -130,6 +130,7 @@ static const CONF_PARSER thread_config[] = {
 	  .func = num_networks_parse },
 	{ FR_CONF_OFFSET("num_workers", FR_TYPE_UINT32, main_config_t, num_workers), .dflt = STRINGIFY(4),
 	  .func = num_workers_parse },
+	{ FR_CONF_OFFSET("worker_select", FR_TYPE_STRING, main_config_t, worker_select), .dflt = "outstanding" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -350,7 +351,8 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >, 0);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <=, 32);
 
 	memcpy(out, &value, sizeof(value));
 
@@ -1259,6 +1261,7 @@ do {\
 	 *	Register the %{config:section.subsection} xlat function.
 	 */
 	xlat_register(NULL, "config", xlat_config, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+	xlat_pure("config");
 
 	/*
 	 *	Ensure cwd is inside the chroot.
@@ -32,9 +32,51 @@ RCSID("$Id$")
 #include <freeradius-devel/util/heap.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/thread_local.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#include <time.h>
+
+/*
+ *	Number of per-thread connection caches in each pool.  Threads
+ *	share a cache if there are more threads than this.  Must be a
+ *	power of 2.
+ */
+#define POOL_CACHE_SLOTS	(64)
 
 typedef struct fr_pool_connection fr_pool_connection_t;
 
+/** A connection parked by the last thread which released it
+ *
+ * Whoever swaps the connection out of the slot owns it, so the owning
+ * thread can take it back without locking the pool, and other threads
+ * can still steal it (under the pool mutex) when the pool runs dry.
+ */
+typedef struct {
+	_Atomic(fr_pool_connection_t *)	conn;		//!< Parked connection, or NULL.
+	atomic_uint_fast64_t		hits;		//!< Connections reserved from this slot.
+	uint8_t				pad[64 - sizeof(void *) - sizeof(uint64_t)];	//!< Keep slots on separate
+											//!< cache lines.
+} fr_pool_cache_t;
+
+/*
+ *	Which cache slot this thread uses, plus one.  Zero if it hasn't
+ *	been assigned yet.
+ */
+static _Thread_local unsigned int pool_thread_slot;
+static atomic_uint pool_thread_next;
+
+/*
+ *	The connection most recently reserved by this thread.  Lets us
+ *	release it without searching the connection list.
+ */
+static _Thread_local fr_pool_connection_t *pool_thread_reserved;
+
 static int connection_check(fr_pool_t *pool, REQUEST *request);
 
 /** An individual connection within the connection pool
@@ -105,6 +147,11 @@ struct fr_pool {
 	bool		spread;			//!< If true we spread requests over the connections,
 						//!< using the connection released longest ago, first.
 
+	bool		affinity;		//!< If true, each thread keeps the last connection it
+						//!< released, and reuses it without locking the pool.
+	fr_pool_cache_t	*cache;			//!< Per-thread connection caches, NULL if disabled.
+	atomic_uint	parked;			//!< Number of connections in the caches.
+
 	fr_heap_t	*heap;			//!< For the next connection heap
 
 	fr_pool_connection_t	*head;		//!< Start of the connection list.
@@ -112,6 +159,7 @@ struct fr_pool {
 
 	pthread_mutex_t	mutex;			//!< Mutex used to keep consistent state when making
 						//!< modifications in threaded mode.
+	uint64_t	locked_at;		//!< When the mutex was last acquired, in nanoseconds.
 	pthread_cond_t	done_spawn;		//!< Threads that need to ensure no spawning is in progress,
 						//!< should block on this condition if pending != 0.
 	pthread_cond_t	done_reconnecting;	//!< Before calling the create callback, threads should
@@ -157,9 +205,96 @@ static const CONF_PARSER pool_config[] = {
 	{ FR_CONF_OFFSET("held_trigger_max", FR_TYPE_TIMEVAL, fr_pool_t, held_trigger_max), .dflt = "0.5" },
 	{ FR_CONF_OFFSET("retry_delay", FR_TYPE_UINT32, fr_pool_t, retry_delay), .dflt = "1" },
 	{ FR_CONF_OFFSET("spread", FR_TYPE_BOOL, fr_pool_t, spread), .dflt = "no" },
+	{ FR_CONF_OFFSET("affinity", FR_TYPE_BOOL, fr_pool_t, affinity), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
 };
 
+static inline uint64_t pool_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/** Lock the pool, recording contention and how long we waited
+ *
+ */
+static inline void pool_lock(fr_pool_t *pool)
+{
+	uint64_t start;
+
+	if (pthread_mutex_trylock(&pool->mutex) == 0) {
+		pool->locked_at = pool_time();
+		pool->state.lock_count++;
+		return;
+	}
+
+	start = pool_time();
+	pthread_mutex_lock(&pool->mutex);
+	pool->locked_at = pool_time();
+
+	pool->state.lock_count++;
+	pool->state.lock_contended++;
+	pool->state.lock_wait += pool->locked_at - start;
+}
+
+/** Unlock the pool, recording how long it was held
+ *
+ */
+static inline void pool_unlock(fr_pool_t *pool)
+{
+	uint64_t held = pool_time() - pool->locked_at;
+
+	pool->state.lock_held += held;
+	if (held > pool->state.lock_held_max) pool->state.lock_held_max = held;
+
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+/** Wait on a condition, without counting the wait as time the mutex was held
+ *
+ */
+static inline void pool_cond_wait(fr_pool_t *pool, pthread_cond_t *cond)
+{
+	uint64_t held = pool_time() - pool->locked_at;
+
+	pool->state.lock_held += held;
+	if (held > pool->state.lock_held_max) pool->state.lock_held_max = held;
+
+	pthread_cond_wait(cond, &pool->mutex);
+	pool->locked_at = pool_time();
+}
+
+/** Return the cache slot for this thread
+ *
+ */
+static inline fr_pool_cache_t *pool_cache_slot(fr_pool_t *pool)
+{
+	if (!pool_thread_slot) {
+		pool_thread_slot = atomic_fetch_add_explicit(&pool_thread_next, 1, memory_order_relaxed) + 1;
+	}
+
+	return &pool->cache[(pool_thread_slot - 1) & (POOL_CACHE_SLOTS - 1)];
+}
+
+/** Take a connection out of a cache slot
+ *
+ * @return the connection, which the caller now owns, or NULL if the slot was empty.
+ */
+static inline fr_pool_connection_t *pool_cache_take(fr_pool_t *pool, fr_pool_cache_t *slot)
+{
+	fr_pool_connection_t *this;
+
+	if (!atomic_load_explicit(&slot->conn, memory_order_relaxed)) return NULL;
+
+	this = atomic_exchange_explicit(&slot->conn, NULL, memory_order_acquire);
+	if (this) atomic_fetch_sub_explicit(&pool->parked, 1, memory_order_relaxed);
+
+	return this;
+}
+
 /** Order connections by reserved most recently
  */
 static int last_reserved_cmp(void const *one, void const *two)
@@ -285,7 +420,7 @@ static fr_pool_connection_t *connection_find(fr_pool_t *pool, void *conn)
 
 	if (!pool || !conn) return NULL;
 
-	pthread_mutex_lock(&pool->mutex);
+	pool_lock(pool);
 
 	/*
 	 *	FIXME: This loop could be avoided if we passed a 'void
@@ -307,7 +442,7 @@ static fr_pool_connection_t *connection_find(fr_pool_t *pool, void *conn)
 		}
 	}
 
-	pthread_mutex_unlock(&pool->mutex);
+	pool_unlock(pool);
 	return NULL;
 }
 
@@ -346,14 +481,14 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 	 */
 	if ((pool->state.num == 0) && pool->state.pending && pool->state.last_failed) return NULL;
 
-	pthread_mutex_lock(&pool->mutex);
+	pool_lock(pool);
 	rad_assert(pool->state.num <= pool->max);
 
 	/*
 	 *	Don't spawn too many connections at the same time.
 	 */
 	if ((pool->state.num + pool->state.pending) >= pool->max) {
-		pthread_mutex_unlock(&pool->mutex);
+		pool_unlock(pool);
 
 		ROPTIONAL(RERROR, ERROR, "Cannot open new connection, already at max");
 		return NULL;
@@ -372,7 +507,7 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 			pool->state.last_throttled = now;
 		}
 
-		pthread_mutex_unlock(&pool->mutex);
+		pool_unlock(pool);
 
 		if (!RATE_LIMIT_ENABLED || complain) {
 			ROPTIONAL(RERROR, ERROR, "Last connection attempt failed, waiting %d seconds before retrying",
@@ -386,7 +521,7 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 	 *	We limit the rate of new connections after a failed attempt.
 	 */
 	if (pool->state.pending > pool->pending_window) {
-		pthread_mutex_unlock(&pool->mutex);
+		pool_unlock(pool);
 		RATE_LIMIT(ROPTIONAL(RWARN, WARN, "Cannot open a new connection due to rate limit after failure"));
 
 		return NULL;
@@ -399,7 +534,7 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 	 *	Don't starve out the thread trying to reconnect
 	 *	the pool, by continuously opening new connections.
 	 */
-	while (pool->state.reconnecting) pthread_cond_wait(&pool->done_reconnecting, &pool->mutex);
+	while (pool->state.reconnecting) pool_cond_wait(pool, &pool->done_reconnecting);
 
 	/*
 	 *	Unlock the mutex while we try to open a new
@@ -408,7 +543,7 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 	 *	that case, we want the other connections to continue
 	 *	to be used.
 	 */
-	pthread_mutex_unlock(&pool->mutex);
+	pool_unlock(pool);
 
 	/*
 	 *	The true value for pending_window is the smaller of
@@ -437,7 +572,7 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 		ROPTIONAL(RERROR, ERROR, "Opening connection failed (%" PRIu64 ")", number);
 
 		pool->state.last_failed = now;
-		pthread_mutex_lock(&pool->mutex);
+		pool_lock(pool);
 		pool->pending_window = 1;
 		pool->state.pending--;
 
@@ -447,7 +582,7 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 		 */
 		fr_pool_trigger_exec(pool, request, "fail");
 		pthread_cond_broadcast(&pool->done_spawn);
-		pthread_mutex_unlock(&pool->mutex);
+		pool_unlock(pool);
 
 		talloc_free(ctx);
 
@@ -458,12 +593,12 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 	 *	And lock the mutex again while we link the new
 	 *	connection back into the pool.
 	 */
-	pthread_mutex_lock(&pool->mutex);
+	pool_lock(pool);
 
 	this = talloc_zero(pool, fr_pool_connection_t);
 	if (!this) {
 		pthread_cond_broadcast(&pool->done_spawn);
-		pthread_mutex_unlock(&pool->mutex);
+		pool_unlock(pool);
 
 		talloc_free(ctx);
 
@@ -518,7 +653,7 @@ static fr_pool_connection_t *connection_spawn(fr_pool_t *pool, REQUEST *request,
 	fr_pool_trigger_exec(pool, request, "open");
 
 	pthread_cond_broadcast(&pool->done_spawn);
-	if (unlock) pthread_mutex_unlock(&pool->mutex);
+	if (unlock) pool_unlock(pool);
 
 	/* coverity[missing_unlock] */
 	return this;
@@ -630,6 +765,131 @@ static int connection_manage(fr_pool_t *pool, REQUEST *request, fr_pool_connecti
 }
 
 
+/** Check whether a cached connection can be used without consulting the pool
+ *
+ * Mirrors the limits in #connection_manage, but never closes anything.
+ */
+static bool connection_cacheable(fr_pool_t *pool, fr_pool_connection_t *this, time_t now)
+{
+	if (this->needs_reconnecting) return false;
+
+	if ((pool->max_uses > 0) && (this->num_uses >= pool->max_uses)) return false;
+
+	if ((pool->lifetime > 0) && ((this->created + pool->lifetime) < now)) return false;
+
+	if ((pool->idle_timeout > 0) && ((this->last_released.tv_sec + pool->idle_timeout) < now)) return false;
+
+	return true;
+}
+
+/** Return a connection taken from a per-thread cache to the heap
+ *
+ * @note Must be called with the mutex held.
+ */
+static void connection_unpark(fr_pool_t *pool, fr_pool_connection_t *this)
+{
+	rad_assert(this->in_use);
+
+	this->in_use = false;
+
+	rad_assert(pool->state.active != 0);
+	pool->state.active--;
+
+	fr_heap_insert(pool->heap, this);
+}
+
+/** Move connections from the per-thread caches back to the heap
+ *
+ * @note Must be called with the mutex held.  Parked connections can't be
+ *	closed without it, so it's safe to look at them.
+ *
+ * @param[in] pool	to reclaim connections in.
+ * @param[in] now	Current time.
+ * @param[in] idle	only reclaim connections released at least this many seconds ago.
+ * @param[in] max	reclaim at most this many connections.
+ * @return the number of connections reclaimed.
+ */
+static uint32_t connection_reclaim(fr_pool_t *pool, time_t now, time_t idle, uint32_t max)
+{
+	uint32_t		i, count = 0;
+	fr_pool_connection_t	*this;
+
+	if (!pool->cache) return 0;
+
+	for (i = 0; (i < POOL_CACHE_SLOTS) && (count < max); i++) {
+		this = atomic_load_explicit(&pool->cache[i].conn, memory_order_acquire);
+		if (!this) continue;
+
+		if (idle && ((this->last_released.tv_sec + idle) > now)) continue;
+
+		this = pool_cache_take(pool, &pool->cache[i]);
+		if (!this) continue;
+
+		connection_unpark(pool, this);
+		count++;
+	}
+
+	return count;
+}
+
+/** Park a connection in this thread's cache, instead of releasing it to the pool
+ *
+ * Connections aren't parked if the pool is due for maintenance, if the
+ * connection has hit one of its limits, or if releasing it would fire a
+ * trigger.  Those cases all need the mutex.
+ *
+ * @note Held time statistics are only recorded for connections released
+ *	to the pool.
+ *
+ * @note Must be called with the mutex free.
+ *
+ * @return
+ *	- true if the connection was parked.
+ *	- false if it should be released to the pool.
+ */
+static bool connection_park(fr_pool_t *pool, REQUEST *request, fr_pool_connection_t *this)
+{
+	struct timeval		released, held;
+	fr_pool_cache_t		*slot;
+	fr_pool_connection_t	*old;
+
+	gettimeofday(&released, NULL);
+
+	if (pool->state.last_checked != released.tv_sec) return false;
+
+	if (!connection_cacheable(pool, this, released.tv_sec)) return false;
+
+	fr_timeval_subtract(&held, &released, &this->last_reserved);
+	if ((pool->held_trigger_min.tv_sec || pool->held_trigger_min.tv_usec) &&
+	    (fr_timeval_cmp(&held, &pool->held_trigger_min) < 0)) return false;
+
+	if ((pool->held_trigger_max.tv_sec || pool->held_trigger_max.tv_usec) &&
+	    (fr_timeval_cmp(&held, &pool->held_trigger_max) > 0)) return false;
+
+	this->last_released = released;
+
+	slot = pool_cache_slot(pool);
+
+	atomic_fetch_add_explicit(&pool->parked, 1, memory_order_relaxed);
+	old = atomic_exchange_explicit(&slot->conn, this, memory_order_release);
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Released connection (%" PRIu64 ") to thread cache", this->number);
+
+	/*
+	 *	We were holding more than one connection, or
+	 *	another thread shares our slot.
+	 */
+	if (old) {
+		atomic_fetch_sub_explicit(&pool->parked, 1, memory_order_relaxed);
+
+		pool_lock(pool);
+		connection_unpark(pool, old);
+		pool_unlock(pool);
+	}
+
+	return true;
+}
+
 /** Check whether any connections need to be removed from the pool
  *
  * Maintains the number of connections in the pool as per the configuration
@@ -651,16 +911,26 @@ static int connection_check(fr_pool_t *pool, REQUEST *request)
 	fr_pool_connection_t *this, *next;
 
 	if (pool->state.last_checked == now) {
-		pthread_mutex_unlock(&pool->mutex);
+		pool_unlock(pool);
 		return 1;
 	}
 
+	/*
+	 *	Connections which threads have kept, but haven't used
+	 *	recently, go back to the pool so that the limits below
+	 *	apply to them.
+	 */
+	(void) connection_reclaim(pool, now, 1, UINT32_MAX);
+
 	/*
 	 *	Some idle connections are OK, if they're within the
 	 *	configured "spare" range.  Any extra connections
 	 *	outside of that range can be closed.
+	 *
+	 *	Parked connections are still counted as active, but
+	 *	they're really idle.
 	 */
-	idle = pool->state.num - pool->state.active;
+	idle = pool->state.num - pool->state.active + atomic_load_explicit(&pool->parked, memory_order_relaxed);
 	if (idle <= pool->spare) {
 		extra = 0;
 	} else {
@@ -745,9 +1015,9 @@ static int connection_check(fr_pool_t *pool, REQUEST *request)
 	 *	a connection. Avoids spurious log messages.
 	 */
 	if (spawn) {
-		pthread_mutex_unlock(&pool->mutex);
+		pool_unlock(pool);
 		(void) connection_spawn(pool, request, now, false, true);
-		pthread_mutex_lock(&pool->mutex);
+		pool_lock(pool);
 	}
 
 	/*
@@ -791,7 +1061,7 @@ static int connection_check(fr_pool_t *pool, REQUEST *request)
 
 	pool->state.last_checked = now;
 done:
-	pthread_mutex_unlock(&pool->mutex);
+	pool_unlock(pool);
 
 	return 1;
 }
@@ -810,11 +1080,45 @@ done:
 static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spawn)
 {
 	time_t now;
-	fr_pool_connection_t *this;
+	fr_pool_connection_t *this, *cached = NULL;
 
 	if (!pool) return NULL;
 
-	pthread_mutex_lock(&pool->mutex);
+	/*
+	 *	Try the connection this thread released last.  It's
+	 *	still reserved, so we don't need the mutex.
+	 */
+	if (pool->cache) {
+		fr_pool_cache_t *slot = pool_cache_slot(pool);
+
+		cached = pool_cache_take(pool, slot);
+		if (cached && connection_cacheable(pool, cached, time(NULL))) {
+			this = cached;
+
+			atomic_fetch_add_explicit(&slot->hits, 1, memory_order_relaxed);
+
+			this->num_uses++;
+			gettimeofday(&this->last_reserved, NULL);
+#ifdef PTHREAD_DEBUG
+			this->pthread_id = pthread_self();
+#endif
+			pool_thread_reserved = this;
+
+			ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ") from thread cache", this->number);
+
+			return this->connection;
+		}
+	}
+
+	pool_lock(pool);
+
+	if (pool->cache) pool->state.cache_misses++;
+
+	/*
+	 *	The cached connection hit a limit.  Give it back, and
+	 *	let "connection manage" deal with it.
+	 */
+	if (cached) connection_unpark(pool, cached);
 
 	now = time(NULL);
 
@@ -823,11 +1127,19 @@ static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spa
 	 *	for limits.  If "connection manage" says the link is
 	 *	no longer usable, go grab another one.
 	 */
+again:
 	do {
 		this = fr_heap_peek(pool->heap);
 		if (!this) break;
 	} while (!connection_manage(pool, request, this, now));
 
+	/*
+	 *	Nothing free in the pool.  Steal a connection from
+	 *	another thread's cache before opening a new one.
+	 */
+	if (!this && (atomic_load_explicit(&pool->parked, memory_order_relaxed) > 0) &&
+	    (connection_reclaim(pool, now, 0, 1) > 0)) goto again;
+
 	/*
 	 *	We have a working connection.  Extract it from the
 	 *	heap and use it.
@@ -848,7 +1160,7 @@ static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spa
 			pool->state.last_at_max = now;
 		}
 
-		pthread_mutex_unlock(&pool->mutex);
+		pool_unlock(pool);
 		if (!RATE_LIMIT_ENABLED || complain) {
 			ROPTIONAL(RERROR, ERROR, "No connections available and at max connection limit");
 			/*
@@ -861,7 +1173,7 @@ static void *connection_get_internal(fr_pool_t *pool, REQUEST *request, bool spa
 		return NULL;
 	}
 
-	pthread_mutex_unlock(&pool->mutex);
+	pool_unlock(pool);
 
 	if (!spawn) return NULL;
 
@@ -883,7 +1195,9 @@ do_return:
 #ifdef PTHREAD_DEBUG
 	this->pthread_id = pthread_self();
 #endif
-	pthread_mutex_unlock(&pool->mutex);
+	pool_unlock(pool);
+
+	pool_thread_reserved = this;
 
 	ROPTIONAL(RDEBUG2, DEBUG2, "Reserved connection (%" PRIu64 ")", this->number);
 
@@ -1082,6 +1396,19 @@ fr_pool_t *fr_pool_init(TALLOC_CTX *ctx,
 	 */
 	FR_TIMEVAL_BOUND_CHECK("connect_timeout", &pool->connect_timeout, >=, 0, 100000);
 
+	/*
+	 *	Per-thread caches reuse the same connection, which
+	 *	defeats "spread".
+	 */
+	if (pool->affinity && !pool->spread) {
+		pool->cache = talloc_zero_array(pool, fr_pool_cache_t, POOL_CACHE_SLOTS);
+		if (!pool->cache) {
+			ERROR("%s: Failed allocating connection caches", __FUNCTION__);
+			goto error;
+		}
+	}
+	atomic_init(&pool->parked, 0);
+
 	/*
 	 *	Don't open any connections.  Instead, force the limits
 	 *	to only 1 connection.
@@ -1140,6 +1467,16 @@ fr_pool_t *fr_pool_copy(TALLOC_CTX *ctx, fr_pool_t *pool, void *opaque)
  */
 fr_pool_state_t const *fr_pool_state(fr_pool_t *pool)
 {
+	uint32_t	i;
+	uint64_t	hits = 0;
+
+	if (pool->cache) {
+		for (i = 0; i < POOL_CACHE_SLOTS; i++) {
+			hits += atomic_load_explicit(&pool->cache[i].hits, memory_order_relaxed);
+		}
+		pool->state.cache_hits = hits;
+	}
+
 	return &pool->state;
 }
 
@@ -1215,7 +1552,7 @@ int fr_pool_reconnect(fr_pool_t *pool, REQUEST *request)
 	fr_pool_connection_t	*this;
 	time_t			now;
 
-	pthread_mutex_lock(&pool->mutex);
+	pool_lock(pool);
 
 	/*
 	 *	Pause new spawn attempts (we release the mutex
@@ -1228,7 +1565,7 @@ int fr_pool_reconnect(fr_pool_t *pool, REQUEST *request)
 	 *	and we're guaranteed the connection create callback
 	 *	will not be using the opaque data.
 	 */
-	while (pool->state.pending) pthread_cond_wait(&pool->done_spawn, &pool->mutex);
+	while (pool->state.pending) pool_cond_wait(pool, &pool->done_spawn);
 
 	/*
 	 *	We want to ensure at least 'start' connections
@@ -1269,7 +1606,7 @@ int fr_pool_reconnect(fr_pool_t *pool, REQUEST *request)
 	 */
 	pool->state.reconnecting = false;
 	pthread_cond_broadcast(&pool->done_reconnecting);
-	pthread_mutex_unlock(&pool->mutex);
+	pool_unlock(pool);
 
 	now = time(NULL);
 
@@ -1311,7 +1648,9 @@ void fr_pool_free(fr_pool_t *pool)
 
 	DEBUG2("Removing connection pool");
 
-	pthread_mutex_lock(&pool->mutex);
+	pool_lock(pool);
+
+	(void) connection_reclaim(pool, 0, 0, UINT32_MAX);
 
 	/*
 	 *	Don't loop over the list.  Just keep removing the head
@@ -1377,6 +1716,14 @@ void fr_pool_connection_release(fr_pool_t *pool, REQUEST *request, void *conn)
 	struct timeval	held;
 	bool trigger_min = false, trigger_max = false;
 
+	/*
+	 *	Usually we're releasing the connection we just
+	 *	reserved, and can keep it for this thread.
+	 */
+	this = pool_thread_reserved;
+	pool_thread_reserved = NULL;
+	if (this && pool->cache && (this->connection == conn) && connection_park(pool, request, this)) return;
+
 	this = connection_find(pool, conn);
 	if (!this) return;
 
@@ -1470,6 +1817,8 @@ void *fr_pool_connection_reconnect(fr_pool_t *pool, REQUEST *request, void *conn
 
 	if (!pool || !conn) return NULL;
 
+	if (pool_thread_reserved && (pool_thread_reserved->connection == conn)) pool_thread_reserved = NULL;
+
 	/*
 	 *	If connection_find is successful the pool is now locked
 	 */
@@ -1505,6 +1854,8 @@ int fr_pool_connection_close(fr_pool_t *pool, REQUEST *request, void *conn)
 {
 	fr_pool_connection_t *this;
 
+	if (pool_thread_reserved && (pool_thread_reserved->connection == conn)) pool_thread_reserved = NULL;
+
 	this = connection_find(pool, conn);
 	if (!this) return 0;
 
@@ -64,6 +64,16 @@ typedef struct fr_pool_state {
 	uint32_t	active;	 		//!< Number of currently reserved connections.
 
 	bool		reconnecting;		//!< We are currently reconnecting the pool.
+
+	uint64_t	lock_count;		//!< Number of times the pool mutex was acquired.
+	uint64_t	lock_contended;		//!< Number of times the pool mutex was already held.
+	uint64_t	lock_wait;		//!< Total time spent waiting for the pool mutex, in nanoseconds.
+	uint64_t	lock_held;		//!< Total time the pool mutex was held, in nanoseconds.
+	uint64_t	lock_held_max;		//!< Longest time the pool mutex was held, in nanoseconds.
+
+	uint64_t	cache_hits;		//!< Connections reserved from a per-thread cache,
+						//!< without locking the pool.
+	uint64_t	cache_misses;		//!< Connections reserved from the shared pool.
 } fr_pool_state_t;
 
 /** Alter the opaque data of a connection pool during reconnection event
@@ -26,7 +26,13 @@
 RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+
+#include <pthread.h>
 
 #ifdef HAVE_REGEX
 
@@ -300,4 +306,269 @@ int regex_request_to_sub(TALLOC_CTX *ctx, char **out, REQUEST *request, uint32_t
 	return 0;
 }
 #  endif
+
+/*
+ *	Maximum number of dynamically expanded regular expressions
+ *	each worker keeps compiled.
+ */
+#define REGEX_CACHE_SIZE	256
+
+/** A compiled regular expression in a worker's cache
+ *
+ */
+typedef struct {
+	char const	*pattern;	//!< The expanded pattern.
+	size_t		len;		//!< Length of the pattern.
+	bool		iflag;		//!< Case insensitive.
+	bool		mflag;		//!< Multiline.
+
+	regex_t		*preg;		//!< Compiled (and where possible JIT'd) pattern.
+
+	fr_dlist_t	entry;		//!< Entry in the LRU list.
+} regex_cache_entry_t;
+
+/** Per-worker cache of compiled regular expressions
+ *
+ */
+typedef struct {
+	fr_hash_table_t	*ht;		//!< Entries, keyed on the pattern and flags.
+	fr_dlist_head_t	lru;		//!< Entries, most recently used first.
+
+	int		worker_id;	//!< Worker which owns the cache.
+
+	uint64_t	hits;		//!< Lookups which found a compiled pattern.
+	uint64_t	misses;		//!< Lookups which had to compile the pattern.
+	uint64_t	evictions;	//!< Entries removed to make room for new ones.
+
+	fr_dlist_t	entry;		//!< Entry in the list of all workers' caches.
+} regex_cache_t;
+
+fr_thread_local_setup(regex_cache_t *, regex_cache)	/* macro */
+
+static pthread_mutex_t		regex_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t		regex_cache_list;
+static bool			regex_cache_list_init;
+
+static uint32_t regex_cache_entry_hash(void const *data)
+{
+	regex_cache_entry_t const	*entry = data;
+	uint8_t				flags = (entry->iflag << 1) | entry->mflag;
+
+	return fr_hash_update(&flags, sizeof(flags), fr_hash(entry->pattern, entry->len));
+}
+
+static int regex_cache_entry_cmp(void const *one, void const *two)
+{
+	regex_cache_entry_t const	*a = one, *b = two;
+	int				ret;
+
+	ret = (a->iflag - b->iflag);
+	if (ret != 0) return ret;
+
+	ret = (a->mflag - b->mflag);
+	if (ret != 0) return ret;
+
+	ret = (a->len > b->len) - (a->len < b->len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->pattern, b->pattern, a->len);
+}
+
+/** Free an entry, leaving the compiled pattern to any requests which still reference it
+ *
+ */
+static int _regex_cache_entry_free(regex_cache_entry_t *entry)
+{
+	talloc_unlink(entry, entry->preg);
+
+	return 0;
+}
+
+static void _regex_cache_free(void *arg)
+{
+	regex_cache_t *cache = arg;
+
+	pthread_mutex_lock(&regex_cache_mutex);
+	fr_dlist_remove(&regex_cache_list, cache);
+	pthread_mutex_unlock(&regex_cache_mutex);
+
+	talloc_free(cache);
+}
+
+/** Return the calling thread's cache, allocating it if necessary
+ *
+ */
+static regex_cache_t *regex_cache_get(void)
+{
+	regex_cache_t *cache = regex_cache;
+
+	if (cache) return cache;
+
+	cache = talloc_zero(NULL, regex_cache_t);
+	if (!cache) return NULL;
+
+	cache->ht = fr_hash_table_create(cache, regex_cache_entry_hash, regex_cache_entry_cmp, NULL);
+	if (!cache->ht) {
+		talloc_free(cache);
+		return NULL;
+	}
+	fr_dlist_init(&cache->lru, regex_cache_entry_t, entry);
+	cache->worker_id = fr_schedule_worker_id();
+
+	pthread_mutex_lock(&regex_cache_mutex);
+	if (!regex_cache_list_init) {
+		fr_dlist_init(&regex_cache_list, regex_cache_t, entry);
+		regex_cache_list_init = true;
+	}
+	fr_dlist_insert_tail(&regex_cache_list, cache);
+	pthread_mutex_unlock(&regex_cache_mutex);
+
+	fr_thread_local_set_destructor(regex_cache, _regex_cache_free, cache);
+
+	return cache;
+}
+
+/** Compile a dynamically expanded regular expression, or find it in the worker's cache
+ *
+ * Policies often build regular expressions from a small set of distinct
+ * values (realms, NAS identifiers).  Compiling, and studying, each of
+ * them once per worker is much cheaper than compiling them for every
+ * request.
+ *
+ * The compiled pattern belongs to the cache, and must not be freed by
+ * the caller.  A reference is held by the request, so the pattern remains
+ * valid for subcapture expansions even if it is evicted from the cache.
+ *
+ * @param[in] request		The current request.
+ * @param[out] out		Where to write the compiled pattern.
+ * @param[in] pattern		to compile.
+ * @param[in] len		of pattern.
+ * @param[in] iflag		Whether to do case insensitive matching.
+ * @param[in] mflag		If true $ matches newlines.
+ * @return
+ *	- >= 1 on success.
+ *	- <= 0 on error. Negative value is offset of parse error.
+ */
+ssize_t regex_cache_compile(REQUEST *request, regex_t **out, char const *pattern, size_t len,
+			    bool iflag, bool mflag)
+{
+	regex_cache_t		*cache;
+	regex_cache_entry_t	*entry, find;
+	ssize_t			slen;
+
+	*out = NULL;
+
+	cache = regex_cache_get();
+	if (!cache) {
+		fr_strerror_printf("Out of memory");
+		return 0;
+	}
+
+	find = (regex_cache_entry_t) {
+		.pattern = pattern,
+		.len = len,
+		.iflag = iflag,
+		.mflag = mflag
+	};
+
+	entry = fr_hash_table_finddata(cache->ht, &find);
+	if (entry) {
+		cache->hits++;
+
+		fr_dlist_remove(&cache->lru, entry);
+		fr_dlist_insert_head(&cache->lru, entry);
+		goto done;
+	}
+	cache->misses++;
+
+	MEM(entry = talloc_zero(cache, regex_cache_entry_t));
+	slen = regex_compile(entry, &entry->preg, pattern, len, iflag, mflag, true, false);
+	if (slen <= 0) {
+		talloc_free(entry);
+		return slen;
+	}
+	MEM(entry->pattern = talloc_memdup(entry, pattern, len));
+	entry->len = len;
+	entry->iflag = iflag;
+	entry->mflag = mflag;
+	talloc_set_destructor(entry, _regex_cache_entry_free);
+
+	if (fr_hash_table_num_elements(cache->ht) >= REGEX_CACHE_SIZE) {
+		regex_cache_entry_t *old;
+
+		old = fr_dlist_tail(&cache->lru);
+		fr_dlist_remove(&cache->lru, old);
+		fr_hash_table_delete(cache->ht, old);
+		talloc_free(old);
+		cache->evictions++;
+	}
+
+	if (!fr_hash_table_insert(cache->ht, entry)) {
+		talloc_free(entry);
+		fr_strerror_printf("Failed inserting pattern into regex cache");
+		return 0;
+	}
+	fr_dlist_insert_head(&cache->lru, entry);
+
+done:
+	if (!talloc_reference(request, entry->preg)) {
+		fr_strerror_printf("Out of memory");
+		return 0;
+	}
+	*out = entry->preg;
+
+	return len;
+}
+
+static int cmd_stats_regex(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	regex_cache_t *cache;
+
+	pthread_mutex_lock(&regex_cache_mutex);
+	if (!regex_cache_list_init) {
+		pthread_mutex_unlock(&regex_cache_mutex);
+		return 0;
+	}
+
+	for (cache = fr_dlist_head(&regex_cache_list);
+	     cache;
+	     cache = fr_dlist_next(&regex_cache_list, cache)) {
+		fprintf(fp, "worker\t\t\t\t%i\n", cache->worker_id);
+		fprintf(fp, "cache.entries\t\t\t%i\n", fr_hash_table_num_elements(cache->ht));
+		fprintf(fp, "cache.hits\t\t\t%" PRIu64 "\n", cache->hits);
+		fprintf(fp, "cache.misses\t\t\t%" PRIu64 "\n", cache->misses);
+		fprintf(fp, "cache.evictions\t\t\t%" PRIu64 "\n", cache->evictions);
+	}
+	pthread_mutex_unlock(&regex_cache_mutex);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "stats",
+		.name = "regex",
+		.func = cmd_stats_regex,
+		.help = "Show statistics for each worker's cache of dynamically expanded regular expressions.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Register the radmin command for regex cache statistics
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int regex_cache_stats_register(void)
+{
+	if (fr_command_register_hook(NULL, NULL, NULL, cmd_table) < 0) {
+		PERROR("Failed registering radmin commands for regex cache");
+		return -1;
+	}
+
+	return 0;
+}
 #endif
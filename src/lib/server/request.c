@@ -121,10 +121,138 @@ REQUEST *request_alloc(TALLOC_CTX *ctx)
 	return request;
 }
 
+/** Reset a REQUEST so that it can be used to process another packet
+ *
+ * Everything hanging off the request is freed, with the exception of the
+ * packet, reply, log destination, unlang stack and async data.  Those are
+ * cleared and re-parented to the request, so that the next packet doesn't
+ * have to allocate them again.
+ *
+ * The async data is opaque here, and must be re-initialised by the caller.
+ *
+ * @param[in] request	to reset.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the request can't be re-used, and should be freed instead.
+ */
+int request_reset(REQUEST *request)
+{
+	RADIUS_PACKET	*packet = NULL, *reply = NULL;
+	log_dst_t	*dst = NULL;
+	void		*stack = NULL, *async = NULL;
+	TALLOC_CTX	*state_ctx;
+
+	REQUEST_VERIFY(request);
+
+	/*
+	 *	Requests with pending timers, or which belong to
+	 *	another request, can't be recycled.
+	 */
+	if (request->ev || request->parent) return -1;
+
+	/*
+	 *	Only keep the things we allocated.  If a module
+	 *	replaced them, they'll be freed below, and
+	 *	re-allocated by the caller.
+	 */
+#define KEEP(_var, _field) \
+	if (request->_field && (talloc_parent(request->_field) == request)) { \
+		_var = request->_field; \
+		(void) talloc_steal(NULL, _var); \
+	}
+
+	KEEP(packet, packet);
+	KEEP(reply, reply);
+	KEEP(dst, log.dst);
+	KEEP(async, async);
+	if (unlang_stack_reset(request->stack) == 0) KEEP(stack, stack);
+#undef KEEP
+
+	/*
+	 *	If the state attributes were moved to a
+	 *	fr_state_entry_t, then state_ctx is NULL.
+	 */
+	state_ctx = request->state_ctx;
+	if (state_ctx) talloc_free_children(state_ctx);
+
+	talloc_free_children(request);
+	memset(request, 0, sizeof(*request));
+
+#ifndef NDEBUG
+	request->magic = REQUEST_MAGIC;
+#endif
+	request->log.lvl = req_debug_lvl;
+	request->component = "<core>";
+	request->runnable_id = -1;
+	request->time_order_id = -1;
+	request->state_ctx = state_ctx;
+
+	if (packet) {
+		talloc_free_children(packet);
+		memset(packet, 0, sizeof(*packet));
+		packet->id = -1;
+		request->packet = talloc_steal(request, packet);
+	}
+
+	if (reply) {
+		talloc_free_children(reply);
+		memset(reply, 0, sizeof(*reply));
+		reply->id = -1;
+		request->reply = talloc_steal(request, reply);
+	}
+
+	if (async) request->async = talloc_steal(request, async);
+
+	if (stack) {
+		request->stack = talloc_steal(request, stack);
+	} else {
+		request->stack = unlang_stack_alloc(request);
+		if (!request->stack) return -1;
+	}
+
+	if (dst) {
+		request->log.dst = talloc_steal(request, dst);
+	} else {
+		request->log.dst = talloc_zero(request, log_dst_t);
+		if (!request->log.dst) return -1;
+	}
+	request->log.dst->func = vlog_request;
+	request->log.dst->uctx = &default_log;
+	request->log.dst->next = NULL;
+
+	if (!request->state_ctx) {
+		request->state_ctx = talloc_init("session-state");
+		if (!request->state_ctx) return -1;
+	}
+
+	fr_dlist_talloc_init(&request->data, request_data_t, list);
+
+	return 0;
+}
+
+/** Return the name of a request, formatting it if necessary
+ *
+ * Requests created by the workers are only given a number.  The name
+ * is formatted the first time something needs to print it, so that
+ * packets which never produce any log output don't pay for it.
+ *
+ * @param[in] request	to return the name of.
+ * @return the name of the request.
+ */
+char const *request_name(REQUEST *request)
+{
+	if (!request->name) {
+		request->name = talloc_typed_asprintf(request, "%" PRIu64, request->number);
+		if (!request->name) return "";
+	}
+
+	return request->name;
+}
+
 static REQUEST *request_init_fake(REQUEST *request, REQUEST *fake)
 {
 	fake->number = request->child_number++;
-	fake->name = talloc_typed_asprintf(fake, "%s.%" PRIu64 , request->name, fake->number);
+	fake->name = talloc_typed_asprintf(fake, "%s.%" PRIu64 , request_name(request), fake->number);
 
 	fake->seq_start = 0;	/* children always start with their own sequence */
 
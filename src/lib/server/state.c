@@ -52,6 +52,18 @@ RCSID("$Id$")
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/server/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/*
+ *	Number of independently locked partitions in a thread safe
+ *	state tree.  Must be a power of 2.
+ */
+#define STATE_SHARDS	(32)
+
 /** Holds a state value, and associated VALUE_PAIRs and data
  *
  */
@@ -109,28 +121,87 @@ typedef struct state_entry {
 	REQUEST			*thawed;			//!< The request that thawed this entry.
 } fr_state_entry_t;
 
-struct fr_state_tree_t {
-	uint64_t		id;				//!< Next ID to assign.
+/** One partition of the state tree
+ *
+ * Entries are assigned to a shard by the hash of their state value,
+ * so requests for different sessions rarely contend for the same mutex.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	rbtree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+
 	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
+	uint64_t		locked;				//!< Number of times the mutex was acquired.
+	uint64_t		contended;			//!< Number of times the mutex was already held.
+} fr_state_shard_t;
+
+struct fr_state_tree_t {
+	atomic_uint_fast64_t	id;				//!< Next ID to assign.
+	atomic_uint_fast32_t	num_entries;			//!< Number of entries in all shards.
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	rbtree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
 
 	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
 
 	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+
+	uint32_t		num_shards;			//!< Number of shards.  Always a power of 2.
+	fr_state_shard_t	*shards;			//!< Independently locked partitions of the tree.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 
 	fr_dict_attr_t const	*da;				//!< State attribute used.
 };
 
-#define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
-#define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
+static void state_entry_unlink(fr_state_tree_t *state, fr_state_shard_t *shard, fr_state_entry_t *entry);
+
+/** Find the shard which holds a state value
+ *
+ */
+static inline fr_state_shard_t *state_shard(fr_state_tree_t *state, uint8_t const *value, size_t len)
+{
+	if (state->num_shards == 1) return &state->shards[0];
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+	return &state->shards[fr_hash(value, len) & (state->num_shards - 1)];
+}
+
+/** Lock a shard, recording whether another thread already held it
+ *
+ */
+static inline void state_shard_lock(fr_state_tree_t *state, fr_state_shard_t *shard)
+{
+	if (!state->thread_safe) return;
+
+	if (pthread_mutex_trylock(&shard->mutex) != 0) {
+		pthread_mutex_lock(&shard->mutex);
+		shard->contended++;
+	}
+	shard->locked++;
+}
+
+static inline void state_shard_unlock(fr_state_tree_t *state, fr_state_shard_t *shard)
+{
+	if (state->thread_safe) pthread_mutex_unlock(&shard->mutex);
+}
+
+/** Free a list of entries which have already been unlinked
+ *
+ * @return the number of entries freed.
+ */
+static uint32_t state_entries_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t	*entry;
+	uint32_t		count = 0;
+
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+		count++;
+	}
+
+	return count;
+}
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -147,22 +218,29 @@ static int state_entry_cmp(void const *one, void const *two)
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*entry;
+	uint32_t		i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		if (!shard->tree) continue;
+
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(state, shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -171,7 +249,8 @@ static int _state_tree_free(fr_state_tree_t *state)
  *
  * @param[in] ctx		to link the lifecycle of the state tree to.
  * @param[in] da		Attribute used to store and retrieve state from.
- * @param[in] thread_safe		Whether we should mutex protect the state tree.
+ * @param[in] thread_safe		Whether we should mutex protect the state tree.  Thread safe
+ *				trees are split into #STATE_SHARDS independently locked shards.
  * @param[in] max_sessions	we track state for.
  * @param[in] timeout		How long to wait before cleaning up entries.
  * @param[in] server_id		ID byte to use in load-balancing operations.
@@ -183,12 +262,17 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint32_t max_sessions, uint32_t timeout, uint8_t server_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
 
 	state->max_sessions = max_sessions;
 	state->timeout = timeout;
+	state->thread_safe = thread_safe;
+	state->num_shards = thread_safe ? STATE_SHARDS : 1;
+	atomic_init(&state->id, 0);
+	atomic_init(&state->num_entries, 0);
 
 	/*
 	 *	Create a break in the contexts.
@@ -199,29 +283,39 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
+	state->shards = talloc_zero_array(state, fr_state_shard_t, state->num_shards);
+	if (!state->shards) {
 		talloc_free(state);
 		return NULL;
 	}
+	talloc_set_destructor(state, _state_tree_free);
 
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, list);
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
-	 */
-	state->tree = rbtree_talloc_create(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
-	if (!state->tree) {
-		talloc_free(state);
-		return NULL;
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(state);
+			return NULL;
+		}
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, list);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = rbtree_talloc_create(NULL, state_entry_cmp, fr_state_entry_t, NULL, 0);
+		if (!shard->tree) {
+			if (thread_safe) pthread_mutex_destroy(&shard->mutex);
+			talloc_free(state);
+			return NULL;
+		}
 	}
-	talloc_set_destructor(state, _state_tree_free);
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
-	state->thread_safe = thread_safe;
 
 	return state;
 }
@@ -229,16 +323,16 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 /** Unlink an entry and remove if from the tree
  *
  */
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+static void state_entry_unlink(fr_state_tree_t *state, fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
 
-	rbtree_deletebydata(state->tree, entry);
+	if (rbtree_deletebydata(shard->tree, entry)) atomic_fetch_sub_explicit(&state->num_entries, 1, memory_order_relaxed);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -281,54 +375,87 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
-/** Create a new state entry
+/** Unlink entries which have timed out
  *
- * @note Called with the mutex held.
+ * @note Called with the shard mutex held.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *request,
-					    RADIUS_PACKET *packet, fr_state_entry_t *old)
+static void state_shard_expire(fr_state_tree_t *state, fr_state_shard_t *shard, time_t now, fr_dlist_head_t *to_free)
 {
-	size_t			i;
-	uint32_t		x;
-	time_t			now = time(NULL);
-	VALUE_PAIR		*vp;
 	fr_state_entry_t	*entry, *next;
 
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
-	uint64_t		timed_out = 0;
-	bool			too_many = false;
-	fr_dlist_head_t		to_free;
-
-	fr_dlist_init(&to_free, fr_state_entry_t, list);
-
-	/*
-	 *	Clean up old entries.
-	 */
-	for (entry = fr_dlist_head(&state->to_expire);
+	for (entry = fr_dlist_head(&shard->to_expire);
 	     entry != NULL;
 	     entry = next) {
 		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
+		next = fr_dlist_next(&shard->to_expire, entry);		/* Advance *before* potential unlinking */
+
+		/*
+		 *	The list is ordered by cleanup time, so
+		 *	everything after this is newer.
+		 */
+		if (entry->cleanup >= now) break;
+
+		state_entry_unlink(state, shard, entry);
+		fr_dlist_insert_tail(to_free, entry);
+		shard->timed_out++;
+	}
+}
 
-		if (entry == old) continue;
+/** Fill in the state value for an entry, and the key used to find it
+ *
+ */
+static void state_entry_key(fr_state_entry_t *entry, REQUEST *request, fr_value_box_t const *vb)
+{
+	/*
+	 *	Assume our own State first.
+	 */
+	if (vb->vb_length == sizeof(entry->state)) {
+		memcpy(entry->state, vb->vb_octets, sizeof(entry->state));
 
 		/*
-		 *	Too old, we can delete it.
+		 *	Too big?  Get the MD5 hash, in order
+		 *	to depend on the entire contents of State.
 		 */
-		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
+	} else if (vb->vb_length > sizeof(entry->state)) {
+		fr_md5_calc(entry->state, vb->vb_octets, vb->vb_length);
 
-		break;
+		/*
+		 *	Too small?  Use the whole thing, and
+		 *	set the rest of my_entry.state to zero.
+		 */
+	} else {
+		memcpy(entry->state, vb->vb_octets, vb->vb_length);
+		memset(&entry->state[vb->vb_length], 0, sizeof(entry->state) - vb->vb_length);
 	}
 
-	state->timed_out += timed_out;
+	/*
+	 *	Make it unique for different virtual servers handling the same request
+	 */
+	entry->state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
+}
+
+/** Create a new state entry
+ *
+ * If old is set, *p_shard must be the shard holding it, and must be
+ * locked.  That lock is released before the new entry is created.
+ *
+ * @note On success, returns with *p_shard set to the shard holding the new
+ *	entry, and with that shard locked.  On failure, no shard is locked.
+ *	Either way, the caller must free any entries added to to_free, after
+ *	releasing the lock.
+ */
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, fr_state_shard_t **p_shard, REQUEST *request,
+					    RADIUS_PACKET *packet, fr_state_entry_t *old, fr_dlist_head_t *to_free)
+{
+	size_t			i;
+	uint32_t		x;
+	time_t			now = time(NULL);
+	VALUE_PAIR		*vp;
+	fr_state_entry_t	*entry;
+	fr_state_shard_t	*shard;
 
-	if (!old && (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions)) too_many = true;
+	uint8_t			old_state[sizeof(old->state)];
+	int			old_tries = 0;
 
 	/*
 	 *	Record the information from the old state, we may base the
@@ -338,6 +465,8 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 *	so we have to grab the values now.
 	 */
 	if (old) {
+		shard = *p_shard;
+
 		old_tries = old->tries;
 
 		memcpy(old_state, old->state, sizeof(old_state));
@@ -346,53 +475,33 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		 *	The old one isn't used any more, so we can free it.
 		 */
 		if (fr_dlist_empty(&old->data)) {
-			state_entry_unlink(state, old);
-			fr_dlist_insert_tail(&to_free, old);
+			state_entry_unlink(state, shard, old);
+			fr_dlist_insert_tail(to_free, old);
 		}
+		state_shard_unlock(state, shard);
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
 
 	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
+	 *	The new entry will almost certainly live in a different
+	 *	shard, so we can't hold the old shard's lock while
+	 *	waiting for the new one.  Free the old entry now.
 	 *
 	 *	If there's request data that was persisted it will now
 	 *	be freed also, and it may have complex destructors associated
 	 *	with it.
 	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
-
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		return NULL;
-	}
+	(void) state_entries_free(to_free);
 
 	/*
 	 *	Allocation doesn't need to occur inside the critical region
 	 *	and would add significantly to contention.
 	 */
 	entry = talloc_zero(NULL, fr_state_entry_t);
-	if (!entry) {
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
-	}
+	if (!entry) return NULL;
 
 	request_data_list_init(&entry->data);
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -485,8 +594,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 		       entry->id, hex, (uint64_t)entry->cleanup - now);
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -495,57 +602,51 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, REQUEST *req
 	 */
 	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	if (!rbtree_insert(state->tree, entry)) {
-		RERROR("Failed inserting state entry - Insertion into state tree failed");
+	shard = state_shard(state, entry->state, sizeof(entry->state));
+	state_shard_lock(state, shard);
+
+	/*
+	 *	Clean up old entries.
+	 */
+	state_shard_expire(state, shard, now, to_free);
+
+	if (!old && (atomic_load_explicit(&state->num_entries, memory_order_relaxed) >= state->max_sessions)) {
+		state_shard_unlock(state, shard);
+		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
+		       state->max_sessions);
+	error:
 		fr_pair_delete_by_da(&packet->vps, state->da);
 		talloc_free(entry);
 		return NULL;
 	}
 
+	if (!rbtree_insert(shard->tree, entry)) {
+		state_shard_unlock(state, shard);
+		RERROR("Failed inserting state entry - Insertion into state tree failed");
+		goto error;
+	}
+	atomic_fetch_add_explicit(&state->num_entries, 1, memory_order_relaxed);
+
 	/*
 	 *	Link it to the end of the list, which is implicitely
 	 *	ordered by cleanup time.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	fr_dlist_insert_tail(&shard->to_expire, entry);
+
+	*p_shard = shard;
 
 	return entry;
 }
 
 /** Find the entry, based on the State attribute
  *
+ * @note Called with the shard mutex held.
  */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *request, fr_value_box_t const *vb)
+static fr_state_entry_t *state_entry_find(fr_state_shard_t *shard, fr_state_entry_t const *my_entry)
 {
-	fr_state_entry_t *entry, my_entry;
-
-	/*
-	 *	Assume our own State first.
-	 */	
-	if (vb->vb_length == sizeof(my_entry.state)) {
-		memcpy(my_entry.state, vb->vb_octets, sizeof(my_entry.state));
-
-		/*
-		 *	Too big?  Get the MD5 hash, in order
-		 *	to depend on the entire contents of State.
-		 */
-	} else if (vb->vb_length > sizeof(my_entry.state)) {
-		fr_md5_calc(my_entry.state, vb->vb_octets, vb->vb_length);
-
-		/*
-		 *	Too small?  Use the whole thing, and
-		 *	set the rest of my_entry.state to zero.
-		 */
-	} else {
-		memcpy(my_entry.state, vb->vb_octets, vb->vb_length);
-		memset(&my_entry.state[vb->vb_length], 0, sizeof(my_entry.state) - vb->vb_length);
-	}
-
-	/*
-	 *	Make it unique for different virtual servers handling the same request
-	 */
-	my_entry.state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
+	fr_state_entry_t *entry;
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+	entry = rbtree_finddata(shard->tree, my_entry);
 
 	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
 
@@ -557,20 +658,24 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, REQUEST *reque
  */
 void fr_state_discard(fr_state_tree_t *state, REQUEST *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 	VALUE_PAIR		*vp;
 
 	vp = fr_pair_find_by_da(request->packet->vps, state->da, TAG_ANY);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	state_entry_key(&my_entry, request, &vp->data);
+	shard = state_shard(state, my_entry.state, sizeof(my_entry.state));
+
+	state_shard_lock(state, shard);
+	entry = state_entry_find(shard, &my_entry);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		state_shard_unlock(state, shard);
 		return;
 	}
-	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_entry_unlink(state, shard, entry);
+	state_shard_unlock(state, shard);
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -607,7 +712,8 @@ void fr_state_discard(fr_state_tree_t *state, REQUEST *request)
  */
 void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 	TALLOC_CTX		*old_ctx = NULL;
 	VALUE_PAIR		*vp;
 
@@ -623,13 +729,16 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	state_entry_key(&my_entry, request, &vp->data);
+	shard = state_shard(state, my_entry.state, sizeof(my_entry.state));
+
+	state_shard_lock(state, shard);
+	entry = state_entry_find(shard, &my_entry);
 	if (entry) {
 		(void)talloc_get_type_abort(entry, fr_state_entry_t);
 		if (entry->thawed) {
 			REDEBUG("State entry has already been thawed by a request %"PRIu64, entry->thawed->number);
-			PTHREAD_MUTEX_UNLOCK(&state->mutex);
+			state_shard_unlock(state, shard);
 			return;
 		}
 		if (request->state_ctx) old_ctx = request->state_ctx;	/* Store for later freeing */
@@ -645,7 +754,7 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
 		entry->vps = NULL;
 		entry->thawed = request;
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_shard_unlock(state, shard);
 
 	if (request->state) {
 		RDEBUG2("Restored &session-state");
@@ -673,9 +782,11 @@ void fr_state_to_request(fr_state_tree_t *state, REQUEST *request)
  */
 int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 {
-	fr_state_entry_t	*entry, *old = NULL;
-	fr_dlist_head_t		data;
+	fr_state_entry_t	*entry, *old = NULL, my_entry;
+	fr_state_shard_t	*shard = NULL;
+	fr_dlist_head_t		data, to_free;
 	VALUE_PAIR		*vp;
+	uint32_t		timed_out;
 
 	request_data_list_init(&data);
 	request_data_by_persistance(&data, request, true);
@@ -687,14 +798,21 @@ int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 		log_request_pair_list(L_DBG_LVL_2, request, request->state, "&session-state:");
 	}
 
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
+
 	vp = fr_pair_find_by_da(request->packet->vps, state->da, TAG_ANY);
+	if (vp) {
+		state_entry_key(&my_entry, request, &vp->data);
+		shard = state_shard(state, my_entry.state, sizeof(my_entry.state));
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (vp) old = state_entry_find(state, request, &vp->data);
+		state_shard_lock(state, shard);
+		old = state_entry_find(shard, &my_entry);
+		if (!old) state_shard_unlock(state, shard);
+	}
 
-	entry = state_entry_create(state, request, request->reply, old);
+	entry = state_entry_create(state, &shard, request, request->reply, old, &to_free);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		(void) state_entries_free(&to_free);
 		RERROR("Creating state entry failed");
 		request_data_restore(request, &data);	/* Put it back again */
 		return -1;
@@ -711,7 +829,15 @@ int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
 	request->state_ctx = NULL;
 	request->state = NULL;
 
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_shard_unlock(state, shard);
+
+	/*
+	 *	Now free the timed out entries.  We do it here as
+	 *	freeing may involve significantly more work than just
+	 *	freeing the data.
+	 */
+	timed_out = state_entries_free(&to_free);
+	if (timed_out > 0) RWDEBUG("Cleaned up %u timed out state entries", timed_out);
 
 	RDEBUG3("RADIUS State - saved");
 	REQUEST_VERIFY(request);
@@ -724,7 +850,7 @@ int fr_request_to_state(fr_state_tree_t *state, REQUEST *request)
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -732,7 +858,12 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint32_t	i;
+	uint64_t	timed_out = 0;
+
+	for (i = 0; i < state->num_shards; i++) timed_out += state->shards[i].timed_out;
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -740,5 +871,43 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	return (uint32_t)atomic_load_explicit(&state->num_entries, memory_order_relaxed);
+}
+
+static int cmd_stats_state_shards(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	fr_state_tree_t const	*state = ctx;
+	uint32_t		i;
+
+	fprintf(fp, "shard\ttracked\ttimed_out\tlocked\tcontended\n");
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t const *shard = &state->shards[i];
+
+		fprintf(fp, "%u\t%u\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n", i,
+			(uint32_t) rbtree_num_elements(shard->tree),
+			shard->timed_out, shard->locked, shard->contended);
+	}
+
+	return 0;
 }
+
+fr_cmd_table_t cmd_state_table[] = {
+	{
+		.parent = "stats",
+		.name = "state",
+		.help = "Statistics for multi-round session state.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats state",
+		.add_name = true,
+		.name = "shards",
+		.func = cmd_stats_state_shards,
+		.help = "Show the size, lock and contention counters for each shard of a state tree.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
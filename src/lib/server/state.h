@@ -26,6 +26,8 @@
  */
 RCSIDH(state_h, "$Id$")
 
+#include <freeradius-devel/server/command.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -47,6 +49,8 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state);
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state);
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state);
 
+extern fr_cmd_table_t cmd_state_table[];
+
 #ifdef __cplusplus
 }
 #endif
@@ -284,6 +284,8 @@ int		_xlat_async_register(TALLOC_CTX *ctx,
 				     xlat_thread_detach_t thread_detach,
 				     void *uctx);
 
+int		xlat_pure(char const *name);
+
 void		xlat_unregister(char const *name);
 void		xlat_unregister_module(void *instance);
 int		xlat_register_redundant(CONF_SECTION *cs);
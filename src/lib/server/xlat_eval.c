@@ -1079,7 +1079,14 @@ static char *xlat_aprint(TALLOC_CTX *ctx, REQUEST *request, xlat_exp_t const * c
 		 */
 	case XLAT_LITERAL:
 		XLAT_DEBUG("%.*sxlat_aprint LITERAL", lvl, xlat_spaces);
-		return talloc_typed_strdup(ctx, node->fmt);
+		if (!node->folded) return talloc_typed_strdup(ctx, node->fmt);
+
+		/*
+		 *	Folded function calls are escaped, the
+		 *	same as the function's output would be.
+		 */
+		str = talloc_typed_strdup(ctx, node->fmt);
+		break;
 
 		/*
 		 *	Do a one-character expansion.
@@ -1374,6 +1381,43 @@ static size_t xlat_process(TALLOC_CTX *ctx, char **out, REQUEST *request, xlat_e
 	return total;
 }
 
+/** Evaluate a call to a pure function with constant arguments
+ *
+ * Used to fold the call into a literal when the expansion is bootstrapped.
+ *
+ * @param[in] ctx	to allocate the result in.
+ * @param[out] out	Where to write the result of the call.
+ * @param[in] node	to evaluate.  Must be a synchronous #XLAT_FUNC node
+ *			with only #XLAT_LITERAL children.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the function failed, or produced no output.
+ */
+int xlat_eval_pure(TALLOC_CTX *ctx, char **out, xlat_exp_t const *node)
+{
+	REQUEST	*request;
+
+	*out = NULL;
+
+	rad_assert(node->type == XLAT_FUNC);
+	rad_assert(node->xlat->pure && (node->xlat->type == XLAT_FUNC_SYNC));
+
+	/*
+	 *	Some functions need the server config, and all of
+	 *	them expect to be able to log against a request.
+	 */
+	if (!main_config) return -1;
+
+	request = request_alloc(NULL);
+	if (!request) return -1;
+	request->config = main_config;
+
+	*out = xlat_aprint(ctx, request, node, NULL, NULL, 0);
+	talloc_free(request);
+
+	return *out ? 0 : -1;
+}
+
 /** Replace %whatever in a string.
  *
  * See 'doc/configuration/variables.rst' for more information.
@@ -1395,6 +1439,15 @@ static ssize_t _xlat_eval_compiled(TALLOC_CTX *ctx, char **out, size_t outlen, R
 
 	rad_assert(node != NULL);
 
+	/*
+	 *	Constant expansions (including ones where calls to
+	 *	pure functions were folded) can be copied straight
+	 *	to the caller's buffer.
+	 */
+	if (*out && (node->type == XLAT_LITERAL) && !node->next && (!node->folded || !escape)) {
+		return strlcpy(*out, node->fmt, outlen);
+	}
+
 	len = xlat_process(ctx, &buff, request, node, escape, escape_ctx);
 	if ((len < 0) || !buff) {
 		rad_assert(buff == NULL);
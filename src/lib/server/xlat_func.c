@@ -2024,6 +2024,7 @@ int xlat_register(void *mod_inst, char const *name,
 	c->instantiate = instantiate;
 	c->inst_size = inst_size;
 	c->async_safe = async_safe;
+	c->pure = false;
 
 	DEBUG3("%s: %s", __FUNCTION__, c->name);
 
@@ -2037,6 +2038,34 @@ int xlat_register(void *mod_inst, char const *name,
 	return 0;
 }
 
+/** Mark a registered xlat function as pure
+ *
+ * Pure functions always produce the same output for the same input, and
+ * have no side effects.  They must not interpret their input as a reference
+ * to an attribute.
+ *
+ * Calls to synchronous pure functions with constant arguments are evaluated
+ * once, when the expansion is bootstrapped, and replaced with the result.
+ *
+ * @param[in] name	of the xlat function.
+ * @return
+ *	- 0 on success.
+ *	- -1 if no function with that name is registered.
+ */
+int xlat_pure(char const *name)
+{
+	xlat_t *c;
+
+	c = xlat_func_find(name);
+	if (!c) {
+		ERROR("%s: Unknown expansion %s", __FUNCTION__, name);
+		return -1;
+	}
+	c->pure = true;
+
+	return 0;
+}
+
 /** Register an async xlat
  *
  * All functions registered must be async_safe.
@@ -2549,6 +2578,7 @@ int xlat_init(void)
 
 	XLAT_REGISTER(integer);
 	XLAT_REGISTER(strlen);
+	xlat_pure("strlen");
 	XLAT_REGISTER(length);
 	XLAT_REGISTER(hex);
 	XLAT_REGISTER(tag);
@@ -2563,6 +2593,8 @@ int xlat_init(void)
 
 	xlat_register(NULL, "tolower", tolower_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
 	xlat_register(NULL, "toupper", toupper_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+	xlat_pure("tolower");
+	xlat_pure("toupper");
 	xlat_register(NULL, "sha1", sha1_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
 #ifdef HAVE_OPENSSL_EVP_H
 	xlat_register(NULL, "sha224", sha224_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
@@ -2583,6 +2615,7 @@ int xlat_init(void)
 
 
 	xlat_register(NULL, "base64tohex", base64_to_hex_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
+	xlat_pure("base64tohex");
 
 	xlat_register(NULL, "explode", explode_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
 
@@ -456,6 +456,82 @@ static int _xlat_bootstrap_walker(xlat_exp_t *node, UNUSED void *uctx)
 	return 0;
 }
 
+/** Replace calls to pure functions with constant arguments, with their output
+ *
+ * Children are folded first, so nested calls like %{tolower:%{toupper:a}}
+ * are reduced to a single literal.
+ *
+ * @param[in] head	of the list of nodes to fold.
+ * @return
+ *	- true if every node in the list is now a literal.
+ *	- false if one or more nodes must still be expanded at runtime.
+ */
+static bool xlat_fold(xlat_exp_t *head)
+{
+	xlat_exp_t	*node;
+	bool		constant = true;
+
+	for (node = head; node; node = node->next) {
+		bool	args_constant;
+		char	*str;
+
+		switch (node->type) {
+		case XLAT_LITERAL:
+			continue;
+
+		case XLAT_ALTERNATE:
+			(void) xlat_fold(node->child);
+			(void) xlat_fold(node->alternate);
+			constant = false;
+			continue;
+
+		case XLAT_FUNC:
+			break;
+
+		default:
+			constant = false;
+			continue;
+		}
+
+		/*
+		 *	Always fold the arguments, even if this call
+		 *	can't be folded itself.
+		 */
+		args_constant = xlat_fold(node->child);
+
+		if (!args_constant || !node->xlat->pure || (node->xlat->type != XLAT_FUNC_SYNC) ||
+		    node->xlat->instantiate || node->xlat->thread_instantiate) {
+			constant = false;
+			continue;
+		}
+
+		/*
+		 *	Empty output or an error.  Leave the call
+		 *	alone, it'll be handled at runtime.
+		 */
+		if (xlat_eval_pure(node, &str, node) < 0) {
+			constant = false;
+			continue;
+		}
+
+		DEBUG3("Folded xlat \"%s\" node %p to \"%s\"", node->xlat->name, node, str);
+
+		/*
+		 *	The children aren't freed, they're parented
+		 *	by the node, and are freed with it.
+		 */
+		node->type = XLAT_LITERAL;
+		node->fmt = str;
+		node->len = talloc_array_length(str) - 1;
+		node->folded = true;
+		node->xlat = NULL;
+		node->child = NULL;
+		node->async_safe = true;
+	}
+
+	return constant;
+}
+
 /** Create instance data for "permanent" xlats
  *
  * @note This must only be used for xlats created during startup.
@@ -474,6 +550,8 @@ int xlat_bootstrap(xlat_exp_t *root)
 
 	if (!xlat_inst_tree) xlat_instantiate_init();
 
+	(void) xlat_fold(root);
+
 	return xlat_eval_walk(root, _xlat_bootstrap_walker, XLAT_FUNC, NULL);
 }
 
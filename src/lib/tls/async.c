@@ -0,0 +1,836 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file tls/async.c
+ * @brief Run TLS handshake steps without blocking the worker.
+ *
+ * Each handshake step (one call to SSL_read) runs on a coroutine with its own
+ * stack.  When OpenSSL needs an RSA private key operation, the operation is
+ * queued for one of the crypto threads, and the coroutine switches back to
+ * the worker, which yields the request.  When the operation completes the
+ * request is marked resumable, and the coroutine is continued from where it
+ * left off.
+ *
+ * OpenSSL's own ASYNC jobs aren't used, as they run on small fixed size
+ * stacks, and handshake steps may call back into the server to check
+ * certificates, or to load and store sessions.
+ *
+ * Statistics for handshake steps are kept for every thread, whether or not
+ * they're run asynchronously.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
+
+#ifdef WITH_TLS
+#define LOG_PREFIX "tls - "
+
+#include <freeradius-devel/io/schedule.h>
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/syserror.h>
+#include <freeradius-devel/util/thread_local.h>
+#include "base.h"
+
+#include <pthread.h>
+
+#ifdef WITH_TLS_ASYNC
+#  include <openssl/rsa.h>
+#  include <sys/mman.h>
+#  include <ucontext.h>
+#endif
+
+/** Handshake statistics for a single thread
+ *
+ * Only written by the thread they belong to.
+ */
+typedef struct {
+	int			worker_id;		//!< Worker the statistics belong to.
+
+	uint64_t		steps;			//!< Handshake steps run.
+	uint64_t		yielded;		//!< Number of times a step yielded to wait
+							///< for a crypto thread.
+	fr_time_t		running;		//!< Time spent running handshake steps.
+	fr_time_elapsed_t	running_elapsed;	//!< Distribution of time spent running each step.
+
+	uint64_t		offloaded;		//!< Private key operations run by crypto threads.
+	uint64_t		inline_ops;		//!< Private key operations run by this thread.
+	fr_time_t		queued;			//!< Time operations waited for a crypto thread.
+	fr_time_t		queued_max;		//!< Longest time an operation waited for a crypto thread.
+	fr_time_elapsed_t	queued_elapsed;		//!< Distribution of time operations waited for a
+							///< crypto thread.
+	fr_time_t		crypto;			//!< Time crypto threads spent on our operations.
+
+	fr_dlist_t		entry;			//!< Entry in the list of all threads' statistics.
+} tls_async_stats_t;
+
+fr_thread_local_setup(tls_async_stats_t *, async_stats)	/* macro */
+
+static pthread_mutex_t		stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fr_dlist_head_t		stats_list;
+static bool			stats_list_init;
+static bool			stats_registered;
+
+#ifdef WITH_TLS_ASYNC
+typedef struct tls_async_op_s tls_async_op_t;
+
+/** A private key operation for a crypto thread
+ *
+ * Allocated with malloc, as it's shared between threads.  It's freed when
+ * both the coroutine, and the crypto thread have released it.
+ */
+struct tls_async_op_s {
+	fr_dlist_t		entry;			//!< Entry in the pool's queue.
+	int			refs;			//!< Protected by the pool mutex.
+	int			fd[2];			//!< The crypto thread writes to fd[1] when the
+							///< operation is complete.
+
+	bool			decrypt;		//!< Whether this is a priv_dec operation.
+	int			flen;
+	unsigned char		*from;
+	unsigned char		*to;			//!< Result, RSA_size() octets.
+	RSA			*rsa;			//!< Key to use, we hold a reference.
+	int			padding;
+
+	int			ret;			//!< Return value of the operation.
+	unsigned long		error;			//!< First error the operation produced.
+
+	fr_time_t		queued;			//!< When the operation was queued.
+	fr_time_t		started;		//!< When a crypto thread started the operation.
+	fr_time_t		finished;		//!< When the operation completed.
+};
+
+/** Crypto threads, shared by all workers using a TLS configuration
+ *
+ */
+struct tls_async_pool_s {
+	pthread_mutex_t		mutex;			//!< Protects the queue and op references.
+	pthread_cond_t		cond;			//!< Signalled when operations are queued.
+	fr_dlist_head_t		queue;			//!< Operations waiting for a crypto thread.
+	bool			stop;			//!< Tell the crypto threads to exit.
+
+	pthread_t		*threads;
+	uint32_t		num_threads;		//!< Number of threads which were started.
+
+	RSA_METHOD		*rsa_method;		//!< Offloads private key operations.
+};
+
+/** State of asynchronous handshake steps for a #tls_session_t
+ *
+ */
+struct tls_async_s {
+	tls_session_t		*session;
+	tls_async_pool_t	*pool;
+
+	uint8_t			*stack;			//!< Stack for the coroutine, with a guard page.
+	size_t			stack_len;		//!< Length of the mapping, including the guard page.
+	size_t			stack_size;		//!< Usable stack size.
+
+	ucontext_t		caller;			//!< Where to switch back to from the coroutine.
+	ucontext_t		fibre;			//!< The coroutine running the handshake step.
+
+	tls_async_func_t	func;			//!< Handshake step.
+	int			ret;			//!< What the handshake step returned.
+	bool			running;		//!< Whether a step has been started, but not finished.
+	fr_time_t		step_time;		//!< Time spent running the current step.
+
+	tls_async_op_t		*op;			//!< Operation the step is waiting for.
+	bool			ready;			//!< The operation has completed.
+	REQUEST			*request;		//!< To resume when the operation completes.
+	fr_event_list_t		*el;			//!< Event list waiting for the operation.
+};
+
+/** The coroutine which is currently running on this thread
+ *
+ */
+static _Thread_local tls_async_t *async_current;
+#endif
+
+/** Free the statistics when a thread exits
+ *
+ */
+static void _async_stats_free(void *arg)
+{
+	tls_async_stats_t *stats = arg;
+
+	pthread_mutex_lock(&stats_mutex);
+	fr_dlist_remove(&stats_list, stats);
+	pthread_mutex_unlock(&stats_mutex);
+
+	free(stats);
+}
+
+/** Return the statistics for this thread, allocating them if needed
+ *
+ * @return
+ *	- Statistics for the current thread.
+ *	- NULL if we're out of memory.
+ */
+static tls_async_stats_t *async_stats_get(void)
+{
+	tls_async_stats_t *stats = async_stats;
+
+	if (stats) return stats;
+
+	stats = calloc(1, sizeof(*stats));
+	if (!stats) return NULL;
+
+	stats->worker_id = fr_schedule_worker_id();
+
+	pthread_mutex_lock(&stats_mutex);
+	if (!stats_list_init) {
+		fr_dlist_init(&stats_list, tls_async_stats_t, entry);
+		stats_list_init = true;
+	}
+	fr_dlist_insert_tail(&stats_list, stats);
+	pthread_mutex_unlock(&stats_mutex);
+
+	fr_thread_local_set_destructor(async_stats, _async_stats_free, stats);
+
+	return stats;
+}
+
+/** Record that a handshake step has completed
+ *
+ */
+static inline void async_stats_step(fr_time_t running)
+{
+	tls_async_stats_t *stats = async_stats_get();
+
+	if (!stats) return;
+
+	stats->steps++;
+	stats->running += running;
+	fr_time_elapsed_update(&stats->running_elapsed, 0, running);
+}
+
+#define TIME_ARGS(_t) (unsigned int) ((_t) / NANOSEC), (unsigned int) ((_t) % NANOSEC) / 1000000
+
+static int cmd_stats_tls(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	tls_async_stats_t *stats;
+
+	pthread_mutex_lock(&stats_mutex);
+	if (!stats_list_init) {
+		pthread_mutex_unlock(&stats_mutex);
+		return 0;
+	}
+
+	for (stats = fr_dlist_head(&stats_list);
+	     stats;
+	     stats = fr_dlist_next(&stats_list, stats)) {
+		fprintf(fp, "worker\t\t\t\t%i\n", stats->worker_id);
+
+		fprintf(fp, "handshake.steps\t\t\t%" PRIu64 "\n", stats->steps);
+		fprintf(fp, "handshake.yielded\t\t%" PRIu64 "\n", stats->yielded);
+		fprintf(fp, "handshake.cpu\t\t\t%u.%03u\n", TIME_ARGS(stats->running));
+		fr_time_elapsed_fprint(fp, &stats->running_elapsed, "handshake.cpu", 2);
+
+		fprintf(fp, "crypto.offloaded\t\t%" PRIu64 "\n", stats->offloaded);
+		fprintf(fp, "crypto.inline\t\t\t%" PRIu64 "\n", stats->inline_ops);
+		fprintf(fp, "crypto.cpu\t\t\t%u.%03u\n", TIME_ARGS(stats->crypto));
+		fprintf(fp, "crypto.queued\t\t\t%u.%03u\n", TIME_ARGS(stats->queued));
+		fprintf(fp, "crypto.queued_max\t\t%u.%03u\n", TIME_ARGS(stats->queued_max));
+		fr_time_elapsed_fprint(fp, &stats->queued_elapsed, "crypto.queued", 2);
+	}
+	pthread_mutex_unlock(&stats_mutex);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "stats",
+		.name = "tls",
+		.func = cmd_stats_tls,
+		.help = "Show TLS handshake statistics for each thread.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Register the radmin command for TLS handshake statistics
+ *
+ * May be called multiple times, the command is only registered once.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int tls_async_stats_register(void)
+{
+	if (stats_registered) return 0;
+
+	if (fr_command_register_hook(NULL, NULL, NULL, cmd_table) < 0) {
+		PERROR("Failed registering radmin commands for TLS");
+		return -1;
+	}
+	stats_registered = true;
+
+	return 0;
+}
+
+#ifdef WITH_TLS_ASYNC
+/** Release a reference to an operation
+ *
+ * @note Must be called with the pool mutex held.
+ */
+static void async_op_release(tls_async_op_t *op)
+{
+	if (--op->refs > 0) return;
+
+	close(op->fd[0]);
+	close(op->fd[1]);
+	RSA_free(op->rsa);
+	free(op);
+}
+
+/** Do a private key operation using OpenSSL's RSA implementation
+ *
+ */
+static inline int async_rsa_priv(bool decrypt, int flen, unsigned char const *from,
+				 unsigned char *to, RSA *rsa, int padding)
+{
+	RSA_METHOD const *meth = RSA_PKCS1_OpenSSL();
+
+	if (decrypt) return RSA_meth_get_priv_dec(meth)(flen, from, to, rsa, padding);
+
+	return RSA_meth_get_priv_enc(meth)(flen, from, to, rsa, padding);
+}
+
+/** Take operations from the queue, and run them
+ *
+ */
+static void *async_crypto_thread(void *arg)
+{
+	tls_async_pool_t	*pool = arg;
+	tls_async_op_t		*op;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->stop && !(op = fr_dlist_head(&pool->queue))) {
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+		if (pool->stop) break;
+
+		fr_dlist_remove(&pool->queue, op);
+		op->started = fr_time();
+		pthread_mutex_unlock(&pool->mutex);
+
+		op->ret = async_rsa_priv(op->decrypt, op->flen, op->from, op->to, op->rsa, op->padding);
+		if (op->ret < 0) op->error = ERR_peek_error();
+		ERR_clear_error();
+
+		pthread_mutex_lock(&pool->mutex);
+		op->finished = fr_time();
+		pthread_mutex_unlock(&pool->mutex);
+
+		/*
+		 *	The pipe belongs to the op, and we hold a
+		 *	reference, so it can't have been closed.
+		 */
+		if (write(op->fd[1], "", 1) < 0) {
+			ERROR("Failed signalling completion of crypto operation: %s", fr_syserror(errno));
+		}
+
+		pthread_mutex_lock(&pool->mutex);
+		async_op_release(op);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Queue a private key operation, and switch back to the worker until it completes
+ *
+ * Called by OpenSSL for RSA keys using the pool's method.  If we're not
+ * running on a coroutine, the operation is done immediately.
+ */
+static int async_rsa_op(bool decrypt, int flen, unsigned char const *from, unsigned char *to, RSA *rsa, int padding)
+{
+	tls_async_pool_t	*pool = RSA_meth_get0_app_data(RSA_get_method(rsa));
+	tls_async_t		*async = async_current;
+	tls_async_stats_t	*stats = async_stats_get();
+	tls_async_op_t		*op;
+	int			size = RSA_size(rsa);
+	int			ret;
+
+	if (!pool || !async || (async->pool != pool) || (flen < 0) || (size <= 0)) {
+	do_inline:
+		if (stats) stats->inline_ops++;
+		return async_rsa_priv(decrypt, flen, from, to, rsa, padding);
+	}
+
+	op = calloc(1, sizeof(*op) + flen + size);
+	if (!op) goto do_inline;
+
+	if (pipe(op->fd) < 0) {
+		ERROR("Failed creating pipe for crypto operation: %s", fr_syserror(errno));
+		free(op);
+		goto do_inline;
+	}
+
+	op->refs = 2;			/* coroutine + crypto thread */
+	op->decrypt = decrypt;
+	op->flen = flen;
+	op->from = (unsigned char *)(op + 1);
+	op->to = op->from + flen;
+	op->padding = padding;
+	memcpy(op->from, from, flen);
+	RSA_up_ref(rsa);
+	op->rsa = rsa;
+
+	pthread_mutex_lock(&pool->mutex);
+	op->queued = fr_time();
+	fr_dlist_insert_tail(&pool->queue, op);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	/*
+	 *	Back to tls_async_run(), which yields the request.
+	 *	We get switched back to once the operation is done.
+	 */
+	async->op = op;
+	async->ready = false;
+	swapcontext(&async->fibre, &async->caller);
+
+	pthread_mutex_lock(&pool->mutex);
+	ret = op->ret;
+	if (ret > 0) {
+		memcpy(to, op->to, ret);
+	} else if (op->error) {
+		ERR_put_error(ERR_GET_LIB(op->error), ERR_GET_FUNC(op->error), ERR_GET_REASON(op->error),
+			      __FILE__, __LINE__);
+	}
+
+	if (stats) {
+		fr_time_t queued = op->started - op->queued;
+
+		stats->offloaded++;
+		stats->queued += queued;
+		if (queued > stats->queued_max) stats->queued_max = queued;
+		fr_time_elapsed_update(&stats->queued_elapsed, op->queued, op->started);
+		stats->crypto += op->finished - op->started;
+	}
+
+	async->op = NULL;
+	async_op_release(op);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return ret;
+}
+
+static int async_rsa_priv_enc(int flen, unsigned char const *from, unsigned char *to, RSA *rsa, int padding)
+{
+	return async_rsa_op(false, flen, from, to, rsa, padding);
+}
+
+static int async_rsa_priv_dec(int flen, unsigned char const *from, unsigned char *to, RSA *rsa, int padding)
+{
+	return async_rsa_op(true, flen, from, to, rsa, padding);
+}
+
+/** Stop the crypto threads
+ *
+ * The RSA method isn't freed, as keys in SSL_CTXs which haven't been freed
+ * yet may still be using it.  Without the pool, operations are done inline.
+ */
+static int _tls_async_pool_free(tls_async_pool_t *pool)
+{
+	uint32_t	i;
+	tls_async_op_t	*op;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_threads; i++) pthread_join(pool->threads[i], NULL);
+
+	while ((op = fr_dlist_head(&pool->queue)) != NULL) {
+		fr_dlist_remove(&pool->queue, op);
+		async_op_release(op);
+	}
+
+	RSA_meth_set0_app_data(pool->rsa_method, NULL);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	return 0;
+}
+#endif
+
+/** Create the crypto threads for a TLS configuration
+ *
+ * @param[in] ctx	to allocate the pool in.
+ * @param[in] conf	async configuration.  If async handshakes aren't
+ *			supported, they're disabled.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int tls_async_pool_alloc(TALLOC_CTX *ctx, fr_tls_async_conf_t *conf)
+{
+#ifndef WITH_TLS_ASYNC
+	UNUSED_VAR(ctx);
+
+	WARN("Asynchronous TLS handshakes are not supported with this build of OpenSSL, "
+	     "handshakes will block the worker");
+	conf->enable = false;
+
+	return 0;
+#else
+	tls_async_pool_t	*pool;
+	uint32_t		i;
+	int			ret;
+
+	if (conf->pool) return 0;
+
+	if (!conf->threads) conf->threads = 1;
+	if (conf->stack_size < 65536) conf->stack_size = 65536;
+
+	pool = talloc_zero(ctx, tls_async_pool_t);
+	if (!pool) return -1;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	fr_dlist_init(&pool->queue, tls_async_op_t, entry);
+	talloc_set_destructor(pool, _tls_async_pool_free);
+
+	pool->rsa_method = RSA_meth_dup(RSA_PKCS1_OpenSSL());
+	if (!pool->rsa_method) {
+		tls_log_error(NULL, "Failed creating RSA method");
+	error:
+		talloc_free(pool);
+		return -1;
+	}
+	RSA_meth_set1_name(pool->rsa_method, "FreeRADIUS async RSA method");
+	RSA_meth_set_priv_enc(pool->rsa_method, async_rsa_priv_enc);
+	RSA_meth_set_priv_dec(pool->rsa_method, async_rsa_priv_dec);
+	RSA_meth_set0_app_data(pool->rsa_method, pool);
+
+	pool->threads = talloc_zero_array(pool, pthread_t, conf->threads);
+	if (!pool->threads) goto error;
+
+	for (i = 0; i < conf->threads; i++) {
+		ret = pthread_create(&pool->threads[i], NULL, async_crypto_thread, pool);
+		if (ret != 0) {
+			ERROR("Failed creating crypto thread: %s", fr_syserror(ret));
+			goto error;
+		}
+		pool->num_threads++;
+	}
+
+	DEBUG2("Started %u crypto thread(s) for TLS handshakes", pool->num_threads);
+
+	conf->pool = pool;
+
+	return 0;
+#endif
+}
+
+/** Make the RSA private keys in an SSL_CTX use the crypto threads
+ *
+ * Keys which use an engine are left alone.
+ *
+ * @param[in] conf	async configuration.
+ * @param[in] ctx	to change the keys of.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int tls_async_ctx_keys_set(fr_tls_async_conf_t const *conf, SSL_CTX *ctx)
+{
+#ifdef WITH_TLS_ASYNC
+	int ret;
+
+	if (!conf->pool) return 0;
+
+	for (ret = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);
+	     ret == 1;
+	     ret = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_NEXT)) {
+		EVP_PKEY	*pkey = SSL_CTX_get0_privatekey(ctx);
+		RSA		*rsa;
+
+		if (!pkey || (EVP_PKEY_base_id(pkey) != EVP_PKEY_RSA)) continue;
+
+		rsa = EVP_PKEY_get1_RSA(pkey);
+		if (!rsa) continue;
+
+		if ((RSA_get_method(rsa) == RSA_PKCS1_OpenSSL()) &&
+		    (RSA_set_method(rsa, conf->pool->rsa_method) != 1)) {
+			tls_log_error(NULL, "Failed setting RSA method for private key");
+			RSA_free(rsa);
+			return -1;
+		}
+		RSA_free(rsa);
+	}
+	(void)SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);	/* Reset */
+#else
+	UNUSED_VAR(conf);
+	UNUSED_VAR(ctx);
+#endif
+
+	return 0;
+}
+
+#ifdef WITH_TLS_ASYNC
+/** Abandon any outstanding operation, and free the coroutine's stack
+ *
+ * If a step was interrupted, its stack frames are discarded without being
+ * unwound, so anything which OpenSSL allocated and only referenced from
+ * those frames is leaked.  This only happens if the session is freed part
+ * way through a handshake step, e.g. when a request is cancelled.
+ */
+static int _tls_async_free(tls_async_t *async)
+{
+	tls_async_op_t *op = async->op;
+
+	if (op) {
+		if (!async->ready && async->el) (void) fr_event_fd_delete(async->el, op->fd[0], FR_EVENT_FILTER_IO);
+
+		pthread_mutex_lock(&async->pool->mutex);
+		if (!op->started) {
+			fr_dlist_remove(&async->pool->queue, op);
+			async_op_release(op);
+		}
+		async_op_release(op);
+		pthread_mutex_unlock(&async->pool->mutex);
+	}
+
+	if (async->stack) munmap(async->stack, async->stack_len);
+	if (async_current == async) async_current = NULL;
+
+	return 0;
+}
+
+/** Map a stack for the coroutine, with a guard page below it
+ *
+ */
+static int async_stack_alloc(tls_async_t *async)
+{
+	size_t	page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t	len = ((async->stack_size + page - 1) / page) * page + page;
+	void	*stack;
+	int	flags = MAP_PRIVATE | MAP_ANON;
+
+#ifdef MAP_STACK
+	flags |= MAP_STACK;
+#endif
+
+	stack = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (stack == MAP_FAILED) {
+		ERROR("Failed mapping handshake stack: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (mprotect(stack, page, PROT_NONE) < 0) {
+		ERROR("Failed protecting handshake stack guard page: %s", fr_syserror(errno));
+		munmap(stack, len);
+		return -1;
+	}
+
+	async->stack = stack;
+	async->stack_len = len;
+
+	return 0;
+}
+
+/** Entry point of the coroutine
+ *
+ * Returning switches back to tls_async_run() via uc_link.
+ */
+static void async_fibre_entry(void)
+{
+	tls_async_t *async = async_current;
+
+	async->ret = async->func(async->session);
+}
+
+/** The crypto thread has finished our operation
+ *
+ */
+static void async_op_readable(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	tls_async_t *async = talloc_get_type_abort(uctx, tls_async_t);
+
+	(void) fr_event_fd_delete(async->el, fd, FR_EVENT_FILTER_IO);
+	async->ready = true;
+
+	unlang_resumable(async->request);
+}
+#endif
+
+/** Allocate the state needed to run handshake steps asynchronously
+ *
+ * @param[in] session	to run handshake steps for.
+ * @param[in] conf	async configuration, which must have a pool.
+ * @return
+ *	- New async state, which is freed with the session.
+ *	- NULL if async handshakes aren't available.
+ */
+tls_async_t *tls_async_alloc(tls_session_t *session, fr_tls_async_conf_t const *conf)
+{
+#ifdef WITH_TLS_ASYNC
+	tls_async_t *async;
+
+	if (!conf->pool) return NULL;
+
+	async = talloc_zero(session, tls_async_t);
+	if (!async) return NULL;
+
+	async->session = session;
+	async->pool = conf->pool;
+	async->stack_size = conf->stack_size;
+	talloc_set_destructor(async, _tls_async_free);
+
+	return async;
+#else
+	UNUSED_VAR(session);
+	UNUSED_VAR(conf);
+
+	return NULL;
+#endif
+}
+
+/** Whether a handshake step is waiting for a crypto thread
+ *
+ * @param[in] session	to check.
+ * @return true if the step must be continued with #tls_async_run.
+ */
+bool tls_async_pending(tls_session_t const *session)
+{
+#ifdef WITH_TLS_ASYNC
+	return session->async && session->async->running;
+#else
+	UNUSED_VAR(session);
+
+	return false;
+#endif
+}
+
+/** Run, or continue, a handshake step
+ *
+ * If the session has async state, the step is run on a coroutine.  If the
+ * step needs a private key operation, the operation is given to a crypto
+ * thread, and we return so the caller can yield the request.  The request
+ * is marked resumable when the operation is done, and the caller should
+ * then call this function again to continue the step.
+ *
+ * Otherwise the step is run immediately.
+ *
+ * @param[in] request	The current request.
+ * @param[in] session	to run the step for.
+ * @param[in] func	the handshake step.
+ * @param[out] out	What func returned.
+ * @return
+ *	- 0 if the step is waiting for a crypto thread.
+ *	- 1 if the step is done, and out has been written.
+ */
+int tls_async_run(REQUEST *request, tls_session_t *session, tls_async_func_t func, int *out)
+{
+	fr_time_t		start;
+#ifdef WITH_TLS_ASYNC
+	tls_async_t		*async = session->async;
+	tls_async_stats_t	*stats;
+
+	if (!async || (!async->running && !request->el)) goto run;
+
+	if (!async->running) {
+		if (!async->stack && (async_stack_alloc(async) < 0)) goto run;
+
+		if (getcontext(&async->fibre) < 0) {
+			ERROR("Failed initialising handshake coroutine: %s", fr_syserror(errno));
+			goto run;
+		}
+		async->fibre.uc_stack.ss_sp = async->stack + (async->stack_len - async->stack_size);
+		async->fibre.uc_stack.ss_size = async->stack_size;
+		async->fibre.uc_link = &async->caller;
+		makecontext(&async->fibre, async_fibre_entry, 0);
+
+		async->func = func;
+		async->running = true;
+		async->step_time = 0;
+
+	/*
+	 *	Resumed for some other reason, keep waiting.
+	 */
+	} else if (async->op && !async->ready) {
+		return 0;
+	}
+
+	for (;;) {
+		start = fr_time();
+		async_current = async;
+		swapcontext(&async->caller, &async->fibre);
+		async_current = NULL;
+		async->step_time += fr_time() - start;
+
+		if (!async->op) break;
+
+		/*
+		 *	The step is waiting for a crypto thread.
+		 */
+		stats = async_stats_get();
+		if (stats) stats->yielded++;
+
+		async->request = request;
+		async->el = request->el;
+		if (fr_event_fd_insert(async, async->el, async->op->fd[0],
+				       async_op_readable, NULL, NULL, async) == 0) {
+			RDEBUG3("Waiting for crypto thread");
+			return 0;
+		}
+
+		/*
+		 *	Can't wait in the event loop, so block.
+		 */
+		RPERROR("Failed inserting crypto event, blocking until the operation completes");
+		async->el = NULL;
+		{
+			char c;
+
+			while ((read(async->op->fd[0], &c, 1) < 0) && (errno == EINTR));
+		}
+		async->ready = true;
+	}
+
+	async->running = false;
+	*out = async->ret;
+	async_stats_step(async->step_time);
+
+	return 1;
+
+run:
+#else
+	UNUSED_VAR(request);
+#endif
+	start = fr_time();
+	*out = func(session);
+	async_stats_step(fr_time() - start);
+
+	return 1;
+}
+#endif /* WITH_TLS */
@@ -105,10 +105,21 @@ static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("timeout", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, timeout), .dflt = "yes" },
 	{ FR_CONF_OFFSET("softfail", FR_TYPE_BOOL, fr_tls_ocsp_conf_t, softfail), .dflt = "no" },
 
+	{ FR_CONF_OFFSET("cache_size", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, cache_size), .dflt = "1024" },
+	{ FR_CONF_OFFSET("cache_max_ttl", FR_TYPE_UINT32, fr_tls_ocsp_conf_t, cache_max_ttl), .dflt = "3600" },
+
 	CONF_PARSER_TERMINATOR
 };
 #endif
 
+static CONF_PARSER async_config[] = {
+	{ FR_CONF_OFFSET("enable", FR_TYPE_BOOL, fr_tls_async_conf_t, enable), .dflt = "no" },
+	{ FR_CONF_OFFSET("threads", FR_TYPE_UINT32, fr_tls_async_conf_t, threads), .dflt = "2" },
+	{ FR_CONF_OFFSET("stack_size", FR_TYPE_UINT32, fr_tls_async_conf_t, stack_size), .dflt = "262144" },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER tls_chain_config[] = {
 	{ FR_CONF_OFFSET("format", FR_TYPE_VOID, fr_tls_chain_conf_t, file_format), .dflt = "pem", .func = certificate_format_type_parse },
 	{ FR_CONF_OFFSET("certificate_file", FR_TYPE_FILE_INPUT | FR_TYPE_REQUIRED , fr_tls_chain_conf_t, certificate_file) },
@@ -176,6 +187,8 @@ CONF_PARSER tls_server_config[] = {
 
 	{ FR_CONF_POINTER("verify", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) verify_config },
 
+	{ FR_CONF_OFFSET("async", FR_TYPE_SUBSECTION, fr_tls_conf_t, async), .subcs = (void const *) async_config },
+
 #ifdef HAVE_OPENSSL_OCSP_H
 	{ FR_CONF_OFFSET("ocsp", FR_TYPE_SUBSECTION, fr_tls_conf_t, ocsp), .subcs = (void const *) ocsp_config },
 
@@ -447,6 +460,15 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 	conf->ctx_count = fr_tls_max_threads * 2; /* Reduce contention */
 	if (!conf->ctx_count) conf->ctx_count = 1;
 
+	if (tls_async_stats_register() < 0) goto error;
+
+	/*
+	 *	The crypto threads must be started before the
+	 *	contexts are created, so their keys can be
+	 *	switched over to use them.
+	 */
+	if (conf->async.enable && (tls_async_pool_alloc(conf, &conf->async) < 0)) goto error;
+
 	/*
 	 *	Initialize TLS
 	 */
@@ -470,11 +492,29 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 	if (conf->ocsp.enable) {
 		conf->ocsp.store = conf_ocsp_revocation_store(conf);
 		if (conf->ocsp.store == NULL) goto error;
+
+		if (conf->ocsp.cache_size) {
+			conf->ocsp.response_cache = tls_ocsp_cache_alloc(conf, conf->ocsp.cache_size,
+									 conf->ocsp.cache_max_ttl);
+			if (!conf->ocsp.response_cache) {
+				ERROR("Failed creating OCSP response cache: %s", fr_strerror());
+				goto error;
+			}
+		}
 	}
 
 	if (conf->staple.enable) {
 		conf->staple.store = conf_ocsp_revocation_store(conf);
 		if (conf->staple.store == NULL) goto error;
+
+		if (conf->staple.cache_size) {
+			conf->staple.response_cache = tls_ocsp_cache_alloc(conf, conf->staple.cache_size,
+									   conf->staple.cache_max_ttl);
+			if (!conf->staple.response_cache) {
+				ERROR("Failed creating OCSP staple response cache: %s", fr_strerror());
+				goto error;
+			}
+		}
 	}
 #endif /*HAVE_OPENSSL_OCSP_H*/
 
@@ -468,6 +468,12 @@ SSL_CTX *tls_ctx_alloc(fr_tls_conf_t const *conf, bool client)
 			}
 		}
 
+		/*
+		 *	Hand private key operations off to the
+		 *	crypto threads, if they're enabled.
+		 */
+		if (tls_async_ctx_keys_set(&conf->async, ctx) < 0) goto error;
+
 #if OPENSSL_VERSION_NUMBER >= 0x10002000L
 		/*
 		 *	Print out our certificate chains.
@@ -32,7 +32,11 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/modules.h>
 #include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/unlang/base.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/rbtree.h>
 #include <openssl/ocsp.h>
+#include <poll.h>
 #include "base.h"
 #include "tls_attrs.h"
 
@@ -50,6 +54,71 @@ typedef enum {
  */
 #define OCSP_MAX_VALIDITY_PERIOD (5 * 60)
 
+/** A verified OCSP response, held in the response cache
+ *
+ */
+typedef struct {
+	uint8_t			*key;			//!< DER encoded OCSP_CERTID.  Contains hashes of the
+							///< issuer's name and key, and the certificate serial.
+	size_t			key_len;		//!< Length of the key.
+
+	ocsp_status_t		status;			//!< What the response told us about the certificate.
+	uint8_t			*resp;			//!< DER encoded response, so it can be stapled.
+	size_t			resp_len;		//!< Length of the response.
+
+	time_t			next_update;		//!< When the responder will have new information.
+	time_t			expires;		//!< When this entry should no longer be used.
+
+	fr_dlist_t		entry;			//!< Entry in the LRU list.
+} ocsp_cache_entry_t;
+
+/** OCSP responses shared between all worker threads
+ *
+ */
+struct fr_tls_ocsp_cache_s {
+	pthread_mutex_t		mutex;			//!< Synchronisation mutex.
+	rbtree_t		*tree;			//!< Entries, keyed by OCSP_CERTID.
+	fr_dlist_head_t		lru;			//!< Least recently used entry at the head.
+
+	uint32_t		max_entries;		//!< Maximum number of entries to hold.
+	uint32_t		max_ttl;		//!< Maximum time an entry can be used for, regardless
+							///< of nextUpdate.  0 means there's no limit.
+};
+
+/** State of an OCSP lookup which wasn't answered from a cache
+ *
+ */
+struct tls_ocsp_s {
+	REQUEST			*request;		//!< The request the lookup is being performed for.
+	SSL			*ssl;			//!< SSL session the certificate was presented in.
+	tls_session_t		*session;		//!< Session the lookup was deferred in, or NULL.
+
+	fr_tls_ocsp_conf_t	*conf;			//!< OCSP configuration.
+	X509_STORE		*store;			//!< Used to verify the responder's signature.
+	bool			staple_response;	//!< Whether the response should be stapled.
+
+	OCSP_CERTID		*certid;		//!< Identifies the certificate.  Owned by req.
+	OCSP_REQUEST		*req;			//!< Request sent to the responder.
+	OCSP_RESPONSE		*resp;			//!< Response from the responder.
+	uint8_t			*key;			//!< DER encoded certid, used as the response cache key.
+	size_t			key_len;		//!< Length of the key.
+
+	char			*host;			//!< Responder host (must be freed with OPENSSL_free()).
+	char			*port;			//!< Responder port (must be freed with OPENSSL_free()).
+	char			*path;			//!< Responder path (must be freed with OPENSSL_free()).
+	BIO			*conn;			//!< Connection to the responder.
+	BIO			*ssl_log;		//!< Accumulates OpenSSL errors and messages.
+#if OPENSSL_VERSION_NUMBER >= 0x1000003f
+	OCSP_REQ_CTX		*ctx;			//!< HTTP exchange with the responder.
+#endif
+
+	fr_event_list_t		*el;			//!< Event list a deferred exchange is running in.
+	int			fd;			//!< Responder socket, whilst it's in the event list.
+	fr_event_timer_t const	*ev;			//!< When we give up waiting for the responder.
+	bool			done;			//!< Whether a deferred exchange has finished.
+	bool			failed;			//!< Whether a deferred exchange failed.
+};
+
 /** Extract components of OCSP responser URL from a certificate
  *
  * @param[in] cert to extract URL from.
@@ -152,14 +221,817 @@ static int ocsp_staple_to_pair(VALUE_PAIR **out, REQUEST *request, OCSP_RESPONSE
 	MEM(pair_update_request(&vp, attr_tls_ocsp_response) >= 0);
 	fr_pair_value_memsteal(vp, buff);
 
-	RDEBUG2("Serializing OCSP response");
-	RINDENT();
-	RDEBUG2("&%pP", vp);
-	REXDENT();
+	RDEBUG2("Serializing OCSP response");
+	RINDENT();
+	RDEBUG2("&%pP", vp);
+	REXDENT();
+
+	*out = vp;
+
+	return 0;
+}
+
+/** Add a &TLS-OCSP-Next-Update attribute to the current request
+ *
+ * @param request	The current request.
+ * @param next		When the responder will have new information.
+ * @param now		The current time.
+ */
+static void ocsp_next_update_to_pair(REQUEST *request, time_t next, time_t now)
+{
+	VALUE_PAIR *vp;
+
+	RDEBUG2("Adding OCSP TTL attribute");
+
+	MEM(pair_update_request(&vp, attr_tls_ocsp_next_update) >= 0);
+	vp->vp_uint32 = next - now;
+	RINDENT();
+	RDEBUG2("&%pP", vp);
+	REXDENT();
+}
+
+static int ocsp_cache_entry_cmp(void const *one, void const *two)
+{
+	ocsp_cache_entry_t const *a = one, *b = two;
+
+	if (a->key_len != b->key_len) return (a->key_len > b->key_len) - (a->key_len < b->key_len);
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Free entries removed from the cache
+ *
+ * Called after the mutex has been released.
+ */
+static void ocsp_cache_entries_free(fr_dlist_head_t *to_free)
+{
+	ocsp_cache_entry_t *entry;
+
+	while ((entry = fr_dlist_head(to_free)) != NULL) {
+		fr_dlist_remove(to_free, entry);
+		talloc_free(entry);
+	}
+}
+
+/** Remove an entry from the cache
+ *
+ * @note Must be called with the mutex held.
+ */
+static void ocsp_cache_entry_unlink(fr_tls_ocsp_cache_t *cache, ocsp_cache_entry_t *entry, fr_dlist_head_t *to_free)
+{
+	rbtree_deletebydata(cache->tree, entry);
+	fr_dlist_remove(&cache->lru, entry);
+	fr_dlist_insert_tail(to_free, entry);
+}
+
+/** Find a cached response for a certificate
+ *
+ * @param[out] status		What the responder said about the certificate.
+ * @param[out] next_update	When the responder will have new information.
+ * @param[out] resp		Where to write a copy of the response.  May be NULL
+ *				if the response isn't going to be stapled.
+ * @param[in] cache		to search.
+ * @param[in] key		DER encoded OCSP_CERTID identifying the certificate.
+ * @param[in] key_len		Length of the key.
+ * @param[in] now		The current time.
+ * @return
+ *	- true if a response was found, and hasn't expired.
+ *	- false if there's no usable response.
+ */
+static bool ocsp_cache_find(ocsp_status_t *status, time_t *next_update, OCSP_RESPONSE **resp,
+			    fr_tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len, time_t now)
+{
+	ocsp_cache_entry_t	find, *entry;
+	fr_dlist_head_t		to_free;
+	uint8_t const		*p;
+	bool			found = false;
+
+	memcpy(&find.key, &key, sizeof(find.key));
+	find.key_len = key_len;
+
+	fr_dlist_talloc_init(&to_free, ocsp_cache_entry_t, entry);
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = rbtree_finddata(cache->tree, &find);
+	if (entry && (entry->expires <= now)) {
+		ocsp_cache_entry_unlink(cache, entry, &to_free);
+		entry = NULL;
+	}
+
+	if (entry) {
+		fr_dlist_remove(&cache->lru, entry);
+		fr_dlist_insert_tail(&cache->lru, entry);
+
+		*status = entry->status;
+		*next_update = entry->next_update;
+		found = true;
+
+		if (resp) {
+			p = entry->resp;
+			*resp = d2i_OCSP_RESPONSE(NULL, &p, entry->resp_len);
+			if (!*resp) found = false;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	ocsp_cache_entries_free(&to_free);
+
+	return found;
+}
+
+/** Add a verified response to the cache
+ *
+ * The entry is used until the responder's nextUpdate time, or until max_ttl
+ * seconds have passed, whichever is sooner.
+ *
+ * @param[in] cache		to add the response to.
+ * @param[in] key		DER encoded OCSP_CERTID identifying the certificate.
+ * @param[in] key_len		Length of the key.
+ * @param[in] status		What the responder said about the certificate.
+ * @param[in] resp		The response.
+ * @param[in] next_update	When the responder will have new information.
+ * @param[in] now		The current time.
+ */
+static void ocsp_cache_insert(fr_tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len,
+			      ocsp_status_t status, OCSP_RESPONSE *resp, time_t next_update, time_t now)
+{
+	ocsp_cache_entry_t	*entry, *old;
+	fr_dlist_head_t		to_free;
+	uint8_t			*p;
+	int			len;
+
+	/*
+	 *	Allocation and serialisation don't need to occur
+	 *	inside the critical region.
+	 */
+	len = i2d_OCSP_RESPONSE(resp, NULL);
+	if (len <= 0) return;
+
+	entry = talloc_zero(NULL, ocsp_cache_entry_t);
+	if (!entry) return;
+
+	MEM(entry->key = talloc_memdup(entry, key, key_len));
+	entry->key_len = key_len;
+
+	MEM(p = entry->resp = talloc_array(entry, uint8_t, len));
+	if (i2d_OCSP_RESPONSE(resp, &p) != len) {
+		talloc_free(entry);
+		return;
+	}
+	entry->resp_len = len;
+
+	entry->status = status;
+	entry->next_update = next_update;
+	entry->expires = next_update;
+	if (cache->max_ttl && ((now + (time_t)cache->max_ttl) < entry->expires)) entry->expires = now + cache->max_ttl;
+
+	fr_dlist_talloc_init(&to_free, ocsp_cache_entry_t, entry);
+
+	pthread_mutex_lock(&cache->mutex);
+	old = rbtree_finddata(cache->tree, entry);
+	if (old) ocsp_cache_entry_unlink(cache, old, &to_free);
+
+	if (!rbtree_insert(cache->tree, entry)) {
+		fr_dlist_insert_tail(&to_free, entry);
+	} else {
+		fr_dlist_insert_tail(&cache->lru, entry);
+
+		while (rbtree_num_elements(cache->tree) > cache->max_entries) {
+			ocsp_cache_entry_unlink(cache, fr_dlist_head(&cache->lru), &to_free);
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	ocsp_cache_entries_free(&to_free);
+}
+
+static int _ocsp_cache_free(fr_tls_ocsp_cache_t *cache)
+{
+	ocsp_cache_entries_free(&cache->lru);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate a cache for OCSP responses
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of responses to keep.
+ * @param[in] max_ttl		Maximum time to use a response for.  0 means
+ *				responses are used until their nextUpdate time.
+ * @return
+ *	- A new cache on success.
+ *	- NULL on failure.
+ */
+fr_tls_ocsp_cache_t *tls_ocsp_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t max_ttl)
+{
+	fr_tls_ocsp_cache_t	*cache;
+	int			ret;
+
+	cache = talloc_zero(ctx, fr_tls_ocsp_cache_t);
+	if (!cache) return NULL;
+
+	ret = pthread_mutex_init(&cache->mutex, NULL);
+	if (ret != 0) {
+		fr_strerror_printf("Failed initialising mutex: %s", fr_syserror(ret));
+		talloc_free(cache);
+		return NULL;
+	}
+	talloc_set_destructor(cache, _ocsp_cache_free);
+
+	cache->tree = rbtree_talloc_create(cache, ocsp_cache_entry_cmp, ocsp_cache_entry_t, NULL, 0);
+	if (!cache->tree) {
+		talloc_free(cache);
+		return NULL;
+	}
+	fr_dlist_talloc_init(&cache->lru, ocsp_cache_entry_t, entry);
+
+	cache->max_entries = max_entries;
+	cache->max_ttl = max_ttl;
+
+	return cache;
+}
+
+static int _ocsp_free(tls_ocsp_t *ocsp)
+{
+	if (ocsp->fd >= 0) (void) fr_event_fd_delete(ocsp->el, ocsp->fd, FR_EVENT_FILTER_IO);
+	if (ocsp->ev) (void) fr_event_timer_delete(ocsp->el, &ocsp->ev);
+	if (ocsp->session && (ocsp->session->ocsp == ocsp)) ocsp->session->ocsp = NULL;
+
+#if OPENSSL_VERSION_NUMBER >= 0x1000003f
+	if (ocsp->ctx) OCSP_REQ_CTX_free(ocsp->ctx);
+#endif
+	OCSP_REQUEST_free(ocsp->req);
+	OCSP_RESPONSE_free(ocsp->resp);
+	OPENSSL_free(ocsp->host);
+	OPENSSL_free(ocsp->port);
+	OPENSSL_free(ocsp->path);
+	BIO_free_all(ocsp->conn);
+	BIO_free(ocsp->ssl_log);
+
+	return 0;
+}
+
+/** Create the OCSP request, and the key used to find cached responses
+ *
+ * @param[in] ocsp		lookup to create the request for.
+ * @param[in] issuer_cert	of the certificate being checked.
+ * @param[in] client_cert	being checked.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int ocsp_request_create(tls_ocsp_t *ocsp, X509 *issuer_cert, X509 *client_cert)
+{
+	REQUEST	*request = ocsp->request;
+	uint8_t	*p;
+	int	len;
+
+	ocsp->certid = OCSP_cert_to_id(NULL, client_cert, issuer_cert);
+	if (!ocsp->certid) {
+		REDEBUG("Failed creating OCSP certificate ID");
+		return -1;
+	}
+
+	ocsp->req = OCSP_REQUEST_new();
+	if (!ocsp->req || !OCSP_request_add0_id(ocsp->req, ocsp->certid)) {
+		OCSP_CERTID_free(ocsp->certid);
+		ocsp->certid = NULL;
+		REDEBUG("Failed creating OCSP request");
+		return -1;
+	}
+	if (ocsp->conf->use_nonce) OCSP_request_add1_nonce(ocsp->req, NULL, 8);
+
+	len = i2d_OCSP_CERTID(ocsp->certid, NULL);
+	if (len <= 0) {
+		REDEBUG("Failed serialising OCSP certificate ID");
+		return -1;
+	}
+	MEM(p = ocsp->key = talloc_array(ocsp, uint8_t, len));
+	ocsp->key_len = i2d_OCSP_CERTID(ocsp->certid, &p);
+
+	return 0;
+}
+
+/** Determine which responder to send the request to
+ *
+ * @param[in] ocsp		lookup to find a responder for.
+ * @param[in] client_cert	being checked.
+ * @return
+ *	- 0 if a responder was found.
+ *	- -1 if there's no usable responder URL.
+ */
+static int ocsp_responder_url(tls_ocsp_t *ocsp, X509 *client_cert)
+{
+	REQUEST			*request = ocsp->request;
+	fr_tls_ocsp_conf_t	*conf = ocsp->conf;
+	int			use_ssl = -1;
+
+	/* Get OCSP responder URL */
+	if (conf->override_url) {
+		char *url;
+
+	use_url:
+		memcpy(&url, &conf->url, sizeof(url));
+		/* Reading the libssl src, they do a strdup on the URL, so it could of been const *sigh* */
+		OCSP_parse_url(url, &ocsp->host, &ocsp->port, &ocsp->path, &use_ssl);
+		if (!ocsp->host || !ocsp->port || !ocsp->path) {
+			RWDEBUG("Host or port or path missing from configured URL \"%s\".  Not doing OCSP", url);
+			return -1;
+		}
+
+		return 0;
+	}
+
+	switch (ocsp_cert_url_parse(client_cert, &ocsp->host, &ocsp->port, &ocsp->path, &use_ssl)) {
+	case -1:
+		RWDEBUG("Invalid URL in certificate.  Not doing OCSP");
+		return -1;
+
+	case 0:
+		if (conf->url) {
+			RWDEBUG("No OCSP URL in certificate, falling back to configured URL");
+			goto use_url;
+		}
+		RWDEBUG("No OCSP URL in certificate.  Not doing OCSP");
+		return -1;
+
+	default:
+		rad_assert(ocsp->host && ocsp->port && ocsp->path);
+		break;
+	}
+
+	return 0;
+}
+
+/** Connect to the responder, and prepare the HTTP request
+ *
+ * @param[in] ocsp	lookup to connect for.
+ * @param[in] nbio	Whether the connection should be non-blocking.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int ocsp_connect(tls_ocsp_t *ocsp, bool nbio)
+{
+	REQUEST		*request = ocsp->request;
+	char		host_header[1024];
+#if OPENSSL_VERSION_NUMBER >= 0x1000003f
+	int		rc;
+#endif
+
+	RDEBUG2("Using responder URL \"http://%s:%s%s\"", ocsp->host, ocsp->port, ocsp->path);
+
+	/* Check host and port length are sane, then create Host: HTTP header */
+	if ((strlen(ocsp->host) + strlen(ocsp->port) + 2) > sizeof(host_header)) {
+		RWDEBUG("Host and port too long");
+		return -1;
+	}
+	snprintf(host_header, sizeof(host_header), "%s:%s", ocsp->host, ocsp->port);
+
+	/* Setup BIO socket to OCSP responder */
+	ocsp->conn = BIO_new_connect(ocsp->host);
+	BIO_set_conn_port(ocsp->conn, ocsp->port);
+
+#if OPENSSL_VERSION_NUMBER < 0x1000003f
+	BIO_do_connect(ocsp->conn);
+#else
+	if (nbio) BIO_set_nbio(ocsp->conn, 1);
+
+	rc = BIO_do_connect(ocsp->conn);
+	if ((rc <= 0) && (!nbio || !BIO_should_retry(ocsp->conn))) {
+		REDEBUG("Couldn't connect to OCSP responder");
+		return -1;
+	}
+
+	ocsp->ctx = OCSP_sendreq_new(ocsp->conn, ocsp->path, NULL, -1);
+	if (!ocsp->ctx) {
+		REDEBUG("Couldn't create OCSP request");
+		return -1;
+	}
+
+	if (!OCSP_REQ_CTX_add1_header(ocsp->ctx, "Host", host_header)) {
+		REDEBUG("Couldn't set Host header");
+		return -1;
+	}
+
+	if (!OCSP_REQ_CTX_set1_req(ocsp->ctx, ocsp->req)) {
+		REDEBUG("Couldn't add data to OCSP request");
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+/** Send the OCSP request and wait for the response
+ *
+ * Used where the caller can't wait for a deferred exchange.  If a timeout
+ * is configured, we sleep until the socket is ready, or the timeout is hit.
+ *
+ * @param[in] ocsp	lookup to perform the exchange for.
+ * @return
+ *	- 0 if a response was received.
+ *	- -1 on failure or timeout.
+ */
+static int ocsp_exchange(tls_ocsp_t *ocsp)
+{
+	REQUEST			*request = ocsp->request;
+#if OPENSSL_VERSION_NUMBER < 0x1000003f
+	/* Send OCSP request and wait for response */
+	ocsp->resp = OCSP_sendreq_bio(ocsp->conn, ocsp->path, ocsp->req);
+	if (!ocsp->resp) {
+		REDEBUG("Couldn't get OCSP response");
+		return -1;
+	}
+#else
+	struct timeval		when, now, left;
+	struct pollfd		pfd;
+	int			rc, wait = -1;
+
+	gettimeofday(&when, NULL);
+	when.tv_sec += ocsp->conf->timeout;
+
+	while (((rc = OCSP_sendreq_nbio(&ocsp->resp, ocsp->ctx)) == -1) && BIO_should_retry(ocsp->conn)) {
+		if (ocsp->conf->timeout) {
+			gettimeofday(&now, NULL);
+			if (fr_timeval_cmp(&now, &when) >= 0) {
+				REDEBUG("Response timed out");
+				return -1;
+			}
+			fr_timeval_subtract(&left, &when, &now);
+			wait = (left.tv_sec * 1000) + ((left.tv_usec + 999) / 1000);
+		}
+
+		/*
+		 *	Sleep until the responder's socket is ready,
+		 *	instead of spinning on the non-blocking BIO.
+		 */
+		pfd.fd = BIO_get_fd(ocsp->conn, NULL);
+		pfd.events = BIO_should_read(ocsp->conn) ? POLLIN : POLLOUT;
+		pfd.revents = 0;
+		(void) poll(&pfd, 1, wait);
+	}
+
+	if (rc == 0) {
+		REDEBUG("Couldn't get OCSP response");
+		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ocsp->ssl_log);
+		return -1;
+	}
+#endif
+
+	return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x1000003f
+/** Mark a deferred exchange as finished, and resume the request
+ *
+ */
+static void ocsp_async_done(tls_ocsp_t *ocsp, bool failed)
+{
+	if (ocsp->fd >= 0) {
+		(void) fr_event_fd_delete(ocsp->el, ocsp->fd, FR_EVENT_FILTER_IO);
+		ocsp->fd = -1;
+	}
+	(void) fr_event_timer_delete(ocsp->el, &ocsp->ev);
+
+	ocsp->done = true;
+	ocsp->failed = failed;
+
+	unlang_resumable(ocsp->request);
+}
+
+static void ocsp_async_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	tls_ocsp_t	*ocsp = talloc_get_type_abort(uctx, tls_ocsp_t);
+	REQUEST		*request = ocsp->request;
+
+	REDEBUG("Connection to OCSP responder failed: %s", fr_syserror(fd_errno));
+
+	ocsp_async_done(ocsp, true);
+}
+
+static void ocsp_async_timeout(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	tls_ocsp_t	*ocsp = talloc_get_type_abort(uctx, tls_ocsp_t);
+	REQUEST		*request = ocsp->request;
+
+	REDEBUG("Response timed out");
+
+	ocsp_async_done(ocsp, true);
+}
+
+/** Continue the exchange when the responder's socket is ready
+ *
+ */
+static void ocsp_async_io(fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	tls_ocsp_t	*ocsp = talloc_get_type_abort(uctx, tls_ocsp_t);
+	REQUEST		*request = ocsp->request;
+	bool		want_read;
+	int		rc;
+
+	rc = OCSP_sendreq_nbio(&ocsp->resp, ocsp->ctx);
+	if ((rc == -1) && BIO_should_retry(ocsp->conn)) {
+		/*
+		 *	Only ask to be told the socket is writable
+		 *	whilst we're still sending the request,
+		 *	otherwise we'd be called continuously.
+		 */
+		want_read = BIO_should_read(ocsp->conn);
+		if (fr_event_fd_insert(ocsp, el, fd,
+				       want_read ? ocsp_async_io : NULL,
+				       want_read ? NULL : ocsp_async_io,
+				       ocsp_async_error, ocsp) == 0) return;
+
+		RPEDEBUG("Failed updating OCSP responder socket events");
+		rc = 0;
+	}
+
+	if (rc != 1) {
+		REDEBUG("Couldn't get OCSP response");
+		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ocsp->ssl_log);
+	}
+
+	ocsp_async_done(ocsp, (rc != 1));
+}
+
+/** Run the exchange with the responder in the request's event list
+ *
+ * @param[in] ocsp	lookup to defer.
+ * @param[in] session	to record the deferred lookup in.
+ * @return
+ *	- 0 if the exchange was started.
+ *	- -1 if the exchange must be performed synchronously.
+ */
+static int ocsp_async_start(tls_ocsp_t *ocsp, tls_session_t *session)
+{
+	REQUEST		*request = ocsp->request;
+	struct timeval	when;
+
+	ocsp->fd = BIO_get_fd(ocsp->conn, NULL);
+	if (ocsp->fd < 0) return -1;
+
+	ocsp->el = request->el;
+	if (fr_event_fd_insert(ocsp, ocsp->el, ocsp->fd, NULL, ocsp_async_io, ocsp_async_error, ocsp) < 0) {
+		RPWDEBUG("Failed inserting OCSP responder socket into event list");
+		ocsp->fd = -1;
+		return -1;
+	}
+
+	if (ocsp->conf->timeout) {
+		gettimeofday(&when, NULL);
+		when.tv_sec += ocsp->conf->timeout;
+
+		if (fr_event_timer_insert(ocsp, ocsp->el, &ocsp->ev, &when, ocsp_async_timeout, ocsp) < 0) {
+			RPWDEBUG("Failed inserting OCSP timeout");
+			(void) fr_event_fd_delete(ocsp->el, ocsp->fd, FR_EVENT_FILTER_IO);
+			ocsp->fd = -1;
+			return -1;
+		}
+	}
+
+	ocsp->session = session;
+	session->ocsp = ocsp;
+
+	return 0;
+}
+#endif
+
+/** Verify the responder's response, and determine the status of the certificate
+ *
+ * Verified responses are added to the response cache.
+ *
+ * @param[in] ocsp	lookup to check the response of.
+ * @return the status of the certificate.
+ */
+static ocsp_status_t ocsp_response_check(tls_ocsp_t *ocsp)
+{
+	REQUEST			*request = ocsp->request;
+	fr_tls_ocsp_conf_t	*conf = ocsp->conf;
+	BIO			*ssl_log = ocsp->ssl_log;
+	OCSP_BASICRESP		*bresp = NULL;
+	ocsp_status_t		ocsp_status = OCSP_STATUS_FAILED;
+	int			status;
+	long			this_fudge = OCSP_MAX_VALIDITY_PERIOD, this_max_age = -1;
+	ASN1_GENERALIZEDTIME	*rev, *this_update, *next_update;
+	int			reason;
+	time_t			now, next = 0;
+
+	/* Verify OCSP response status */
+	status = OCSP_response_status(ocsp->resp);
+	if (status != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+		REDEBUG("Response status: %s", OCSP_response_status_str(status));
+		goto finish;
+	}
+	bresp = OCSP_response_get1_basic(ocsp->resp);
+	if (conf->use_nonce && OCSP_check_nonce(ocsp->req, bresp) != 1) {
+		REDEBUG("Response has wrong nonce value");
+		goto finish;
+	}
+	if (OCSP_basic_verify(bresp, NULL, ocsp->store, 0) != 1){
+		REDEBUG("Couldn't verify OCSP basic response");
+		goto finish;
+	}
+
+	/*	Verify OCSP cert status */
+	if (!OCSP_resp_find_status(bresp, ocsp->certid, &status, &reason, &rev, &this_update, &next_update)) {
+		REDEBUG("No Status found");
+		goto finish;
+	}
+
+	/*
+	 *	Here we check the fields 'thisUpdate' and 'nextUpdate'
+	 *	from the OCSP response against the server's time.
+	 *
+	 *	this_fudge is the number of seconds +- between the current
+	 *	time and this_update.
+	 *
+	 *	The default for this_fudge is 300, defined by OCSP_MAX_VALIDITY_PERIOD.
+	 */
+	if (!OCSP_check_validity(this_update, next_update, this_fudge, this_max_age)) {
+		/*
+		 *	We want this to show up in the global log
+		 *	so someone will fix it...
+		 */
+		RATE_LIMIT(RERROR("Delta +/- between OCSP response time and our time is greater than %li "
+				  "seconds.  Check servers are synchronised to a common time source",
+				  this_fudge));
+		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
+		goto finish;
+	}
+
+	/*
+	 *	Print any messages we may have accumulated
+	 */
+	SSL_DRAIN_ERROR_QUEUE(RDEBUG2, "", ssl_log);
+	if (RDEBUG_ENABLED) {
+		RDEBUG2("OCSP response valid from:");
+		ASN1_GENERALIZEDTIME_print(ssl_log, this_update);
+		RINDENT();
+		SSL_DRAIN_LOG_QUEUE(RDEBUG2, "", ssl_log);
+		REXDENT();
+
+		if (next_update) {
+			RDEBUG2("New information available at:");
+			ASN1_GENERALIZEDTIME_print(ssl_log, next_update);
+			RINDENT();
+			SSL_DRAIN_LOG_QUEUE(RDEBUG2, "", ssl_log);
+			REXDENT();
+		}
+	}
+
+	/*
+	 *	When an OCSP validation command is used with OpenSSL
+	 *	next_update is NULL.
+	 */
+	now = time(NULL);
+	if (next_update) {
+		if (tls_utils_asn1time_to_epoch(&next, next_update) < 0) {
+			RPEDEBUG("Failed parsing next_update time");
+			ocsp_status = OCSP_STATUS_SKIPPED;
+			goto finish;
+		}
+		if (now < next) {
+			ocsp_next_update_to_pair(request, next, now);
+		} else {
+			RDEBUG2("Update time is in the past.  Not adding &TLS-OCSP-Next-Update");
+			next = 0;
+		}
+	} else {
+		RDEBUG2("Update time not provided.  Not adding &TLS-OCSP-Next-Update");
+	}
+
+	switch (status) {
+	case V_OCSP_CERTSTATUS_GOOD:
+		RDEBUG2("Cert status: good");
+		ocsp_status = OCSP_STATUS_OK;
+		break;
+
+	default:
+		/* REVOKED / UNKNOWN */
+		REDEBUG("Cert status: %s", OCSP_cert_status_str(status));
+		if (reason != -1) REDEBUG("Reason: %s", OCSP_crl_reason_str(reason));
+
+		/*
+		 *	Print any messages we may have accumulated
+		 */
+		SSL_DRAIN_LOG_QUEUE(RDEBUG, "", ssl_log);
+		if (RDEBUG_ENABLED2) {
+			RDEBUG2("Revocation time:");
+			ASN1_GENERALIZEDTIME_print(ssl_log, rev);
+			RINDENT();
+			SSL_DRAIN_LOG_QUEUE(RDEBUG2, "", ssl_log);
+			REXDENT();
+		}
+		break;
+	}
+
+	/*
+	 *	Responses without a nextUpdate time mean newer
+	 *	information is always available, so they're not
+	 *	cached.
+	 */
+	if (conf->response_cache && next) {
+		RDEBUG2("Caching OCSP response");
+		ocsp_cache_insert(conf->response_cache, ocsp->key, ocsp->key_len, ocsp_status, ocsp->resp, next, now);
+	}
+
+finish:
+	OCSP_BASICRESP_free(bresp);
+
+	return ocsp_status;
+}
+
+/** Record the result of an OCSP lookup, and free the lookup state
+ *
+ * @param[in] ocsp	lookup to finish.
+ * @param[in] status	of the certificate.
+ * @return
+ *	- 0 if the certificate should be rejected.
+ *	- 1 if the certificate is valid (or the check was skipped, and softfail is enabled).
+ *	- 2 if the check was skipped.
+ *	- -1 if setting the stapled response failed.
+ */
+static int ocsp_finish(tls_ocsp_t *ocsp, ocsp_status_t ocsp_status)
+{
+	REQUEST			*request = ocsp->request;
+	fr_tls_ocsp_conf_t	*conf = ocsp->conf;
+	BIO			*ssl_log = ocsp->ssl_log;
+	VALUE_PAIR		*vp;
+	int			ret;
+
+	switch (ocsp_status) {
+	case OCSP_STATUS_OK:
+		RDEBUG2("Certificate is valid");
+
+		if (ocsp->staple_response) {
+			/*
+			 *	Convert the OCSP response to a VALUE_PAIR
+			 *	and add it to the current request.
+			 */
+			if (ocsp_staple_to_pair(&vp, request, ocsp->resp) < 0) goto skipped;
+
+			/*
+			 *	Set the stapled response for the current
+			 *	SSL session.
+			 */
+			if (ocsp_staple_from_pair(request, ocsp->ssl, vp) < 0) {
+				talloc_free(ocsp);
+				return -1;
+			}
+			vp = NULL;	/* It's in the request, don't need to free it! */
+		}
+
+		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
+		vp->vp_uint32 = 1;	/* yes */
+		ocsp_status = OCSP_STATUS_OK;
+
+		break;
+
+	case OCSP_STATUS_SKIPPED:
+	skipped:
+		SSL_DRAIN_ERROR_QUEUE(RWDEBUG, "", ssl_log);
+		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
+		vp->vp_uint32 = 2;	/* skipped */
+		if (conf->softfail) {
+			RWDEBUG("Unable to check certificate: %s",
+				ocsp->staple_response ?
+					"Cannot provide TLS client with stapled OCSP response":
+					"TLS clients presenting revoked certificates may be granted access");
+
+			ocsp_status = OCSP_STATUS_OK;
+
+			/* Remove OpenSSL errors from queue or handshake will fail */
+			while (ERR_get_error());	/* Not always debugging */
+		} else {
+			REDEBUG("Unable to check certificate, failing");
+			ocsp_status = OCSP_STATUS_FAILED;
+		}
+		break;
+
+	default:
+		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
+		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
+		vp->vp_uint32 = 0;	/* no */
+		REDEBUG("Failed to validate certificate");
+		break;
+	}
+
+	if (conf->cache_server) switch (tls_cache_process(request, conf->cache.store)) {
+	case RLM_MODULE_OK:
+	case RLM_MODULE_UPDATED:
+		break;
 
-	*out = vp;
+	default:
+		RWDEBUG("Failed writing cached OCSP status");
+		break;
+	}
 
-	return 0;
+	ret = ocsp_status;
+	talloc_free(ocsp);
+
+	return ret;
 }
 
 /** Callback used to get stapling data for the current server cert
@@ -243,33 +1115,21 @@ int tls_ocsp_staple_cb(SSL *ssl, void *data)
 
 /** Sends a OCSP request to a defined OCSP responder
  *
+ * Responses are first looked for in the response cache.  If the certificate
+ * was presented in a #tls_session_t with ocsp_async set, and a responder
+ * needs to be contacted, the exchange is run in the request's event list.
+ * The check then provisionally succeeds, and the caller must yield until
+ * #tls_ocsp_async_result returns the real result.
  */
 int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		   X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
 		   fr_tls_ocsp_conf_t *conf, bool staple_response)
 {
-	OCSP_CERTID	*certid;
-	OCSP_REQUEST	*req = NULL;
-	OCSP_RESPONSE	*resp = NULL;
-	OCSP_BASICRESP	*bresp = NULL;
-	char		*host = NULL;
-	char		*port = NULL;
-	char		*path = NULL;
-	char		host_header[1024];
-	int		use_ssl = -1;
-	long		this_fudge = OCSP_MAX_VALIDITY_PERIOD, this_max_age = -1;
-	BIO		*conn = NULL, *ssl_log = NULL;
-	ocsp_status_t   ocsp_status = OCSP_STATUS_FAILED;
+	tls_ocsp_t	*ocsp;
+	tls_session_t	*session;
 	ocsp_status_t	status;
-	ASN1_GENERALIZEDTIME *rev, *this_update, *next_update;
-	int		reason;
-#if OPENSSL_VERSION_NUMBER >= 0x1000003f
-	OCSP_REQ_CTX	*ctx;
-	int		rc;
-	struct timeval	when;
-#endif
-	struct timeval	now = { 0, 0 };
-	time_t		next;
+	time_t		now, next_update;
+	bool		defer = false;
 	VALUE_PAIR	*vp;
 
 	if (conf->cache_server) switch (tls_cache_process(request, conf->cache.load)) {
@@ -331,341 +1191,121 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		break;
 	}
 
+	MEM(ocsp = talloc_zero(request, tls_ocsp_t));
+	ocsp->request = request;
+	ocsp->ssl = ssl;
+	ocsp->conf = conf;
+	ocsp->store = store;
+	ocsp->staple_response = staple_response;
+	ocsp->fd = -1;
+	talloc_set_destructor(ocsp, _ocsp_free);
+
 	if (issuer_cert == NULL) {
 		RWDEBUG("Could not get issuer certificate");
-		goto skipped;
+		return ocsp_finish(ocsp, OCSP_STATUS_SKIPPED);
 	}
 
 	/*
 	 *	Setup logging for this OCSP operation
 	 */
-	ssl_log = BIO_new(BIO_s_mem());
-	if (!ssl_log) {
+	ocsp->ssl_log = BIO_new(BIO_s_mem());
+	if (!ocsp->ssl_log) {
 		REDEBUG("Failed creating log queue");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
+		return ocsp_finish(ocsp, OCSP_STATUS_SKIPPED);
 	}
 
 	/*
 	 *	Create OCSP Request
 	 */
-	certid = OCSP_cert_to_id(NULL, client_cert, issuer_cert);
-	req = OCSP_REQUEST_new();
-	OCSP_request_add0_id(req, certid);
-	if (conf->use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
+	if (ocsp_request_create(ocsp, issuer_cert, client_cert) < 0) return ocsp_finish(ocsp, OCSP_STATUS_SKIPPED);
 
 	/*
-	 *	Send OCSP Request and get OCSP Response
+	 *	A previous lookup for the same certificate may have
+	 *	given us a response that's still valid.
 	 */
-
-	/* Get OCSP responder URL */
-	if (conf->override_url) {
-		char *url;
-
-	use_url:
-		memcpy(&url, &conf->url, sizeof(url));
-		/* Reading the libssl src, they do a strdup on the URL, so it could of been const *sigh* */
-		OCSP_parse_url(url, &host, &port, &path, &use_ssl);
-		if (!host || !port || !path) {
-			RWDEBUG("Host or port or path missing from configured URL \"%s\".  Not doing OCSP", url);
-			goto skipped;
-		}
-	} else {
-		int ret;
-
-		ret = ocsp_cert_url_parse(client_cert, &host, &port, &path, &use_ssl);
-		switch (ret) {
-		case -1:
-			RWDEBUG("Invalid URL in certificate.  Not doing OCSP");
-			break;
-
-		case 0:
-			if (conf->url) {
-				RWDEBUG("No OCSP URL in certificate, falling back to configured URL");
-				goto use_url;
-			}
-			RWDEBUG("No OCSP URL in certificate.  Not doing OCSP");
-			goto skipped;
-
-		case 1:
-			rad_assert(host && port && path);
-			break;
-		}
-	}
-
-	RDEBUG2("Using responder URL \"http://%s:%s%s\"", host, port, path);
-
-	/* Check host and port length are sane, then create Host: HTTP header */
-	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
-		RWDEBUG("Host and port too long");
-		goto skipped;
-	}
-	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
-
-	/* Setup BIO socket to OCSP responder */
-	conn = BIO_new_connect(host);
-	BIO_set_conn_port(conn, port);
-
-#if OPENSSL_VERSION_NUMBER < 0x1000003f
-	BIO_do_connect(conn);
-
-	/* Send OCSP request and wait for response */
-	resp = OCSP_sendreq_bio(conn, path, req);
-	if (!resp) {
-		REDEBUG("Couldn't get OCSP response");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-#else
-	if (conf->timeout) BIO_set_nbio(conn, 1);
-
-	rc = BIO_do_connect(conn);
-	if ((rc <= 0) && ((!conf->timeout) || !BIO_should_retry(conn))) {
-		REDEBUG("Couldn't connect to OCSP responder");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	ctx = OCSP_sendreq_new(conn, path, NULL, -1);
-	if (!ctx) {
-		REDEBUG("Couldn't create OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	if (!OCSP_REQ_CTX_add1_header(ctx, "Host", host_header)) {
-		REDEBUG("Couldn't set Host header");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	if (!OCSP_REQ_CTX_set1_req(ctx, req)) {
-		REDEBUG("Couldn't add data to OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	gettimeofday(&when, NULL);
-	when.tv_sec += conf->timeout;
-
-	do {
-		rc = OCSP_sendreq_nbio(&resp, ctx);
-		if (conf->timeout) {
-			gettimeofday(&now, NULL);
-			if (fr_timeval_cmp(&now, &when) >= 0) break;
+	now = time(NULL);
+	if (conf->response_cache &&
+	    ocsp_cache_find(&status, &next_update, staple_response ? &ocsp->resp : NULL,
+			    conf->response_cache, ocsp->key, ocsp->key_len, now)) {
+		RDEBUG2("Found cached OCSP response");
+		if (status == OCSP_STATUS_OK) {
+			RDEBUG2("Cert status: good");
+		} else {
+			REDEBUG("Cert status: revoked or unknown");
 		}
-	} while ((rc == -1) && BIO_should_retry(conn));
-
-	if (conf->timeout && (rc == -1) && BIO_should_retry(conn)) {
-		REDEBUG("Response timed out");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	OCSP_REQ_CTX_free(ctx);
-
-	if (rc == 0) {
-		REDEBUG("Couldn't get OCSP response");
-		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-#endif /* OPENSSL_VERSION_NUMBER < 0x1000003f */
-
-	/* Verify OCSP response status */
-	status = OCSP_response_status(resp);
-	if (status != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
-		REDEBUG("Response status: %s", OCSP_response_status_str(status));
-		goto finish;
-	}
-	bresp = OCSP_response_get1_basic(resp);
-	if (conf->use_nonce && OCSP_check_nonce(req, bresp) != 1) {
-		REDEBUG("Response has wrong nonce value");
-		goto finish;
-	}
-	if (OCSP_basic_verify(bresp, NULL, store, 0) != 1){
-		REDEBUG("Couldn't verify OCSP basic response");
-		goto finish;
-	}
-
-	/*	Verify OCSP cert status */
-	if (!OCSP_resp_find_status(bresp, certid, (int *)&status, &reason, &rev, &this_update, &next_update)) {
-		REDEBUG("No Status found");
-		goto finish;
-	}
+		ocsp_next_update_to_pair(request, next_update, now);
 
-	/*
-	 *	Here we check the fields 'thisUpdate' and 'nextUpdate'
-	 *	from the OCSP response against the server's time.
-	 *
-	 *	this_fudge is the number of seconds +- between the current
-	 *	time and this_update.
-	 *
-	 *	The default for this_fudge is 300, defined by OCSP_MAX_VALIDITY_PERIOD.
-	 */
-	if (!OCSP_check_validity(this_update, next_update, this_fudge, this_max_age)) {
-		/*
-		 *	We want this to show up in the global log
-		 *	so someone will fix it...
-		 */
-		RATE_LIMIT(RERROR("Delta +/- between OCSP response time and our time is greater than %li "
-				  "seconds.  Check servers are synchronised to a common time source",
-				  this_fudge));
-		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
-		goto finish;
+		return ocsp_finish(ocsp, status);
 	}
 
 	/*
-	 *	Print any messages we may have accumulated
+	 *	Send OCSP Request and get OCSP Response
 	 */
-	SSL_DRAIN_ERROR_QUEUE(RDEBUG2, "", ssl_log);
-	if (RDEBUG_ENABLED) {
-		RDEBUG2("OCSP response valid from:");
-		ASN1_GENERALIZEDTIME_print(ssl_log, this_update);
-		RINDENT();
-		SSL_DRAIN_LOG_QUEUE(RDEBUG2, "", ssl_log);
-		REXDENT();
-
-		if (next_update) {
-			RDEBUG2("New information available at:");
-			ASN1_GENERALIZEDTIME_print(ssl_log, next_update);
-			RINDENT();
-			SSL_DRAIN_LOG_QUEUE(RDEBUG2, "", ssl_log);
-			REXDENT();
-		}
-	}
+	if (ocsp_responder_url(ocsp, client_cert) < 0) return ocsp_finish(ocsp, OCSP_STATUS_SKIPPED);
 
 	/*
-	 *	When an OCSP validation command is used with OpenSSL
-	 *	next_update is NULL.
+	 *	If the caller can yield, the exchange with the responder
+	 *	is run in the request's event list.  A stapled response
+	 *	has to be provided from inside an OpenSSL callback, so
+	 *	those lookups are always synchronous.
 	 */
-	if (next_update) {
-		/*
-		 *	Sometimes we already know what 'now' is depending
-		 *	on the code path, other times we don't.
-		 */
-		if (now.tv_sec == 0) gettimeofday(&now, NULL);
-		if (tls_utils_asn1time_to_epoch(&next, next_update) < 0) {
-			RPEDEBUG("Failed parsing next_update time");
-			ocsp_status = OCSP_STATUS_SKIPPED;
-			goto finish;
-		}
-		if (now.tv_sec < next){
-			RDEBUG2("Adding OCSP TTL attribute");
-
-			MEM(pair_update_request(&vp, attr_tls_ocsp_next_update) >= 0);
-			vp->vp_uint32 = next - now.tv_sec;
-			RINDENT();
-			RDEBUG2("&%pP", vp);
-			REXDENT();
-		} else {
-			RDEBUG2("Update time is in the past.  Not adding &TLS-OCSP-Next-Update");
-		}
-	} else {
-		RDEBUG2("Update time not provided.  Not adding &TLS-OCSP-Next-Update");
-	}
-
-	switch (status) {
-	case V_OCSP_CERTSTATUS_GOOD:
-		RDEBUG2("Cert status: good");
-		ocsp_status = OCSP_STATUS_OK;
-		break;
+#if OPENSSL_VERSION_NUMBER >= 0x1000003f
+	session = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_TLS_SESSION);
+	defer = !staple_response && session && session->ocsp_async && !session->ocsp && request->el;
+#else
+	session = NULL;
+#endif
 
-	default:
-		/* REVOKED / UNKNOWN */
-		REDEBUG("Cert status: %s", OCSP_cert_status_str(status));
-		if (reason != -1) REDEBUG("Reason: %s", OCSP_crl_reason_str(reason));
+	if (ocsp_connect(ocsp, (defer || conf->timeout)) < 0) return ocsp_finish(ocsp, OCSP_STATUS_SKIPPED);
 
-		/*
-		 *	Print any messages we may have accumulated
-		 */
-		SSL_DRAIN_LOG_QUEUE(RDEBUG, "", ssl_log);
-		if (RDEBUG_ENABLED2) {
-			RDEBUG2("Revocation time:");
-			ASN1_GENERALIZEDTIME_print(ssl_log, rev);
-			RINDENT();
-			SSL_DRAIN_LOG_QUEUE(RDEBUG2, "", ssl_log);
-			REXDENT();
-		}
-		break;
+#if OPENSSL_VERSION_NUMBER >= 0x1000003f
+	if (defer && (ocsp_async_start(ocsp, session) == 0)) {
+		RDEBUG2("Waiting for OCSP response in the background");
+		return OCSP_STATUS_OK;
 	}
+#endif
 
-finish:
-	switch (ocsp_status) {
-	case OCSP_STATUS_OK:
-		RDEBUG2("Certificate is valid");
-
-		if (staple_response) {
-			/*
-			 *	Convert the OCSP response to a VALUE_PAIR
-			 *	and add it to the current request.
-			 */
-			if (ocsp_staple_to_pair(&vp, request, resp) < 0) goto skipped;
-
-			/*
-			 *	Set the stapled response for the current
-			 *	SSL session.
-			 */
-			if (ocsp_staple_from_pair(request, ssl, vp) < 0) return -1;
-			vp = NULL;	/* It's in the request, don't need to free it! */
-		}
-
-		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
-		vp->vp_uint32 = 1;	/* yes */
-		ocsp_status = OCSP_STATUS_OK;
-
-		break;
-
-	case OCSP_STATUS_SKIPPED:
-	skipped:
-		SSL_DRAIN_ERROR_QUEUE(RWDEBUG, "", ssl_log);
-		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
-		vp->vp_uint32 = 2;	/* skipped */
-		if (conf->softfail) {
-			RWDEBUG("Unable to check certificate: %s",
-				staple_response ?
-					"Cannot provide TLS client with stapled OCSP response":
-					"TLS clients presenting revoked certificates may be granted access");
+	if (ocsp_exchange(ocsp) < 0) return ocsp_finish(ocsp, OCSP_STATUS_SKIPPED);
 
-			ocsp_status = OCSP_STATUS_OK;
+	return ocsp_finish(ocsp, ocsp_response_check(ocsp));
+}
 
-			/* Remove OpenSSL errors from queue or handshake will fail */
-			while (ERR_get_error());	/* Not always debugging */
-		} else {
-			REDEBUG("Unable to check certificate, failing");
-			ocsp_status = OCSP_STATUS_FAILED;
-		}
-		break;
+/** Get the result of a deferred OCSP lookup
+ *
+ * Should be called after the request has been resumed.  If the exchange
+ * with the responder has finished, the response is checked, and the lookup
+ * is completed in the same way as if it had been run synchronously.
+ *
+ * @param[in] request	The current request.
+ * @param[in] session	the lookup was deferred in.
+ * @return
+ *	- -1 if the exchange with the responder hasn't finished.
+ *	- 0 if the certificate should be rejected.
+ *	- 1 if the certificate is valid (or the check was skipped, and softfail is enabled).
+ */
+int tls_ocsp_async_result(REQUEST *request, tls_session_t *session)
+{
+	tls_ocsp_t	*ocsp = session->ocsp;
+	int		ret;
 
-	default:
-		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
-		MEM(pair_update_request(&vp, attr_tls_ocsp_cert_valid) >= 0);
-		vp->vp_uint32 = 0;	/* no */
-		REDEBUG("Failed to validate certificate");
-		break;
-	}
+	if (!ocsp) return OCSP_STATUS_OK;
+	if (!ocsp->done) return -1;
 
-	if (conf->cache_server) switch (tls_cache_process(request, conf->cache.store)) {
-	case RLM_MODULE_OK:
-	case RLM_MODULE_UPDATED:
-		break;
+	rad_assert(ocsp->request == request);
 
-	default:
-		RWDEBUG("Failed writing cached OCSP status");
-		break;
-	}
+	session->ocsp = NULL;
+	ocsp->session = NULL;
 
-	/* Free OCSP Stuff */
-	OCSP_REQUEST_free(req);
-	OCSP_BASICRESP_free(bresp);
-	OCSP_RESPONSE_free(resp);
-	OPENSSL_free(host);
-	OPENSSL_free(port);
-	OPENSSL_free(path);
-	BIO_free_all(conn);
-	BIO_free(ssl_log);
+	RDEBUG2("Received OCSP response");
+	RINDENT();
+	ret = ocsp_finish(ocsp, ocsp->failed ? OCSP_STATUS_SKIPPED : ocsp_response_check(ocsp));
+	REXDENT();
 
-	return ocsp_status;
+	/*
+	 *	Stapling is never deferred, so there's no
+	 *	response to set.
+	 */
+	return (ret == OCSP_STATUS_OK) ? OCSP_STATUS_OK : OCSP_STATUS_FAILED;
 }
 
 #define CACHE_SECTION(_out, _verb, _name) \
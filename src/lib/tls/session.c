@@ -1252,16 +1252,31 @@ int tls_session_handshake_alert(UNUSED REQUEST *request, tls_session_t *session,
 	return 0;
 }
 
+/** Read from OpenSSL, advancing the handshake
+ *
+ * May be run on a coroutine, see #tls_async_run.
+ */
+static int session_handshake_read(tls_session_t *session)
+{
+	return SSL_read(session->ssl, session->clean_out.data + session->clean_out.used,
+			sizeof(session->clean_out.data) - session->clean_out.used);
+}
+
 /** Continue a TLS handshake
  *
  * Advance the TLS handshake by feeding OpenSSL data from dirty_in,
  * and reading data from OpenSSL into dirty_out.
  *
+ * If the session runs handshake steps asynchronously, the step may have
+ * to wait for a private key operation.  The caller must then yield the
+ * request, and call this function again when the request is resumed.
+ *
  * @param request The current request.
  * @param session The current TLS session.
  * @return
  *	- 0 on error.
  *	- 1 on success.
+ *	- 2 if the handshake step is waiting for a private key operation.
  */
 int tls_session_handshake(REQUEST *request, tls_session_t *session)
 {
@@ -1318,8 +1333,7 @@ int tls_session_handshake(REQUEST *request, tls_session_t *session)
 	 *	If acting as a server SSL_set_accept_state must have
 	 *	been called before this function.
 	 */
-	ret = SSL_read(session->ssl, session->clean_out.data + session->clean_out.used,
-		       sizeof(session->clean_out.data) - session->clean_out.used);
+	if (tls_async_run(request, session, session_handshake_read, &ret) == 0) return 2;
 	if (ret > 0) {
 		session->clean_out.used += ret;
 		return 1;
@@ -1507,6 +1521,18 @@ int tls_session_handshake(REQUEST *request, tls_session_t *session)
  */
 static int _tls_session_free(tls_session_t *session)
 {
+	/*
+	 *	An outstanding OCSP lookup references the SSL
+	 *	session, so must be cancelled first.
+	 */
+	TALLOC_FREE(session->ocsp);
+
+	/*
+	 *	As does a handshake step waiting for a
+	 *	private key operation.
+	 */
+	TALLOC_FREE(session->async);
+
 	if (session->ssl) {
 		SSL_set_quiet_shutdown(session->ssl, 1);
 		SSL_shutdown(session->ssl);
@@ -1805,6 +1831,12 @@ tls_session_t *tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *conf, REQ
 
 	if (conf->session_cache_server) session->allow_session_resumption = true; /* otherwise it's false */
 
+	/*
+	 *	Run handshake steps on a coroutine, so that
+	 *	private key operations don't block the worker.
+	 */
+	if (conf->async.enable) session->async = tls_async_alloc(session, &conf->async);
+
 	return session;
 }
 #endif /* WITH_TLS */
@@ -135,6 +135,8 @@ rlm_rcode_t	unlang_interpret_synchronous(REQUEST *request, CONF_SECTION *cs, rlm
 
 void		*unlang_stack_alloc(TALLOC_CTX *ctx);
 
+int		unlang_stack_reset(void *stack);
+
 void		unlang_op_register(int type, unlang_op_t *op);
 
 int		unlang_compile(CONF_SECTION *cs, rlm_components_t component, vp_tmpl_rules_t const *rules);
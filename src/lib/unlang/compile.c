@@ -1867,6 +1867,139 @@ static unlang_t *compile_group(unlang_t *parent, unlang_compile_t *unlang_ctx, C
 	return compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
 }
 
+/** Whether 'case' values of a given type can be matched by looking them up in a hash table
+ *
+ * i.e. whether two values of the type are equal if, and only if, their data is identical.
+ */
+static bool switch_case_indexable(fr_type_t type)
+{
+	switch (type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+	case FR_TYPE_UINT8:
+	case FR_TYPE_UINT16:
+	case FR_TYPE_UINT32:
+	case FR_TYPE_UINT64:
+	case FR_TYPE_INT8:
+	case FR_TYPE_INT16:
+	case FR_TYPE_INT32:
+	case FR_TYPE_INT64:
+	case FR_TYPE_SIZE:
+	case FR_TYPE_DATE:
+	case FR_TYPE_ETHERNET:
+	case FR_TYPE_IFID:
+	case FR_TYPE_IPV4_ADDR:
+	case FR_TYPE_IPV6_ADDR:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static uint32_t switch_case_hash(void const *data)
+{
+	fr_value_box_t const *value = ((unlang_switch_case_t const *)data)->value;
+
+	switch (value->type) {
+	case FR_TYPE_STRING:
+	case FR_TYPE_OCTETS:
+		return fr_hash(value->vb_octets, value->datum.length);
+
+	/*
+	 *	Only hash the address.  The rest of the fr_ipaddr_t
+	 *	(padding, unused bytes of the address union) isn't
+	 *	always initialised.
+	 */
+	case FR_TYPE_IPV4_ADDR:
+		return fr_hash(&value->vb_ip.addr.v4, sizeof(value->vb_ip.addr.v4));
+
+	case FR_TYPE_IPV6_ADDR:
+		return fr_hash(&value->vb_ip.addr.v6, sizeof(value->vb_ip.addr.v6));
+
+	default:
+		return fr_hash(((uint8_t const *)value) + fr_value_box_offsets[value->type],
+			       fr_value_box_field_sizes[value->type]);
+	}
+}
+
+static int switch_case_cmp(void const *one, void const *two)
+{
+	unlang_switch_case_t const *a = one, *b = two;
+
+	/*
+	 *	Compare the same fields as switch_case_hash().
+	 */
+	switch (a->value->type) {
+	case FR_TYPE_IPV4_ADDR:
+	case FR_TYPE_IPV6_ADDR:
+		if (a->value->type != b->value->type) break;
+
+		return fr_ipaddr_cmp(&a->value->vb_ip, &b->value->vb_ip);
+
+	default:
+		break;
+	}
+
+	return fr_value_box_cmp(a->value, b->value);
+}
+
+/** Build an index of the constant values of the 'case' statements of a 'switch'
+ *
+ * Switching over an attribute would otherwise mean comparing it against
+ * each 'case' value in turn.  Cases which aren't constants (attribute
+ * references, expansions) are still evaluated at run-time, in order.
+ *
+ * @param[in] g		the compiled 'switch' statement.
+ * @return
+ *	- 0 on success (including when the 'switch' can't be indexed).
+ *	- -1 on failure.
+ */
+static int compile_switch_index(unlang_group_t *g)
+{
+	unlang_t		*this;
+	unlang_group_t		*h;
+	unlang_switch_case_t	*entry;
+	int			position = 0;
+
+	if ((g->vpt->type != TMPL_TYPE_ATTR) || !switch_case_indexable(g->vpt->tmpl_da->type)) return 0;
+
+	g->cases = fr_hash_table_create(g, switch_case_hash, switch_case_cmp, NULL);
+	if (!g->cases) return -1;
+
+	for (this = g->children; this; this = this->next, position++) {
+		h = unlang_generic_to_group(this);
+
+		if (!h->vpt) {
+			g->default_case = this;
+			continue;
+		}
+
+		if ((h->vpt->type != TMPL_TYPE_DATA) || (h->vpt->tmpl_value_type != g->vpt->tmpl_da->type)) {
+			g->dynamic_cases = true;
+			continue;
+		}
+
+		MEM(entry = talloc(g, unlang_switch_case_t));
+		*entry = (unlang_switch_case_t) {
+			.value = &h->vpt->tmpl_value,
+			.instruction = this,
+			.position = position
+		};
+
+		/*
+		 *	An earlier 'case' has the same value,
+		 *	so this one can never match.
+		 */
+		if (!fr_hash_table_insert(g->cases, entry)) {
+			cf_log_warn(h->cs, "Duplicate 'case' value, this 'case' will never match");
+			talloc_free(entry);
+		}
+	}
+
+	return 0;
+}
+
 static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
 				   unlang_group_type_t group_type, unlang_group_type_t parentgroup_type, unlang_type_t mod_type)
 {
@@ -1964,7 +2097,16 @@ static unlang_t *compile_switch(unlang_t *parent, unlang_compile_t *unlang_ctx,
 		return NULL;
 	}
 
-	return compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
+	c = compile_children(g, parent, unlang_ctx, group_type, parentgroup_type);
+	if (!c) return NULL;
+
+	if (compile_switch_index(g) < 0) {
+		cf_log_err(cs, "Failed indexing 'case' statements");
+		talloc_free(g);
+		return NULL;
+	}
+
+	return c;
 }
 
 static unlang_t *compile_case(unlang_t *parent, unlang_compile_t *unlang_ctx, CONF_SECTION *cs,
@@ -846,6 +846,26 @@ void *unlang_stack_alloc(TALLOC_CTX *ctx)
 	return stack;
 }
 
+/** Reset an unlang stack so that it can be used for another request
+ *
+ * @param[in] ctx	stack to reset.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the stack still has frames on it, and must be freed instead.
+ */
+int unlang_stack_reset(void *ctx)
+{
+	unlang_stack_t *stack = ctx;
+
+	if (!stack || (stack->depth != 0)) return -1;
+
+	talloc_free_children(stack);
+	memset(stack, 0, sizeof(*stack));
+	stack->result = RLM_MODULE_UNKNOWN;
+
+	return 0;
+}
+
 /** Wrap an #fr_event_timer_t providing data needed for unlang events
  *
  */
@@ -1476,7 +1496,7 @@ rlm_rcode_t unlang_module_yield(REQUEST *request, fr_unlang_module_resume_t call
 		 *	the callbacks and context.
 		 */
 		mr->callback = (void *)callback;
-		mr->signal = (void *)signal;
+		mr->signal = (void *)cancel;
 		mr->rctx = rctx;
 
 		return RLM_MODULE_YIELD;
@@ -1458,13 +1458,33 @@ static unlang_action_t unlang_foreach(REQUEST *request,
 	return UNLANG_ACTION_PUSHED_CHILD;
 }
 
+/** Find the first constant 'case' matching any instance of the attribute being switched over
+ *
+ */
+static unlang_t *unlang_switch_find(REQUEST *request, unlang_group_t *g)
+{
+	VALUE_PAIR		*vp;
+	fr_cursor_t		cursor;
+	unlang_switch_case_t	*entry, *found = NULL;
+	int			err;
+
+	for (vp = tmpl_cursor_init(&err, &cursor, request, g->vpt);
+	     vp;
+	     vp = fr_cursor_next(&cursor)) {
+		entry = fr_hash_table_finddata(g->cases, &(unlang_switch_case_t){ .value = &vp->data });
+		if (entry && (!found || (entry->position < found->position))) found = entry;
+	}
+
+	return found ? found->instruction : NULL;
+}
+
 static unlang_action_t unlang_switch(REQUEST *request,
 				       UNUSED rlm_rcode_t *presult, UNUSED int *priority)
 {
 	unlang_stack_t		*stack = request->stack;
 	unlang_stack_frame_t	*frame = &stack->frame[stack->depth];
 	unlang_t		*instruction = frame->instruction;
-	unlang_t		*this, *found, *null_case;
+	unlang_t		*this, *found, *null_case, *indexed = NULL;
 	unlang_group_t		*g, *h;
 	fr_cond_t		cond;
 	fr_value_box_t		data;
@@ -1506,6 +1526,19 @@ static unlang_action_t unlang_switch(REQUEST *request,
 		goto do_null_case;
 	}
 
+	/*
+	 *	Look the attribute up in the index of constant
+	 *	'case' values.  If all of the cases are constant,
+	 *	there's nothing else to evaluate.
+	 */
+	if (g->cases) {
+		indexed = unlang_switch_find(request, g);
+		if (!g->dynamic_cases) {
+			found = indexed ? indexed : g->default_case;
+			goto do_null_case;
+		}
+	}
+
 	/*
 	 *	Expand the template if necessary, so that it
 	 *	is evaluated once instead of for each 'case'
@@ -1540,6 +1573,18 @@ static unlang_action_t unlang_switch(REQUEST *request,
 			continue;
 		}
 
+		/*
+		 *	Constant cases have already been looked up
+		 *	in the index.  Only the first match counts.
+		 */
+		if (g->cases && (h->vpt->type == TMPL_TYPE_DATA) &&
+		    (h->vpt->tmpl_value_type == g->vpt->tmpl_da->type)) {
+			if (this != indexed) continue;
+
+			found = this;
+			break;
+		}
+
 		/*
 		 *	If we're switching over an attribute
 		 *	AND we haven't pre-parsed the data for
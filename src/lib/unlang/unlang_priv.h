@@ -28,6 +28,7 @@
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/hash.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -155,6 +156,13 @@ typedef struct {
 					void const		*process;	//!< #UNLANG_TYPE_CALL
 					CONF_SECTION		*server_cs;	//!< #UNLANG_TYPE_CALL
 				};
+				struct {
+					fr_hash_table_t		*cases;		//!< #UNLANG_TYPE_SWITCH, constant case
+										///< values, or NULL if not indexed.
+					unlang_t		*default_case;	//!< #UNLANG_TYPE_SWITCH
+					bool			dynamic_cases;	//!< #UNLANG_TYPE_SWITCH, whether there are
+										///< cases which must be evaluated.
+				};
 			};
 		};
 		fr_cond_t		*cond;		//!< #UNLANG_TYPE_IF, #UNLANG_TYPE_ELSIF.
@@ -163,6 +171,17 @@ typedef struct {
 	};
 } unlang_group_t;
 
+/** An entry in the index of constant 'case' values of a 'switch' statement
+ *
+ */
+typedef struct {
+	fr_value_box_t const	*value;			//!< Value of the 'case' statement.
+	unlang_t		*instruction;		//!< The 'case' statement to push if the value matches.
+	int			position;		//!< Of the 'case' statement in the 'switch', so that
+							///< when several values of the attribute match, the
+							///< first 'case' wins.
+} unlang_switch_case_t;
+
 /** A call to a module method
  *
  */
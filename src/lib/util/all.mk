@@ -27,6 +27,7 @@ SOURCES		:= \
 		   misc.c \
 		   missing.c \
 		   net.c \
+		   ohash.c \
 		   packet.c \
 		   pair_cursor.c \
 		   pair.c \
@@ -46,8 +47,10 @@ SOURCES		:= \
 		   talloc.c \
 		   token.c \
 		   trie.c \
+		   twheel.c \
 		   udp.c \
 		   udpfromto.c \
+		   uring.c \
 		   value.c \
 		   version.c
 
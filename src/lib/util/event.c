@@ -18,6 +18,14 @@
  *
  * Non-thread-safe event handling specific to FreeRADIUS.
  *
+ * On Linux, libkqueue emulates kqueue on top of epoll, which adds a
+ * layer of filter bookkeeping to every kevent() call.  Where epoll is
+ * available, I/O filters are registered directly with an epoll
+ * instance, and timers use a timerfd.  User, process and vnode events
+ * stay in the kqueue, and the kqueue itself is watched by the epoll
+ * instance.  The epoll registration keeps the trigger semantics of the
+ * kevent filters it replaces (level-triggered, unless EV_CLEAR).
+ *
  * By non-thread-safe we mean multiple threads can't insert/delete
  * events concurrently into the same event list without synchronization.
  *
@@ -34,16 +42,22 @@ RCSID("$Id$")
 #include <freeradius-devel/io/time.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/event.h>
-#include <freeradius-devel/util/heap.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/rbtree.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/talloc.h>
 #include <freeradius-devel/util/token.h>
+#include <freeradius-devel/util/twheel.h>
 
 #include <sys/stat.h>
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#  define HAVE_EVENT_EPOLL 1
+#  include <sys/epoll.h>
+#  include <sys/timerfd.h>
+#endif
+
 #define FR_EV_BATCH_FDS (256)
 
 #undef USEC
@@ -90,7 +104,7 @@ struct fr_event_timer {
 	TALLOC_CTX		*linked_ctx;		//!< talloc ctx this event was bound to.
 
 	fr_event_timer_t const	**parent;		//!< Previous timer.
-	int32_t			heap_id;	       	//!< Where to store opaque heap data.
+	fr_twheel_entry_t	tw_entry;		//!< Where to store timer wheel data.
 };
 
 typedef enum {
@@ -252,6 +266,11 @@ struct fr_event_fd {
 							///< kevent.  Mostly for debugging.
 	bool			in_fd_to_free;		//!< Whether this event is in the fd_to_free list.
 
+#ifdef HAVE_EVENT_EPOLL
+	bool			is_epoll;		//!< Filters are registered with el->epfd, not el->kq.
+	uint32_t		epoll_events;		//!< Events currently registered with epoll.
+#endif
+
 	void			*uctx;			//!< Context pointer to pass to each file descriptor callback.
 	TALLOC_CTX		*linked_ctx;		//!< talloc ctx this event was bound to.
 
@@ -298,7 +317,7 @@ typedef struct {
  *
  */
 struct fr_event_list {
-	fr_heap_t		*times;			//!< of timer events to be executed.
+	fr_twheel_t		*times;			//!< of timer events to be executed.
 	rbtree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 
 	int			exit;			//!< If non-zero, the event loop will exit after its current
@@ -318,26 +337,42 @@ struct fr_event_list {
 
 	struct kevent		events[FR_EV_BATCH_FDS]; /* so it doesn't go on the stack every time */
 
+#ifdef HAVE_EVENT_EPOLL
+	int			epfd;			//!< epoll instance for I/O filters, or -1 to use the kq.
+	int			timerfd;		//!< Wakes epoll_wait() when the first timer is due.
+	struct timeval		timer_armed;		//!< When timerfd will fire, or zero if it's not armed.
+
+	int			num_epoll_events;	//!< Number of events in ep_events.
+	struct epoll_event	ep_events[FR_EV_BATCH_FDS];
+#endif
+
 	bool			in_handler;		//!< Deletes should be deferred until after the
 							///< handlers complete.
 
 	fr_event_fd_t		*fd_to_free;		//!< File descriptor events pending deletion.
 };
 
-/** Compare two timer events to see which one should occur first
+/*
+ *	Backend for event lists allocated after the next call to
+ *	fr_event_list_backend_set().
+ */
+static fr_event_backend_t event_backend = FR_EVENT_BACKEND_DEFAULT;
+
+/** Convert a timeval to nanoseconds, for the timer wheel
  *
- * @param[in] a the first timer event.
- * @param[in] b the second timer event.
- * @return
- *	- +1 if a should occur later than b.
- *	- -1 if a should occur earlier than b.
- *	- 0 if both events occur at the same time.
  */
-static int fr_event_timer_cmp(void const *a, void const *b)
+static inline fr_time_t event_timeval_to_ns(struct timeval const *tv)
 {
-	fr_event_timer_t const	*ev_a = a, *ev_b = b;
+	return ((fr_time_t) tv->tv_sec * NANOSEC) + ((fr_time_t) tv->tv_usec * 1000);
+}
 
-	return fr_timeval_cmp(&ev_a->when, &ev_b->when);
+/** Convert nanoseconds from the timer wheel to a timeval
+ *
+ */
+static inline void event_ns_to_timeval(struct timeval *tv, fr_time_t when)
+{
+	tv->tv_sec = when / NANOSEC;
+	tv->tv_usec = (when % NANOSEC) / 1000;
 }
 
 /** Compare two file descriptor handles
@@ -379,7 +414,7 @@ int fr_event_list_num_timers(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_heap_num_elements(el->times);
+	return fr_twheel_num_elements(el->times);
 }
 
 /** Return the kq associated with an event list.
@@ -543,6 +578,100 @@ static ssize_t fr_event_build_evset(struct kevent out_kev[], size_t outlen, fr_e
 	return out - out_kev;
 }
 
+#ifdef HAVE_EVENT_EPOLL
+/** Register the active I/O functions of an fd with epoll
+ *
+ * The epoll registration mirrors the kevent filters in the fd's
+ * function map.  Filters without EV_CLEAR are level-triggered in
+ * kqueue, and are registered level-triggered with epoll, so a write
+ * callback that stays registered keeps firing while the socket is
+ * writable, exactly as it does with kevent.  Filters with EV_CLEAR
+ * are edge-triggered, and map to EPOLLET.
+ *
+ * epoll applies EPOLLET to the whole fd, not per direction, so the
+ * registration is only edge-triggered if every active filter has
+ * EV_CLEAR.  Otherwise a level-triggered filter would miss events.
+ *
+ * @param[in] el	the fd is registered with.
+ * @param[in] ef	whose active functions have changed.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int event_epoll_apply(fr_event_list_t *el, fr_event_fd_t *ef)
+{
+	struct epoll_event	ev;
+	fr_event_func_map_t const *map;
+	uint32_t		events = 0;
+	bool			edge = true;
+	int			op;
+
+	for (map = ef->map; map->name; map++) {
+		if (!*(uintptr_t const *)((uint8_t const *)&ef->active + map->offset)) continue;
+
+		switch (map->filter) {
+		case EVFILT_READ:
+			events |= EPOLLIN | EPOLLRDHUP;
+			break;
+
+		case EVFILT_WRITE:
+			events |= EPOLLOUT;
+			break;
+
+		default:
+			continue;
+		}
+
+		if (!(map->flags & EV_CLEAR)) edge = false;
+	}
+
+	if (events && edge) events |= EPOLLET;
+
+	if (events == ef->epoll_events) return 0;
+
+	if (!ef->epoll_events) {
+		op = EPOLL_CTL_ADD;
+	} else if (!events) {
+		op = EPOLL_CTL_DEL;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = ef;
+
+	if (epoll_ctl(el->epfd, op, ef->fd, &ev) < 0) return -1;
+
+	ef->epoll_events = events;
+
+	return 0;
+}
+#endif
+
+/** Apply the changes made by #fr_event_build_evset
+ *
+ * @param[in] el	the fd is registered with.
+ * @param[in] ef	whose filters have changed.
+ * @param[in] evset	kevent changes, used if the fd isn't registered with epoll.
+ * @param[in] count	number of changes in evset.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int event_filter_apply(fr_event_list_t *el, fr_event_fd_t *ef, struct kevent *evset, int count)
+{
+#ifdef HAVE_EVENT_EPOLL
+	if (ef->is_epoll) return event_epoll_apply(el, ef);
+#else
+	(void) ef;	/* -Wunused */
+#endif
+
+	if (!count) return 0;
+
+	return kevent(el->kq, evset, count, NULL, 0, NULL);
+}
+
 /** Discover the type of a file descriptor
  *
  * This function writes the result of the discovery to the ef->type,
@@ -630,13 +759,13 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 		 *	If this fails, it's a pretty catastrophic error.
 		 */
 		count = fr_event_build_evset(evset, sizeof(evset)/sizeof(*evset), &ef->active, ef, &funcs, &ef->active);
-		if (count > 0) {
+		if (count >= 0) {
 			int ret;
 
 			/*
 			 *	If this fails, assert on debug builds.
 			 */
-			ret = kevent(el->kq, evset, count, NULL, 0, NULL);
+			ret = event_filter_apply(el, ef, evset, count);
 			if (!fr_cond_assert_msg(ret >= 0,
 						"FD was closed without being removed from the KQ: %s",
 						fr_syserror(errno))) {
@@ -652,6 +781,11 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 		 *	udata to NULL to mark them as deleted.
 		 */
 		for (i = 0; i < el->num_fd_events; i++) if (el->events[i].udata == ef) el->events[i].udata = NULL;
+#ifdef HAVE_EVENT_EPOLL
+		for (i = 0; i < el->num_epoll_events; i++) {
+			if (el->ep_events[i].data.ptr == ef) el->ep_events[i].data.ptr = NULL;
+		}
+#endif
 
 		el->num_fds--;
 	}
@@ -800,7 +934,7 @@ int fr_event_filter_update(fr_event_list_t *el, int fd, fr_event_filter_t filter
 		return -1;
 	}
 
-	if (count && unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+	if (unlikely(event_filter_apply(el, ef, evset, count) < 0)) {
 		fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
 		goto error;
 	}
@@ -825,6 +959,7 @@ int fr_event_filter_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 			   void *uctx)
 {
 	ssize_t			count;
+	int			ret;
 	fr_event_fd_t		find, *ef;
 	fr_event_funcs_t	active;
 	struct kevent		evset[10];
@@ -896,9 +1031,25 @@ int fr_event_filter_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 			goto free;
 		}
 
+#ifdef HAVE_EVENT_EPOLL
+		ef->is_epoll = (el->epfd >= 0) && (filter == FR_EVENT_FILTER_IO);
+#endif
+
 		count = fr_event_build_evset(evset, sizeof(evset)/sizeof(*evset), &ef->active, ef, funcs, &ef->active);
 		if (count < 0) goto free;
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+
+		ret = event_filter_apply(el, ef, evset, count);
+#ifdef HAVE_EVENT_EPOLL
+		/*
+		 *	epoll refuses regular files, which libkqueue
+		 *	reports as always readable/writable.
+		 */
+		if ((ret < 0) && (errno == EPERM) && ef->is_epoll) {
+			ef->is_epoll = false;
+			ret = event_filter_apply(el, ef, evset, count);
+		}
+#endif
+		if (unlikely(ret < 0)) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto free;
 		}
@@ -928,7 +1079,7 @@ int fr_event_filter_insert(TALLOC_CTX *ctx, fr_event_list_t *el, int fd,
 			memcpy(&ef->active, &active, sizeof(ef->active));
 			return -1;
 		}
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (unlikely(event_filter_apply(el, ef, evset, count) < 0)) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto error;
 		}
@@ -1007,17 +1158,17 @@ static int _event_timer_free(fr_event_timer_t *ev)
 	fr_event_timer_t const **ev_p;
 	int		ret;
 
-	ret = fr_heap_extract(el->times, ev);
+	ret = fr_twheel_extract(el->times, ev);
 
 	ev_p = ev->parent;
 	rad_assert(*(ev->parent) == ev);
 	*ev_p = NULL;
 
 	/*
-	 *	Events MUST be in the heap
+	 *	Events MUST be in the timer wheel
 	 */
 	if (!fr_cond_assert(ret == 0)) {
-		fr_strerror_printf("Event not found in heap");
+		fr_strerror_printf("Event not found in timer wheel");
 		return -1;
 	}
 
@@ -1101,7 +1252,7 @@ int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t
 		 *	context changes, we need to free the old
 		 *	event, and allocate a new one.
 		 *
-		 *	Freeing the event also removes it from the heap.
+		 *	Freeing the event also removes it from the timer wheel.
 		 */
 		if (unlikely(ev->linked_ctx != ctx)) {
 			talloc_free(ev);
@@ -1112,7 +1263,7 @@ int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t
 		 *	Event may have fired, in which case the
 		 *	event will no longer be in the event loop.
 		 */
-		(void) fr_heap_extract(el->times, ev);
+		(void) fr_twheel_extract(el->times, ev);
 	}
 
 	ev->el = el;
@@ -1122,7 +1273,7 @@ int fr_event_timer_insert(TALLOC_CTX *ctx, fr_event_list_t *el, fr_event_timer_t
 	ev->linked_ctx = ctx;
 	ev->parent = ev_p;
 
-	if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
+	if (unlikely(fr_twheel_insert(el->times, ev, event_timeval_to_ns(when)) < 0)) {
 		talloc_free(ev);
 		return -1;
 	}
@@ -1354,7 +1505,9 @@ int fr_event_post_delete(fr_event_list_t *el, fr_event_cb_t callback, void *uctx
 /** Run a single scheduled timer event
  *
  * @param[in] el	containing the timer events.
- * @param[in] when	Process events scheduled to run before or at this time.
+ * @param[in,out] when	Process events scheduled to run before or at this time.
+ *			If no events are due, this is set to the time we should
+ *			next be called, which may be earlier than the next event.
  * @return
  *	- 0 no timer events fired.
  *	- 1 a timer event fired.
@@ -1367,26 +1520,20 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 
 	if (unlikely(!el)) return 0;
 
-	if (fr_heap_num_elements(el->times) == 0) {
-		when->tv_sec = 0;
-		when->tv_usec = 0;
-		return 0;
-	}
-
-	ev = fr_heap_peek(el->times);
-	if (!ev) {
+	if (fr_twheel_num_elements(el->times) == 0) {
 		when->tv_sec = 0;
 		when->tv_usec = 0;
 		return 0;
 	}
 
 	/*
-	 *	See if it's time to do this one.
+	 *	The first call for a given time moves every timer
+	 *	which is due to the expired list of the wheel.
+	 *	Subsequent calls just take the next one off it.
 	 */
-	if ((ev->when.tv_sec > when->tv_sec) ||
-	    ((ev->when.tv_sec == when->tv_sec) &&
-	     (ev->when.tv_usec > when->tv_usec))) {
-		*when = ev->when;
+	ev = fr_twheel_peek(el->times, event_timeval_to_ns(when));
+	if (!ev) {
+		event_ns_to_timeval(when, fr_twheel_next(el->times));
 		return 0;
 	}
 
@@ -1405,6 +1552,99 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
 	return 1;
 }
 
+#ifdef HAVE_EVENT_EPOLL
+/** Wait for I/O events on the epoll instance
+ *
+ * The kqueue and the timerfd are serviced here, so that
+ * el->ep_events only contains I/O events when we return.
+ *
+ * @param[in] el	to process events for.
+ * @param[in] wake	how long to wait.  NULL to wait forever.
+ * @param[in] first	when the timer wheel next needs checking, if wake is non-zero.
+ * @return
+ *	- <0 on error.
+ *	- the number of kqueue and epoll events.
+ */
+static int event_epoll_corral(fr_event_list_t *el, struct timeval const *wake, struct timeval const *first)
+{
+	int	i, j, num;
+	int	timeout = -1;
+
+	/*
+	 *	Only re-arm the timerfd when the first timer changes.
+	 *	In a busy loop, the first timer is usually the same
+	 *	one as last time round.
+	 */
+	if (wake) {
+		if (!wake->tv_sec && !wake->tv_usec) {
+			timeout = 0;
+
+		} else if (fr_timeval_cmp(first, &el->timer_armed) != 0) {
+			struct itimerspec its;
+
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_sec = first->tv_sec;
+			its.it_value.tv_nsec = first->tv_usec * 1000;
+
+			if (timerfd_settime(el->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+				fr_strerror_printf("Failed arming timerfd: %s", fr_syserror(errno));
+				return -1;
+			}
+			el->timer_armed = *first;
+		}
+	}
+
+	num = epoll_wait(el->epfd, el->ep_events, FR_EV_BATCH_FDS, timeout);
+	if (unlikely(num < 0)) {
+		if (errno == EINTR) return 0;
+
+		fr_strerror_printf("Failed calling epoll_wait: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	for (i = 0, j = 0; i < num; i++) {
+		if (el->ep_events[i].data.ptr == &el->kq) {
+			struct timespec	ts_poll = { 0, 0 };
+			int		ret;
+
+			ret = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, &ts_poll);
+			if (unlikely(ret < 0)) {
+				if (errno == EINTR) continue;
+
+				fr_strerror_printf("Failed calling kevent: %s", fr_syserror(errno));
+				return -1;
+			}
+			el->num_fd_events = ret;
+			continue;
+		}
+
+		if (el->ep_events[i].data.ptr == &el->timerfd) {
+			uint64_t expired;
+
+			/*
+			 *	Nothing to read means someone else
+			 *	already drained it.
+			 */
+			if (read(el->timerfd, &expired, sizeof(expired)) < 0) {
+				if (errno != EAGAIN) {
+					fr_strerror_printf("Failed reading timerfd: %s", fr_syserror(errno));
+					return -1;
+				}
+			}
+			el->timer_armed.tv_sec = 0;
+			el->timer_armed.tv_usec = 0;
+			continue;
+		}
+
+		if (i != j) el->ep_events[j] = el->ep_events[i];
+		j++;
+	}
+	el->num_epoll_events = j;
+
+	return el->num_fd_events + el->num_epoll_events;
+}
+#endif
+
 /** Gather outstanding timer and file descriptor events
  *
  * @param[in] el	to process events for.
@@ -1415,12 +1655,15 @@ int fr_event_timer_run(fr_event_list_t *el, struct timeval *when)
  */
 int fr_event_corral(fr_event_list_t *el, bool wait)
 {
-	struct timeval		when, *wake;
+	struct timeval		when, *wake, first;
 	struct timespec		ts_when, *ts_wake;
 	fr_event_pre_t		*pre;
 	int			num_fd_events, num_timer_events;
 
 	el->num_fd_events = 0;
+#ifdef HAVE_EVENT_EPOLL
+	el->num_epoll_events = 0;
+#endif
 	num_timer_events = 0;
 
 	if (el->exit) {
@@ -1437,14 +1680,8 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 	wake = &when;
 
 	if (wait) {
-		if (fr_heap_num_elements(el->times) > 0) {
-			fr_event_timer_t *ev;
-
-			ev = fr_heap_peek(el->times);
-			if (!fr_cond_assert(ev)) {
-				fr_strerror_printf("Timer heap says it is non-empty, but there are no entries in it");
-				return -1;
-			}
+		if (fr_twheel_num_elements(el->times) > 0) {
+			event_ns_to_timeval(&first, fr_twheel_next(el->times));
 
 			gettimeofday(&el->now, NULL);
 
@@ -1452,7 +1689,7 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 			 *	Next event is in the future, get the time
 			 *	between now and that event.
 			 */
-			if (fr_timeval_cmp(&ev->when, &el->now) > 0) fr_timeval_subtract(&when, &ev->when, &el->now);
+			if (fr_timeval_cmp(&first, &el->now) > 0) fr_timeval_subtract(&when, &first, &el->now);
 
 			wake = &when;
 			num_timer_events = 1;
@@ -1477,6 +1714,15 @@ int fr_event_corral(fr_event_list_t *el, bool wait)
 		}
 	}
 
+#ifdef HAVE_EVENT_EPOLL
+	if (el->epfd >= 0) {
+		num_fd_events = event_epoll_corral(el, wake, &first);
+		if (unlikely(num_fd_events < 0)) return -1;
+
+		return num_fd_events + num_timer_events;
+	}
+#endif
+
 	if (wake) {
 		ts_wake = &ts_when;
 		ts_when.tv_sec = when.tv_sec;
@@ -1699,6 +1945,81 @@ service:
 			break;
 		}
 	}
+
+#ifdef HAVE_EVENT_EPOLL
+	/*
+	 *	Run the I/O events from epoll.  Read and write
+	 *	readiness arrive in the same event.
+	 */
+	for (i = 0; i < el->num_epoll_events; i++) {
+		fr_event_fd_t	*ef;
+		uint32_t	events = el->ep_events[i].events;
+		int		fd_errno = 0;
+		int		flags = 0;
+
+		/*
+		 *	Skip events for deleted FDs.
+		 */
+		if (!el->ep_events[i].data.ptr) continue;
+
+		ef = talloc_get_type_abort(el->ep_events[i].data.ptr, fr_event_fd_t);
+
+		if (!fr_cond_assert(ef->is_registered)) continue;
+
+		/*
+		 *	Same as EV_EOF above.  For files (and pipes)
+		 *	the read callback sees the EOF.
+		 */
+		if (events & (EPOLLHUP | EPOLLRDHUP)) {
+			flags |= EV_EOF;
+
+			if (ef->type != FR_EVENT_FD_FILE) {
+				socklen_t len;
+
+			epoll_error:
+				len = sizeof(fd_errno);
+				if (getsockopt(ef->fd, SOL_SOCKET, SO_ERROR, &fd_errno, &len) < 0) fd_errno = 0;
+
+				if (ef->error) ef->error(el, ef->fd, flags, fd_errno, ef->uctx);
+				TALLOC_FREE(ef);
+				continue;
+			}
+			events |= EPOLLIN;
+		}
+
+		/*
+		 *	Pending socket errors, e.g. an ICMP port
+		 *	unreachable for a connected UDP socket.  kqueue
+		 *	reports these as the socket being readable and
+		 *	writable, and the callbacks get the error from
+		 *	read() or write().  Do the same here, and don't
+		 *	read SO_ERROR, as that would clear the error.
+		 *
+		 *	If there's no callback to clear the error,
+		 *	epoll would keep returning it, so treat it as
+		 *	fatal.
+		 */
+		if (unlikely(events & EPOLLERR)) {
+			if (!ef->active.io.read && !ef->active.io.write) {
+				flags |= EV_ERROR;
+				goto epoll_error;
+			}
+			events |= EPOLLIN | EPOLLOUT;
+		}
+
+		if ((events & EPOLLIN) && ef->active.io.read) {
+			ef->active.io.read(el, ef->fd, flags, ef->uctx);
+
+			/*
+			 *	io.read can delete the event, in which case
+			 *	we *DON'T* want to call the write event.
+			 */
+			if (!el->ep_events[i].data.ptr) continue;
+		}
+
+		if ((events & EPOLLOUT) && ef->active.io.write) ef->active.io.write(el, ef->fd, flags, ef->uctx);
+	}
+#endif
 	el->in_handler = false;
 
 	/*
@@ -1717,7 +2038,7 @@ service:
 	/*
 	 *	Run all of the timer events.
 	 */
-	if (fr_heap_num_elements(el->times) > 0) {
+	if (fr_twheel_num_elements(el->times) > 0) {
 		do {
 			when = el->now;
 		} while (fr_event_timer_run(el, &when) == 1);
@@ -1796,11 +2117,89 @@ static int _event_list_free(fr_event_list_t *el)
 {
 	fr_event_timer_t const *ev;
 
-	while ((ev = fr_heap_peek(el->times)) != NULL) fr_event_timer_delete(el, &ev);
+	if (el->times) while ((ev = fr_twheel_peek(el->times, ~((fr_time_t) 0))) != NULL) fr_event_timer_delete(el, &ev);
 
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
+#ifdef HAVE_EVENT_EPOLL
+	if (el->epfd >= 0) close(el->epfd);
+	if (el->timerfd >= 0) close(el->timerfd);
+#endif
+
+	return 0;
+}
+
+#ifdef HAVE_EVENT_EPOLL
+/** Create the epoll instance, and watch the kqueue and timerfd with it
+ *
+ * On failure, el->epfd is left as -1, and the event list uses kqueue
+ * for everything.
+ *
+ * @param[in] el	to initialise.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int event_epoll_init(fr_event_list_t *el)
+{
+	struct epoll_event	ev;
+
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		fr_strerror_printf("Failed allocating epoll instance: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	el->timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (el->timerfd < 0) {
+		fr_strerror_printf("Failed allocating timerfd: %s", fr_syserror(errno));
+	error:
+		close(el->epfd);
+		el->epfd = -1;
+		if (el->timerfd >= 0) close(el->timerfd);
+		el->timerfd = -1;
+		return -1;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &el->kq;
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->kq, &ev) < 0) {
+		fr_strerror_printf("Failed adding kqueue to epoll: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	ev.data.ptr = &el->timerfd;
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->timerfd, &ev) < 0) {
+		fr_strerror_printf("Failed adding timerfd to epoll: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	return 0;
+}
+#endif
+
+/** Set the backend used by event lists allocated after this call
+ *
+ * With #FR_EVENT_BACKEND_DEFAULT, epoll is used where it's available,
+ * and kqueue is used if the epoll instance can't be created.
+ *
+ * @param[in] backend	to use.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the backend isn't available on this platform.
+ */
+int fr_event_list_backend_set(fr_event_backend_t backend)
+{
+#ifndef HAVE_EVENT_EPOLL
+	if (backend == FR_EVENT_BACKEND_EPOLL) {
+		fr_strerror_printf("epoll is not available on this platform");
+		return -1;
+	}
+#endif
+
+	event_backend = backend;
 
 	return 0;
 }
@@ -1818,6 +2217,7 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 {
 	fr_event_list_t	*el;
 	struct kevent	kev;
+	struct timeval	now;
 
 	el = talloc_zero(ctx, fr_event_list_t);
 	if (!fr_cond_assert(el)) {
@@ -1825,11 +2225,16 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		return NULL;
 	}
 	el->kq = -1;	/* So destructor can be used before kqueue() provides us with fd */
+#ifdef HAVE_EVENT_EPOLL
+	el->epfd = -1;
+	el->timerfd = -1;
+#endif
 	talloc_set_destructor(el, _event_list_free);
 
-	el->times = fr_heap_talloc_create(el, fr_event_timer_cmp, fr_event_timer_t, heap_id);
+	gettimeofday(&now, NULL);
+	el->times = fr_twheel_talloc_create(el, fr_event_timer_t, tw_entry, event_timeval_to_ns(&now));
 	if (!el->times) {
-		fr_strerror_printf("Failed allocating event heap");
+		fr_strerror_printf("Failed allocating timer wheel");
 	error:
 		talloc_free(el);
 		return NULL;
@@ -1862,6 +2267,11 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		goto error;
 	}
 
+#ifdef HAVE_EVENT_EPOLL
+	if ((event_backend != FR_EVENT_BACKEND_KQUEUE) &&
+	    (event_epoll_init(el) < 0) && (event_backend == FR_EVENT_BACKEND_EPOLL)) goto error;
+#endif
+
 	return el;
 }
 
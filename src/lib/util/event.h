@@ -58,6 +58,14 @@ typedef enum {
 	FR_EVENT_FILTER_VNODE			//!< Filter for vnode subfilters
 } fr_event_filter_t;
 
+/** Which kernel interface an event list uses to wait for file descriptor events
+ */
+typedef enum {
+	FR_EVENT_BACKEND_DEFAULT = 0,		//!< epoll where available, otherwise kqueue.
+	FR_EVENT_BACKEND_KQUEUE,		//!< kqueue (or libkqueue) for everything.
+	FR_EVENT_BACKEND_EPOLL			//!< Native epoll for I/O filters, kqueue for everything else.
+} fr_event_backend_t;
+
 /** Operations to perform on filter
  */
 typedef enum {
@@ -234,6 +242,7 @@ void		fr_event_loop_exit(fr_event_list_t *el, int code);
 bool		fr_event_loop_exiting(fr_event_list_t *el);
 int		fr_event_loop(fr_event_list_t *el);
 
+int		fr_event_list_backend_set(fr_event_backend_t backend);
 fr_event_list_t	*fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t status, void *status_ctx);
 
 #ifdef __cplusplus
@@ -0,0 +1,295 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Open addressing hash tables with cache line sized buckets
+ *
+ * Entries are stored directly in an array of buckets, each of which
+ * is one cache line.  A bucket holds the full hash of each entry, so
+ * most mismatches are rejected without calling the comparison
+ * function, or touching the entry itself.
+ *
+ * When a bucket is full, inserts probe linearly to the next bucket,
+ * and increment the "overflow" count of the bucket they skipped.
+ * Lookups stop at the first bucket with no overflow, so there are no
+ * tombstones, and deletes never need to move entries.
+ *
+ * @file src/lib/util/ohash.c
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/ohash.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+#define OHASH_CACHE_LINE	(64)
+
+/*
+ *	5 hashes, an overflow count, and 5 pointers fill a 64 byte
+ *	cache line on LP64 systems.
+ */
+#define OHASH_SLOTS		(5)
+
+/*
+ *	The smallest table we create, in buckets.  Must be a power of two.
+ */
+#define OHASH_MIN_BUCKETS	(8)
+
+/*
+ *	Grow the table when it is more than 80% full.
+ */
+#define OHASH_MAX_LOAD(_buckets) ((((_buckets) * OHASH_SLOTS) / 5) * 4)
+
+typedef struct {
+	uint32_t		hash[OHASH_SLOTS];	//!< Full hash of each entry.
+	uint32_t		overflow;		//!< Number of entries which probed past this bucket.
+	void			*data[OHASH_SLOTS];	//!< Entries, NULL for an empty slot.
+} fr_ohash_bucket_t;
+
+struct fr_ohash_t {
+	uint32_t		num_elements;		//!< Number of entries in the table.
+	uint32_t		max_elements;		//!< Grow the table when we reach this many entries.
+	uint32_t		mask;			//!< Number of buckets - 1.
+
+	fr_ohash_hash_t		hash;			//!< Hash an entry.
+	fr_ohash_cmp_t		cmp;			//!< Compare two entries.  Only equality matters.
+
+	void			*mem;			//!< Memory holding the buckets.
+	fr_ohash_bucket_t	*buckets;		//!< Cache line aligned buckets.
+};
+
+/** Allocate a cache line aligned array of buckets
+ *
+ */
+static int ohash_buckets_alloc(fr_ohash_t *oh, uint32_t num_buckets)
+{
+	uintptr_t	p;
+
+	oh->mem = talloc_zero_array(oh, uint8_t, (num_buckets * sizeof(fr_ohash_bucket_t)) + OHASH_CACHE_LINE);
+	if (!oh->mem) return -1;
+
+	p = (uintptr_t) oh->mem;
+	p = (p + (OHASH_CACHE_LINE - 1)) & ~((uintptr_t) (OHASH_CACHE_LINE - 1));
+
+	oh->buckets = (fr_ohash_bucket_t *) p;
+	oh->mask = num_buckets - 1;
+	oh->max_elements = OHASH_MAX_LOAD(num_buckets);
+
+	return 0;
+}
+
+/** Put an entry into the first free slot, starting at its home bucket
+ *
+ *  The caller ensures that there is room, and that the entry doesn't already exist.
+ */
+static void ohash_place(fr_ohash_t *oh, uint32_t hash, void *data)
+{
+	uint32_t		b, i;
+	fr_ohash_bucket_t	*bucket;
+
+	for (b = hash & oh->mask; ; b = (b + 1) & oh->mask) {
+		bucket = &oh->buckets[b];
+
+		for (i = 0; i < OHASH_SLOTS; i++) {
+			if (bucket->data[i]) continue;
+
+			bucket->hash[i] = hash;
+			bucket->data[i] = data;
+			oh->num_elements++;
+			return;
+		}
+
+		bucket->overflow++;
+	}
+}
+
+/** Find the bucket and slot holding an entry
+ *
+ * @return
+ *	- true if the entry was found, with *p_bucket and *p_slot set.
+ *	- false if the entry was not found.
+ */
+static bool ohash_lookup(fr_ohash_t *oh, uint32_t hash, void const *data, uint32_t *p_bucket, uint32_t *p_slot)
+{
+	uint32_t		b, i, probes;
+	fr_ohash_bucket_t	*bucket;
+
+	for (b = hash & oh->mask, probes = 0; probes <= oh->mask; b = (b + 1) & oh->mask, probes++) {
+		bucket = &oh->buckets[b];
+
+		for (i = 0; i < OHASH_SLOTS; i++) {
+			if (!bucket->data[i] || (bucket->hash[i] != hash)) continue;
+
+			if (oh->cmp(data, bucket->data[i]) != 0) continue;
+
+			*p_bucket = b;
+			*p_slot = i;
+			return true;
+		}
+
+		if (!bucket->overflow) break;
+	}
+
+	return false;
+}
+
+/** Double the number of buckets, and re-insert all of the entries
+ *
+ */
+static int ohash_grow(fr_ohash_t *oh)
+{
+	void			*old_mem = oh->mem;
+	fr_ohash_bucket_t	*old = oh->buckets;
+	uint32_t		b, i, old_num_buckets = oh->mask + 1;
+
+	if (ohash_buckets_alloc(oh, old_num_buckets * 2) < 0) {
+		oh->mem = old_mem;
+		oh->buckets = old;
+		oh->mask = old_num_buckets - 1;
+		oh->max_elements = OHASH_MAX_LOAD(old_num_buckets);
+		return -1;
+	}
+
+	oh->num_elements = 0;
+	for (b = 0; b < old_num_buckets; b++) {
+		for (i = 0; i < OHASH_SLOTS; i++) {
+			if (!old[b].data[i]) continue;
+
+			ohash_place(oh, old[b].hash[i], old[b].data[i]);
+		}
+	}
+
+	talloc_free(old_mem);
+
+	return 0;
+}
+
+/** Create an open addressing hash table
+ *
+ * @param[in] ctx		to allocate the table in.
+ * @param[in] hash		function to hash entries.
+ * @param[in] cmp		function to compare entries.  Returns 0 if they're the same.
+ * @param[in] num_elements	hint for the number of entries we expect.  May be 0.
+ * @return
+ *	- NULL on error.
+ *	- a new hash table.
+ */
+fr_ohash_t *fr_ohash_create(TALLOC_CTX *ctx, fr_ohash_hash_t hash, fr_ohash_cmp_t cmp, uint32_t num_elements)
+{
+	fr_ohash_t	*oh;
+	uint32_t	num_buckets = OHASH_MIN_BUCKETS;
+
+	if (!hash || !cmp) return NULL;
+
+	oh = talloc_zero(ctx, fr_ohash_t);
+	if (!oh) return NULL;
+
+	oh->hash = hash;
+	oh->cmp = cmp;
+
+	while ((OHASH_MAX_LOAD(num_buckets) < num_elements) && (num_buckets < (1U << 30))) num_buckets <<= 1;
+
+	if (ohash_buckets_alloc(oh, num_buckets) < 0) {
+		talloc_free(oh);
+		return NULL;
+	}
+
+	return oh;
+}
+
+/** Insert an entry into the table
+ *
+ * @param[in] oh	to insert into.
+ * @param[in] data	to insert.  Must not be NULL.
+ * @return
+ *	- 0 on success.
+ *	- -1 if an identical entry already exists, or on allocation failure.
+ */
+int fr_ohash_insert(fr_ohash_t *oh, void const *data)
+{
+	uint32_t	hash, b, i;
+	void		*entry;
+
+	if (!data) return -1;
+
+	hash = oh->hash(data);
+	if (ohash_lookup(oh, hash, data, &b, &i)) return -1;
+
+	if ((oh->num_elements >= oh->max_elements) && (ohash_grow(oh) < 0)) return -1;
+
+	memcpy(&entry, &data, sizeof(entry)); /* const work-arounds */
+	ohash_place(oh, hash, entry);
+
+	return 0;
+}
+
+/** Find an entry in the table
+ *
+ * @param[in] oh	to search.
+ * @param[in] data	an entry with the same key as the one to find.
+ * @return
+ *	- NULL if no matching entry exists.
+ *	- the matching entry.
+ */
+void *fr_ohash_find(fr_ohash_t *oh, void const *data)
+{
+	uint32_t	b, i;
+
+	if (!ohash_lookup(oh, oh->hash(data), data, &b, &i)) return NULL;
+
+	return oh->buckets[b].data[i];
+}
+
+/** Remove an entry from the table
+ *
+ * @param[in] oh	to remove from.
+ * @param[in] data	an entry with the same key as the one to remove.
+ * @return
+ *	- NULL if no matching entry exists.
+ *	- the entry which was removed.
+ */
+void *fr_ohash_remove(fr_ohash_t *oh, void const *data)
+{
+	uint32_t	hash, b, i, home;
+	void		*found;
+
+	hash = oh->hash(data);
+	if (!ohash_lookup(oh, hash, data, &b, &i)) return NULL;
+
+	found = oh->buckets[b].data[i];
+	oh->buckets[b].data[i] = NULL;
+	oh->num_elements--;
+
+	/*
+	 *	The entry skipped over every bucket between its home
+	 *	bucket and the one it was stored in.
+	 */
+	for (home = hash & oh->mask; home != b; home = (home + 1) & oh->mask) {
+		oh->buckets[home].overflow--;
+	}
+
+	return found;
+}
+
+/** Return the number of entries in the table
+ *
+ */
+uint32_t fr_ohash_num_elements(fr_ohash_t const *oh)
+{
+	return oh->num_elements;
+}
@@ -0,0 +1,48 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Open addressing hash tables with cache line sized buckets
+ *
+ * @file src/lib/util/ohash.h
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSIDH(ohash_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+
+#include <stdint.h>
+#include <talloc.h>
+
+typedef struct fr_ohash_t fr_ohash_t;
+typedef uint32_t (*fr_ohash_hash_t)(void const *data);
+typedef int (*fr_ohash_cmp_t)(void const *one, void const *two);
+
+fr_ohash_t	*fr_ohash_create(TALLOC_CTX *ctx, fr_ohash_hash_t hash, fr_ohash_cmp_t cmp, uint32_t num_elements);
+int		fr_ohash_insert(fr_ohash_t *oh, void const *data);
+void		*fr_ohash_find(fr_ohash_t *oh, void const *data);
+void		*fr_ohash_remove(fr_ohash_t *oh, void const *data);
+uint32_t	fr_ohash_num_elements(fr_ohash_t const *oh);
+
+#ifdef __cplusplus
+}
+#endif
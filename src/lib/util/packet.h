@@ -69,6 +69,9 @@ typedef struct radius_packet {
 	uint8_t			*data;			//!< Packet data (body).
 	size_t			data_len;		//!< Length of packet data.
 	VALUE_PAIR		*vps;			//!< Result of decoding the packet into VALUE_PAIRs.
+	uint8_t			vps_fingerprint[FR_PAIR_LIST_FINGERPRINT_LEN];	//!< fr_pair_list_fingerprint() of vps
+										///< when they were decoded from data.
+	bool			vps_fingerprinted;	//!< Whether vps_fingerprint is valid.
 
 	uint32_t       		rounds;			//!< for State[0]
 
@@ -28,6 +28,8 @@ RCSID("$Id$")
 #include <freeradius-devel/attributes.h>
 #include <freeradius-devel/util/regex.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/proto.h>
 #include <freeradius-devel/util/print.h>
@@ -780,7 +782,6 @@ void *fr_pair_iter_next_by_ancestor(void **prev, void *to_eval, void *uctx)
  */
 VALUE_PAIR *fr_pair_find_by_da(VALUE_PAIR *head, fr_dict_attr_t const *da, int8_t tag)
 {
-	fr_cursor_t 	cursor;
 	VALUE_PAIR	*vp;
 
 	/* List head may be NULL if it contains no VPs */
@@ -790,9 +791,12 @@ VALUE_PAIR *fr_pair_find_by_da(VALUE_PAIR *head, fr_dict_attr_t const *da, int8_
 
 	if (!da) return NULL;
 
-	for (vp = fr_cursor_init(&cursor, &head);
-	     vp;
-	     vp = fr_cursor_next(&cursor)) {
+	/*
+	 *	Walk the list directly, this is called far too
+	 *	often to go through the cursor functions.
+	 */
+	for (vp = head; vp; vp = vp->next) {
+		VP_VERIFY(vp);
 		if ((da == vp->da) && TAG_EQ(tag, vp->tag)) return vp;
 	}
 
@@ -895,6 +899,186 @@ void fr_pair_add(VALUE_PAIR **head, VALUE_PAIR *add)
 	i->next = add;
 }
 
+/*
+ *	Lookups done by walking a wrapped list, before it's indexed.
+ */
+#define PAIR_LIST_INDEX_LOOKUPS	4
+
+static uint32_t pair_list_index_hash(void const *data)
+{
+	VALUE_PAIR const *vp = data;
+
+	return fr_hash(&vp->da, sizeof(vp->da));
+}
+
+static int pair_list_index_cmp(void const *one, void const *two)
+{
+	VALUE_PAIR const *a = one, *b = two;
+
+	return (a->da > b->da) - (a->da < b->da);
+}
+
+/** Wrap a list of pairs
+ *
+ * @note #fr_pair_list_done must be called when the wrapper is no longer needed.
+ *
+ * @param[out] list	to initialise.
+ * @param[in] head	of the list to wrap.  The list may be empty.
+ */
+void fr_pair_list_init(fr_pair_list_t *list, VALUE_PAIR **head)
+{
+	*list = (fr_pair_list_t) {
+		.head = head
+	};
+}
+
+/** Add one or more pairs to the end of a wrapped list
+ *
+ * The end of the list is remembered, so appending doesn't walk the list
+ * each time, as #fr_pair_add does.
+ *
+ * @param[in] list	to append to.
+ * @param[in] add	pair, or list of pairs, to append.
+ */
+void fr_pair_list_append(fr_pair_list_t *list, VALUE_PAIR *add)
+{
+	VALUE_PAIR *vp;
+
+	if (!add) return;
+
+	if (!list->tail) {
+		for (list->tail = list->head; *list->tail; list->tail = &(*list->tail)->next);
+	}
+
+	*list->tail = add;
+	for (vp = add; vp; vp = vp->next) {
+		VP_VERIFY(vp);
+
+		/*
+		 *	Fails if there's already a pair of this
+		 *	attribute, which is the one we want to find.
+		 */
+		if (list->index) (void) fr_ohash_insert(list->index, vp);
+		list->tail = &vp->next;
+	}
+}
+
+/** Build the index of a wrapped list
+ *
+ */
+static int pair_list_index(fr_pair_list_t *list)
+{
+	VALUE_PAIR *vp;
+
+	list->index = fr_ohash_create(NULL, pair_list_index_hash, pair_list_index_cmp, 0);
+	if (!list->index) return -1;
+
+	for (vp = *list->head; vp; vp = vp->next) (void) fr_ohash_insert(list->index, vp);
+
+	return 0;
+}
+
+/** Find the first pair of an attribute in a wrapped list
+ *
+ * The first few lookups walk the list.  After that, the list is indexed,
+ * so that later lookups take the same time however long the list is.
+ *
+ * @param[in] list	to search.
+ * @param[in] da	to search for.
+ * @param[in] tag	to search for, or TAG_ANY.
+ * @return
+ *	- The first matching pair.
+ *	- NULL if there are no matching pairs.
+ */
+VALUE_PAIR *fr_pair_list_find_by_da(fr_pair_list_t *list, fr_dict_attr_t const *da, int8_t tag)
+{
+	VALUE_PAIR *vp;
+
+	if (!da) return NULL;
+
+	if (!list->index) {
+		if (list->lookups++ < PAIR_LIST_INDEX_LOOKUPS) return fr_pair_find_by_da(*list->head, da, tag);
+
+		if (pair_list_index(list) < 0) return fr_pair_find_by_da(*list->head, da, tag);
+	}
+
+	vp = fr_ohash_find(list->index, &(VALUE_PAIR){ .da = da });
+	if (!vp) return NULL;
+
+	if (TAG_EQ(tag, vp->tag)) return vp;
+
+	/*
+	 *	There may be other instances of the attribute
+	 *	with the right tag.
+	 */
+	return fr_pair_find_by_da(vp->next, da, tag);
+}
+
+/** Let the wrapper know that pairs were removed from the list by other means
+ *
+ * @param[in] list	which was changed.
+ */
+void fr_pair_list_changed(fr_pair_list_t *list)
+{
+	TALLOC_FREE(list->index);
+	list->tail = NULL;
+	list->lookups = 0;
+}
+
+/** Free the index of a wrapped list
+ *
+ * The list itself isn't changed.
+ *
+ * @param[in] list	which is no longer needed.
+ */
+void fr_pair_list_done(fr_pair_list_t *list)
+{
+	TALLOC_FREE(list->index);
+}
+
+/** Calculate a fingerprint of the attributes in a list, and of their values
+ *
+ * Lets callers check whether a list has been modified since it was decoded,
+ * without keeping a copy of it.  An unmodified list always has the same
+ * fingerprint.  The fingerprint is an MD5 digest, so adding, removing,
+ * re-ordering or changing attributes won't produce the same one unless
+ * someone is trying very hard to make it do so.
+ *
+ * @param[out] out	Where to write the fingerprint.
+ * @param[in] head	of the list.
+ */
+void fr_pair_list_fingerprint(uint8_t out[FR_PAIR_LIST_FINGERPRINT_LEN], VALUE_PAIR const *head)
+{
+	VALUE_PAIR const	*vp;
+	FR_MD5_CTX		ctx;
+
+	fr_md5_init(&ctx);
+
+	for (vp = head; vp; vp = vp->next) {
+		fr_value_box_t const *value = &vp->data;
+
+		VP_VERIFY(vp);
+
+		fr_md5_update(&ctx, (uint8_t const *) &vp->da, sizeof(vp->da));
+		fr_md5_update(&ctx, (uint8_t const *) &vp->tag, sizeof(vp->tag));
+
+		switch (value->type) {
+		case FR_TYPE_STRING:
+		case FR_TYPE_OCTETS:
+			fr_md5_update(&ctx, (uint8_t const *) &value->datum.length, sizeof(value->datum.length));
+			fr_md5_update(&ctx, value->vb_octets, value->datum.length);
+			break;
+
+		default:
+			fr_md5_update(&ctx, ((uint8_t const *)value) + fr_value_box_offsets[value->type],
+				      fr_value_box_field_sizes[value->type]);
+			break;
+		}
+	}
+
+	fr_md5_final(out, &ctx);
+}
+
 /** Replace all matching VPs
  *
  * Walks over 'head', and replaces the head VP that matches 'replace'.
@@ -1887,9 +2071,17 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 	VALUE_PAIR *i, *found;
 	VALUE_PAIR *head_new, **tail_new;
 	VALUE_PAIR **tail_from;
+	fr_pair_list_t dst;
 
 	if (!to || !from || !*from) return;
 
+	/*
+	 *	Moving many pairs means looking up each of them
+	 *	in the "to" list, which is indexed once that's
+	 *	worthwhile.
+	 */
+	fr_pair_list_init(&dst, to);
+
 	/*
 	 *	We're editing the "to" list while we're adding new
 	 *	attributes to it.  We don't want the new attributes to
@@ -1938,7 +2130,7 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 		 *	it doesn't already exist.
 		 */
 		case T_OP_EQ:
-			found = fr_pair_find_by_da(*to, i->da, TAG_ANY);
+			found = fr_pair_list_find_by_da(&dst, i->da, TAG_ANY);
 			if (!found) goto do_add;
 
 			tail_from = &(i->next);
@@ -1949,7 +2141,7 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 		 *	of the same vendor/attr which already exists.
 		 */
 		case T_OP_SET:
-			found = fr_pair_find_by_da(*to, i->da, TAG_ANY);
+			found = fr_pair_list_find_by_da(&dst, i->da, TAG_ANY);
 			if (!found) goto do_add;
 
 			/*
@@ -1988,6 +2180,13 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 			 */
 			fr_pair_delete_by_da(&found->next, found->da);
 
+			/*
+			 *	"found" is still the first pair of
+			 *	its attribute, so the index is fine,
+			 *	but we may have deleted the last pair.
+			 */
+			dst.tail = NULL;
+
 			/*
 			 *	Remove this attribute from the
 			 *	"from" list.
@@ -2015,7 +2214,8 @@ void fr_pair_list_move(TALLOC_CTX *ctx, VALUE_PAIR **to, VALUE_PAIR **from)
 	/*
 	 *	Take the "new" list, and append it to the "to" list.
 	 */
-	fr_pair_add(to, head_new);
+	fr_pair_list_append(&dst, head_new);
+	fr_pair_list_done(&dst);
 }
 
 /** Move a list of pairs
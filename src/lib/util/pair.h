@@ -26,6 +26,7 @@ RCSIDH(pair_h, "$Id$")
 #include <freeradius-devel/build.h>
 #include <freeradius-devel/missing.h>
 #include <freeradius-devel/util/cursor.h>
+#include <freeradius-devel/util/ohash.h>
 #include <freeradius-devel/util/value.h>
 
 #ifdef __cplusplus
@@ -94,6 +95,23 @@ typedef struct value_pair {
 	fr_value_box_t		data;
 } VALUE_PAIR;
 
+/** A list of VALUE_PAIRs with a tail pointer, and an index of the pairs by attribute
+ *
+ * Wraps an existing list head, so the list can still be used with cursors,
+ * and passed to the other fr_pair_* functions.  While the wrapper is in use,
+ * pairs should only be added with #fr_pair_list_append.  If pairs are removed
+ * (or added) by any other means, #fr_pair_list_changed must be called.
+ */
+typedef struct {
+	VALUE_PAIR		**head;		//!< The list being wrapped.
+	VALUE_PAIR		**tail;		//!< Next pointer of the last pair, or NULL if not known.
+	fr_ohash_t		*index;		//!< First pair of each attribute.  Built once enough
+						///< lookups have been done to make it worthwhile.
+	unsigned int		lookups;	//!< Done by walking the list.
+} fr_pair_list_t;
+
+#define FR_PAIR_LIST_FINGERPRINT_LEN	16	//!< Length of the output of #fr_pair_list_fingerprint (an MD5 digest).
+
 /** Abstraction to allow iterating over different configurations of VALUE_PAIRs
  *
  * This allows functions which do not care about the structure of collections of VALUE_PAIRs
@@ -251,6 +269,18 @@ VALUE_PAIR	*fr_pair_find_by_child_num(VALUE_PAIR *head, fr_dict_attr_t const *pa
 
 void		fr_pair_add(VALUE_PAIR **head, VALUE_PAIR *vp);
 
+void		fr_pair_list_init(fr_pair_list_t *list, VALUE_PAIR **head);
+
+void		fr_pair_list_append(fr_pair_list_t *list, VALUE_PAIR *vp);
+
+VALUE_PAIR	*fr_pair_list_find_by_da(fr_pair_list_t *list, fr_dict_attr_t const *da, int8_t tag);
+
+void		fr_pair_list_changed(fr_pair_list_t *list);
+
+void		fr_pair_list_done(fr_pair_list_t *list);
+
+void		fr_pair_list_fingerprint(uint8_t out[FR_PAIR_LIST_FINGERPRINT_LEN], VALUE_PAIR const *head);
+
 void		fr_pair_replace(VALUE_PAIR **head, VALUE_PAIR *add);
 
 void		fr_pair_delete_by_child_num(VALUE_PAIR **head, fr_dict_attr_t const *parent,
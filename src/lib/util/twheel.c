@@ -0,0 +1,471 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Hierarchical timer wheels
+ *
+ * Time is divided into ticks of about a millisecond.  Level 0 of the
+ * wheel has one slot per tick, and each higher level has slots which
+ * are 64 times wider than the level below.  An element goes into the
+ * lowest level whose current rotation contains its expiry time, so
+ * insert and extract are O(1) list operations.
+ *
+ * When the wheel advances over the start of a slot in a higher level,
+ * the elements in that slot are re-inserted, and so "cascade" down to
+ * lower levels.  Elements only ever expire from level 0, where each
+ * element's full expiry time is checked, so they never expire early.
+ *
+ * Advancing the wheel moves every due element onto an "expired" list
+ * in one pass.  A bitmap of occupied slots at each level lets the wheel
+ * skip over empty slots, instead of stepping through every tick.
+ *
+ * @file src/lib/util/twheel.c
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/twheel.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ *	2^20ns is a little over a millisecond.
+ */
+#define TW_TICK_SHIFT		(20)
+
+/*
+ *	64 slots per level, so the occupied slots of a level fit in
+ *	one uint64_t.
+ */
+#define TW_BITS			(6)
+#define TW_SLOTS		(1 << TW_BITS)
+#define TW_MASK			((uint64_t) (TW_SLOTS - 1))
+
+/*
+ *	6 levels cover 2^36 ticks, or a little over two years.  Elements
+ *	further in the future than that go in the top level, and are
+ *	re-inserted each time it wraps around.
+ */
+#define TW_LEVELS		(6)
+
+#define TW_BIT(_slot)		(((uint64_t) 1) << (_slot))
+
+struct fr_twheel_t {
+	uint64_t		cur;			//!< Current tick.  Earlier ticks have been processed.
+	uint32_t		num_elements;		//!< Number of elements in the wheel, including expired ones.
+	size_t			offset;			//!< Offset of the #fr_twheel_entry_t in each element.
+
+	uint64_t		occupied[TW_LEVELS];	//!< Bitmap of slots which contain elements.
+
+	fr_dlist_head_t		expired;		//!< Elements which are due, in order of expiry.
+	fr_dlist_head_t		slots[TW_LEVELS][TW_SLOTS];
+};
+
+static inline fr_twheel_entry_t *twheel_entry(fr_twheel_t const *tw, void *data)
+{
+	return (fr_twheel_entry_t *)(((uint8_t *) data) + tw->offset);
+}
+
+/** Return the index of the lowest set bit
+ *
+ */
+static inline unsigned int twheel_first_bit(uint64_t bits)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(bits);
+#else
+	unsigned int i = 0;
+
+	while (!(bits & 1)) {
+		bits >>= 1;
+		i++;
+	}
+
+	return i;
+#endif
+}
+
+/** Put an element into the slot for its expiry time
+ *
+ */
+static void twheel_place(fr_twheel_t *tw, void *data)
+{
+	fr_twheel_entry_t	*e = twheel_entry(tw, data);
+	uint64_t		tick = e->when >> TW_TICK_SHIFT;
+	unsigned int		level;
+	uint64_t		slot;
+
+	/*
+	 *	Due, or due in this tick.  The current slot is checked
+	 *	every time the wheel advances.
+	 */
+	if (tick <= tw->cur) {
+		level = 0;
+		slot = tw->cur & TW_MASK;
+	} else {
+		/*
+		 *	The lowest level where the element is in the
+		 *	same rotation as the current tick.
+		 */
+		for (level = 0; level < (TW_LEVELS - 1); level++) {
+			unsigned int shift = TW_BITS * (level + 1);
+
+			if ((tick >> shift) == (tw->cur >> shift)) break;
+		}
+		slot = (tick >> (TW_BITS * level)) & TW_MASK;
+	}
+
+	e->head = &tw->slots[level][slot];
+	fr_dlist_insert_tail(e->head, data);
+	tw->occupied[level] |= TW_BIT(slot);
+}
+
+/** Remove an element from whichever list it's in
+ *
+ */
+static void twheel_unlink(fr_twheel_t *tw, void *data)
+{
+	fr_twheel_entry_t	*e = twheel_entry(tw, data);
+	fr_dlist_head_t		*head = e->head;
+
+	fr_dlist_remove(head, data);
+	e->head = NULL;
+
+	if ((head != &tw->expired) && fr_dlist_empty(head)) {
+		size_t i = head - &tw->slots[0][0];
+
+		tw->occupied[i / TW_SLOTS] &= ~TW_BIT(i % TW_SLOTS);
+	}
+}
+
+/** Find the tick at which the first occupied slot starts
+ *
+ * Every element in a level is due before any element in the levels
+ * above it, so only the lowest occupied level needs to be checked.
+ *
+ * @param[in] tw	to search.
+ * @param[out] tick	where the first occupied slot starts.
+ * @param[out] level	of the first occupied slot.
+ * @return
+ *	- true if there's an occupied slot.
+ *	- false if the wheel is empty.
+ */
+static bool twheel_next_slot(fr_twheel_t const *tw, uint64_t *tick, unsigned int *level)
+{
+	unsigned int i;
+
+	for (i = 0; i < TW_LEVELS; i++) {
+		unsigned int	shift = TW_BITS * i;
+		uint64_t	cur_slot = (tw->cur >> shift) & TW_MASK;
+		uint64_t	bits = tw->occupied[i];
+		uint64_t	rotation, after;
+
+		if (!bits) continue;
+
+		rotation = (tw->cur >> (shift + TW_BITS)) << (shift + TW_BITS);
+
+		/*
+		 *	Level 0 includes the current slot, as it may
+		 *	hold elements due later in the current tick.
+		 *	Higher levels have already cascaded their current
+		 *	slot, so anything in it is a rotation away.
+		 */
+		after = bits & ~(TW_BIT(cur_slot) - 1);
+		if (i > 0) after &= ~TW_BIT(cur_slot);
+
+		if (after) {
+			*tick = rotation | ((uint64_t) twheel_first_bit(after) << shift);
+		} else {
+			*tick = rotation + (((uint64_t) 1) << (shift + TW_BITS)) +
+				((uint64_t) twheel_first_bit(bits) << shift);
+		}
+		*level = i;
+
+		return true;
+	}
+
+	return false;
+}
+
+/** Add an element to the expired list, keeping the list in order of expiry
+ *
+ * Elements in a slot are in insertion order, and elements which were
+ * already overdue are placed in the current slot.  Most elements expire
+ * after those already in the list, so the list is searched from the tail.
+ */
+static void twheel_expired_insert(fr_twheel_t *tw, void *data)
+{
+	fr_twheel_entry_t	*e = twheel_entry(tw, data);
+	fr_twheel_entry_t	*p;
+	void			*prev;
+
+	e->head = &tw->expired;
+
+	for (prev = fr_dlist_tail(&tw->expired); prev; prev = fr_dlist_prev(&tw->expired, prev)) {
+		if (twheel_entry(tw, prev)->when <= e->when) break;
+	}
+
+	if (!prev) {
+		fr_dlist_insert_head(&tw->expired, data);
+		return;
+	}
+
+	p = twheel_entry(tw, prev);
+	e->entry.prev = &p->entry;
+	e->entry.next = p->entry.next;
+	p->entry.next->prev = &e->entry;
+	p->entry.next = &e->entry;
+}
+
+/** Move elements which are due from the current level 0 slot to the expired list
+ *
+ */
+static void twheel_expire(fr_twheel_t *tw, fr_time_t now)
+{
+	uint64_t	slot = tw->cur & TW_MASK;
+	fr_dlist_head_t	*head = &tw->slots[0][slot];
+	void		*data, *next;
+
+	if (!(tw->occupied[0] & TW_BIT(slot))) return;
+
+	for (data = fr_dlist_head(head); data; data = next) {
+		fr_twheel_entry_t *e = twheel_entry(tw, data);
+
+		next = fr_dlist_next(head, data);
+
+		if (e->when > now) continue;
+
+		fr_dlist_remove(head, data);
+		twheel_expired_insert(tw, data);
+	}
+
+	if (fr_dlist_empty(head)) tw->occupied[0] &= ~TW_BIT(slot);
+}
+
+/** Set the current tick, and cascade the higher level slots which start at it
+ *
+ */
+static void twheel_cascade(fr_twheel_t *tw, uint64_t tick)
+{
+	unsigned int level;
+
+	tw->cur = tick;
+
+	/*
+	 *	Highest level first, so that elements cascading from
+	 *	it into the current slot of a lower level get
+	 *	cascaded again.
+	 */
+	for (level = TW_LEVELS - 1; level > 0; level--) {
+		unsigned int	shift = TW_BITS * level;
+		uint64_t	slot;
+		fr_dlist_head_t	head, *list;
+		void		*data;
+
+		if (tick & ((((uint64_t) 1) << shift) - 1)) continue;
+
+		slot = (tick >> shift) & TW_MASK;
+		if (!(tw->occupied[level] & TW_BIT(slot))) continue;
+
+		/*
+		 *	Detach the slot first, elements may be
+		 *	re-inserted into it.
+		 */
+		list = &tw->slots[level][slot];
+		_fr_dlist_init(&head, list->offset, list->type);
+		fr_dlist_move(&head, list);
+		tw->occupied[level] &= ~TW_BIT(slot);
+
+		while ((data = fr_dlist_head(&head))) {
+			fr_dlist_remove(&head, data);
+			twheel_place(tw, data);
+		}
+	}
+}
+
+/** Advance the wheel to "now", moving every due element to the expired list
+ *
+ */
+static void twheel_advance(fr_twheel_t *tw, fr_time_t now)
+{
+	uint64_t	now_tick = now >> TW_TICK_SHIFT;
+
+	for (;;) {
+		uint64_t	next;
+		unsigned int	level;
+
+		twheel_expire(tw, now);
+
+		if (tw->cur >= now_tick) return;
+
+		/*
+		 *	Skip straight to the next occupied slot, as
+		 *	nothing needs to be done for the empty ones.
+		 */
+		if (!twheel_next_slot(tw, &next, &level) || (next > now_tick)) next = now_tick;
+		if (next <= tw->cur) next = tw->cur + 1;
+
+		twheel_cascade(tw, next);
+	}
+}
+
+/** Create a timer wheel
+ *
+ * @param[in] ctx		to allocate the wheel in.
+ * @param[in] talloc_type	of elements, or NULL to skip type checks.
+ * @param[in] offset		of the #fr_twheel_entry_t in each element.
+ * @param[in] now		the current time.  Elements due before this
+ *				expire on the next call to #fr_twheel_peek.
+ * @return
+ *	- NULL on error.
+ *	- a new timer wheel.
+ */
+fr_twheel_t *_fr_twheel_create(TALLOC_CTX *ctx, char const *talloc_type, size_t offset, fr_time_t now)
+{
+	fr_twheel_t	*tw;
+	unsigned int	level, slot;
+	size_t		list_offset = offset + offsetof(fr_twheel_entry_t, entry);
+
+	tw = talloc_zero(ctx, fr_twheel_t);
+	if (!tw) return NULL;
+
+	tw->offset = offset;
+	tw->cur = now >> TW_TICK_SHIFT;
+
+	_fr_dlist_init(&tw->expired, list_offset, talloc_type);
+	for (level = 0; level < TW_LEVELS; level++) {
+		for (slot = 0; slot < TW_SLOTS; slot++) {
+			_fr_dlist_init(&tw->slots[level][slot], list_offset, talloc_type);
+		}
+	}
+
+	return tw;
+}
+
+/** Insert an element into the wheel
+ *
+ * @param[in] tw	to insert into.
+ * @param[in] data	to insert.
+ * @param[in] when	the element expires.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the element is already in the wheel.
+ */
+int fr_twheel_insert(fr_twheel_t *tw, void *data, fr_time_t when)
+{
+	fr_twheel_entry_t *e = twheel_entry(tw, data);
+
+	if (e->head) return -1;
+
+	e->when = when;
+	twheel_place(tw, data);
+	tw->num_elements++;
+
+	return 0;
+}
+
+/** Remove an element from the wheel
+ *
+ * @param[in] tw	to remove from.
+ * @param[in] data	to remove.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the element isn't in the wheel.
+ */
+int fr_twheel_extract(fr_twheel_t *tw, void *data)
+{
+	if (!twheel_entry(tw, data)->head) return -1;
+
+	twheel_unlink(tw, data);
+	tw->num_elements--;
+
+	return 0;
+}
+
+/** Return an element which is due, without removing it
+ *
+ * The first call advances the wheel, and moves all of the due elements
+ * to the expired list.  Later calls return elements from that list until
+ * it's empty.  The caller is expected to #fr_twheel_extract each
+ * element before calling this function again.
+ *
+ * Elements are returned in order of expiry.
+ *
+ * @param[in] tw	to check.
+ * @param[in] now	the current time.
+ * @return
+ *	- NULL if no elements are due.
+ *	- an element which is due.
+ */
+void *fr_twheel_peek(fr_twheel_t *tw, fr_time_t now)
+{
+	if (fr_dlist_empty(&tw->expired)) {
+		if (!tw->num_elements) return NULL;
+
+		twheel_advance(tw, now);
+	}
+
+	return fr_dlist_head(&tw->expired);
+}
+
+/** Return when the wheel next needs to be checked
+ *
+ * If the first element is in level 0, this is its expiry time.  Otherwise
+ * it's the start of the slot the first element is in, which is no later
+ * than the element's expiry time.
+ *
+ * @param[in] tw	to check.
+ * @return
+ *	- 0 if the wheel is empty.
+ *	- the time at which #fr_twheel_peek should next be called.
+ */
+fr_time_t fr_twheel_next(fr_twheel_t *tw)
+{
+	uint64_t	tick;
+	unsigned int	level;
+	fr_time_t	first = 0;
+	void		*data;
+	fr_dlist_head_t	*head;
+
+	data = fr_dlist_head(&tw->expired);
+	if (data) return twheel_entry(tw, data)->when;
+
+	if (!twheel_next_slot(tw, &tick, &level)) return 0;
+
+	if (level > 0) return tick << TW_TICK_SHIFT;
+
+	/*
+	 *	Level 0 slots cover one tick, and hold few elements,
+	 *	so we can afford to find the exact time.
+	 */
+	head = &tw->slots[0][tick & TW_MASK];
+	for (data = fr_dlist_head(head); data; data = fr_dlist_next(head, data)) {
+		fr_time_t when = twheel_entry(tw, data)->when;
+
+		if (!first || (when < first)) first = when;
+	}
+
+	return first;
+}
+
+/** Return the number of elements in the wheel
+ *
+ */
+uint32_t fr_twheel_num_elements(fr_twheel_t const *tw)
+{
+	return tw->num_elements;
+}
@@ -0,0 +1,84 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Hierarchical timer wheels
+ *
+ * @file src/lib/util/twheel.h
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSIDH(twheel_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/util/dlist.h>
+
+#include <stdint.h>
+#include <talloc.h>
+
+typedef struct fr_twheel_t fr_twheel_t;
+
+/** Embedded in each element stored in a timer wheel
+ *
+ * Must be zeroed before the element is first inserted.
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in a slot, or in the expired list.
+	fr_time_t		when;			//!< When the element expires.
+	fr_dlist_head_t		*head;			//!< List the element is in.  NULL if it's not
+							///< in the wheel.
+} fr_twheel_entry_t;
+
+/** Creates a timer wheel that can be used with non-talloced elements
+ *
+ * @param[in] _ctx		Talloc ctx to allocate the wheel in.
+ * @param[in] _type		Of elements.
+ * @param[in] _field		#fr_twheel_entry_t within the element.
+ * @param[in] _now		the current time.
+ */
+#define fr_twheel_create(_ctx, _type, _field, _now) \
+	_fr_twheel_create(_ctx, NULL, (size_t)offsetof(_type, _field), _now)
+
+/** Creates a timer wheel that verifies elements are of a specific talloc type
+ *
+ * @param[in] _ctx		Talloc ctx to allocate the wheel in.
+ * @param[in] _talloc_type	of elements.
+ * @param[in] _field		#fr_twheel_entry_t within the element.
+ * @param[in] _now		the current time.
+ * @return
+ *	- A new timer wheel.
+ *	- NULL on error.
+ */
+#define fr_twheel_talloc_create(_ctx, _talloc_type, _field, _now) \
+	_fr_twheel_create(_ctx, #_talloc_type, (size_t)offsetof(_talloc_type, _field), _now)
+
+fr_twheel_t	*_fr_twheel_create(TALLOC_CTX *ctx, char const *talloc_type, size_t offset, fr_time_t now);
+
+int		fr_twheel_insert(fr_twheel_t *tw, void *data, fr_time_t when);
+int		fr_twheel_extract(fr_twheel_t *tw, void *data);
+void		*fr_twheel_peek(fr_twheel_t *tw, fr_time_t now);
+fr_time_t	fr_twheel_next(fr_twheel_t *tw);
+uint32_t	fr_twheel_num_elements(fr_twheel_t const *tw);
+
+#ifdef __cplusplus
+}
+#endif
@@ -256,3 +256,528 @@ done:
 
 	return received;
 }
+
+/** Fill in the addresses of a datagram from the msghdr it was read with
+ *
+ * @param[in,out] d the datagram.  data_len is set to zero if the source
+ *	address is unusable, so that the datagram is ignored.
+ * @param[in] msg the datagram was read with, or NULL for connected sockets.
+ * @param[in] dst the address the socket is bound to.
+ * @param[in] sizeof_dst the length of dst.
+ * @param[in,out] now the current time, if it has already been looked up.
+ */
+static void udp_datagram_addr(udp_datagram_t *d, struct msghdr *msg,
+			      struct sockaddr_storage const *dst, socklen_t sizeof_dst, struct timeval *now)
+{
+	d->if_index = 0;
+	d->when.tv_sec = 0;
+	d->when.tv_usec = 0;
+
+	if (msg) {
+		/*
+		 *	Unknown address family.  Mark the
+		 *	datagram as empty, so that it's ignored.
+		 */
+		if (fr_ipaddr_from_sockaddr(msg->msg_name, msg->msg_namelen,
+					    &d->src_ipaddr, &d->src_port) < 0) {
+			d->data_len = 0;
+			return;
+		}
+
+#ifdef WITH_UDPFROMTO
+		{
+			struct sockaddr_storage	to = *dst;
+			socklen_t		sizeof_to = sizeof_dst;
+
+			udpfromto_cmsg_parse(msg, (struct sockaddr *)&to, &sizeof_to,
+					     &d->if_index, &d->when);
+			fr_ipaddr_from_sockaddr(&to, sizeof_to, &d->dst_ipaddr, &d->dst_port);
+		}
+#else
+		fr_ipaddr_from_sockaddr(dst, sizeof_dst, &d->dst_ipaddr, &d->dst_port);
+#endif
+	}
+
+	if (!d->when.tv_sec) {
+		if (!now->tv_sec) gettimeofday(now, NULL);
+		d->when = *now;
+	}
+}
+
+/** Read multiple UDP packets with one system call
+ *
+ * Where recvmmsg() is not available, this function falls back to
+ * calling udp_recv() in a loop.
+ *
+ * @param[in] sockfd we're reading from.
+ * @param[out] dgram array of datagrams to fill in.  The data pointer of
+ *	each entry must point to a buffer of buffer_len bytes.
+ * @param[in] num number of entries in the dgram array.
+ * @param[in] buffer_len size of each data buffer.
+ * @param[in] flags for things.  #UDP_FLAGS_PEEK is not supported.
+ * @return
+ *	- > 0 on success (number of datagrams read).
+ *	- 0 if there was no data to read.
+ *	- < 0 on failure.
+ */
+int udp_recv_mmsg(int sockfd, udp_datagram_t *dgram, int num, size_t buffer_len, int flags)
+{
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr		msgvec[UDP_BATCH_MAX];
+	struct iovec		iov[UDP_BATCH_MAX];
+	struct sockaddr_storage	src[UDP_BATCH_MAX];
+#ifdef WITH_UDPFROMTO
+	char			cbuf[UDP_BATCH_MAX][UDPFROMTO_CMSG_SIZE];
+#endif
+	struct sockaddr_storage	dst;
+	socklen_t		sizeof_dst = sizeof(dst);
+	struct timeval		now = { 0, 0 };
+	bool			connected = ((flags & UDP_FLAGS_CONNECTED) != 0);
+	int			i, received;
+
+	if (num > UDP_BATCH_MAX) num = UDP_BATCH_MAX;
+
+	/*
+	 *	The destination is the address we're bound to, unless
+	 *	IP_PKTINFO tells us something more specific.
+	 */
+	if (!connected && (getsockname(sockfd, (struct sockaddr *)&dst, &sizeof_dst) < 0)) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	memset(msgvec, 0, sizeof(msgvec[0]) * num);
+
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = dgram[i].data;
+		iov[i].iov_len = buffer_len;
+
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+
+		if (connected) continue;
+
+		msgvec[i].msg_hdr.msg_name = &src[i];
+		msgvec[i].msg_hdr.msg_namelen = sizeof(src[i]);
+#ifdef WITH_UDPFROMTO
+		msgvec[i].msg_hdr.msg_control = cbuf[i];
+		msgvec[i].msg_hdr.msg_controllen = sizeof(cbuf[i]);
+#endif
+	}
+
+	received = recvmmsg(sockfd, msgvec, num, 0, NULL);
+	if (received < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN) || (errno == EINTR)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < received; i++) {
+		udp_datagram_t *d = &dgram[i];
+
+		d->data_len = msgvec[i].msg_len;
+		udp_datagram_addr(d, connected ? NULL : &msgvec[i].msg_hdr, &dst, sizeof_dst, &now);
+	}
+
+	return received;
+#else
+	int			i;
+
+	for (i = 0; i < num; i++) {
+		ssize_t		received;
+
+		received = udp_recv(sockfd, dgram[i].data, buffer_len, flags & ~UDP_FLAGS_PEEK,
+				    &dgram[i].src_ipaddr, &dgram[i].src_port,
+				    &dgram[i].dst_ipaddr, &dgram[i].dst_port,
+				    &dgram[i].if_index, &dgram[i].when);
+		if (received < 0) return (i > 0) ? i : -1;
+		if (received == 0) break;
+
+		dgram[i].data_len = received;
+	}
+
+	return i;
+#endif
+}
+
+/** Write multiple UDP packets with one system call
+ *
+ * Where sendmmsg() is not available, this function falls back to
+ * calling udp_send() in a loop.
+ *
+ * Datagrams which the OS refuses to send are skipped.  If the socket
+ * would block, the remaining datagrams are discarded.  As with any
+ * other UDP packet loss, the client will retransmit.
+ *
+ * @param[in] sockfd we're writing to.
+ * @param[in] dgram array of datagrams to write.
+ * @param[in] num number of entries in the dgram array.
+ * @param[in] flags for things.
+ * @return
+ *	- >= 0 the number of datagrams written.
+ *	- < 0 on failure, when no datagrams could be written.
+ */
+int udp_send_mmsg(int sockfd, udp_datagram_t *dgram, int num, int flags)
+{
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr		msgvec[UDP_BATCH_MAX];
+	struct iovec		iov[UDP_BATCH_MAX];
+	struct sockaddr_storage	dst[UDP_BATCH_MAX];
+#ifdef WITH_UDPFROMTO
+	char			cbuf[UDP_BATCH_MAX][UDPFROMTO_CMSG_SIZE];
+	bool			use_src = true;
+#endif
+	bool			connected = ((flags & UDP_FLAGS_CONNECTED) != 0);
+	int			i, sent, done = 0, written = 0;
+
+	if (num > UDP_BATCH_MAX) num = UDP_BATCH_MAX;
+
+#if defined(WITH_UDPFROMTO) && defined(__FreeBSD__)
+	/*
+	 *	See sendfromto().  FreeBSD won't let us set the source
+	 *	address on sockets which are bound to a specific
+	 *	address.
+	 */
+	if (!connected) {
+		struct sockaddr_storage	bound;
+		socklen_t		sizeof_bound = sizeof(bound);
+
+		if (getsockname(sockfd, (struct sockaddr *)&bound, &sizeof_bound) < 0) {
+			fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		switch (bound.ss_family) {
+		case AF_INET:
+			if (((struct sockaddr_in *) &bound)->sin_addr.s_addr != INADDR_ANY) use_src = false;
+			break;
+
+		case AF_INET6:
+			if (!IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *) &bound)->sin6_addr)) use_src = false;
+			break;
+		}
+	}
+#endif
+
+	memset(msgvec, 0, sizeof(msgvec[0]) * num);
+
+	for (i = 0; i < num; i++) {
+		udp_datagram_t	*d = &dgram[i];
+		socklen_t	sizeof_dst;
+
+		iov[i].iov_base = d->data;
+		iov[i].iov_len = d->data_len;
+
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+
+		if (connected) continue;
+
+		if (fr_ipaddr_to_sockaddr(&d->dst_ipaddr, d->dst_port, &dst[i], &sizeof_dst) < 0) return -1;
+
+		msgvec[i].msg_hdr.msg_name = &dst[i];
+		msgvec[i].msg_hdr.msg_namelen = sizeof_dst;
+
+#ifdef WITH_UDPFROMTO
+		/*
+		 *	And if they don't specify a source IP address, don't
+		 *	use udpfromto.
+		 */
+		if (use_src && (d->src_ipaddr.af != AF_UNSPEC) && (d->dst_ipaddr.af != AF_UNSPEC) &&
+		    !fr_ipaddr_is_inaddr_any(&d->src_ipaddr)) {
+			struct sockaddr_storage	src;
+			socklen_t		sizeof_src;
+
+			fr_ipaddr_to_sockaddr(&d->src_ipaddr, d->src_port, &src, &sizeof_src);
+
+			memset(cbuf[i], 0, sizeof(cbuf[i]));
+			udpfromto_cmsg_build(&msgvec[i].msg_hdr, cbuf[i], (struct sockaddr *)&src, d->if_index);
+		}
+#endif
+	}
+
+	while (done < num) {
+		sent = sendmmsg(sockfd, msgvec + done, num - done, 0);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+
+			fr_strerror_printf("udp_sendmmsg failed: %s", fr_syserror(errno));
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) break;
+
+			/*
+			 *	Skip the datagram which caused the error.
+			 */
+			done++;
+			continue;
+		}
+
+		done += sent;
+		written += sent;
+	}
+
+	if (!written && (num > 0)) return -1;
+
+	return written;
+#else
+	int			i, written = 0;
+
+	for (i = 0; i < num; i++) {
+		if (udp_send(sockfd, dgram[i].data, dgram[i].data_len, flags,
+			     &dgram[i].src_ipaddr, dgram[i].src_port, dgram[i].if_index,
+			     &dgram[i].dst_ipaddr, dgram[i].dst_port) < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) break;
+			continue;
+		}
+
+		written++;
+	}
+
+	if (!written && (num > 0)) return -1;
+
+	return written;
+#endif
+}
+
+/** Allocate a batch of datagram buffers
+ *
+ * @param[in] ctx to allocate the batch in.
+ * @param[in] num maximum number of datagrams in the batch.
+ * @param[in] buffer_len size of each datagram buffer.
+ * @return
+ *	- NULL on error.
+ *	- the new batch.
+ */
+udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, int num, size_t buffer_len)
+{
+	udp_batch_t	*batch;
+	uint8_t		*buffer;
+	int		i;
+
+	if (num < 1) num = 1;
+	if (num > UDP_BATCH_MAX) num = UDP_BATCH_MAX;
+
+	batch = talloc_zero(ctx, udp_batch_t);
+	if (!batch) return NULL;
+
+	batch->num = num;
+	batch->buffer_len = buffer_len;
+
+	batch->dgram = talloc_zero_array(batch, udp_datagram_t, num);
+	buffer = talloc_array(batch, uint8_t, num * buffer_len);
+	if (!batch->dgram || !buffer) {
+		talloc_free(batch);
+		return NULL;
+	}
+
+	for (i = 0; i < num; i++) batch->dgram[i].data = buffer + (i * buffer_len);
+
+	return batch;
+}
+
+/** Read one UDP packet, via a batch
+ *
+ * If the batch is empty, up to batch->num datagrams are read from the
+ * socket with one system call.  The next datagram in the batch is
+ * then copied to the caller's buffer.  Callers MUST keep calling this
+ * function while udp_batch_pending() returns non-zero, as the socket
+ * may no longer be readable.
+ *
+ * If batch is NULL, this function is the same as udp_recv().
+ *
+ * @param[in] batch to read from, or NULL.
+ * @param[in] sockfd we're reading from.
+ * @param[out] data pointer where data will be written
+ * @param[in] data_len length of data to read
+ * @param[in] flags for things.  #UDP_FLAGS_PEEK is only supported when batch is NULL.
+ * @param[out] src_ipaddr of the packet.
+ * @param[out] src_port of the packet.
+ * @param[out] dst_ipaddr of the packet.
+ * @param[out] dst_port of the packet.
+ * @param[out] if_index of the interface that received the packet.
+ * @param[out] when the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 if there was no data to read.
+ *	- < 0 on failure.
+ */
+ssize_t udp_batch_recv(udp_batch_t *batch, int sockfd, void *data, size_t data_len, int flags,
+		       fr_ipaddr_t *src_ipaddr, uint16_t *src_port,
+		       fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
+		       struct timeval *when)
+{
+	if (!batch) return udp_recv(sockfd, data, data_len, flags,
+				    src_ipaddr, src_port, dst_ipaddr, dst_port, if_index, when);
+
+	if (batch->next == batch->used) {
+		int received;
+
+		batch->next = batch->used = 0;
+
+		received = udp_recv_mmsg(sockfd, batch->dgram, batch->num, batch->buffer_len, flags);
+		if (received <= 0) return received;
+
+		batch->syscalls++;
+		batch->datagrams += received;
+		batch->used = received;
+	}
+
+	return udp_batch_pop(batch, data, data_len, src_ipaddr, src_port, dst_ipaddr, dst_port, if_index, when);
+}
+
+/** Add a datagram to a read batch
+ *
+ * This is used when the datagrams are read by something other than
+ * udp_batch_recv(), such as an io_uring multishot receive.  They are
+ * then returned by udp_batch_pop().
+ *
+ * @param[in] batch to add the datagram to.
+ * @param[in] data of the datagram.
+ * @param[in] data_len length of the datagram.  It's truncated to the
+ *	size of the batch buffers.
+ * @param[in] msg the datagram was read with, or NULL for connected sockets.
+ *	msg_name and msg_control are used to get the addresses.
+ * @param[in] dst the address the socket is bound to.
+ * @param[in] sizeof_dst the length of dst.
+ * @return
+ *	- 0 on success.
+ *	- < 0 if the batch is full.
+ */
+int udp_batch_push(udp_batch_t *batch, uint8_t const *data, size_t data_len, struct msghdr *msg,
+		   struct sockaddr_storage const *dst, socklen_t sizeof_dst)
+{
+	udp_datagram_t	*d;
+	struct timeval	now = { 0, 0 };
+
+	if (batch->next == batch->used) batch->next = batch->used = 0;
+
+	if (batch->used == batch->num) return -1;
+
+	d = &batch->dgram[batch->used++];
+
+	if (data_len > batch->buffer_len) data_len = batch->buffer_len;
+	memcpy(d->data, data, data_len);
+	d->data_len = data_len;
+
+	udp_datagram_addr(d, msg, dst, sizeof_dst, &now);
+
+	batch->datagrams++;
+
+	return 0;
+}
+
+/** Return the next datagram from a read batch, without reading the socket
+ *
+ * @param[in] batch to read from.
+ * @param[out] data pointer where data will be written
+ * @param[in] data_len length of data to read
+ * @param[out] src_ipaddr of the packet.
+ * @param[out] src_port of the packet.
+ * @param[out] dst_ipaddr of the packet.
+ * @param[out] dst_port of the packet.
+ * @param[out] if_index of the interface that received the packet.
+ * @param[out] when the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 if the batch is empty.
+ */
+ssize_t udp_batch_pop(udp_batch_t *batch, void *data, size_t data_len,
+		      fr_ipaddr_t *src_ipaddr, uint16_t *src_port,
+		      fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
+		      struct timeval *when)
+{
+	udp_datagram_t	*d;
+	size_t		len;
+
+	if (batch->next == batch->used) return 0;
+
+	d = &batch->dgram[batch->next++];
+
+	/*
+	 *	The OS discards any data in the packet after "len"
+	 *	bytes, so we do the same.
+	 */
+	len = d->data_len;
+	if (len > data_len) len = data_len;
+	memcpy(data, d->data, len);
+
+	if (src_ipaddr) *src_ipaddr = d->src_ipaddr;
+	if (src_port) *src_port = d->src_port;
+	if (dst_ipaddr) *dst_ipaddr = d->dst_ipaddr;
+	if (dst_port) *dst_port = d->dst_port;
+	if (if_index) *if_index = d->if_index;
+	if (when) *when = d->when;
+
+	return len;
+}
+
+/** Queue one UDP packet for writing, via a batch
+ *
+ * The packet is copied to the batch, and written when the batch is
+ * full, or when udp_batch_flush() is called.
+ *
+ * If batch is NULL, this function is the same as udp_send().
+ *
+ * @param[in] batch to write to, or NULL.
+ * @param[in] sockfd we're writing to.
+ * @param[in] data pointer to data to send
+ * @param[in] data_len length of data to send
+ * @param[in] flags to pass to send(), or sendto()
+ * @param[in] src_ipaddr of the packet.
+ * @param[in] src_port of the packet.
+ * @param[in] if_index of the packet.
+ * @param[in] dst_ipaddr of the packet.
+ * @param[in] dst_port of the packet.
+ * @return
+ *	- > 0 on success (number of bytes written or queued).
+ *	- < 0 on failure.
+ */
+ssize_t udp_batch_send(udp_batch_t *batch, int sockfd, void *data, size_t data_len, int flags,
+		       fr_ipaddr_t const *src_ipaddr, uint16_t src_port, int if_index,
+		       fr_ipaddr_t const *dst_ipaddr, uint16_t dst_port)
+{
+	udp_datagram_t	*d;
+
+	if (!batch || (data_len > batch->buffer_len)) {
+		return udp_send(sockfd, data, data_len, flags,
+				src_ipaddr, src_port, if_index, dst_ipaddr, dst_port);
+	}
+
+	if (batch->used == batch->num) (void) udp_batch_flush(batch, sockfd, flags);
+
+	d = &batch->dgram[batch->used++];
+
+	memcpy(d->data, data, data_len);
+	d->data_len = data_len;
+	d->src_ipaddr = *src_ipaddr;
+	d->src_port = src_port;
+	d->if_index = if_index;
+	d->dst_ipaddr = *dst_ipaddr;
+	d->dst_port = dst_port;
+
+	return data_len;
+}
+
+/** Write all of the packets queued in a batch
+ *
+ * @param[in] batch to write, or NULL.
+ * @param[in] sockfd we're writing to.
+ * @param[in] flags for things.
+ * @return
+ *	- >= 0 the number of datagrams written.
+ *	- < 0 on failure.
+ */
+int udp_batch_flush(udp_batch_t *batch, int sockfd, int flags)
+{
+	int sent;
+
+	if (!batch || !batch->used) return 0;
+
+	sent = udp_send_mmsg(sockfd, batch->dgram, batch->used, flags);
+	batch->used = 0;
+
+	batch->syscalls++;
+	if (sent > 0) batch->datagrams += sent;
+
+	return sent;
+}
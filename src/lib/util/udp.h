@@ -33,11 +33,47 @@ extern "C" {
 #  include <freeradius-devel/util/udpfromto.h>
 #endif
 #include <freeradius-devel/util/inet.h>
+#include <talloc.h>
 
 #define UDP_FLAGS_NONE		(0)
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+/** Maximum number of datagrams which are read or written in one system call
+ *
+ */
+#define UDP_BATCH_MAX		(64)
+
+/** One datagram in a batch
+ *
+ */
+typedef struct {
+	uint8_t			*data;			//!< Datagram buffer.
+	size_t			data_len;		//!< Length of the datagram.
+
+	fr_ipaddr_t		src_ipaddr;		//!< Source IP address.
+	uint16_t		src_port;		//!< Source port.
+	fr_ipaddr_t		dst_ipaddr;		//!< Destination IP address.
+	uint16_t		dst_port;		//!< Destination port.
+	int			if_index;		//!< Interface the datagram was received on / sent to.
+	struct timeval		when;			//!< When the datagram was received.
+} udp_datagram_t;
+
+/** A set of datagrams read with one recvmmsg(), or written with one sendmmsg()
+ *
+ */
+typedef struct {
+	int			num;			//!< Maximum number of datagrams in the batch.
+	int			used;			//!< Number of datagrams read, or queued for writing.
+	int			next;			//!< Next datagram to return from a read batch.
+	size_t			buffer_len;		//!< Size of each datagram buffer.
+
+	uint64_t		syscalls;		//!< How many system calls we've made.
+	uint64_t		datagrams;		//!< How many datagrams those system calls transferred.
+
+	udp_datagram_t		*dgram;			//!< Array of datagrams.
+} udp_batch_t;
+
 ssize_t udp_send(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t const *src_ipaddr, uint16_t src_port, int if_index,
 		 fr_ipaddr_t const *dst_ipaddr, uint16_t dst_port);
@@ -51,6 +87,41 @@ ssize_t udp_recv(int sockfd, void *data, size_t data_len, int flags,
 		 fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
 		 struct timeval *when);
 
+int udp_recv_mmsg(int sockfd, udp_datagram_t *dgram, int num, size_t buffer_len, int flags);
+
+int udp_send_mmsg(int sockfd, udp_datagram_t *dgram, int num, int flags);
+
+udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, int num, size_t buffer_len);
+
+ssize_t udp_batch_recv(udp_batch_t *batch, int sockfd, void *data, size_t data_len, int flags,
+		       fr_ipaddr_t *src_ipaddr, uint16_t *src_port,
+		       fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
+		       struct timeval *when);
+
+ssize_t udp_batch_send(udp_batch_t *batch, int sockfd, void *data, size_t data_len, int flags,
+		       fr_ipaddr_t const *src_ipaddr, uint16_t src_port, int if_index,
+		       fr_ipaddr_t const *dst_ipaddr, uint16_t dst_port);
+
+int udp_batch_push(udp_batch_t *batch, uint8_t const *data, size_t data_len, struct msghdr *msg,
+		   struct sockaddr_storage const *dst, socklen_t sizeof_dst);
+
+ssize_t udp_batch_pop(udp_batch_t *batch, void *data, size_t data_len,
+		      fr_ipaddr_t *src_ipaddr, uint16_t *src_port,
+		      fr_ipaddr_t *dst_ipaddr, uint16_t *dst_port, int *if_index,
+		      struct timeval *when);
+
+int udp_batch_flush(udp_batch_t *batch, int sockfd, int flags);
+
+/** Return the number of datagrams which have been read, but not yet returned by udp_batch_recv()
+ *
+ */
+static inline int udp_batch_pending(udp_batch_t const *batch)
+{
+	if (!batch) return 0;
+
+	return batch->used - batch->next;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,9 +36,20 @@ extern "C" {
 #include <netinet/in.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <sys/socket.h>
+
+/** Size of the buffer needed for the control data of one datagram
+ *
+ */
+#define UDPFROMTO_CMSG_SIZE	(256)
 
 int	udpfromto_init(int s);
 
+void	udpfromto_cmsg_parse(struct msghdr *msgh, struct sockaddr *to, socklen_t *to_len,
+			     int *if_index, struct timeval *when);
+
+void	udpfromto_cmsg_build(struct msghdr *msgh, char *cbuf, struct sockaddr const *from, int if_index);
+
 int	recvfromto(int s, void *buf, size_t len, int flags,
 	       	   struct sockaddr *from, socklen_t *fromlen,
 		   struct sockaddr *to, socklen_t *tolen,
@@ -0,0 +1,1027 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Asynchronous I/O using io_uring
+ *
+ * Queues writes and datagram reads on an io_uring, so that many of
+ * them can be started or completed with one system call.
+ *
+ * Operations are queued on the submission ring, and are only passed
+ * to the kernel when #fr_uring_submit is called.  When the ring is
+ * inserted into an event list, that happens once per loop, just
+ * before the event list waits for events.
+ *
+ * The kernel signals an eventfd whenever a completion is posted.
+ * That eventfd is inserted into the event list (or returned to the
+ * caller), so the completions are processed from the normal event
+ * loop, without blocking.
+ *
+ * We use the kernel interface directly, instead of liburing, as
+ * we only need a small subset of it.  If the kernel doesn't support
+ * io_uring, or the operations we need, #fr_uring_alloc returns NULL,
+ * and the caller should fall back to the normal system calls.
+ *
+ * @file src/lib/util/uring.c
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/uring.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#  include <linux/io_uring.h>
+#  include <sys/eventfd.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+/*
+ *	Multishot receives need kernel 6.0, which also has the
+ *	provided buffer rings we use with them.  If the headers are
+ *	older than that, we can still do writes.
+ */
+#ifdef IORING_RECV_MULTISHOT
+#  define HAVE_URING_RECV_MULTISHOT
+#endif
+
+/*
+ *	The rings are shared with the kernel.  The head and tail
+ *	indexes have to be read and written with the correct
+ *	ordering, or we may see stale entries.
+ */
+#define URING_LOAD(_p)		__atomic_load_n(_p, __ATOMIC_ACQUIRE)
+#define URING_STORE(_p, _v)	__atomic_store_n(_p, _v, __ATOMIC_RELEASE)
+
+typedef enum {
+	URING_OP_WRITE = 1,			//!< A (possibly partial) write to a file.
+	URING_OP_RECV				//!< A multishot receive.
+} uring_op_type_t;
+
+/** Common header for everything we put in an SQE's user_data
+ *
+ */
+typedef struct {
+	uring_op_type_t		type;
+	int			fd;
+} uring_op_t;
+
+/** A write which is in progress
+ *
+ */
+typedef struct {
+	uring_op_t		op;			//!< Must be first.
+
+	uint8_t const		*data;			//!< Data to write.
+	size_t			data_len;		//!< Total length of the data.
+	size_t			written;		//!< How much has been written so far.
+
+	fr_uring_write_cb_t	callback;		//!< Run when the write completes.
+	void			*uctx;			//!< Passed to the callback.
+
+	fr_dlist_t		entry;			//!< Entry in the free list.
+} uring_write_t;
+
+/** A multishot receive, and the buffers it reads into
+ *
+ */
+struct fr_uring_recv_t {
+	uring_op_t		op;			//!< Must be first.
+
+	fr_uring_t		*ur;			//!< The ring we're armed on.
+
+	uint16_t		bgid;			//!< Buffer group ID.
+	uint16_t		tail;			//!< Our copy of the buffer ring tail.
+	uint32_t		num;			//!< Number of buffers.  Always a power of 2.
+	size_t			buffer_len;		//!< Size of each buffer, including the headers.
+
+	struct io_uring_buf_ring *br;			//!< Ring of buffers which we give to the kernel.
+	size_t			br_size;		//!< Size of the mmap()ed ring.
+	uint8_t			*buffers;		//!< Memory for the buffers.
+
+	struct msghdr		msg;			//!< Tells the kernel how much room to leave for
+							///< the name and control data.
+
+	fr_uring_recv_cb_t	callback;		//!< Run for each datagram.
+	void			*uctx;			//!< Passed to the callback.
+
+	bool			armed;			//!< Whether the kernel has a receive outstanding.
+	bool			cancelled;		//!< We're being freed.  Completions are discarded,
+							///< and the receive isn't re-armed.
+};
+
+struct fr_uring_t {
+	int			fd;			//!< From io_uring_setup().
+	int			event_fd;		//!< Signalled when completions are posted.
+	fr_event_list_t		*el;			//!< The event list we're inserted into.
+
+	void			*sq_ring;		//!< mmap()ed submission ring.
+	size_t			sq_ring_size;
+	unsigned		*sq_head;
+	unsigned		*sq_tail;
+	unsigned		*sq_array;
+	unsigned		*sq_flags;
+	unsigned		sq_mask;
+	unsigned		sq_entries;
+	unsigned		sq_local_tail;		//!< Tail including SQEs we haven't published yet.
+
+	struct io_uring_sqe	*sqes;			//!< mmap()ed submission entries.
+	size_t			sqes_size;
+
+	void			*cq_ring;		//!< mmap()ed completion ring.
+	size_t			cq_ring_size;
+	unsigned		*cq_head;
+	unsigned		*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	bool			recv_multishot;		//!< Whether the kernel supports multishot receives.
+	uint16_t		next_bgid;		//!< Buffer group ID for the next multishot receive.
+
+	fr_dlist_head_t		free_writes;		//!< Write contexts which can be re-used.
+};
+
+static int _uring_pre(void *uctx, struct timeval *now);
+
+static inline int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/** Free the ring, and everything associated with it
+ *
+ * Operations which are still outstanding are cancelled by the
+ * kernel.  Their callbacks are not run.
+ */
+static int _uring_free(fr_uring_t *ur)
+{
+	uring_write_t *w;
+
+	if (ur->el) {
+		(void) fr_event_pre_delete(ur->el, _uring_pre, ur);
+		(void) fr_event_fd_delete(ur->el, ur->event_fd, FR_EVENT_FILTER_IO);
+	}
+
+	if (ur->sqes) munmap(ur->sqes, ur->sqes_size);
+	if (ur->cq_ring && (ur->cq_ring != ur->sq_ring)) munmap(ur->cq_ring, ur->cq_ring_size);
+	if (ur->sq_ring) munmap(ur->sq_ring, ur->sq_ring_size);
+
+	if (ur->event_fd >= 0) close(ur->event_fd);
+	if (ur->fd >= 0) close(ur->fd);
+
+	/*
+	 *	Our children (e.g. multishot receives) are freed
+	 *	after this.  Closing the ring cancelled their
+	 *	operations, so tell them there's nothing left to
+	 *	clean up in the kernel.
+	 */
+	ur->fd = ur->event_fd = -1;
+
+	while ((w = fr_dlist_head(&ur->free_writes))) {
+		fr_dlist_remove(&ur->free_writes, w);
+		talloc_free(w);
+	}
+
+	return 0;
+}
+
+/** Check that the kernel supports the operations we use
+ *
+ */
+static int uring_probe(fr_uring_t *ur)
+{
+	struct io_uring_probe	*probe;
+	size_t			len = sizeof(*probe) + (IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+
+	probe = talloc_zero_size(NULL, len);
+	if (!probe) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	if (uring_register(ur->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) {
+		fr_strerror_printf("Failed probing io_uring: %s", fr_syserror(errno));
+	error:
+		talloc_free(probe);
+		return -1;
+	}
+
+	if ((probe->ops_len <= IORING_OP_WRITE) || !(probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)) {
+		fr_strerror_printf("io_uring does not support writes");
+		goto error;
+	}
+
+#ifdef HAVE_URING_RECV_MULTISHOT
+	/*
+	 *	There's no way to probe for multishot receives, but
+	 *	they were added in the same release as zero copy
+	 *	sends, which we can probe for.
+	 */
+	ur->recv_multishot = (probe->ops_len > IORING_OP_SEND_ZC) &&
+			     (probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED);
+#endif
+
+	talloc_free(probe);
+	return 0;
+}
+
+/** Allocate a new io_uring
+ *
+ * @param[in] ctx	to allocate the ring in.
+ * @param[in] entries	Size of the submission ring.  The kernel rounds
+ *			this up to a power of 2.
+ * @return
+ *	- A new ring.
+ *	- NULL if the kernel doesn't support io_uring.  The caller
+ *	  should use normal system calls instead.
+ */
+fr_uring_t *fr_uring_alloc(TALLOC_CTX *ctx, uint32_t entries)
+{
+	fr_uring_t		*ur;
+	struct io_uring_params	p;
+	void			*ptr;
+
+	ur = talloc_zero(ctx, fr_uring_t);
+	if (!ur) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+	ur->fd = ur->event_fd = -1;
+	fr_dlist_init(&ur->free_writes, uring_write_t, entry);
+	talloc_set_destructor(ur, _uring_free);
+
+	memset(&p, 0, sizeof(p));
+	ur->fd = uring_setup(entries, &p);
+	if (ur->fd < 0) {
+		fr_strerror_printf("Failed creating io_uring: %s", fr_syserror(errno));
+	error:
+		talloc_free(ur);
+		return NULL;
+	}
+
+	if (uring_probe(ur) < 0) goto error;
+
+	ur->sq_ring_size = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+	ur->cq_ring_size = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+
+	/*
+	 *	Newer kernels let us map both rings with one mmap().
+	 */
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ur->cq_ring_size > ur->sq_ring_size) ur->sq_ring_size = ur->cq_ring_size;
+		ur->cq_ring_size = ur->sq_ring_size;
+	}
+
+	ptr = mmap(NULL, ur->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   ur->fd, IORING_OFF_SQ_RING);
+	if (ptr == MAP_FAILED) {
+	map_error:
+		fr_strerror_printf("Failed mapping io_uring: %s", fr_syserror(errno));
+		goto error;
+	}
+	ur->sq_ring = ptr;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur->cq_ring = ur->sq_ring;
+	} else {
+		ptr = mmap(NULL, ur->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			   ur->fd, IORING_OFF_CQ_RING);
+		if (ptr == MAP_FAILED) goto map_error;
+		ur->cq_ring = ptr;
+	}
+
+	ur->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ptr = mmap(NULL, ur->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		   ur->fd, IORING_OFF_SQES);
+	if (ptr == MAP_FAILED) goto map_error;
+	ur->sqes = ptr;
+
+	ur->sq_head = (unsigned *) ((uint8_t *) ur->sq_ring + p.sq_off.head);
+	ur->sq_tail = (unsigned *) ((uint8_t *) ur->sq_ring + p.sq_off.tail);
+	ur->sq_array = (unsigned *) ((uint8_t *) ur->sq_ring + p.sq_off.array);
+	ur->sq_flags = (unsigned *) ((uint8_t *) ur->sq_ring + p.sq_off.flags);
+	ur->sq_mask = *(unsigned *) ((uint8_t *) ur->sq_ring + p.sq_off.ring_mask);
+	ur->sq_entries = p.sq_entries;
+	ur->sq_local_tail = *ur->sq_tail;
+
+	ur->cq_head = (unsigned *) ((uint8_t *) ur->cq_ring + p.cq_off.head);
+	ur->cq_tail = (unsigned *) ((uint8_t *) ur->cq_ring + p.cq_off.tail);
+	ur->cq_mask = *(unsigned *) ((uint8_t *) ur->cq_ring + p.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe *) (void *) ((uint8_t *) ur->cq_ring + p.cq_off.cqes);
+
+	ur->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ur->event_fd < 0) {
+		fr_strerror_printf("Failed creating eventfd: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	if (uring_register(ur->fd, IORING_REGISTER_EVENTFD, &ur->event_fd, 1) < 0) {
+		fr_strerror_printf("Failed registering eventfd with io_uring: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	return ur;
+}
+
+/** Return the file descriptor which becomes readable when completions are available
+ *
+ * This is only needed when the ring is not inserted into an event
+ * list with #fr_uring_event_insert.  The caller should then call
+ * #fr_uring_service when the file descriptor is readable.
+ */
+int fr_uring_fd(fr_uring_t const *ur)
+{
+	return ur->event_fd;
+}
+
+/** Get an SQE to fill in
+ *
+ * If the submission ring is full, the queued SQEs are submitted
+ * to make room.
+ */
+static struct io_uring_sqe *uring_sqe_get(fr_uring_t *ur)
+{
+	struct io_uring_sqe	*sqe;
+	unsigned		idx;
+
+	if ((ur->sq_local_tail - URING_LOAD(ur->sq_head)) >= ur->sq_entries) {
+		if (fr_uring_submit(ur) < 0) return NULL;
+
+		if ((ur->sq_local_tail - URING_LOAD(ur->sq_head)) >= ur->sq_entries) {
+			fr_strerror_printf("io_uring submission queue is full");
+			return NULL;
+		}
+	}
+
+	idx = ur->sq_local_tail & ur->sq_mask;
+	ur->sq_array[idx] = idx;
+	ur->sq_local_tail++;
+
+	sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+/** Pass all queued operations to the kernel
+ *
+ * @param[in] ur	to submit.
+ * @return
+ *	- >= 0 the number of operations submitted.
+ *	- <0 on error.
+ */
+int fr_uring_submit(fr_uring_t *ur)
+{
+	unsigned	to_submit;
+	int		ret;
+
+	to_submit = ur->sq_local_tail - URING_LOAD(ur->sq_head);
+	if (!to_submit) return 0;
+
+	URING_STORE(ur->sq_tail, ur->sq_local_tail);
+
+	do {
+		ret = uring_enter(ur->fd, to_submit, 0, 0);
+	} while ((ret < 0) && (errno == EINTR));
+
+	if (ret < 0) {
+		/*
+		 *	The kernel is short of resources.  Try
+		 *	again on the next loop.
+		 */
+		if ((errno == EAGAIN) || (errno == EBUSY)) return 0;
+
+		fr_strerror_printf("Failed submitting to io_uring: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return ret;
+}
+
+/** Return the number of completions which haven't been processed yet
+ *
+ * If the completion ring overflowed, this is always non-zero, so
+ * that the caller calls #fr_uring_service to fetch the rest.
+ */
+uint32_t fr_uring_completions(fr_uring_t const *ur)
+{
+	uint32_t num = URING_LOAD(ur->cq_tail) - *ur->cq_head;
+
+	if (!num && (URING_LOAD(ur->sq_flags) & IORING_SQ_CQ_OVERFLOW)) return 1;
+
+	return num;
+}
+
+/** Queue the rest of a write
+ *
+ */
+static int uring_write_queue(fr_uring_t *ur, uring_write_t *w)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_sqe_get(ur);
+	if (!sqe) return -1;
+
+	sqe->opcode = IORING_OP_WRITE;
+	sqe->fd = w->op.fd;
+	sqe->addr = (uintptr_t) (w->data + w->written);
+	sqe->len = w->data_len - w->written;
+	sqe->off = (uint64_t) -1;		/* current file position, or the end for O_APPEND */
+	sqe->user_data = (uintptr_t) w;
+
+	return 0;
+}
+
+/** Queue a write
+ *
+ * The data is written at the current file position.  If the file
+ * was opened with O_APPEND, the data is appended, as with write().
+ *
+ * Partial writes are continued automatically.  The callback is run
+ * once all of the data has been written, or on error.
+ *
+ * @param[in] ur	to queue the write on.
+ * @param[in] fd	to write to.
+ * @param[in] data	to write.  Must remain valid until the callback is run.
+ * @param[in] data_len	Length of the data.
+ * @param[in] callback	to run when the write completes.
+ * @param[in] uctx	passed to the callback.
+ * @return
+ *	- 0 on success.
+ *	- <0 on error.  The callback will not be run.
+ */
+int fr_uring_write(fr_uring_t *ur, int fd, void const *data, size_t data_len,
+		   fr_uring_write_cb_t callback, void *uctx)
+{
+	uring_write_t *w;
+
+	w = fr_dlist_head(&ur->free_writes);
+	if (w) {
+		fr_dlist_remove(&ur->free_writes, w);
+	} else {
+		w = talloc_zero(ur, uring_write_t);
+		if (!w) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+	}
+
+	w->op.type = URING_OP_WRITE;
+	w->op.fd = fd;
+	w->data = data;
+	w->data_len = data_len;
+	w->written = 0;
+	w->callback = callback;
+	w->uctx = uctx;
+
+	if (uring_write_queue(ur, w) < 0) {
+		fr_dlist_insert_head(&ur->free_writes, w);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void uring_write_complete(fr_uring_t *ur, uring_write_t *w, int res)
+{
+	ssize_t result;
+
+	if (res > 0) {
+		w->written += res;
+
+		if ((w->written < w->data_len) && (uring_write_queue(ur, w) == 0)) return;
+	}
+
+	/*
+	 *	Put the context back before running the callback, as
+	 *	the callback may queue another write.
+	 */
+	if (res < 0) {
+		result = res;
+	} else if (w->written < w->data_len) {
+		result = -EIO;
+	} else {
+		result = w->written;
+	}
+	fr_dlist_insert_head(&ur->free_writes, w);
+
+	w->callback(ur, w->op.fd, result, w->uctx);
+}
+
+#ifdef HAVE_URING_RECV_MULTISHOT
+/** Give a buffer back to the kernel
+ *
+ */
+static inline void uring_recv_buffer_add(fr_uring_recv_t *rv, uint16_t bid)
+{
+	struct io_uring_buf *buf = &rv->br->bufs[rv->tail & (rv->num - 1)];
+
+	/*
+	 *	Don't touch buf->resv, it overlaps the ring tail.
+	 */
+	buf->addr = (uintptr_t) (rv->buffers + ((size_t) bid * rv->buffer_len));
+	buf->len = rv->buffer_len;
+	buf->bid = bid;
+	rv->tail++;
+}
+
+static int uring_recv_arm(fr_uring_recv_t *rv)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_sqe_get(rv->ur);
+	if (!sqe) return -1;
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = rv->op.fd;
+	sqe->addr = (uintptr_t) &rv->msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = rv->bgid;
+	sqe->user_data = (uintptr_t) rv;
+
+	rv->armed = true;
+
+	return fr_uring_submit(rv->ur) < 0 ? -1 : 0;
+}
+
+static void uring_recv_complete(fr_uring_t *ur, fr_uring_recv_t *rv, int res, uint32_t flags)
+{
+	struct io_uring_recvmsg_out	*out;
+	struct msghdr			msg;
+	uint8_t				*buffer;
+	size_t				hdr_len, payload_len;
+	uint16_t			bid;
+
+	if (!(flags & IORING_CQE_F_MORE)) rv->armed = false;
+
+	/*
+	 *	We're draining the receive so that it can be freed.
+	 *	The buffers are about to be unregistered, so don't
+	 *	bother giving them back.
+	 */
+	if (rv->cancelled) return;
+
+	if (res < 0) {
+		/*
+		 *	We ran out of buffers.  They've all been
+		 *	given back by now, so just start again.
+		 */
+		if ((res == -ENOBUFS) && !rv->armed) {
+			if (uring_recv_arm(rv) == 0) return;
+			res = -errno;
+		}
+
+		rv->callback(ur, rv->op.fd, NULL, NULL, res, rv->uctx);
+		return;
+	}
+
+	if (!(flags & IORING_CQE_F_BUFFER)) goto rearm;
+
+	bid = flags >> IORING_CQE_BUFFER_SHIFT;
+	buffer = rv->buffers + ((size_t) bid * rv->buffer_len);
+
+	/*
+	 *	The buffer contains a header, then the name, then the
+	 *	control data, then the payload.
+	 */
+	hdr_len = sizeof(*out) + rv->msg.msg_namelen + rv->msg.msg_controllen;
+	if ((size_t) res < hdr_len) goto done;
+
+	out = (struct io_uring_recvmsg_out *) (void *) buffer;
+
+	memset(&msg, 0, sizeof(msg));
+	if (rv->msg.msg_namelen) {
+		msg.msg_name = buffer + sizeof(*out);
+		msg.msg_namelen = (out->namelen < rv->msg.msg_namelen) ? out->namelen : rv->msg.msg_namelen;
+	}
+	if (out->controllen) {
+		msg.msg_control = buffer + sizeof(*out) + rv->msg.msg_namelen;
+		msg.msg_controllen = out->controllen;
+	}
+	msg.msg_flags = out->flags;
+
+	/*
+	 *	The kernel discards data which doesn't fit.
+	 */
+	payload_len = out->payloadlen;
+	if (payload_len > ((size_t) res - hdr_len)) payload_len = res - hdr_len;
+
+	rv->callback(ur, rv->op.fd, &msg, buffer + hdr_len, payload_len, rv->uctx);
+
+done:
+	uring_recv_buffer_add(rv, bid);
+	URING_STORE(&rv->br->tail, rv->tail);
+
+rearm:
+	if (!rv->armed && (uring_recv_arm(rv) < 0)) {
+		rv->callback(ur, rv->op.fd, NULL, NULL, -errno, rv->uctx);
+	}
+}
+
+/** Stop the receive, and free its buffers
+ *
+ * Every CQE for the receive carries rv as its user_data, so we
+ * can't free rv until the kernel has posted the last one.  We
+ * cancel the receive, and process completions until we see a CQE
+ * for it without IORING_CQE_F_MORE.  Completions for other
+ * operations are processed as normal.
+ *
+ * If the ring itself is being freed, the kernel has already
+ * cancelled the receive, and released the buffers.
+ */
+static int _uring_recv_free(fr_uring_recv_t *rv)
+{
+	fr_uring_t		*ur = rv->ur;
+	struct io_uring_buf_reg	reg;
+
+	if (ur->fd < 0) goto done;
+
+	rv->cancelled = true;
+
+	if (rv->armed) {
+		struct io_uring_sqe *sqe;
+
+		sqe = uring_sqe_get(ur);
+		if (!sqe) {
+		cancel_error:
+			/*
+			 *	Freeing rv now would leave the kernel
+			 *	writing completions which point to
+			 *	freed memory.  Refuse, and leave it
+			 *	to be cleaned up with the ring.
+			 */
+			fr_strerror_printf_push("Failed cancelling multishot receive");
+			rv->cancelled = false;
+			return -1;
+		}
+
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t) rv;
+		sqe->user_data = 0;		/* ignored by fr_uring_service */
+
+		if (fr_uring_submit(ur) < 0) goto cancel_error;
+
+		while (rv->armed) {
+			if ((uring_enter(ur->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR)) {
+				fr_strerror_printf("Failed waiting for io_uring completions: %s",
+						   fr_syserror(errno));
+				goto cancel_error;
+			}
+			(void) fr_uring_service(ur, 0);
+		}
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.bgid = rv->bgid;
+	(void) uring_register(ur->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+done:
+	if (rv->br) munmap(rv->br, rv->br_size);
+
+	return 0;
+}
+
+/** Start a multishot receive on a datagram socket
+ *
+ * The kernel reads datagrams into a ring of buffers which we own,
+ * and posts a completion for each one.  There is no system call
+ * per datagram, and no system call to re-arm the receive.
+ *
+ * The receive is stopped, and the buffers are freed, when the
+ * returned context is freed.
+ *
+ * @param[in] ur		to start the receive on.
+ * @param[in] fd		to read from.
+ * @param[in] num		number of buffers.  Rounded up to a power of 2.
+ * @param[in] buffer_len	Maximum size of a datagram.
+ * @param[in] name_len		Room for the source address, or 0 for connected sockets.
+ * @param[in] control_len	Room for control messages.
+ * @param[in] callback		run for each datagram.
+ * @param[in] uctx		passed to the callback.
+ * @return
+ *	- A new receive context.
+ *	- NULL if the kernel doesn't support multishot receives.
+ */
+fr_uring_recv_t *fr_uring_recv_multishot(fr_uring_t *ur, int fd, uint32_t num, size_t buffer_len,
+					 socklen_t name_len, socklen_t control_len,
+					 fr_uring_recv_cb_t callback, void *uctx)
+{
+	fr_uring_recv_t		*rv;
+	struct io_uring_buf_reg	reg;
+	void			*ptr;
+	uint32_t		i;
+
+	if (!ur->recv_multishot) {
+		fr_strerror_printf("The kernel does not support multishot receives");
+		return NULL;
+	}
+
+	if (!num || (num > 32768)) {
+		fr_strerror_printf("Invalid number of receive buffers %u", num);
+		return NULL;
+	}
+
+	rv = talloc_zero(ur, fr_uring_recv_t);
+	if (!rv) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+
+	rv->op.type = URING_OP_RECV;
+	rv->op.fd = fd;
+	rv->ur = ur;
+	rv->bgid = ur->next_bgid++;
+	rv->callback = callback;
+	rv->uctx = uctx;
+	rv->msg.msg_namelen = name_len;
+	rv->msg.msg_controllen = control_len;
+
+	rv->num = 1;
+	while (rv->num < num) rv->num <<= 1;
+
+	/*
+	 *	Keep the buffers aligned, so that the headers are,
+	 *	too.
+	 */
+	rv->buffer_len = sizeof(struct io_uring_recvmsg_out) + name_len + control_len + buffer_len;
+	rv->buffer_len = (rv->buffer_len + 15) & ~((size_t) 15);
+
+	rv->buffers = talloc_array(rv, uint8_t, rv->num * rv->buffer_len);
+	if (!rv->buffers) {
+		talloc_free(rv);
+		goto oom;
+	}
+
+	/*
+	 *	The buffer ring has to be page aligned.
+	 */
+	rv->br_size = rv->num * sizeof(struct io_uring_buf);
+	ptr = mmap(NULL, rv->br_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (ptr == MAP_FAILED) {
+		fr_strerror_printf("Failed allocating buffer ring: %s", fr_syserror(errno));
+		talloc_free(rv);
+		return NULL;
+	}
+	rv->br = ptr;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t) rv->br;
+	reg.ring_entries = rv->num;
+	reg.bgid = rv->bgid;
+
+	if (uring_register(ur->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		fr_strerror_printf("Failed registering buffer ring: %s", fr_syserror(errno));
+		munmap(rv->br, rv->br_size);
+		talloc_free(rv);
+		return NULL;
+	}
+	talloc_set_destructor(rv, _uring_recv_free);
+
+	for (i = 0; i < rv->num; i++) uring_recv_buffer_add(rv, i);
+	URING_STORE(&rv->br->tail, rv->tail);
+
+	if (uring_recv_arm(rv) < 0) {
+		talloc_free(rv);
+		return NULL;
+	}
+
+	return rv;
+}
+#else
+fr_uring_recv_t *fr_uring_recv_multishot(UNUSED fr_uring_t *ur, UNUSED int fd, UNUSED uint32_t num,
+					 UNUSED size_t buffer_len, UNUSED socklen_t name_len,
+					 UNUSED socklen_t control_len,
+					 UNUSED fr_uring_recv_cb_t callback, UNUSED void *uctx)
+{
+	fr_strerror_printf("Multishot receives are not supported");
+	return NULL;
+}
+#endif
+
+/** Process completions, and run their callbacks
+ *
+ * If max is non-zero, completions may be left on the ring.  The
+ * eventfd will have been cleared, so the caller must check
+ * #fr_uring_completions, and call this function again.
+ *
+ * @param[in] ur	to process completions for.
+ * @param[in] max	Maximum number of completions to process, or 0
+ *			for all of them.
+ * @return the number of completions processed.
+ */
+int fr_uring_service(fr_uring_t *ur, uint32_t max)
+{
+	uint64_t	count;
+	unsigned	head, tail;
+	int		processed = 0;
+
+	/*
+	 *	Clear the eventfd first.  Any completions posted after
+	 *	this will signal it again.
+	 */
+	if (read(ur->event_fd, &count, sizeof(count)) < 0) {
+		/* nothing to do, it's non-blocking */
+	}
+
+again:
+	/*
+	 *	The head is re-read for every CQE, as a callback may
+	 *	free a multishot receive, which processes completions
+	 *	while it waits for the receive to be cancelled.
+	 */
+	for (;;) {
+		struct io_uring_cqe	*cqe;
+		uring_op_t		*op;
+		int			res;
+#ifdef HAVE_URING_RECV_MULTISHOT
+		uint32_t		flags;
+#endif
+
+		head = *ur->cq_head;
+		tail = URING_LOAD(ur->cq_tail);
+		if ((head == tail) || (max && ((uint32_t) processed >= max))) break;
+
+		cqe = &ur->cqes[head & ur->cq_mask];
+		op = (uring_op_t *) (uintptr_t) cqe->user_data;
+		res = cqe->res;
+#ifdef HAVE_URING_RECV_MULTISHOT
+		flags = cqe->flags;
+#endif
+
+		/*
+		 *	Give the slot back before running the
+		 *	callback, which may want to queue more work.
+		 */
+		URING_STORE(ur->cq_head, ++head);
+		processed++;
+
+		if (!op) continue;
+
+		switch (op->type) {
+		case URING_OP_WRITE:
+			uring_write_complete(ur, (uring_write_t *) op, res);
+			break;
+
+#ifdef HAVE_URING_RECV_MULTISHOT
+		case URING_OP_RECV:
+			uring_recv_complete(ur, (fr_uring_recv_t *) op, res, flags);
+			break;
+#endif
+
+		default:
+			break;
+		}
+	}
+
+	/*
+	 *	More completions were posted than fit in the ring.
+	 *	The kernel only moves the rest into the ring when we
+	 *	ask it to.
+	 */
+	if ((head == tail) && (!max || ((uint32_t) processed < max)) &&
+	    (URING_LOAD(ur->sq_flags) & IORING_SQ_CQ_OVERFLOW)) {
+		if (uring_enter(ur->fd, 0, 0, IORING_ENTER_GETEVENTS) >= 0) goto again;
+	}
+
+	return processed;
+}
+
+static void _uring_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	(void) fr_uring_service(uctx, 0);
+}
+
+/** Submit everything which was queued while servicing events
+ *
+ */
+static int _uring_pre(void *uctx, UNUSED struct timeval *now)
+{
+	fr_uring_t *ur = uctx;
+
+	(void) fr_uring_submit(ur);
+
+	/*
+	 *	Don't sleep if there are completions waiting.
+	 */
+	return (fr_uring_completions(ur) > 0);
+}
+
+/** Run the ring from an event list
+ *
+ * Queued operations are submitted once per loop, and completions
+ * are processed when the eventfd is readable.  This means that the
+ * caller should never have to call #fr_uring_submit or #fr_uring_service.
+ *
+ * @param[in] ur	to insert.
+ * @param[in] el	to insert the ring into.
+ * @return
+ *	- 0 on success.
+ *	- <0 on error.
+ */
+int fr_uring_event_insert(fr_uring_t *ur, fr_event_list_t *el)
+{
+	if (ur->el) {
+		fr_strerror_printf("io_uring is already in an event list");
+		return -1;
+	}
+
+	if (fr_event_fd_insert(NULL, el, ur->event_fd, _uring_read, NULL, NULL, ur) < 0) return -1;
+
+	if (fr_event_pre_insert(el, _uring_pre, ur) < 0) {
+		(void) fr_event_fd_delete(el, ur->event_fd, FR_EVENT_FILTER_IO);
+		return -1;
+	}
+
+	ur->el = el;
+
+	return 0;
+}
+
+#else
+/*
+ *	No io_uring.  Callers always fall back to the normal
+ *	system calls.
+ */
+fr_uring_t *fr_uring_alloc(UNUSED TALLOC_CTX *ctx, UNUSED uint32_t entries)
+{
+	fr_strerror_printf("io_uring is not supported on this system");
+	return NULL;
+}
+
+int fr_uring_fd(UNUSED fr_uring_t const *ur)
+{
+	return -1;
+}
+
+int fr_uring_event_insert(UNUSED fr_uring_t *ur, UNUSED fr_event_list_t *el)
+{
+	return -1;
+}
+
+int fr_uring_submit(UNUSED fr_uring_t *ur)
+{
+	return -1;
+}
+
+uint32_t fr_uring_completions(UNUSED fr_uring_t const *ur)
+{
+	return 0;
+}
+
+int fr_uring_service(UNUSED fr_uring_t *ur, UNUSED uint32_t max)
+{
+	return -1;
+}
+
+int fr_uring_write(UNUSED fr_uring_t *ur, UNUSED int fd, UNUSED void const *data, UNUSED size_t data_len,
+		   UNUSED fr_uring_write_cb_t callback, UNUSED void *uctx)
+{
+	fr_strerror_printf("io_uring is not supported on this system");
+	return -1;
+}
+
+fr_uring_recv_t *fr_uring_recv_multishot(UNUSED fr_uring_t *ur, UNUSED int fd, UNUSED uint32_t num,
+					 UNUSED size_t buffer_len, UNUSED socklen_t name_len,
+					 UNUSED socklen_t control_len,
+					 UNUSED fr_uring_recv_cb_t callback, UNUSED void *uctx)
+{
+	fr_strerror_printf("io_uring is not supported on this system");
+	return NULL;
+}
+#endif
@@ -0,0 +1,87 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Asynchronous I/O using io_uring
+ *
+ * @file src/lib/util/uring.h
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+RCSIDH(uring_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/event.h>
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <talloc.h>
+
+typedef struct fr_uring_t fr_uring_t;
+typedef struct fr_uring_recv_t fr_uring_recv_t;
+
+/** Called when a write completes
+ *
+ * @param[in] ur	the ring the write was queued on.
+ * @param[in] fd	which was written to.
+ * @param[in] result	Number of bytes written, or -errno on failure.
+ * @param[in] uctx	passed to #fr_uring_write.
+ */
+typedef void (*fr_uring_write_cb_t)(fr_uring_t *ur, int fd, ssize_t result, void *uctx);
+
+/** Called for each datagram read by a multishot receive
+ *
+ * The data is only valid for the duration of the callback.  The
+ * buffer is given back to the kernel as soon as the callback returns.
+ *
+ * @param[in] ur	the ring the receive was armed on.
+ * @param[in] fd	which was read from.
+ * @param[in] msg	with msg_name, msg_control, and msg_flags filled in.
+ *			NULL on error.
+ * @param[in] data	the datagram.  NULL on error.
+ * @param[in] data_len	Length of the datagram, or -errno on failure.
+ * @param[in] uctx	passed to #fr_uring_recv_multishot.
+ */
+typedef void (*fr_uring_recv_cb_t)(fr_uring_t *ur, int fd, struct msghdr *msg,
+				   uint8_t const *data, ssize_t data_len, void *uctx);
+
+fr_uring_t	*fr_uring_alloc(TALLOC_CTX *ctx, uint32_t entries);
+
+int		fr_uring_fd(fr_uring_t const *ur);
+
+int		fr_uring_event_insert(fr_uring_t *ur, fr_event_list_t *el);
+
+int		fr_uring_submit(fr_uring_t *ur);
+
+uint32_t	fr_uring_completions(fr_uring_t const *ur);
+
+int		fr_uring_service(fr_uring_t *ur, uint32_t max);
+
+int		fr_uring_write(fr_uring_t *ur, int fd, void const *data, size_t data_len,
+			       fr_uring_write_cb_t callback, void *uctx) CC_HINT(nonnull(1,3,5));
+
+fr_uring_recv_t	*fr_uring_recv_multishot(fr_uring_t *ur, int fd, uint32_t num, size_t buffer_len,
+					 socklen_t name_len, socklen_t control_len,
+					 fr_uring_recv_cb_t callback, void *uctx) CC_HINT(nonnull(1,7));
+
+#ifdef __cplusplus
+}
+#endif
@@ -58,6 +58,10 @@ typedef struct proto_dhcpv4_udp_t {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			batch_size;		//!< How many packets to read / write per system call.
+	udp_batch_t			*recv_batch;		//!< Packets read, but not yet returned.
+	udp_batch_t			*send_batch;		//!< Replies queued, but not yet written.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 
 	uint16_t			port;			//!< Port to listen on.
@@ -106,6 +110,8 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_dhcpv4_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_dhcpv4_udp_t, max_attributes), .dflt = STRINGIFY(DHCPV4_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, proto_dhcpv4_udp_t, batch_size), .dflt = "1" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -157,10 +163,10 @@ static ssize_t mod_read(void *instance, void **packet_ctx, fr_time_t **recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (inst->connection != NULL);
 
-	data_size = udp_recv(inst->sockfd, buffer, buffer_len, flags,
-			     &address->src_ipaddr, &address->src_port,
-			     &address->dst_ipaddr, &address->dst_port,
-			     &address->if_index, &timestamp);
+	data_size = udp_batch_recv(inst->recv_batch, inst->sockfd, buffer, buffer_len, flags,
+				   &address->src_ipaddr, &address->src_port,
+				   &address->dst_ipaddr, &address->dst_port,
+				   &address->if_index, &timestamp);
 	if (data_size < 0) {
 		DEBUG2("proto_dhvpv4_udp got read error %zd: %s", data_size, fr_strerror());
 		return data_size;
@@ -421,10 +427,10 @@ send_reply:
 	/*
 	 *	proto_radius_dhcpv4 takes care of suppressing do-not-respond, etc.
 	 */
-	data_size = udp_send(inst->sockfd, buffer, buffer_len, flags,
-			     &address.src_ipaddr, address.src_port,
-			     address.if_index,
-			     &address.dst_ipaddr, address.dst_port);
+	data_size = udp_batch_send(inst->send_batch, inst->sockfd, buffer, buffer_len, flags,
+				   &address.src_ipaddr, address.src_port,
+				   address.if_index,
+				   &address.dst_ipaddr, address.dst_port);
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -435,6 +441,73 @@ send_reply:
 }
 
 
+/** Get the number of packets buffered by a batched read
+ *
+ * @param[in] instance of the DHCPV4 UDP I/O path.
+ * @return the number of buffered packets.
+ */
+static int mod_pending(void const *instance)
+{
+	proto_dhcpv4_udp_t const *inst = talloc_get_type_abort_const(instance, proto_dhcpv4_udp_t);
+
+	return udp_batch_pending(inst->recv_batch);
+}
+
+
+/** Write the replies queued by mod_write()
+ *
+ * @param[in] instance of the DHCPV4 UDP I/O path.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int mod_flush(void const *instance)
+{
+	proto_dhcpv4_udp_t const	*inst = talloc_get_type_abort_const(instance, proto_dhcpv4_udp_t);
+	int				flags, queued, sent;
+
+	if (!inst->send_batch || !inst->send_batch->used) return 0;
+
+	flags = UDP_FLAGS_CONNECTED * (inst->connection != NULL);
+	queued = inst->send_batch->used;
+
+	/*
+	 *	Replies which can't be written are lost, just as with
+	 *	any other UDP packet.  The client will retransmit.
+	 */
+	sent = udp_batch_flush(inst->send_batch, inst->sockfd, flags);
+	if (sent < queued) {
+		DEBUG2("proto_dhcpv4_udp - Failed writing %d of %d replies: %s",
+		       queued - ((sent < 0) ? 0 : sent), queued, fr_strerror());
+	}
+
+	return 0;
+}
+
+
+/** Get the batched read / write statistics
+ *
+ * @param[in] instance of the DHCPV4 UDP I/O path.
+ * @param[out] stats where the statistics are written.
+ */
+static void mod_batch_stats(void const *instance, fr_io_batch_stats_t *stats)
+{
+	proto_dhcpv4_udp_t const *inst = talloc_get_type_abort_const(instance, proto_dhcpv4_udp_t);
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (inst->recv_batch) {
+		stats->read_calls = inst->recv_batch->syscalls;
+		stats->read_packets = inst->recv_batch->datagrams;
+	}
+
+	if (inst->send_batch) {
+		stats->write_calls = inst->send_batch->syscalls;
+		stats->write_packets = inst->send_batch->datagrams;
+	}
+}
+
+
 /** Open a UDP listener for DHCPV4
  *
  * @param[in] instance of the DHCPV4 UDP I/O path.
@@ -458,6 +531,13 @@ static int mod_connection_set(void *instance, fr_io_address_t *connection)
 	proto_dhcpv4_udp_t *inst = talloc_get_type_abort(instance, proto_dhcpv4_udp_t);
 
 	inst->connection = connection;
+
+	/*
+	 *	The batches were copied from the parent socket.  The
+	 *	connection gets its own in mod_open().
+	 */
+	inst->recv_batch = NULL;
+	inst->send_batch = NULL;
 	return 0;
 }
 
@@ -528,6 +608,17 @@ static int mod_open(void *instance, UNUSED void const *master_instance)
 
 	inst->sockfd = sockfd;
 
+	if (inst->batch_size > 1) {
+		inst->recv_batch = udp_batch_alloc(inst, inst->batch_size, inst->max_packet_size);
+		inst->send_batch = udp_batch_alloc(inst, inst->batch_size, inst->max_packet_size);
+		if (!inst->recv_batch || !inst->send_batch) {
+			ERROR("Failed allocating packet batches");
+			close(sockfd);
+			inst->sockfd = -1;
+			goto error;
+		}
+	}
+
 	ci = cf_parent(inst->cs); /* listen { ... } */
 	rad_assert(ci != NULL);
 	ci = cf_parent(ci);
@@ -630,6 +721,9 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, MIN_PACKET_SIZE);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("batch_size", inst->batch_size, >=, 1);
+	FR_INTEGER_BOUND_CHECK("batch_size", inst->batch_size, <=, UDP_BATCH_MAX);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -702,6 +796,9 @@ fr_app_io_t proto_dhcpv4_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.pending		= mod_pending,
+	.flush			= mod_flush,
+	.batch_stats		= mod_batch_stats,
 	.close			= mod_close,
 	.fd			= mod_fd,
 	.fd_set			= mod_fd_set,
@@ -392,6 +392,16 @@ static int mod_decode(void const *instance, REQUEST *request, uint8_t *const dat
 		}
 	}
 
+	/*
+	 *	Remember what the decoded attributes looked like,
+	 *	so that rlm_radius can tell whether or not it can
+	 *	proxy the original packet as-is.
+	 */
+	if (fr_radius_pass_through) {
+		fr_pair_list_fingerprint(request->packet->vps_fingerprint, request->packet->vps);
+		request->packet->vps_fingerprinted = true;
+	}
+
 	if (!inst->io.app_io->decode) return 0;
 
 	/*
@@ -670,6 +670,19 @@ static int mod_instantiate(void *instance, CONF_SECTION *process_app_cs)
 
 	inst->state_tree = fr_state_tree_init(inst, attr_state, main_config->spawn_workers, inst->max_session,
 					      inst->session_timeout, inst->state_server_id);
+	if (!inst->state_tree) {
+		cf_log_err(process_app_cs, "Failed creating state tree");
+		return -1;
+	}
+
+	/*
+	 *	Multiple listeners in one virtual server each have a
+	 *	state tree, but only the first one gets radmin commands.
+	 */
+	if (fr_command_register_hook(NULL, cf_section_name2(server_cs), inst->state_tree, cmd_state_table) < 0) {
+		PWARN("Failed registering radmin commands for the state tree of virtual server %s",
+		      cf_section_name2(server_cs));
+	}
 
 	return 0;
 }
@@ -410,6 +410,16 @@ static int mod_compare(UNUSED void const *instance, void const *one, void const
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+static uint32_t mod_hash(UNUSED void const *instance, void const *packet)
+{
+	uint8_t const *p = packet;
+
+	/*
+	 *	The same fields as mod_compare(): ID and code.
+	 */
+	return fr_hash(p, 2);
+}
+
 
 static char const *mod_name(void *instance)
 {
@@ -637,6 +647,7 @@ fr_app_io_t proto_radius_tcp = {
 	.fd			= mod_fd,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
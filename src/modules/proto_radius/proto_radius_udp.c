@@ -33,8 +33,15 @@
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/uring.h>
 #include "proto_radius.h"
 
+/*
+ *	How many packets the kernel can read ahead of us when
+ *	using io_uring.
+ */
+#define UDP_URING_BUFFERS	(256)
+
 extern fr_app_io_t proto_radius_udp;
 
 typedef struct proto_radius_udp_t {
@@ -57,6 +64,17 @@ typedef struct proto_radius_udp_t {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			batch_size;		//!< How many packets to read / write per system call.
+	udp_batch_t			*recv_batch;		//!< Packets read, but not yet returned.
+	udp_batch_t			*send_batch;		//!< Replies queued, but not yet written.
+
+	bool				io_uring;		//!< Whether we should read packets with io_uring.
+	fr_uring_t			*uring;			//!< The ring packets are read with.
+	fr_uring_recv_t			*uring_recv;		//!< The multishot receive.
+	int				uring_error;		//!< errno from the multishot receive.
+	struct sockaddr_storage		bound;			//!< Address the socket is bound to.
+	socklen_t			sizeof_bound;		//!< Length of the bound address.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 
 	uint16_t			port;			//!< Port to listen on.
@@ -103,6 +121,9 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_radius_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_radius_udp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, proto_radius_udp_t, batch_size), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("io_uring", FR_TYPE_BOOL, proto_radius_udp_t, io_uring), .dflt = "no" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -135,10 +156,32 @@ static ssize_t mod_read(void *instance, void **packet_ctx, fr_time_t **recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (inst->connection != NULL);
 
-	data_size = udp_recv(inst->sockfd, buffer, buffer_len, flags,
-			     &address->src_ipaddr, &address->src_port,
-			     &address->dst_ipaddr, &address->dst_port,
-			     &address->if_index, &timestamp);
+	if (inst->uring) {
+		/*
+		 *	The kernel has already read the packets.  We
+		 *	just pick up the completions.
+		 */
+		if (!udp_batch_pending(inst->recv_batch) &&
+		    (fr_uring_service(inst->uring, inst->recv_batch->num) > 0)) {
+			inst->recv_batch->syscalls++;
+		}
+
+		if (inst->uring_error) {
+			fr_strerror_printf("Failed reading socket: %s", fr_syserror(inst->uring_error));
+			inst->uring_error = 0;
+			data_size = -1;
+		} else {
+			data_size = udp_batch_pop(inst->recv_batch, buffer, buffer_len,
+						  &address->src_ipaddr, &address->src_port,
+						  &address->dst_ipaddr, &address->dst_port,
+						  &address->if_index, &timestamp);
+		}
+	} else {
+		data_size = udp_batch_recv(inst->recv_batch, inst->sockfd, buffer, buffer_len, flags,
+					   &address->src_ipaddr, &address->src_port,
+					   &address->dst_ipaddr, &address->dst_port,
+					   &address->if_index, &timestamp);
+	}
 	if (data_size < 0) {
 		DEBUG2("proto_radius_udp got read error: %s", fr_strerror());
 		return data_size;
@@ -234,10 +277,10 @@ static ssize_t mod_write(void *instance, void *packet_ctx, UNUSED fr_time_t requ
 
 			memcpy(&packet, &track->reply, sizeof(packet)); /* const issues */
 
-			(void) udp_send(inst->sockfd, packet, track->reply_len, flags,
-					&address->dst_ipaddr, address->dst_port,
-					address->if_index,
-					&address->src_ipaddr, address->src_port);
+			(void) udp_batch_send(inst->send_batch, inst->sockfd, packet, track->reply_len, flags,
+					      &address->dst_ipaddr, address->dst_port,
+					      address->if_index,
+					      &address->src_ipaddr, address->src_port);
 		}
 
 		return buffer_len;
@@ -252,10 +295,10 @@ static ssize_t mod_write(void *instance, void *packet_ctx, UNUSED fr_time_t requ
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
 	 */
-	data_size = udp_send(inst->sockfd, buffer, buffer_len, flags,
-			     &address->dst_ipaddr, address->dst_port,
-			     address->if_index,
-			     &address->src_ipaddr, address->src_port);
+	data_size = udp_batch_send(inst->send_batch, inst->sockfd, buffer, buffer_len, flags,
+				   &address->dst_ipaddr, address->dst_port,
+				   address->if_index,
+				   &address->src_ipaddr, address->src_port);
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -274,6 +317,80 @@ static ssize_t mod_write(void *instance, void *packet_ctx, UNUSED fr_time_t requ
 }
 
 
+/** Get the number of packets buffered by a batched read
+ *
+ * @param[in] instance of the RADIUS UDP I/O path.
+ * @return the number of buffered packets.
+ */
+static int mod_pending(void const *instance)
+{
+	proto_radius_udp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+
+	/*
+	 *	mod_read() only processes one batch of completions at
+	 *	a time, so there may be more waiting.
+	 */
+	if (inst->uring) return udp_batch_pending(inst->recv_batch) + fr_uring_completions(inst->uring);
+
+	return udp_batch_pending(inst->recv_batch);
+}
+
+
+/** Write the replies queued by mod_write()
+ *
+ * @param[in] instance of the RADIUS UDP I/O path.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int mod_flush(void const *instance)
+{
+	proto_radius_udp_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+	int				flags, queued, sent;
+
+	if (!inst->send_batch || !inst->send_batch->used) return 0;
+
+	flags = UDP_FLAGS_CONNECTED * (inst->connection != NULL);
+	queued = inst->send_batch->used;
+
+	/*
+	 *	Replies which can't be written are lost, just as with
+	 *	any other UDP packet.  The client will retransmit, and
+	 *	we will reply from the duplicate cache.
+	 */
+	sent = udp_batch_flush(inst->send_batch, inst->sockfd, flags);
+	if (sent < queued) {
+		DEBUG2("proto_radius_udp - Failed writing %d of %d replies: %s",
+		       queued - ((sent < 0) ? 0 : sent), queued, fr_strerror());
+	}
+
+	return 0;
+}
+
+
+/** Get the batched read / write statistics
+ *
+ * @param[in] instance of the RADIUS UDP I/O path.
+ * @param[out] stats where the statistics are written.
+ */
+static void mod_batch_stats(void const *instance, fr_io_batch_stats_t *stats)
+{
+	proto_radius_udp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+
+	memset(stats, 0, sizeof(*stats));
+
+	if (inst->recv_batch) {
+		stats->read_calls = inst->recv_batch->syscalls;
+		stats->read_packets = inst->recv_batch->datagrams;
+	}
+
+	if (inst->send_batch) {
+		stats->write_calls = inst->send_batch->syscalls;
+		stats->write_packets = inst->send_batch->datagrams;
+	}
+}
+
+
 /** Open a UDP listener for RADIUS
  *
  * @param[in] instance of the RADIUS UDP I/O path.
@@ -285,6 +402,13 @@ static int mod_close(void *instance)
 {
 	proto_radius_udp_t *inst = talloc_get_type_abort(instance, proto_radius_udp_t);
 
+	/*
+	 *	Stop the kernel reading from the socket before we
+	 *	close it.
+	 */
+	TALLOC_FREE(inst->uring);
+	inst->uring_recv = NULL;
+
 	close(inst->sockfd);
 	inst->sockfd = -1;
 
@@ -297,6 +421,20 @@ static int mod_connection_set(void *instance, fr_io_address_t *connection)
 	proto_radius_udp_t *inst = talloc_get_type_abort(instance, proto_radius_udp_t);
 
 	inst->connection = connection;
+
+	/*
+	 *	The batches were copied from the parent socket.  The
+	 *	connection gets its own in mod_open().
+	 */
+	inst->recv_batch = NULL;
+	inst->send_batch = NULL;
+
+	/*
+	 *	So was the ring.  Connected sockets always use
+	 *	recvmmsg().
+	 */
+	inst->uring = NULL;
+	inst->uring_recv = NULL;
 	return 0;
 }
 
@@ -311,6 +449,29 @@ static void mod_network_get(void *instance, int *ipproto, bool *dynamic_clients,
 }
 
 
+/** Add a packet read by io_uring to the read batch
+ *
+ */
+static void _uring_recv(UNUSED fr_uring_t *ur, UNUSED int fd, struct msghdr *msg,
+			uint8_t const *data, ssize_t data_len, void *uctx)
+{
+	proto_radius_udp_t *inst = talloc_get_type_abort(uctx, proto_radius_udp_t);
+
+	if (data_len < 0) {
+		inst->uring_error = -data_len;
+		return;
+	}
+
+	/*
+	 *	mod_read() only asks for as many packets as fit in
+	 *	the batch, so this shouldn't happen.
+	 */
+	if (udp_batch_push(inst->recv_batch, data, data_len, msg, &inst->bound, inst->sizeof_bound) < 0) {
+		inst->stats.total_packets_dropped++;
+	}
+}
+
+
 /** Open a UDP listener for RADIUS
  *
  * @param[in] instance of the RADIUS UDP I/O path.
@@ -378,6 +539,51 @@ static int mod_open(void *instance, UNUSED void const *master_instance)
 
 	inst->sockfd = sockfd;
 
+	if ((inst->batch_size > 1) || (inst->io_uring && !inst->connection)) {
+		inst->recv_batch = udp_batch_alloc(inst, inst->batch_size, inst->max_packet_size);
+		inst->send_batch = udp_batch_alloc(inst, inst->batch_size, inst->max_packet_size);
+		if (!inst->recv_batch || !inst->send_batch) {
+			ERROR("Failed allocating packet batches");
+			close(sockfd);
+			inst->sockfd = -1;
+			goto error;
+		}
+	}
+
+	/*
+	 *	Have the kernel read packets into buffers which it
+	 *	owns, without a system call per packet.  If it can't,
+	 *	then we use recvmmsg() as before.
+	 */
+	if (inst->io_uring && !inst->connection) {
+		socklen_t control_len = 0;
+
+#ifdef WITH_UDPFROMTO
+		control_len = UDPFROMTO_CMSG_SIZE;
+#endif
+
+		inst->sizeof_bound = sizeof(inst->bound);
+		if (getsockname(sockfd, (struct sockaddr *) &inst->bound, &inst->sizeof_bound) < 0) {
+			ERROR("Failed getting socket name: %s", fr_syserror(errno));
+			close(sockfd);
+			inst->sockfd = -1;
+			goto error;
+		}
+
+		inst->uring = fr_uring_alloc(inst, UDP_BATCH_MAX);
+		if (inst->uring) {
+			inst->uring_recv = fr_uring_recv_multishot(inst->uring, sockfd, UDP_URING_BUFFERS,
+								   inst->max_packet_size,
+								   sizeof(struct sockaddr_storage), control_len,
+								   _uring_recv, inst);
+		}
+
+		if (!inst->uring_recv) {
+			PWARN("Not using io_uring");
+			TALLOC_FREE(inst->uring);
+		}
+	}
+
 	ci = cf_parent(inst->cs); /* listen { ... } */
 	rad_assert(ci != NULL);
 	ci = cf_parent(ci);
@@ -408,6 +614,23 @@ static int mod_fd(void const *instance)
 	return inst->sockfd;
 }
 
+/** Get the file descriptor to watch for reads
+ *
+ * Replies are always written to the socket, but when the kernel
+ * reads packets for us, the ring's eventfd is readable instead.
+ *
+ * @param[in] instance of the RADIUS UDP I/O path.
+ * @return the file descriptor
+ */
+static int mod_read_fd(void const *instance)
+{
+	proto_radius_udp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+
+	if (inst->uring) return fr_uring_fd(inst->uring);
+
+	return inst->sockfd;
+}
+
 /** Set the file descriptor for this socket.
  *
  * @param[in] instance of the RADIUS UDP I/O path.
@@ -446,6 +669,16 @@ static int mod_compare(UNUSED void const *instance, void const *one, void const
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+static uint32_t mod_hash(UNUSED void const *instance, void const *packet)
+{
+	uint8_t const *p = packet;
+
+	/*
+	 *	The same fields as mod_compare(): ID and code.
+	 */
+	return fr_hash(p, 2);
+}
+
 
 static char const *mod_name(void *instance)
 {
@@ -485,6 +718,9 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("batch_size", inst->batch_size, >=, 1);
+	FR_INTEGER_BOUND_CHECK("batch_size", inst->batch_size, <=, UDP_BATCH_MAX);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -577,10 +813,15 @@ fr_app_io_t proto_radius_udp = {
 	.open			= mod_open,
 	.read			= mod_read,
 	.write			= mod_write,
+	.pending		= mod_pending,
+	.flush			= mod_flush,
+	.batch_stats		= mod_batch_stats,
 	.close			= mod_close,
 	.fd			= mod_fd,
+	.read_fd		= mod_read_fd,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -421,6 +421,18 @@ static int mod_compare(UNUSED void const *instance, void const *one, void const
 	return (a[1] < b[1]) - (a[1] > b[1]);
 }
 
+static uint32_t mod_hash(UNUSED void const *instance, void const *packet)
+{
+	uint8_t const *p = packet;
+	uint32_t hash;
+
+	/*
+	 *	The same fields as mod_compare(): transaction ID and opcode.
+	 */
+	hash = fr_hash(p + 4, 4);
+	return fr_hash_update(p + 1, 1, hash);
+}
+
 static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 {
 	proto_vmps_udp_t	*inst = talloc_get_type_abort(instance, proto_vmps_udp_t);
@@ -545,6 +557,7 @@ fr_app_io_t proto_vmps_udp = {
 	.fd			= mod_fd,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.hash			= mod_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -0,0 +1,631 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_sharded.c
+ * @brief In memory cache, striped over multiple independently locked shards.
+ *
+ * Entries are distributed over the shards by the hash of their key.  Each
+ * shard has its own lock, lookup table, expiry heap, and LRU list, so
+ * workers only contend with each other when they use keys which map to
+ * the same shard.
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
+#include <freeradius-devel/server/radmin.h>
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/ohash.h>
+#include <freeradius-devel/util/thread_local.h>
+#include "../../rlm_cache.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#define MAX_SHARDS		(1024)
+
+typedef struct {
+	pthread_mutex_t		mutex;		//!< Protects everything in this shard, other than num_entries.
+
+	fr_ohash_t		*cache;		//!< For looking up cache keys.
+	fr_heap_t		*heap;		//!< For managing entry expiry.
+	fr_dlist_head_t		lru;		//!< Entries in order of use, most recently used first.
+
+	size_t			size;		//!< Memory used by the entries in this shard.
+	atomic_uint		num_entries;	//!< Read without the lock by cache_entry_count().
+
+	uint64_t		hits;		//!< Lookups which found an entry.
+	uint64_t		misses;		//!< Lookups which didn't find an entry.
+	uint64_t		evictions;	//!< Entries removed to stay under max_size.
+	uint64_t		expired;	//!< Entries removed because their TTL passed.
+	uint64_t		contended;	//!< Times the lock was already held by another thread.
+} rlm_cache_shard_t;
+
+typedef struct rlm_cache_sharded {
+	uint32_t		num_shards;	//!< Number of shards.  Rounded up to a power of 2.
+	size_t			max_size;	//!< Maximum memory used by all entries, 0 for no limit.
+
+	size_t			shard_max_size;	//!< Maximum memory used by the entries in one shard.
+	rlm_cache_shard_t	*shards;
+} rlm_cache_sharded_t;
+
+typedef struct rlm_cache_sharded_entry {
+	rlm_cache_entry_t	fields;		//!< Entry data.  Must be first.
+	uint32_t		hash;		//!< Hash of the key.  Selects the shard.
+	size_t			size;		//!< Memory used by this entry.
+	int32_t			heap_id;	//!< Offset used for heap.
+	fr_dlist_t		entry;		//!< Entry in the shard LRU list.
+} rlm_cache_sharded_entry_t;
+
+typedef struct rlm_cache_sharded_handle_s rlm_cache_sharded_handle_t;
+
+/** Tracks which shard is locked between acquire and release
+ *
+ */
+struct rlm_cache_sharded_handle_s {
+	rlm_cache_sharded_t		*driver;
+	rlm_cache_shard_t		*shard;		//!< Shard we hold the lock for, if any.
+	rlm_cache_sharded_handle_t	*next;		//!< Next handle in the thread's free list.
+};
+
+/** Handles which aren't in use, so acquire doesn't have to allocate one
+ *
+ * Usually there's only one.  More are needed if a cache is used while
+ * the handle for another is held, e.g. by an expansion in its update section.
+ */
+typedef struct {
+	rlm_cache_sharded_handle_t	*free;
+} rlm_cache_sharded_handles_t;
+
+fr_thread_local_setup(rlm_cache_sharded_handles_t *, sharded_handles)	/* macro */
+
+static CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_sharded_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_size", FR_TYPE_SIZE, rlm_cache_sharded_t, max_size), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+static uint32_t cache_entry_hash(void const *data)
+{
+	rlm_cache_sharded_entry_t const *c = data;
+
+	return c->hash;
+}
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one, *b = two;
+
+	return (a->expires > b->expires) - (a->expires < b->expires);
+}
+
+/** Lock the shard for a key
+ *
+ * The lock is held until the handle is released.  rlm_cache only uses
+ * one key per handle, so switching shards only happens if that changes,
+ * and no entries from the old shard are still in use.
+ */
+static rlm_cache_shard_t *shard_lock(rlm_cache_sharded_handle_t *handle, uint32_t hash)
+{
+	rlm_cache_sharded_t	*driver = handle->driver;
+	rlm_cache_shard_t	*shard;
+
+	/*
+	 *	The low bits of the hash pick the bucket in the
+	 *	shard's table, so use the high bits here.
+	 */
+	shard = &driver->shards[(hash >> 16) & (driver->num_shards - 1)];
+	if (handle->shard == shard) return shard;
+
+	if (handle->shard) pthread_mutex_unlock(&handle->shard->mutex);
+
+	if (pthread_mutex_trylock(&shard->mutex) != 0) {
+		pthread_mutex_lock(&shard->mutex);
+		shard->contended++;
+	}
+	handle->shard = shard;
+
+	return shard;
+}
+
+/** Remove an entry from all of the shard's structures
+ *
+ */
+static void shard_entry_remove(rlm_cache_shard_t *shard, rlm_cache_sharded_entry_t *c)
+{
+	(void) fr_heap_extract(shard->heap, c);
+	(void) fr_ohash_remove(shard->cache, c);
+	fr_dlist_remove(&shard->lru, c);
+
+	shard->size -= c->size;
+	atomic_fetch_sub_explicit(&shard->num_entries, 1, memory_order_relaxed);
+}
+
+/** Remove entries from a shard which have passed their expiry time
+ *
+ */
+static void shard_expire(rlm_cache_shard_t *shard, time_t now)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	while ((c = fr_heap_peek(shard->heap)) && (c->fields.expires < now)) {
+		shard_entry_remove(shard, c);
+		talloc_free(c);
+		shard->expired++;
+	}
+}
+
+static int cmd_show_cache_shards(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_cache_sharded_t	*driver = ctx;
+	uint32_t		i;
+
+	fprintf(fp, "shard\tentries\tsize\thits\tmisses\tevictions\texpired\tcontended\n");
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_shard_t	*shard = &driver->shards[i];
+		rlm_cache_shard_t	copy;
+
+		pthread_mutex_lock(&shard->mutex);
+		copy.size = shard->size;
+		copy.hits = shard->hits;
+		copy.misses = shard->misses;
+		copy.evictions = shard->evictions;
+		copy.expired = shard->expired;
+		copy.contended = shard->contended;
+		pthread_mutex_unlock(&shard->mutex);
+
+		fprintf(fp, "%u\t%u\t%zu\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n",
+			i, atomic_load_explicit(&shard->num_entries, memory_order_relaxed), copy.size,
+			copy.hits, copy.misses, copy.evictions, copy.expired, copy.contended);
+	}
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "shards",
+		.func = cmd_show_cache_shards,
+		.help = "Show per-shard statistics for a sharded cache.",
+		.read_only = true,
+	},
+
+	CMD_TABLE_END
+};
+
+/** Cleanup a cache_sharded instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_entry_t	*c;
+	uint32_t			i;
+
+	if (!driver->shards) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_shard_t *shard = &driver->shards[i];
+
+		/*
+		 *	Every entry is in the LRU list.
+		 */
+		if (shard->cache) while ((c = fr_dlist_head(&shard->lru))) {
+			shard_entry_remove(shard, c);
+			talloc_free(c);
+		}
+
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	return 0;
+}
+
+/** Create a new cache_sharded instance
+ *
+ * @copydetails cache_instantiate_t
+ */
+static int mod_instantiate(rlm_cache_config_t const *config, void *instance, UNUSED CONF_SECTION *conf)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	uint32_t		i, num_shards = 1;
+
+	if (driver->num_shards == 0) driver->num_shards = 1;
+	if (driver->num_shards > MAX_SHARDS) driver->num_shards = MAX_SHARDS;
+
+	while (num_shards < driver->num_shards) num_shards <<= 1;
+	driver->num_shards = num_shards;
+
+	driver->shard_max_size = driver->max_size / driver->num_shards;
+	if (driver->max_size && !driver->shard_max_size) {
+		ERROR("max_size must be at least %u bytes, one for each shard", driver->num_shards);
+		return -1;
+	}
+
+	driver->shards = talloc_zero_array(driver, rlm_cache_shard_t, driver->num_shards);
+	if (!driver->shards) {
+		ERROR("Failed allocating cache shards");
+		return -1;
+	}
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_shard_t *shard = &driver->shards[i];
+
+		if (pthread_mutex_init(&shard->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		atomic_init(&shard->num_entries, 0);
+		fr_dlist_init(&shard->lru, rlm_cache_sharded_entry_t, entry);
+
+		/*
+		 *	The cache.
+		 */
+		shard->cache = fr_ohash_create(driver->shards, cache_entry_hash, cache_entry_cmp, 0);
+		if (!shard->cache) {
+			ERROR("Failed to create cache");
+			return -1;
+		}
+
+		/*
+		 *	The heap of entries to expire.
+		 */
+		shard->heap = fr_heap_talloc_create(driver->shards, cache_heap_cmp, rlm_cache_sharded_entry_t, heap_id);
+		if (!shard->heap) {
+			ERROR("Failed to create heap for the cache");
+			return -1;
+		}
+	}
+
+	if (fr_command_register_hook(NULL, config->name, driver, cmd_table) < 0) {
+		PERROR("Failed registering radmin commands for cache %s", config->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    REQUEST *request)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_sharded_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+	c->heap_id = -1;
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+				       REQUEST *request, void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_shard_t		*shard;
+	rlm_cache_sharded_entry_t	*c, my_c;
+
+	my_c.fields.key = key;
+	my_c.fields.key_len = key_len;
+	my_c.hash = fr_hash(key, key_len);
+
+	shard = shard_lock(handle, my_c.hash);
+
+	/*
+	 *	Clear out old entries
+	 */
+	shard_expire(shard, request->packet->timestamp.tv_sec);
+
+	/*
+	 *	Is there an entry for this key?
+	 */
+	c = fr_ohash_find(shard->cache, &my_c);
+	if (!c) {
+		shard->misses++;
+		*out = NULL;
+		return CACHE_MISS;
+	}
+	shard->hits++;
+
+	/*
+	 *	Move it to the front of the LRU list.
+	 */
+	fr_dlist_remove(&shard->lru, c);
+	fr_dlist_insert_head(&shard->lru, c);
+
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					 REQUEST *request, void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_shard_t		*shard;
+	rlm_cache_sharded_entry_t	*c, my_c;
+
+	if (!request) return CACHE_ERROR;
+
+	my_c.fields.key = key;
+	my_c.fields.key_len = key_len;
+	my_c.hash = fr_hash(key, key_len);
+
+	shard = shard_lock(handle, my_c.hash);
+
+	c = fr_ohash_find(shard->cache, &my_c);
+	if (!c) return CACHE_MISS;
+
+	shard_entry_remove(shard, c);
+	talloc_free(c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * If the shard would go over its share of max_size, the least recently
+ * used entries are evicted to make room.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 REQUEST *request, void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_shard_t		*shard;
+	rlm_cache_sharded_entry_t	*my_c, *old;
+
+	if (!request) return CACHE_ERROR;
+
+	memcpy(&my_c, &c, sizeof(my_c));
+
+	my_c->hash = fr_hash(c->key, c->key_len);
+	my_c->size = talloc_total_size(my_c);
+
+	if (driver->shard_max_size && (my_c->size > driver->shard_max_size)) {
+		RERROR("Entry is %zu bytes, which is larger than the per-shard limit of %zu bytes",
+		       my_c->size, driver->shard_max_size);
+		return CACHE_ERROR;
+	}
+
+	shard = shard_lock(handle, my_c->hash);
+
+	shard_expire(shard, request->packet->timestamp.tv_sec);
+
+	/*
+	 *	Allow overwriting
+	 */
+	old = fr_ohash_find(shard->cache, my_c);
+	if (old) {
+		shard_entry_remove(shard, old);
+		talloc_free(old);
+	}
+
+	if (driver->shard_max_size) while ((shard->size + my_c->size) > driver->shard_max_size) {
+		old = fr_dlist_tail(&shard->lru);
+		if (!old) break;
+
+		RDEBUG3("Evicting least recently used entry to make room");
+		shard_entry_remove(shard, old);
+		talloc_free(old);
+		shard->evictions++;
+	}
+
+	if (fr_ohash_insert(shard->cache, my_c) < 0) {
+		RERROR("Failed adding entry");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(shard->heap, my_c) < 0) {
+		(void) fr_ohash_remove(shard->cache, my_c);
+		RERROR("Failed adding entry to expiry heap");
+		return CACHE_ERROR;
+	}
+
+	fr_dlist_insert_head(&shard->lru, my_c);
+	shard->size += my_c->size;
+	atomic_fetch_add_explicit(&shard->num_entries, 1, memory_order_relaxed);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					  REQUEST *request, void *handle,
+					  rlm_cache_entry_t *c)
+{
+	rlm_cache_sharded_entry_t	*my_c = (rlm_cache_sharded_entry_t *)c;
+	rlm_cache_shard_t		*shard;
+
+#ifdef NDEBUG
+	if (!request) return CACHE_ERROR;
+#endif
+
+	shard = shard_lock(handle, my_c->hash);
+
+	if (!fr_cond_assert(fr_heap_extract(shard->heap, my_c) == 0)) {
+		RERROR("Entry not in heap");
+		return CACHE_ERROR;
+	}
+
+	if (fr_heap_insert(shard->heap, my_c) < 0) {
+		shard_entry_remove(shard, my_c);	/* make sure we don't leak entries... */
+		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
+		return CACHE_ERROR;
+	}
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * The shard counts are read without locking, so the total is only
+ * approximate if other workers are inserting or removing entries.
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  REQUEST *request, UNUSED void *handle)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	uint32_t		i, count = 0;
+
+	if (!request) return CACHE_ERROR;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		count += atomic_load_explicit(&driver->shards[i].num_entries, memory_order_relaxed);
+	}
+
+	return count;
+}
+
+static void _sharded_handles_free(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Get a handle to track the locked shard
+ *
+ * No lock is taken here, as we don't know the key yet.  The shard for the
+ * key is locked by the first operation which uses it.
+ *
+ * Handles are reused from the thread's free list where possible.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+			 REQUEST *request)
+{
+	rlm_cache_sharded_handles_t	*handles = sharded_handles;
+	rlm_cache_sharded_handle_t	*h;
+
+	if (!handles) {
+		handles = talloc_zero(NULL, rlm_cache_sharded_handles_t);
+		if (!handles) {
+		oom:
+			RERROR("Failed allocating cache handle");
+			return -1;
+		}
+		fr_thread_local_set_destructor(sharded_handles, _sharded_handles_free, handles);
+	}
+
+	h = handles->free;
+	if (h) {
+		handles->free = h->next;
+		h->next = NULL;
+	} else {
+		h = talloc_zero(handles, rlm_cache_sharded_handle_t);
+		if (!h) goto oom;
+	}
+	h->driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+
+	*handle = h;
+
+	return 0;
+}
+
+/** Release the handle, unlocking any shard we locked
+ *
+ * The handle is returned to the thread's free list.
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, REQUEST *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_sharded_handle_t	*h = talloc_get_type_abort(handle, rlm_cache_sharded_handle_t);
+	rlm_cache_sharded_handles_t	*handles = sharded_handles;
+
+	if (h->shard) {
+		pthread_mutex_unlock(&h->shard->mutex);
+		RDEBUG3("Shard %u released", (unsigned int) (h->shard - h->driver->shards));
+		h->shard = NULL;
+	}
+
+	rad_assert(handles);
+	h->next = handles->free;
+	handles->free = h;
+}
+
+extern cache_driver_t rlm_cache_sharded;
+cache_driver_t rlm_cache_sharded = {
+	.name		= "rlm_cache_sharded",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_sharded_t),
+	.config		= driver_config,
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
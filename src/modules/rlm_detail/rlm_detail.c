@@ -30,6 +30,7 @@ RCSID("$Id$")
 #include <freeradius-devel/server/modules.h>
 #include <freeradius-devel/server/rad_assert.h>
 #include <freeradius-devel/server/exfile.h>
+#include <freeradius-devel/util/uring.h>
 
 #include <ctype.h>
 #include <fcntl.h>
@@ -62,6 +63,8 @@ typedef struct detail_instance {
 
 	bool		escape;		//!< do filename escaping, yes / no
 
+	bool		io_uring;	//!< Write entries asynchronously with io_uring.
+
 	xlat_escape_t	escape_func; //!< escape function
 
 	exfile_t    	*ef;		//!< Log file handler
@@ -69,6 +72,14 @@ typedef struct detail_instance {
 	fr_hash_table_t *ht;		//!< Holds suppressed attributes.
 } rlm_detail_t;
 
+/** Thread specific data for rlm_detail
+ *
+ */
+typedef struct {
+	rlm_detail_t const	*inst;		//!< Instance of rlm_detail.
+	fr_uring_t		*uring;		//!< For writing entries, or NULL to write them synchronously.
+} rlm_detail_thread_t;
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("filename", FR_TYPE_FILE_OUTPUT | FR_TYPE_REQUIRED | FR_TYPE_XLAT, rlm_detail_t, filename), .dflt = "%A/%{Packet-Src-IP-Address}/detail" },
 	{ FR_CONF_OFFSET("header", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_detail_t, header), .dflt = "%t" },
@@ -77,6 +88,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("locking", FR_TYPE_BOOL, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", FR_TYPE_BOOL, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", FR_TYPE_BOOL, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("io_uring", FR_TYPE_BOOL, rlm_detail_t, io_uring), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -160,6 +172,15 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		inst->escape_func = rad_filename_make_safe;
 	}
 
+	/*
+	 *	The lock would have to be held until the write
+	 *	completes, which would block every other thread.
+	 */
+	if (inst->io_uring && inst->locking) {
+		cf_log_warn(conf, "Ignoring 'io_uring = yes', as 'locking = yes'");
+		inst->io_uring = false;
+	}
+
 	inst->ef = module_exfile_init(inst, conf, 256, 30, inst->locking, NULL, NULL);
 	if (!inst->ef) {
 		cf_log_err(conf, "Failed creating log file context");
@@ -220,6 +241,39 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	return 0;
 }
 
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_detail_t		*inst = talloc_get_type_abort(instance, rlm_detail_t);
+	rlm_detail_thread_t	*t = thread;
+
+	(void) talloc_set_type(t, rlm_detail_thread_t);
+
+	t->inst = inst;
+
+	if (!inst->io_uring) return 0;
+
+	/*
+	 *	If the kernel doesn't support io_uring, we write
+	 *	entries synchronously, as before.
+	 */
+	t->uring = fr_uring_alloc(t, 64);
+	if (!t->uring || (fr_uring_event_insert(t->uring, el) < 0)) {
+		PWARN("Not using io_uring");
+		TALLOC_FREE(t->uring);
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_detail_thread_t *t = talloc_get_type_abort(thread, rlm_detail_thread_t);
+
+	TALLOC_FREE(t->uring);
+
+	return 0;
+}
+
 /*
  *	Wrapper for VPs allocated on the stack.
  */
@@ -377,11 +431,132 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 	return 0;
 }
 
+/** An entry which is being written by io_uring
+ *
+ * This is allocated in the thread context, not the request, as the
+ * write can't be cancelled.  If the request is cancelled, the entry
+ * is freed when the write completes.
+ */
+typedef struct {
+	REQUEST			*request;	//!< The request, or NULL if it was cancelled.
+	rlm_detail_t const	*inst;		//!< Instance of rlm_detail.
+	int			outfd;		//!< From exfile_open().
+	char			*entry;		//!< The formatted entry.
+	size_t			entry_len;	//!< Length of the entry.
+	ssize_t			result;		//!< Bytes written, or -errno.
+} detail_write_t;
+
+static int _detail_write_free(detail_write_t *dw)
+{
+	exfile_close(dw->inst->ef, dw->request, dw->outfd);
+	free(dw->entry);
+
+	return 0;
+}
+
+static void _detail_written(UNUSED fr_uring_t *ur, UNUSED int fd, ssize_t result, void *uctx)
+{
+	detail_write_t *dw = talloc_get_type_abort(uctx, detail_write_t);
+
+	if (!dw->request) {
+		talloc_free(dw);
+		return;
+	}
+
+	dw->result = result;
+	unlang_resumable(dw->request);
+}
+
+static rlm_rcode_t detail_write_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx)
+{
+	detail_write_t	*dw = talloc_get_type_abort(rctx, detail_write_t);
+	rlm_rcode_t	rcode = RLM_MODULE_OK;
+
+	if (dw->result < 0) {
+		RERROR("Failed writing to detail file: %s", fr_syserror(-dw->result));
+		rcode = RLM_MODULE_FAIL;
+	}
+
+	talloc_free(dw);
+
+	return rcode;
+}
+
+static void detail_write_signal(UNUSED REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx,
+				fr_state_signal_t action)
+{
+	detail_write_t *dw = talloc_get_type_abort(rctx, detail_write_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	/*
+	 *	The write can't be stopped.  Let _detail_written()
+	 *	clean up.
+	 */
+	dw->request = NULL;
+}
+
+/** Format the entry in memory, and queue it to be appended to the file
+ *
+ * The entry is written as one write(), so that entries from
+ * different threads are never interleaved.
+ */
+static rlm_rcode_t detail_write_async(rlm_detail_thread_t *t, REQUEST *request, int outfd,
+				      RADIUS_PACKET *packet, bool compat)
+{
+	rlm_detail_t const	*inst = t->inst;
+	detail_write_t		*dw;
+	FILE			*fp;
+	int			flags;
+
+	MEM(dw = talloc_zero(t, detail_write_t));
+	dw->request = request;
+	dw->inst = inst;
+	dw->outfd = outfd;
+	talloc_set_destructor(dw, _detail_write_free);
+
+	fp = open_memstream(&dw->entry, &dw->entry_len);
+	if (!fp) {
+		RERROR("Failed allocating detail entry: %s", fr_syserror(errno));
+	fail:
+		talloc_free(dw);
+		return RLM_MODULE_FAIL;
+	}
+
+	if (detail_write(fp, inst, request, packet, compat) < 0) {
+		fclose(fp);
+		goto fail;
+	}
+	fclose(fp);
+
+	if (!dw->entry_len) {
+		talloc_free(dw);
+		return RLM_MODULE_OK;
+	}
+
+	/*
+	 *	This is what fdopen(..., "a") does for the
+	 *	synchronous path.
+	 */
+	flags = fcntl(outfd, F_GETFL);
+	if ((flags < 0) || (!(flags & O_APPEND) && (fcntl(outfd, F_SETFL, flags | O_APPEND) < 0))) {
+		RERROR("Failed setting append mode on detail file: %s", fr_syserror(errno));
+		goto fail;
+	}
+
+	if (fr_uring_write(t->uring, outfd, dw->entry, dw->entry_len, _detail_written, dw) < 0) {
+		RPERROR("Failed queueing write to detail file");
+		goto fail;
+	}
+
+	return unlang_module_yield(request, detail_write_resume, detail_write_signal, dw);
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
-static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *request,
-					      RADIUS_PACKET *packet, bool compat)
+static rlm_rcode_t CC_HINT(nonnull(1,3,4)) detail_do(void const *instance, rlm_detail_thread_t *t,
+						     REQUEST *request, RADIUS_PACKET *packet, bool compat)
 {
 	int		outfd, dupfd;
 	char		buffer[DIRLEN];
@@ -428,6 +603,8 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 	}
 
 skip_group:
+	if (t && t->uring) return detail_write_async(t, request, outfd, packet, compat);
+
 	outfp = NULL;
 	dupfd = dup(outfd);
 	if (dupfd < 0) {
@@ -463,42 +640,42 @@ skip_group:
 /*
  *	Accounting - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_accounting(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->packet, true);
+	return detail_do(instance, thread, request, request->packet, true);
 }
 
 /*
  *	Incoming Access Request - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_authorize(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->packet, false);
+	return detail_do(instance, thread, request, request->packet, false);
 }
 
 /*
  *	Outgoing Access-Request Reply - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->reply, false);
+	return detail_do(instance, thread, request, request->reply, false);
 }
 
 #ifdef WITH_COA
 /*
  *	Incoming CoA - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_recv_coa(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_recv_coa(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->packet, false);
+	return detail_do(instance, thread, request, request->packet, false);
 }
 
 /*
  *	Outgoing CoA - write the detail files.
  */
-static rlm_rcode_t CC_HINT(nonnull) mod_send_coa(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_send_coa(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->reply, false);
+	return detail_do(instance, thread, request, request->reply, false);
 }
 #endif
 
@@ -506,9 +683,9 @@ static rlm_rcode_t CC_HINT(nonnull) mod_send_coa(void *instance, UNUSED void *th
  *	Outgoing Access-Request to home server - write the detail files.
  */
 #ifdef WITH_PROXY
-static rlm_rcode_t CC_HINT(nonnull) mod_pre_proxy(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t CC_HINT(nonnull) mod_pre_proxy(void *instance, void *thread, REQUEST *request)
 {
-	return detail_do(instance, request, request->proxy->packet, false);
+	return detail_do(instance, thread, request, request->proxy->packet, false);
 }
 
 
@@ -527,14 +704,18 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_proxy(void *instance, void *thread,
 	if (!request->proxy->reply) {
 		rlm_rcode_t rcode;
 
-		rcode = mod_accounting(instance, thread, request);
+		/*
+		 *	Write the entry synchronously, as we need
+		 *	the result now.
+		 */
+		rcode = detail_do(instance, NULL, request, request->packet, true);
 		if (rcode == RLM_MODULE_OK) {
 			request->reply->code = FR_CODE_ACCOUNTING_RESPONSE;
 		}
 		return rcode;
 	}
 
-	return detail_do(instance, request, request->proxy->reply, false);
+	return detail_do(instance, thread, request, request->proxy->reply, false);
 }
 #endif
 
@@ -547,6 +728,9 @@ rad_module_t rlm_detail = {
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_detail_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 		[MOD_PREACCT]		= mod_accounting,
@@ -71,6 +71,8 @@
 RCSID("$Id$")
 USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
+#include <freeradius-devel/unlang/base.h>
+
 #include "eap_tls.h"
 #include "eap_attrs.h"
 
@@ -79,6 +81,7 @@ FR_NAME_NUMBER const eap_tls_status_table[] = {
 	{ "established",		EAP_TLS_ESTABLISHED },
 	{ "fail",			EAP_TLS_FAIL },
 	{ "handled",			EAP_TLS_HANDLED },
+	{ "yield",			EAP_TLS_YIELD },
 
 	{ "start",			EAP_TLS_START_SEND },
 	{ "request",			EAP_TLS_RECORD_SEND },
@@ -787,22 +790,31 @@ ignore_length:
  *	- EAP_TLS_HANDLED if we need to send an additional request to the peer.
  *	- EAP_TLS_ESTABLISHED if the handshake completed successfully, and there's
  *	  no more data to send.
+ *	- EAP_TLS_YIELD if the handshake step is waiting for a crypto thread.
  */
 static eap_tls_status_t eap_tls_handshake(eap_session_t *eap_session)
 {
 	REQUEST			*request = eap_session->request;
 	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
 	tls_session_t		*tls_session = eap_tls_session->tls_session;
+	int			ret;
 
 	/*
 	 *	Continue the TLS handshake
 	 */
-	if (!tls_session_handshake(eap_session->request, tls_session)) {
+	ret = tls_session_handshake(eap_session->request, tls_session);
+	if (!ret) {
 		REDEBUG("TLS receive handshake failed during operation");
 		tls_cache_deny(tls_session);
 		return EAP_TLS_FAIL;
 	}
 
+	/*
+	 *	The handshake step is continued when
+	 *	the private key operation completes.
+	 */
+	if (ret == 2) return EAP_TLS_YIELD;
+
 	/*
 	 *	FIXME: return success/fail.
 	 *
@@ -880,6 +892,16 @@ eap_tls_status_t eap_tls_process(eap_session_t *eap_session)
 
 	SSL_set_ex_data(tls_session->ssl, FR_TLS_EX_INDEX_REQUEST, request);
 
+	/*
+	 *	The last handshake step was waiting for a crypto
+	 *	thread.  The data from the peer has already been
+	 *	given to OpenSSL, so just continue the handshake.
+	 */
+	if (tls_async_pending(tls_session)) {
+		status = eap_tls_handshake(eap_session);
+		goto done;
+	}
+
 	/*
 	 *	Call eap_tls_verify to sanity check the incoming EAP data.
 	 */
@@ -1016,6 +1038,73 @@ eap_tls_status_t eap_tls_process(eap_session_t *eap_session)
 	return status;
 }
 
+/** Tracks an EAP-TLS round which is waiting for a crypto thread
+ *
+ */
+typedef struct {
+	void			*instance;		//!< Submodule instance.
+	eap_session_t		*eap_session;		//!< The EAP session the handshake step is for.
+	bool			resumed;		//!< Whether we've been resumed.
+	bool			processed;		//!< Whether the round has been processed again.
+} eap_tls_yield_rctx_t;
+
+/** Process the EAP-TLS round again once the crypto thread is done
+ *
+ */
+static unlang_action_t eap_tls_yield_resume(UNUSED REQUEST *request, rlm_rcode_t *presult,
+					    UNUSED int *priority, void *uctx)
+{
+	eap_tls_yield_rctx_t	*rctx = talloc_get_type_abort(uctx, eap_tls_yield_rctx_t);
+	rlm_rcode_t		rcode;
+
+	/*
+	 *	Called as soon as we're pushed.
+	 */
+	if (!rctx->resumed) {
+		rctx->resumed = true;
+		return UNLANG_ACTION_YIELD;
+	}
+
+	/*
+	 *	Processing the round pushed more frames,
+	 *	and their result is in presult.
+	 */
+	if (rctx->processed) return UNLANG_ACTION_CALCULATE_RESULT;
+
+	rctx->processed = true;
+	rcode = rctx->eap_session->process(rctx->instance, rctx->eap_session);
+	if (rcode == RLM_MODULE_YIELD) return UNLANG_ACTION_PUSHED_CHILD;
+
+	*presult = rcode;
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
+/** Yield until a handshake step's private key operation is done
+ *
+ * Should be called by submodules when #eap_tls_process returns
+ * #EAP_TLS_YIELD.  When the request is resumed, the submodule's
+ * process function is called again, and continues the handshake.
+ *
+ * @param instance	of the submodule.
+ * @param eap_session	the handshake step is for.
+ * @return RLM_MODULE_YIELD.
+ */
+rlm_rcode_t eap_tls_yield(void *instance, eap_session_t *eap_session)
+{
+	REQUEST			*request = eap_session->request;
+	eap_tls_yield_rctx_t	*rctx;
+
+	MEM(rctx = talloc(request, eap_tls_yield_rctx_t));
+	*rctx = (eap_tls_yield_rctx_t) {
+		.instance = instance,
+		.eap_session = eap_session
+	};
+
+	unlang_push_function(request, NULL, eap_tls_yield_resume, rctx);
+
+	return RLM_MODULE_YIELD;
+}
+
 /** Create a new tls_session_t associated with an #eap_session_t
  *
  * Creates a new server tls_session_t and associates it with an #eap_session_t
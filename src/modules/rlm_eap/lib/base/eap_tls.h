@@ -90,6 +90,8 @@ typedef enum {
 	EAP_TLS_ESTABLISHED,       			//!< Session established, send success (or start phase2).
 	EAP_TLS_FAIL,       				//!< Fail, send fail.
 	EAP_TLS_HANDLED,	  			//!< TLS code has handled it.
+	EAP_TLS_YIELD,					//!< Handshake step is waiting for a crypto thread,
+							///< call eap_tls_yield().
 
 	/*
 	 *	Composition states, we need to
@@ -153,6 +155,8 @@ extern FR_NAME_NUMBER const eap_tls_status_table[];
  */
 eap_tls_status_t	eap_tls_process(eap_session_t *eap_session) CC_HINT(nonnull);
 
+rlm_rcode_t		eap_tls_yield(void *instance, eap_session_t *eap_session) CC_HINT(nonnull);
+
 int			eap_tls_start(eap_session_t *eap_session) CC_HINT(nonnull);
 
 int			eap_tls_success(eap_session_t *eap_session) CC_HINT(nonnull);
@@ -480,6 +480,13 @@ static rlm_rcode_t mod_process(void *instance, eap_session_t *eap_session)
 	}
 
 	switch (status) {
+	/*
+	 *	The handshake step is waiting for a crypto
+	 *	thread, try again when it's done.
+	 */
+	case EAP_TLS_YIELD:
+		return eap_tls_yield(inst, eap_session);
+
 	/*
 	 *	EAP-TLS handshake was successful, tell the
 	 *	client to keep talking.
@@ -146,20 +146,14 @@ static rlm_rcode_t eap_tls_virtual_server(rlm_eap_tls_t *inst, eap_session_t *ea
 	return RLM_MODULE_YIELD;
 }
 
-static rlm_rcode_t mod_process(void *instance, eap_session_t *eap_session)
+/** Convert the result of processing an EAP-TLS packet into a module rcode
+ *
+ */
+static rlm_rcode_t eap_tls_status_process(rlm_eap_tls_t *inst, eap_session_t *eap_session, eap_tls_status_t status)
 {
-	eap_tls_status_t	status;
 	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
 	tls_session_t		*tls_session = eap_tls_session->tls_session;
 	REQUEST			*request = eap_session->request;
-	rlm_eap_tls_t		*inst = talloc_get_type_abort(instance, rlm_eap_tls_t);
-
-	status = eap_tls_process(eap_session);
-	if ((status == EAP_TLS_INVALID) || (status == EAP_TLS_FAIL)) {
-		REDEBUG("[eap-tls process] = %s", fr_int2str(eap_tls_status_table, status, "<INVALID>"));
-	} else {
-		RDEBUG2("[eap-tls process] = %s", fr_int2str(eap_tls_status_table, status, "<INVALID>"));
-	}
 
 	switch (status) {
 	/*
@@ -206,6 +200,123 @@ static rlm_rcode_t mod_process(void *instance, eap_session_t *eap_session)
 	}
 }
 
+#ifdef HAVE_OPENSSL_OCSP_H
+/** Tracks an EAP-TLS round which is waiting for an OCSP response
+ *
+ */
+typedef struct {
+	rlm_eap_tls_t		*inst;			//!< Module instance.
+	eap_session_t		*eap_session;		//!< The EAP session the lookup was started in.
+	eap_tls_status_t	status;			//!< What eap_tls_process() returned.
+	bool			checked;		//!< Whether the OCSP result has been processed.
+} eap_tls_ocsp_rctx_t;
+
+/** Complete an EAP-TLS round once the OCSP responder has answered
+ *
+ * The handshake carries on whilst the OCSP lookup is outstanding, but
+ * the reply isn't released until we know the certificate is good.
+ */
+static unlang_action_t eap_tls_ocsp_resume(REQUEST *request, rlm_rcode_t *presult,
+					   UNUSED int *priority, void *uctx)
+{
+	eap_tls_ocsp_rctx_t	*rctx = talloc_get_type_abort(uctx, eap_tls_ocsp_rctx_t);
+	eap_session_t		*eap_session = rctx->eap_session;
+	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
+	rlm_rcode_t		rcode;
+
+	/*
+	 *	The virtual server has finished validating the
+	 *	certificate, and its result is in presult.
+	 */
+	if (rctx->checked) return UNLANG_ACTION_CALCULATE_RESULT;
+
+	switch (tls_ocsp_async_result(request, eap_tls_session->tls_session)) {
+	case -1:
+		return UNLANG_ACTION_YIELD;
+
+	case 0:
+		REDEBUG("Certificate rejected by OCSP responder");
+		eap_tls_fail(eap_session);
+		*presult = RLM_MODULE_REJECT;
+		return UNLANG_ACTION_CALCULATE_RESULT;
+
+	default:
+		break;
+	}
+
+	rctx->checked = true;
+	rcode = eap_tls_status_process(rctx->inst, eap_session, rctx->status);
+	if (rcode == RLM_MODULE_YIELD) return UNLANG_ACTION_PUSHED_CHILD;
+
+	*presult = rcode;
+	return UNLANG_ACTION_CALCULATE_RESULT;
+}
+
+/** Yield until the OCSP responder has answered
+ *
+ */
+static rlm_rcode_t eap_tls_ocsp_wait(rlm_eap_tls_t *inst, eap_session_t *eap_session, eap_tls_status_t status)
+{
+	eap_tls_session_t	*eap_tls_session = talloc_get_type_abort(eap_session->opaque, eap_tls_session_t);
+	REQUEST			*request = eap_session->request;
+	eap_tls_ocsp_rctx_t	*rctx;
+
+	/*
+	 *	No point waiting for the responder if the
+	 *	handshake has already failed.
+	 */
+	if ((status == EAP_TLS_INVALID) || (status == EAP_TLS_FAIL)) {
+		TALLOC_FREE(eap_tls_session->tls_session->ocsp);
+		return eap_tls_status_process(inst, eap_session, status);
+	}
+
+	MEM(rctx = talloc(request, eap_tls_ocsp_rctx_t));
+	*rctx = (eap_tls_ocsp_rctx_t) {
+		.inst = inst,
+		.eap_session = eap_session,
+		.status = status
+	};
+
+	RDEBUG2("Waiting for OCSP response");
+	unlang_push_function(request, NULL, eap_tls_ocsp_resume, rctx);
+
+	return RLM_MODULE_YIELD;
+}
+#endif
+
+static rlm_rcode_t mod_process(void *instance, eap_session_t *eap_session)
+{
+	eap_tls_status_t	status;
+	REQUEST			*request = eap_session->request;
+	rlm_eap_tls_t		*inst = talloc_get_type_abort(instance, rlm_eap_tls_t);
+
+	status = eap_tls_process(eap_session);
+	if ((status == EAP_TLS_INVALID) || (status == EAP_TLS_FAIL)) {
+		REDEBUG("[eap-tls process] = %s", fr_int2str(eap_tls_status_table, status, "<INVALID>"));
+	} else {
+		RDEBUG2("[eap-tls process] = %s", fr_int2str(eap_tls_status_table, status, "<INVALID>"));
+	}
+
+	/*
+	 *	The handshake step is waiting for a crypto
+	 *	thread, try again when it's done.
+	 */
+	if (status == EAP_TLS_YIELD) return eap_tls_yield(inst, eap_session);
+
+#ifdef HAVE_OPENSSL_OCSP_H
+	/*
+	 *	The client's certificate is being checked by an
+	 *	OCSP responder.  Wait for the result before
+	 *	sending anything back to the client.
+	 */
+	if (((eap_tls_session_t *) eap_session->opaque)->tls_session->ocsp) {
+		return eap_tls_ocsp_wait(inst, eap_session, status);
+	}
+#endif
+
+	return eap_tls_status_process(inst, eap_session, status);
+}
+
 /*
  *	Send an initial eap-tls request to the peer, using the libeap functions.
  */
@@ -237,6 +348,7 @@ static rlm_rcode_t mod_session_init(void *uctx, eap_session_t *eap_session)
 
 	eap_tls_session->include_length = inst->include_length;
 	eap_tls_session->tls_session->prf_label = "client EAP encryption";
+	eap_tls_session->tls_session->ocsp_async = true;
 
 	/*
 	 *	TLS session initialization is over.  Now handle TLS
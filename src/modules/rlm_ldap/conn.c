@@ -153,3 +153,256 @@ void *mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *tim
 
 	return conn;
 }
+
+/** Allocate a ctx for waiting on the results of operations
+ *
+ * @param[in] request	The current request.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] conn	to send operations on.  Released by #rlm_ldap_async_free.
+ * @return
+ *	- A new async ctx.
+ *	- NULL on error.  The connection is not released.
+ */
+rlm_ldap_async_t *rlm_ldap_async_alloc(REQUEST *request, rlm_ldap_t const *inst, fr_ldap_connection_t *conn)
+{
+	rlm_ldap_async_t	*async;
+
+	async = talloc_zero(request, rlm_ldap_async_t);
+	if (!async) {
+		REDEBUG("Out of memory");
+		return NULL;
+	}
+	async->inst = inst;
+	async->conn = conn;
+	async->msgid = -1;
+	async->fd = -1;
+
+	return async;
+}
+
+/** Free any result, and release the connection
+ *
+ * If the last operation failed because the connection was bad, the
+ * connection is closed instead of being released.
+ *
+ * @param[in] request	The current request.
+ * @param[in] async	ctx to free.
+ */
+void rlm_ldap_async_free(REQUEST *request, rlm_ldap_async_t *async)
+{
+	if (async->result) ldap_msgfree(async->result);
+
+	if (async->conn) {
+		if (async->status == LDAP_PROC_BAD_CONN) {
+			fr_pool_connection_close(async->inst->pool, request, async->conn);
+		} else {
+			mod_conn_release(async->inst, request, async->conn);
+		}
+	}
+
+	talloc_free(async);
+}
+
+/** Remove the events we registered while waiting for a result
+ *
+ */
+static void _ldap_async_unwatch(REQUEST *request, rlm_ldap_async_t *async)
+{
+	(void) unlang_event_fd_delete(request, async, async->fd);
+	if (async->timeout_set) (void) unlang_event_timeout_delete(request, async);
+	async->timeout_set = false;
+}
+
+/** The connection's socket is readable, see if the whole result has arrived
+ *
+ */
+static void _ldap_async_read(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx, UNUSED int fd)
+{
+	rlm_ldap_async_t *async = talloc_get_type_abort(rctx, rlm_ldap_async_t);
+
+	async->status = fr_ldap_result_poll(&async->result, async->conn, async->msgid, async->dn);
+	if (async->status == LDAP_PROC_CONTINUE) return;
+
+	async->msgid = -1;
+	_ldap_async_unwatch(request, async);
+	unlang_resumable(request);
+}
+
+static void _ldap_async_error(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx, UNUSED int fd)
+{
+	rlm_ldap_async_t *async = talloc_get_type_abort(rctx, rlm_ldap_async_t);
+
+	RERROR("Error on connection socket");
+
+	async->status = LDAP_PROC_BAD_CONN;
+	_ldap_async_unwatch(request, async);
+	unlang_resumable(request);
+}
+
+static void _ldap_async_timeout(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx,
+				UNUSED struct timeval *fired)
+{
+	rlm_ldap_async_t *async = talloc_get_type_abort(rctx, rlm_ldap_async_t);
+
+	async->timeout_set = false;
+	async->status = LDAP_PROC_TIMEOUT;
+	_ldap_async_unwatch(request, async);
+	unlang_resumable(request);
+}
+
+static rlm_rcode_t _ldap_async_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx)
+{
+	rlm_ldap_async_t *async = talloc_get_type_abort(rctx, rlm_ldap_async_t);
+
+	/*
+	 *	Tell the server we're no longer interested,
+	 *	so the connection can be reused.
+	 */
+	if ((async->status == LDAP_PROC_TIMEOUT) && (async->msgid >= 0)) {
+		REDEBUG("Timed out waiting for result");
+		ldap_abandon_ext(async->conn->handle, async->msgid, NULL, NULL);
+		async->msgid = -1;
+	}
+
+	return async->resume(request, async);
+}
+
+static void _ldap_async_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx,
+			       fr_state_signal_t action)
+{
+	rlm_ldap_async_t *async = talloc_get_type_abort(rctx, rlm_ldap_async_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	RDEBUG2("Abandoning LDAP operation");
+
+	_ldap_async_unwatch(request, async);
+	if (async->msgid >= 0) ldap_abandon_ext(async->conn->handle, async->msgid, NULL, NULL);
+
+	rlm_ldap_async_free(request, async);
+}
+
+/** Yield until the result of an operation is available
+ *
+ * The request is resumed once the whole result has been read, the
+ * connection errors, or res_timeout passes.  resume is then called
+ * with the status (and for searches, the result) in the async ctx.
+ *
+ * @param[in] request	The current request.
+ * @param[in] async	ctx of the connection the operation was sent on.
+ * @param[in] msgid	of the operation.
+ * @param[in] dn	the operation was performed on, used in log messages.
+ * @param[in] resume	Called when the result is available.
+ * @return
+ *	- #RLM_MODULE_YIELD if we're waiting for the result.
+ *	- #RLM_MODULE_FAIL if we couldn't wait for the result.  async will have been freed.
+ */
+rlm_rcode_t rlm_ldap_async_wait(REQUEST *request, rlm_ldap_async_t *async, int msgid, char const *dn,
+				rlm_ldap_async_resume_t resume)
+{
+	fr_ldap_config_t const	*handle_config = async->conn->config;
+	struct timeval		now, when;
+
+	async->msgid = msgid;
+	async->resume = resume;
+	async->status = LDAP_PROC_CONTINUE;
+
+	talloc_const_free(async->dn);
+	async->dn = talloc_typed_strdup(async, dn ? dn : "");
+
+	if (async->result) {
+		ldap_msgfree(async->result);
+		async->result = NULL;
+	}
+
+	if ((ldap_get_option(async->conn->handle, LDAP_OPT_DESC, &async->fd) != LDAP_OPT_SUCCESS) ||
+	    (async->fd < 0)) {
+		REDEBUG("Failed retrieving connection socket");
+	error:
+		ldap_abandon_ext(async->conn->handle, msgid, NULL, NULL);
+		async->status = LDAP_PROC_BAD_CONN;
+		rlm_ldap_async_free(request, async);
+		return RLM_MODULE_FAIL;
+	}
+
+	if (unlang_event_fd_add(request, _ldap_async_read, NULL, _ldap_async_error, async, async->fd) < 0) {
+		RPEDEBUG("Failed adding event for connection socket");
+		goto error;
+	}
+
+	if (timerisset(&handle_config->res_timeout)) {
+		gettimeofday(&now, NULL);
+		fr_timeval_add(&when, &now, &handle_config->res_timeout);
+
+		if (unlang_event_module_timeout_add(request, _ldap_async_timeout, async, &when) < 0) {
+			RPEDEBUG("Failed adding result timeout");
+			(void) unlang_event_fd_delete(request, async, async->fd);
+			goto error;
+		}
+		async->timeout_set = true;
+	}
+
+	return unlang_module_yield(request, _ldap_async_resume, _ldap_async_signal, async);
+}
+
+/** Continue once we've rebound as the admin user
+ *
+ */
+static rlm_rcode_t _ldap_async_admin_resume(REQUEST *request, rlm_ldap_async_t *async)
+{
+	if (async->status != LDAP_PROC_SUCCESS) {
+		rlm_ldap_async_free(request, async);
+		return RLM_MODULE_FAIL;
+	}
+
+	async->conn->rebound = false;
+
+	return async->next(request, async);
+}
+
+/** Bind the connection as the admin user, if it was rebound as a user
+ *
+ * Searches are always performed as the admin user.  Simple binds are sent
+ * without blocking.  SASL binds need several round trips, and are still
+ * performed synchronously.
+ *
+ * @param[in] request	The current request.
+ * @param[in] async	ctx of the connection to bind.
+ * @param[in] next	Called once the connection is bound as the admin user.
+ * @return
+ *	- #RLM_MODULE_YIELD if we're waiting for the bind result.
+ *	- #RLM_MODULE_FAIL if the bind failed.  async will have been freed.
+ *	- The return value of next.
+ */
+rlm_rcode_t rlm_ldap_async_admin(REQUEST *request, rlm_ldap_async_t *async, rlm_ldap_async_resume_t next)
+{
+	fr_ldap_config_t const	*handle_config = async->conn->config;
+	int			msgid;
+
+	if (!async->conn->rebound) return next(request, async);
+
+	if (handle_config->admin_sasl.mech) {
+		if (fr_ldap_bind(request, &async->conn, handle_config->admin_identity, handle_config->admin_password,
+				 &handle_config->admin_sasl, NULL, NULL, NULL) != LDAP_PROC_SUCCESS) {
+			rlm_ldap_async_free(request, async);
+			return RLM_MODULE_FAIL;
+		}
+
+		rad_assert(async->conn);
+
+		async->conn->rebound = false;
+
+		return next(request, async);
+	}
+
+	async->status = fr_ldap_bind_send(&msgid, request, async->conn,
+					  handle_config->admin_identity, handle_config->admin_password, NULL, NULL);
+	if (async->status != LDAP_PROC_SUCCESS) {
+		rlm_ldap_async_free(request, async);
+		return RLM_MODULE_FAIL;
+	}
+
+	async->next = next;
+
+	return rlm_ldap_async_wait(request, async, msgid, handle_config->admin_identity, _ldap_async_admin_resume);
+}
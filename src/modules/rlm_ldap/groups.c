@@ -840,3 +840,313 @@ rlm_rcode_t rlm_ldap_check_cached(rlm_ldap_t const *inst, REQUEST *request, VALU
 
 	return RLM_MODULE_NOTFOUND;
 }
+
+/** The result of checking whether a user is a member of a group
+ *
+ */
+typedef struct {
+	char const	*user_dn;		//!< Normalised DN of the user object.
+	char const	*group;			//!< Group DN (normalised) or group name, as it was checked.
+	bool		member;			//!< Whether the user is a member of the group.
+
+	time_t		expires;		//!< When the entry should be removed.
+	int32_t		heap_id;		//!< Offset used for the expiry heap.
+	fr_heap_t	*heap;			//!< Heap the entry is in, so it can remove itself.
+} ldap_group_cache_entry_t;
+
+/** Compare two entries by user DN and group
+ *
+ */
+static int ldap_group_cache_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->user_dn, b->user_dn);
+	if (ret != 0) return ret;
+
+	return strcmp(a->group, b->group);
+}
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int ldap_group_cache_heap_cmp(void const *one, void const *two)
+{
+	ldap_group_cache_entry_t const *a = one, *b = two;
+
+	return (a->expires > b->expires) - (a->expires < b->expires);
+}
+
+/** Remove an entry from the expiry heap when it's removed from the tree
+ *
+ */
+static int _ldap_group_cache_entry_free(ldap_group_cache_entry_t *entry)
+{
+	fr_heap_extract(entry->heap, entry);
+
+	return 0;
+}
+
+/** Remove all entries, or entries for a given DN
+ *
+ * @param[in] ctx	DN of the user or group to remove entries for, or NULL
+ *			to remove all entries.
+ * @param[in] data	entry to check.
+ * @return
+ *	- 2 to delete the entry.
+ *	- 0 to keep it.
+ */
+static int _ldap_group_cache_entry_flush(void *ctx, void *data)
+{
+	char const			*dn = ctx;
+	ldap_group_cache_entry_t const	*entry = data;
+
+	if (!dn || (strcmp(entry->user_dn, dn) == 0) || (strcmp(entry->group, dn) == 0)) return 2;
+
+	return 0;
+}
+
+static int _ldap_group_cache_free(rlm_ldap_group_cache_t *cache)
+{
+	/*
+	 *	Entries have to be removed before the heap is freed.
+	 */
+	rbtree_walk(cache->tree, RBTREE_DELETE_ORDER, _ldap_group_cache_entry_flush, NULL);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Remove entries whose TTL has passed
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void ldap_group_cache_expire(rlm_ldap_group_cache_t *cache, time_t now)
+{
+	ldap_group_cache_entry_t *entry;
+
+	while ((entry = fr_heap_peek(cache->heap)) && (entry->expires <= now)) {
+		rbtree_deletebydata(cache->tree, entry);
+		cache->expired++;
+	}
+}
+
+/** Allocate the cache of group membership checks
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst)
+{
+	rlm_ldap_group_cache_t *cache;
+
+	MEM(cache = talloc_zero(inst, rlm_ldap_group_cache_t));
+
+	cache->tree = rbtree_talloc_create(cache, ldap_group_cache_cmp, ldap_group_cache_entry_t,
+					   rbtree_node_talloc_free, 0);
+	if (!cache->tree) {
+		ERROR("Failed to create group membership cache");
+	error:
+		talloc_free(cache);
+		return -1;
+	}
+
+	cache->heap = fr_heap_talloc_create(cache, ldap_group_cache_heap_cmp, ldap_group_cache_entry_t, heap_id);
+	if (!cache->heap) {
+		ERROR("Failed to create heap for the group membership cache");
+		goto error;
+	}
+
+	if (pthread_mutex_init(&cache->mutex, NULL) < 0) {
+		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+		goto error;
+	}
+	talloc_set_destructor(cache, _ldap_group_cache_free);
+
+	inst->group_cache = cache;
+
+	return 0;
+}
+
+/** Check whether we've recently determined if the user is a member of a group
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] request	Current request.
+ * @param[in] user_dn	Normalised DN of the user object.
+ * @param[in] check	vp containing the group value (name or dn).
+ * @return
+ *	- #RLM_MODULE_OK if the user is a member.
+ *	- #RLM_MODULE_NOTFOUND if the user isn't a member.
+ *	- #RLM_MODULE_NOOP if there's no cached result.
+ */
+rlm_rcode_t rlm_ldap_group_cache_find(rlm_ldap_t const *inst, REQUEST *request, char const *user_dn,
+				      VALUE_PAIR *check)
+{
+	rlm_ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_entry_t	find, *entry;
+	rlm_rcode_t			rcode = RLM_MODULE_NOOP;
+
+	if (!cache) return RLM_MODULE_NOOP;
+
+	find.user_dn = user_dn;
+	find.group = check->vp_strvalue;
+
+	pthread_mutex_lock(&cache->mutex);
+	entry = rbtree_finddata(cache->tree, &find);
+	if (entry && (entry->expires <= time(NULL))) {
+		rbtree_deletebydata(cache->tree, entry);
+		cache->expired++;
+		entry = NULL;
+	}
+
+	if (!entry) {
+		cache->misses++;
+	} else if (entry->member) {
+		cache->hits++;
+		rcode = RLM_MODULE_OK;
+	} else {
+		cache->negative_hits++;
+		rcode = RLM_MODULE_NOTFOUND;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	switch (rcode) {
+	case RLM_MODULE_OK:
+		RDEBUG2("User found. Matched membership in group cache");
+		break;
+
+	case RLM_MODULE_NOTFOUND:
+		RDEBUG2("User not found. Matched non-membership in group cache");
+		break;
+
+	default:
+		break;
+	}
+
+	return rcode;
+}
+
+/** Record whether the user is a member of a group
+ *
+ * If the cache is full, the entry closest to expiry is replaced.
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] request	Current request.
+ * @param[in] user_dn	Normalised DN of the user object.
+ * @param[in] check	vp containing the group value (name or dn).
+ * @param[in] member	Whether the user is a member of the group.
+ */
+void rlm_ldap_group_cache_add(rlm_ldap_t const *inst, REQUEST *request, char const *user_dn,
+			      VALUE_PAIR *check, bool member)
+{
+	rlm_ldap_group_cache_t		*cache = inst->group_cache;
+	ldap_group_cache_entry_t	*entry, *old;
+	uint32_t			ttl = member ? inst->group_cache_ttl : inst->group_cache_negative_ttl;
+	time_t				now;
+
+	if (!cache || !ttl) return;
+
+	now = time(NULL);
+
+	MEM(entry = talloc_zero(NULL, ldap_group_cache_entry_t));
+	entry->user_dn = talloc_typed_strdup(entry, user_dn);
+	entry->group = talloc_typed_strdup(entry, check->vp_strvalue);
+	entry->member = member;
+	entry->expires = now + ttl;
+	entry->heap_id = -1;
+	entry->heap = cache->heap;
+
+	pthread_mutex_lock(&cache->mutex);
+	ldap_group_cache_expire(cache, now);
+
+	/*
+	 *	Another request may have checked the same
+	 *	group while we were searching.
+	 */
+	old = rbtree_finddata(cache->tree, entry);
+	if (old) {
+		rbtree_deletebydata(cache->tree, old);
+	} else if (rbtree_num_elements(cache->tree) >= inst->group_cache_size) {
+		rbtree_deletebydata(cache->tree, fr_heap_peek(cache->heap));
+		cache->evicted++;
+	}
+
+	if (!rbtree_insert(cache->tree, entry)) {
+		pthread_mutex_unlock(&cache->mutex);
+		talloc_free(entry);
+		return;
+	}
+	fr_heap_insert(cache->heap, entry);
+	talloc_set_destructor(entry, _ldap_group_cache_entry_free);
+	pthread_mutex_unlock(&cache->mutex);
+
+	RDEBUG3("Caching %s of \"%s\" for %u seconds", member ? "membership" : "non-membership",
+		check->vp_strvalue, ttl);
+}
+
+/** Remove cached group memberships for a user or group object
+ *
+ * Entries where the group was checked by name can only be removed by
+ * flushing the entire cache, or by the user's DN.
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] dn	of the user or group object that changed.  NULL
+ *			to remove all entries.
+ * @return The number of entries removed.
+ */
+uint32_t rlm_ldap_group_cache_flush(rlm_ldap_t const *inst, char const *dn)
+{
+	rlm_ldap_group_cache_t	*cache = inst->group_cache;
+	char			*norm = NULL;
+	uint32_t		count;
+
+	if (!cache) return 0;
+
+	if (dn) {
+		MEM(norm = talloc_typed_strdup(NULL, dn));
+		fr_ldap_util_normalise_dn(norm, dn);
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+	count = rbtree_num_elements(cache->tree);
+	rbtree_walk(cache->tree, RBTREE_DELETE_ORDER, _ldap_group_cache_entry_flush, norm);
+	count -= rbtree_num_elements(cache->tree);
+	cache->invalidated += count;
+	pthread_mutex_unlock(&cache->mutex);
+
+	talloc_free(norm);
+
+	return count;
+}
+
+/** Copy the group membership cache counters
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[out] stats	Where to write the counters.  Only the counters
+ *			are valid, the tree, heap and mutex are not copied.
+ * @return The number of entries in the cache.
+ */
+uint32_t rlm_ldap_group_cache_stats(rlm_ldap_t const *inst, rlm_ldap_group_cache_t *stats)
+{
+	rlm_ldap_group_cache_t	*cache = inst->group_cache;
+	uint32_t		entries;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!cache) return 0;
+
+	pthread_mutex_lock(&cache->mutex);
+	entries = rbtree_num_elements(cache->tree);
+	stats->hits = cache->hits;
+	stats->negative_hits = cache->negative_hits;
+	stats->misses = cache->misses;
+	stats->expired = cache->expired;
+	stats->evicted = cache->evicted;
+	stats->invalidated = cache->invalidated;
+	pthread_mutex_unlock(&cache->mutex);
+
+	return entries;
+}
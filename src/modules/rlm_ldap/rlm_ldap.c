@@ -29,6 +29,7 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/server/rad_assert.h>
 
 #include "rlm_ldap.h"
@@ -99,6 +100,16 @@ static CONF_PARSER user_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Group membership cache configuration
+ */
+static CONF_PARSER group_cache_config[] = {
+	{ FR_CONF_OFFSET("size", FR_TYPE_UINT32, rlm_ldap_t, group_cache_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("ttl", FR_TYPE_UINT32, rlm_ldap_t, group_cache_ttl), .dflt = "300" },
+	{ FR_CONF_OFFSET("negative_ttl", FR_TYPE_UINT32, rlm_ldap_t, group_cache_negative_ttl), .dflt = "60" },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	Group configuration
  */
@@ -114,6 +125,7 @@ static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("cacheable_dn", FR_TYPE_BOOL, rlm_ldap_t, cacheable_group_dn), .dflt = "no" },
 	{ FR_CONF_OFFSET("cache_attribute", FR_TYPE_STRING, rlm_ldap_t, cache_attribute) },
 	{ FR_CONF_OFFSET("group_attribute", FR_TYPE_STRING, rlm_ldap_t, group_attribute) },
+	{ FR_CONF_POINTER("membership_cache", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) group_cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -270,6 +282,58 @@ static ssize_t ldap_unescape_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t out
 	return fr_ldap_unescape_func(request, *out, outlen, fmt, NULL);
 }
 
+/** Remove cached group memberships for a user or group object
+ *
+ * With an empty DN, all cached group memberships are removed.
+ *
+ * @verbatim %{<inst>_group_cache_flush:<dn>} @endverbatim
+ */
+static ssize_t ldap_group_cache_flush_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
+					   void const *mod_inst, UNUSED void const *xlat_inst,
+					   REQUEST *request, char const *fmt)
+{
+	rlm_ldap_t const	*inst = mod_inst;
+	uint32_t		count;
+
+	while (isspace((uint8_t) *fmt)) fmt++;
+
+	count = rlm_ldap_group_cache_flush(inst, *fmt ? fmt : NULL);
+	RDEBUG2("Removed %u cached group membership(s)", count);
+
+	return snprintf(*out, outlen, "%u", count);
+}
+
+/** Return one of the group membership cache counters
+ *
+ * Shows the same values as the "show module <inst> group_cache" radmin command.
+ *
+ * @verbatim %{<inst>_group_cache_stats:<counter>} @endverbatim
+ */
+static ssize_t ldap_group_cache_stats_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
+					   void const *mod_inst, UNUSED void const *xlat_inst,
+					   REQUEST *request, char const *fmt)
+{
+	rlm_ldap_t const	*inst = mod_inst;
+	rlm_ldap_group_cache_t	copy;
+	uint32_t		entries;
+
+	while (isspace((uint8_t) *fmt)) fmt++;
+
+	entries = rlm_ldap_group_cache_stats(inst, &copy);
+
+	if (strcmp(fmt, "entries") == 0) return snprintf(*out, outlen, "%u", entries);
+	if (strcmp(fmt, "hits") == 0) return snprintf(*out, outlen, "%" PRIu64, copy.hits);
+	if (strcmp(fmt, "negative_hits") == 0) return snprintf(*out, outlen, "%" PRIu64, copy.negative_hits);
+	if (strcmp(fmt, "misses") == 0) return snprintf(*out, outlen, "%" PRIu64, copy.misses);
+	if (strcmp(fmt, "expired") == 0) return snprintf(*out, outlen, "%" PRIu64, copy.expired);
+	if (strcmp(fmt, "evicted") == 0) return snprintf(*out, outlen, "%" PRIu64, copy.evicted);
+	if (strcmp(fmt, "invalidated") == 0) return snprintf(*out, outlen, "%" PRIu64, copy.invalidated);
+
+	REDEBUG("Unknown group cache counter \"%s\"", fmt);
+
+	return -1;
+}
+
 /** Expand an LDAP URL into a query, and return a string result from that query.
  *
  */
@@ -588,6 +652,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 	fr_ldap_connection_t		*conn = NULL;
 	char const		*user_dn;
+	VALUE_PAIR		*user_dn_vp;
 
 	rad_assert(inst->groupobj_base_dn);
 
@@ -628,6 +693,26 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 		}
 	}
 
+	/*
+	 *	Check if we've recently searched for this membership.
+	 *	If we already know the user's DN we can do this without
+	 *	reserving a connection.
+	 */
+	user_dn_vp = fr_pair_find_by_da(request->control, attr_ldap_userdn, TAG_ANY);
+	if (user_dn_vp) {
+		switch (rlm_ldap_group_cache_find(inst, request, user_dn_vp->vp_strvalue, check)) {
+		case RLM_MODULE_OK:
+			found = true;
+			goto finish;
+
+		case RLM_MODULE_NOTFOUND:
+			goto finish;
+
+		default:
+			break;
+		}
+	}
+
 	conn = mod_conn_get(inst, request);
 	if (!conn) return 1;
 
@@ -642,11 +727,30 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 	rad_assert(conn);
 
+	/*
+	 *	Otherwise check the cache now we've found the user.
+	 */
+	if (!user_dn_vp) {
+		switch (rlm_ldap_group_cache_find(inst, request, user_dn, check)) {
+		case RLM_MODULE_OK:
+			found = true;
+			goto finish;
+
+		case RLM_MODULE_NOTFOUND:
+			goto finish;
+
+		default:
+			break;
+		}
+	}
+
 	/*
 	 *	Check groupobj user membership
 	 */
+	rcode = RLM_MODULE_NOTFOUND;
 	if (inst->groupobj_membership_filter) {
-		switch (rlm_ldap_check_groupobj_dynamic(inst, request, &conn, check)) {
+		rcode = rlm_ldap_check_groupobj_dynamic(inst, request, &conn, check);
+		switch (rcode) {
 		case RLM_MODULE_NOTFOUND:
 			break;
 
@@ -654,7 +758,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 			found = true;
 
 		default:
-			goto finish;
+			goto cache;
 		}
 	}
 
@@ -664,7 +768,8 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 	 *	Check userobj group membership
 	 */
 	if (inst->userobj_membership_attr) {
-		switch (rlm_ldap_check_userobj_dynamic(inst, request, &conn, user_dn, check)) {
+		rcode = rlm_ldap_check_userobj_dynamic(inst, request, &conn, user_dn, check);
+		switch (rcode) {
 		case RLM_MODULE_NOTFOUND:
 			break;
 
@@ -672,12 +777,20 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 			found = true;
 
 		default:
-			goto finish;
+			goto cache;
 		}
 	}
 
 	rad_assert(conn);
 
+cache:
+	/*
+	 *	Only cache definite answers, not failures
+	 */
+	if ((rcode == RLM_MODULE_OK) || (rcode == RLM_MODULE_NOTFOUND)) {
+		rlm_ldap_group_cache_add(inst, request, user_dn, check, found);
+	}
+
 finish:
 	if (conn) mod_conn_release(inst, request, conn);
 
@@ -690,6 +803,93 @@ finish:
 	return 0;
 }
 
+/** Convert the result of binding as the user to an rcode
+ *
+ */
+static rlm_rcode_t mod_authenticate_rcode(REQUEST *request, fr_ldap_rcode_t status, char const *dn)
+{
+	switch (status) {
+	case LDAP_PROC_SUCCESS:
+		RDEBUG("Bind as user \"%s\" was successful", dn);
+		return RLM_MODULE_OK;
+
+	case LDAP_PROC_NOT_PERMITTED:
+		return RLM_MODULE_USERLOCK;
+
+	case LDAP_PROC_REJECT:
+		return RLM_MODULE_REJECT;
+
+	case LDAP_PROC_BAD_DN:
+		return RLM_MODULE_INVALID;
+
+	case LDAP_PROC_NO_RESULT:
+		return RLM_MODULE_NOTFOUND;
+
+	default:
+		return RLM_MODULE_FAIL;
+	}
+}
+
+static rlm_rcode_t mod_authenticate_bind_resume(REQUEST *request, rlm_ldap_async_t *async)
+{
+	rlm_rcode_t rcode;
+
+	if (async->status != LDAP_PROC_SUCCESS) RPEDEBUG("Bind as user \"%s\" failed", async->dn);
+
+	rcode = mod_authenticate_rcode(request, async->status, async->dn);
+	rlm_ldap_async_free(request, async);
+
+	return rcode;
+}
+
+/** Send a simple bind as the user, and wait for the result
+ *
+ */
+static rlm_rcode_t mod_authenticate_bind(REQUEST *request, rlm_ldap_async_t *async, char const *dn)
+{
+	rlm_rcode_t	rcode;
+	int		msgid;
+
+	async->conn->rebound = true;
+	async->status = fr_ldap_bind_send(&msgid, request, async->conn, dn, request->password->vp_strvalue,
+					  NULL, NULL);
+	if (async->status != LDAP_PROC_SUCCESS) {
+		rcode = mod_authenticate_rcode(request, async->status, dn);
+		rlm_ldap_async_free(request, async);
+		return rcode;
+	}
+
+	return rlm_ldap_async_wait(request, async, msgid, dn, mod_authenticate_bind_resume);
+}
+
+static rlm_rcode_t mod_authenticate_user_resume(REQUEST *request, rlm_ldap_async_t *async)
+{
+	rlm_rcode_t	rcode;
+	char const	*dn;
+
+	dn = rlm_ldap_find_user_result(async->inst, request, async->conn, async->status, &async->result, &rcode);
+	if (!dn) {
+		rlm_ldap_async_free(request, async);
+		return rcode;
+	}
+
+	return mod_authenticate_bind(request, async, dn);
+}
+
+static rlm_rcode_t mod_authenticate_user_search(REQUEST *request, rlm_ldap_async_t *async)
+{
+	rlm_rcode_t	rcode;
+	int		msgid;
+
+	async->status = rlm_ldap_find_user_async(async->inst, request, async->conn, NULL, &msgid, &rcode);
+	if (async->status != LDAP_PROC_SUCCESS) {
+		rlm_ldap_async_free(request, async);
+		return rcode;
+	}
+
+	return rlm_ldap_async_wait(request, async, msgid, NULL, mod_authenticate_user_resume);
+}
+
 static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
 {
@@ -738,35 +938,59 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 	conn = mod_conn_get(inst, request);
 	if (!conn) return RLM_MODULE_FAIL;
 
+	/*
+	 *	Simple binds, and the search for the user's DN,
+	 *	are sent without waiting for the result.  SASL
+	 *	binds need several round trips, and block.
+	 */
+	if (!inst->user_sasl.mech) {
+		rlm_ldap_async_t	*async;
+		VALUE_PAIR		*vp;
+
+		RDEBUG("Login attempt by \"%pV\"", &request->username->data);
+
+		async = rlm_ldap_async_alloc(request, inst, conn);
+		if (!async) {
+			mod_conn_release(inst, request, conn);
+			return RLM_MODULE_FAIL;
+		}
+
+		vp = fr_pair_find_by_da(request->control, attr_ldap_userdn, TAG_ANY);
+		if (vp) {
+			RDEBUG("Using user DN from request \"%pV\"", &vp->data);
+			return mod_authenticate_bind(request, async, vp->vp_strvalue);
+		}
+
+		return rlm_ldap_async_admin(request, async, mod_authenticate_user_search);
+	}
+
 	/*
 	 *	Expand dynamic SASL fields
 	 */
-	if (inst->user_sasl.mech) {
-		memset(&sasl, 0, sizeof(sasl));
+	memset(&sasl, 0, sizeof(sasl));
 
-		if (tmpl_expand(&sasl.mech, sasl_mech_buff, sizeof(sasl_mech_buff), request,
-				inst->user_sasl.mech, fr_ldap_escape_func, inst) < 0) {
-			RPEDEBUG("Failed expanding user.sasl.mech");
+	if (tmpl_expand(&sasl.mech, sasl_mech_buff, sizeof(sasl_mech_buff), request,
+			inst->user_sasl.mech, fr_ldap_escape_func, inst) < 0) {
+		RPEDEBUG("Failed expanding user.sasl.mech");
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	if (inst->user_sasl.proxy) {
+		if (tmpl_expand(&sasl.proxy, sasl_proxy_buff, sizeof(sasl_proxy_buff), request,
+				inst->user_sasl.proxy, fr_ldap_escape_func, inst) < 0) {
+			RPEDEBUG("Failed expanding user.sasl.proxy");
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
+	}
 
-		if (inst->user_sasl.proxy) {
-			if (tmpl_expand(&sasl.proxy, sasl_proxy_buff, sizeof(sasl_proxy_buff), request,
-					inst->user_sasl.proxy, fr_ldap_escape_func, inst) < 0) {
-				RPEDEBUG("Failed expanding user.sasl.proxy");
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
-			}
-		}
-
-		if (inst->user_sasl.realm) {
-			if (tmpl_expand(&sasl.realm, sasl_realm_buff, sizeof(sasl_realm_buff), request,
-					inst->user_sasl.realm, fr_ldap_escape_func, inst) < 0) {
-				RPEDEBUG("Failed expanding user.sasl.realm");
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
-			}
+	if (inst->user_sasl.realm) {
+		if (tmpl_expand(&sasl.realm, sasl_realm_buff, sizeof(sasl_realm_buff), request,
+				inst->user_sasl.realm, fr_ldap_escape_func, inst) < 0) {
+			RPEDEBUG("Failed expanding user.sasl.realm");
+			rcode = RLM_MODULE_FAIL;
+			goto finish;
 		}
 	}
 
@@ -785,35 +1009,10 @@ static rlm_rcode_t CC_HINT(nonnull) mod_authenticate(void *instance, UNUSED void
 	status = fr_ldap_bind(request,
 			      &conn,
 			      dn, request->password->vp_strvalue,
-			      inst->user_sasl.mech ? &sasl : NULL,
+			      &sasl,
 			      NULL,
 			      NULL, NULL);
-	switch (status) {
-	case LDAP_PROC_SUCCESS:
-		rcode = RLM_MODULE_OK;
-		RDEBUG("Bind as user \"%s\" was successful", dn);
-		break;
-
-	case LDAP_PROC_NOT_PERMITTED:
-		rcode = RLM_MODULE_USERLOCK;
-		break;
-
-	case LDAP_PROC_REJECT:
-		rcode = RLM_MODULE_REJECT;
-		break;
-
-	case LDAP_PROC_BAD_DN:
-		rcode = RLM_MODULE_INVALID;
-		break;
-
-	case LDAP_PROC_NO_RESULT:
-		rcode = RLM_MODULE_NOTFOUND;
-		break;
-
-	default:
-		rcode = RLM_MODULE_FAIL;
-		break;
-	};
+	rcode = mod_authenticate_rcode(request, status, dn);
 
 finish:
 	mod_conn_release(inst, request, conn);
@@ -895,60 +1094,27 @@ free_result:
 	return rcode;
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_authorize_resume(REQUEST *request, rlm_ldap_async_t *async)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
 	int			ldap_errno;
 	int			i;
-	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_t const	*inst = async->inst;
 	struct berval		**values;
-	fr_ldap_connection_t	*conn;
-	LDAPMessage		*result, *entry;
+	fr_ldap_connection_t	*conn = async->conn;
+	LDAPMessage		*entry;
 	char const 		*dn = NULL;
-	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
+	fr_ldap_map_exp_t	*expanded = talloc_get_type_abort(async->uctx, fr_ldap_map_exp_t);
 #ifdef WITH_EDIR
 	fr_ldap_rcode_t		status;
 #endif
 
-	/*
-	 *	Don't be tempted to add a check for request->username
-	 *	or request->password here. rlm_ldap.authorize can be used for
-	 *	many things besides searching for users.
-	 */
-
-	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
-
-	conn = mod_conn_get(inst, request);
-	if (!conn) return RLM_MODULE_FAIL;
-
-	/*
-	 *	Add any additional attributes we need for checking access, memberships, and profiles
-	 */
-	if (inst->userobj_access_attr) {
-		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
-	}
-
-	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
-		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
-	}
-
-	if (inst->profile_attr) {
-		expanded.attrs[expanded.count++] = inst->profile_attr;
-	}
-
-	if (inst->valuepair_attr) {
-		expanded.attrs[expanded.count++] = inst->valuepair_attr;
-	}
-
-	expanded.attrs[expanded.count] = NULL;
-
-	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
+	dn = rlm_ldap_find_user_result(inst, request, conn, async->status, &async->result, &rcode);
 	if (!dn) {
 		goto finish;
 	}
 
-	entry = ldap_first_entry(conn->handle, result);
+	entry = ldap_first_entry(conn->handle, async->result);
 	if (!entry) {
 		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
@@ -1075,7 +1241,7 @@ skip_edir:
 			goto finish;
 		}
 
-		switch (rlm_ldap_map_profile(inst, request, &conn, profile, &expanded)) {
+		switch (rlm_ldap_map_profile(inst, request, &conn, profile, expanded)) {
 		case RLM_MODULE_INVALID:
 			rcode = RLM_MODULE_INVALID;
 			goto finish;
@@ -1103,7 +1269,7 @@ skip_edir:
 				char *value;
 
 				value = fr_ldap_berval_to_string(request, values[i]);
-				ret = rlm_ldap_map_profile(inst, request, &conn, value, &expanded);
+				ret = rlm_ldap_map_profile(inst, request, &conn, value, expanded);
 				talloc_free(value);
 				if (ret == RLM_MODULE_FAIL) {
 					ldap_value_free_len(values);
@@ -1120,19 +1286,92 @@ skip_edir:
 		RDEBUG("Processing user attributes");
 		RINDENT();
 		if (fr_ldap_map_do(request, conn, inst->valuepair_attr,
-				   &expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
+				   expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
 		REXDENT();
 		rlm_ldap_check_reply(inst, request, conn);
 	}
 
 finish:
-	talloc_free(expanded.ctx);
-	if (result) ldap_msgfree(result);
-	mod_conn_release(inst, request, conn);
+	async->conn = conn;
+	rlm_ldap_async_free(request, async);
 
 	return rcode;
 }
 
+static rlm_rcode_t mod_authorize_user_search(REQUEST *request, rlm_ldap_async_t *async)
+{
+	rlm_rcode_t		rcode;
+	int			msgid;
+	fr_ldap_map_exp_t	*expanded = talloc_get_type_abort(async->uctx, fr_ldap_map_exp_t);
+
+	async->status = rlm_ldap_find_user_async(async->inst, request, async->conn, expanded->attrs, &msgid, &rcode);
+	if (async->status != LDAP_PROC_SUCCESS) {
+		rlm_ldap_async_free(request, async);
+		return rcode;
+	}
+
+	return rlm_ldap_async_wait(request, async, msgid, NULL, mod_authorize_resume);
+}
+
+/** Search for the user object, then apply its group memberships, profiles and attribute maps
+ *
+ * The search for the user object is sent without waiting for the result.
+ * Lookups of groups and profiles are still performed synchronously.
+ */
+static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+{
+	rlm_ldap_t const	*inst = instance;
+	fr_ldap_connection_t	*conn;
+	rlm_ldap_async_t	*async;
+	fr_ldap_map_exp_t	*expanded;
+
+	/*
+	 *	Don't be tempted to add a check for request->username
+	 *	or request->password here. rlm_ldap.authorize can be used for
+	 *	many things besides searching for users.
+	 */
+
+	conn = mod_conn_get(inst, request);
+	if (!conn) return RLM_MODULE_FAIL;
+
+	async = rlm_ldap_async_alloc(request, inst, conn);
+	if (!async) {
+		mod_conn_release(inst, request, conn);
+		return RLM_MODULE_FAIL;
+	}
+	MEM(async->uctx = expanded = talloc_zero(async, fr_ldap_map_exp_t));
+
+	if (fr_ldap_map_expand(expanded, request, inst->user_map) < 0) {
+		rlm_ldap_async_free(request, async);
+		return RLM_MODULE_FAIL;
+	}
+	talloc_steal(expanded, expanded->ctx);
+
+	/*
+	 *	Add any additional attributes we need for checking access, memberships, and profiles
+	 */
+	if (inst->userobj_access_attr) {
+		expanded->attrs[expanded->count++] = inst->userobj_access_attr;
+	}
+
+	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
+		expanded->attrs[expanded->count++] = inst->userobj_membership_attr;
+	}
+
+	if (inst->profile_attr) {
+		expanded->attrs[expanded->count++] = inst->profile_attr;
+	}
+
+	if (inst->valuepair_attr) {
+		expanded->attrs[expanded->count++] = inst->valuepair_attr;
+	}
+
+	expanded->attrs[expanded->count] = NULL;
+
+	return rlm_ldap_async_admin(request, async, mod_authorize_user_search);
+}
+
 /** Modify user's object in LDAP
  *
  * Process a modifcation map to update a user object in the LDAP directory.
@@ -1386,6 +1625,45 @@ static rlm_rcode_t CC_HINT(nonnull) mod_post_auth(void *instance, UNUSED void *t
 }
 
 
+/** Print group membership cache statistics for radmin
+ *
+ */
+static int cmd_show_group_cache(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_ldap_t		*inst = ctx;
+	rlm_ldap_group_cache_t	copy;
+	uint32_t		entries;
+	uint64_t		lookups;
+
+	entries = rlm_ldap_group_cache_stats(inst, &copy);
+	lookups = copy.hits + copy.negative_hits + copy.misses;
+
+	fprintf(fp, "entries\t%u\n", entries);
+	fprintf(fp, "max_entries\t%u\n", inst->group_cache_size);
+	fprintf(fp, "hits\t%" PRIu64 "\n", copy.hits);
+	fprintf(fp, "negative_hits\t%" PRIu64 "\n", copy.negative_hits);
+	fprintf(fp, "misses\t%" PRIu64 "\n", copy.misses);
+	fprintf(fp, "hit_rate\t%.1f%%\n", lookups ? (double) (copy.hits + copy.negative_hits) * 100 / lookups : 0);
+	fprintf(fp, "expired\t%" PRIu64 "\n", copy.expired);
+	fprintf(fp, "evicted\t%" PRIu64 "\n", copy.evicted);
+	fprintf(fp, "invalidated\t%" PRIu64 "\n", copy.invalidated);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "group_cache",
+		.func = cmd_show_group_cache,
+		.help = "Show statistics for the group membership cache.",
+		.read_only = true,
+	},
+
+	CMD_TABLE_END
+};
+
 /** Detach from the LDAP server and cleanup internal state.
  *
  */
@@ -1501,6 +1779,10 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 	}
 
 	xlat_register(inst, inst->name, ldap_xlat, fr_ldap_escape_func, NULL, 0, XLAT_DEFAULT_BUF_LEN, false);
+	snprintf(buffer, sizeof(buffer), "%s_group_cache_flush", inst->name);
+	xlat_register(inst, buffer, ldap_group_cache_flush_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, false);
+	snprintf(buffer, sizeof(buffer), "%s_group_cache_stats", inst->name);
+	xlat_register(inst, buffer, ldap_group_cache_stats_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, false);
 	xlat_register(inst, "ldap_escape", ldap_escape_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
 	xlat_register(inst, "ldap_unescape", ldap_unescape_xlat, NULL, NULL, 0, XLAT_DEFAULT_BUF_LEN, true);
 	map_proc_register(inst, inst->name, mod_map_proc, ldap_map_verify, 0);
@@ -1966,6 +2248,18 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 						 mod_conn_create, NULL, NULL, NULL, NULL);
 	if (!inst->pool) goto error;
 
+	/*
+	 *	Cache of group membership checks
+	 */
+	if (inst->group_cache_size) {
+		if (rlm_ldap_group_cache_init(inst) < 0) goto error;
+
+		if (fr_command_register_hook(NULL, inst->name, inst, cmd_table) < 0) {
+			PERROR("Failed registering radmin commands");
+			goto error;
+		}
+	}
+
 	fr_ldap_global_config(inst->ldap_debug, inst->tls_random_file);
 
 	return 0;
@@ -16,9 +16,27 @@
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/modules.h>
 #include <freeradius-devel/ldap/base.h>
+#include <freeradius-devel/util/heap.h>
 
 typedef struct ldap_inst_s rlm_ldap_t;
 
+/** Cache of group membership checks, shared by all workers
+ *
+ */
+typedef struct {
+	rbtree_t		*tree;				//!< Entries, keyed by user DN and group.
+	fr_heap_t		*heap;				//!< Entries, ordered by expiry time.
+
+	pthread_mutex_t		mutex;				//!< Protects the tree, heap and counters.
+
+	uint64_t		hits;				//!< Lookups which found the user was a member.
+	uint64_t		negative_hits;			//!< Lookups which found the user wasn't a member.
+	uint64_t		misses;				//!< Lookups which required searching the directory.
+	uint64_t		expired;			//!< Entries removed because their TTL passed.
+	uint64_t		evicted;			//!< Entries removed because the cache was full.
+	uint64_t		invalidated;			//!< Entries removed by a flush.
+} rlm_ldap_group_cache_t;
+
 typedef struct {
 	vp_tmpl_t	*mech;				//!< SASL mech(s) to try.
 	vp_tmpl_t	*proxy;				//!< Identity to proxy.
@@ -106,6 +124,12 @@ struct ldap_inst_s {
 	char const	*group_attribute;		//!< Sets the attribute we use when comparing group
 							//!< group memberships.
 
+	uint32_t	group_cache_size;		//!< Maximum number of group membership checks to cache.
+							//!< 0 disables the cache.
+	uint32_t	group_cache_ttl;		//!< How long to cache that a user is a member.
+	uint32_t	group_cache_negative_ttl;	//!< How long to cache that a user isn't a member.
+	rlm_ldap_group_cache_t *group_cache;		//!< Cache of group membership checks.
+
 	fr_dict_attr_t const	*group_da;		//!< The DA associated with this specific instance of the
 							//!< rlm_ldap module.
 
@@ -148,6 +172,40 @@ struct ldap_inst_s {
 	uint32_t	ldap_debug;			//!< Debug flag for the SDK.
 };
 
+typedef struct rlm_ldap_async_s rlm_ldap_async_t;
+
+/** Called when the result of an asynchronous operation is available
+ *
+ * @param[in] request	The current request.
+ * @param[in] async	holding the status and result of the operation.
+ * @return The rcode to return from the module, or #RLM_MODULE_YIELD if another operation was sent.
+ */
+typedef rlm_rcode_t (*rlm_ldap_async_resume_t)(REQUEST *request, rlm_ldap_async_t *async);
+
+/** State for an operation we're waiting on the result of
+ *
+ * Pooled connections are held exclusively by the request, so there is
+ * only ever one operation outstanding on a connection.
+ */
+struct rlm_ldap_async_s {
+	rlm_ldap_t const	*inst;			//!< Module instance.
+	fr_ldap_connection_t	*conn;			//!< Connection the operation was sent on.
+							//!< NULL if the connection was closed.
+
+	int			msgid;			//!< Of the outstanding operation.
+	int			fd;			//!< Connection socket we're watching.
+	bool			timeout_set;		//!< Whether we added a timeout event.
+	char const		*dn;			//!< Search base or bind DN, used in log messages.
+
+	fr_ldap_rcode_t		status;			//!< Result of the operation.
+	LDAPMessage		*result;		//!< Result of a search.  Freed with the async ctx.
+
+	rlm_ldap_async_resume_t	resume;			//!< Called with the result of the operation.
+	rlm_ldap_async_resume_t	next;			//!< Called once we've rebound as the admin user.
+
+	void			*uctx;			//!< Method specific state.
+};
+
 extern fr_dict_attr_t const *attr_cleartext_password;
 extern fr_dict_attr_t const *attr_crypt_password;
 extern fr_dict_attr_t const *attr_ldap_userdn;
@@ -163,6 +221,12 @@ extern fr_dict_attr_t const *attr_user_name;
 char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t **pconn,
 			       char const *attrs[], bool force, LDAPMessage **result, rlm_rcode_t *rcode);
 
+fr_ldap_rcode_t rlm_ldap_find_user_async(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t *conn,
+					 char const *attrs[], int *msgid, rlm_rcode_t *rcode);
+
+char const *rlm_ldap_find_user_result(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t *conn,
+				      fr_ldap_rcode_t status, LDAPMessage **result, rlm_rcode_t *rcode);
+
 rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, REQUEST *request,
 				  fr_ldap_connection_t const *conn, LDAPMessage *entry);
 
@@ -184,6 +248,18 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 
 rlm_rcode_t rlm_ldap_check_cached(rlm_ldap_t const *inst, REQUEST *request, VALUE_PAIR *check);
 
+int rlm_ldap_group_cache_init(rlm_ldap_t *inst);
+
+rlm_rcode_t rlm_ldap_group_cache_find(rlm_ldap_t const *inst, REQUEST *request, char const *user_dn,
+				      VALUE_PAIR *check);
+
+void rlm_ldap_group_cache_add(rlm_ldap_t const *inst, REQUEST *request, char const *user_dn,
+			      VALUE_PAIR *check, bool member);
+
+uint32_t rlm_ldap_group_cache_flush(rlm_ldap_t const *inst, char const *dn);
+
+uint32_t rlm_ldap_group_cache_stats(rlm_ldap_t const *inst, rlm_ldap_group_cache_t *stats);
+
 /*
  *	conn.c - Connection wrappers.
  */
@@ -192,3 +268,12 @@ fr_ldap_connection_t	*mod_conn_get(rlm_ldap_t const *inst, REQUEST *request);
 void		mod_conn_release(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t *conn);
 
 void		*mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *timeout);
+
+rlm_ldap_async_t	*rlm_ldap_async_alloc(REQUEST *request, rlm_ldap_t const *inst, fr_ldap_connection_t *conn);
+
+rlm_rcode_t	rlm_ldap_async_admin(REQUEST *request, rlm_ldap_async_t *async, rlm_ldap_async_resume_t next);
+
+rlm_rcode_t	rlm_ldap_async_wait(REQUEST *request, rlm_ldap_async_t *async, int msgid, char const *dn,
+				    rlm_ldap_async_resume_t resume);
+
+void		rlm_ldap_async_free(REQUEST *request, rlm_ldap_async_t *async);
@@ -32,6 +32,43 @@
 
 #include "rlm_ldap.h"
 
+/** Expand the base DN and filter used to find user objects
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[out] base_dn Where to write the expanded base DN.
+ * @param[in] base_dn_buff Buffer to expand the base DN into.
+ * @param[in] base_dn_len Length of base_dn_buff.
+ * @param[out] filter Where to write the expanded filter, NULL if there's no filter.
+ * @param[in] filter_buff Buffer to expand the filter into.
+ * @param[in] filter_len Length of filter_buff.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int user_search_expand(rlm_ldap_t const *inst, REQUEST *request,
+			      char const **base_dn, char *base_dn_buff, size_t base_dn_len,
+			      char const **filter, char *filter_buff, size_t filter_len)
+{
+	*filter = NULL;
+
+	if (inst->userobj_filter) {
+		if (tmpl_expand(filter, filter_buff, filter_len, request, inst->userobj_filter,
+				fr_ldap_escape_func, NULL) < 0) {
+			REDEBUG("Unable to create filter");
+			return -1;
+		}
+	}
+
+	if (tmpl_expand(base_dn, base_dn_buff, base_dn_len, request,
+			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Unable to create base_dn");
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Retrieve the DN of a user object
  *
  * Retrieves the DN of a user and adds it to the control list as LDAP-UserDN. Will also retrieve any
@@ -57,10 +94,8 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 
 	fr_ldap_rcode_t	status;
 	VALUE_PAIR	*vp = NULL;
-	LDAPMessage	*tmp_msg = NULL, *entry = NULL;
-	int		ldap_errno;
-	int		cnt;
-	char		*dn = NULL;
+	LDAPMessage	*tmp_msg = NULL;
+	char const	*dn;
 	char const	*filter = NULL;
 	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
 	char const	*base_dn;
@@ -111,26 +146,92 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 		(*pconn)->rebound = false;
 	}
 
-	if (inst->userobj_filter) {
-		if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request, inst->userobj_filter,
-				fr_ldap_escape_func, NULL) < 0) {
-			REDEBUG("Unable to create filter");
-			*rcode = RLM_MODULE_INVALID;
-
-			return NULL;
-		}
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Unable to create base_dn");
+	if (user_search_expand(inst, request, &base_dn, base_dn_buff, sizeof(base_dn_buff),
+			       &filter, filter_buff, sizeof(filter_buff)) < 0) {
 		*rcode = RLM_MODULE_INVALID;
-
 		return NULL;
 	}
 
 	status = fr_ldap_search(result, request, pconn, base_dn,
 				inst->userobj_scope, filter, attrs, serverctrls, NULL);
+
+	dn = rlm_ldap_find_user_result(inst, request, *pconn, status, result, rcode);
+	if (freeit && *result) {
+		ldap_msgfree(*result);
+		*result = NULL;
+	}
+
+	return dn;
+}
+
+/** Send a search for a user object, without waiting for the result
+ *
+ * The connection must already be bound as the admin user.  The result
+ * should be passed to #rlm_ldap_find_user_result.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn to send the search on.
+ * @param[in] attrs Additional attributes to retrieve, may be NULL.
+ * @param[out] msgid of the search.
+ * @param[out] rcode The status of the operation if the search couldn't be sent.
+ * @return
+ *	- LDAP_PROC_SUCCESS if the search was sent.
+ *	- One of the other LDAP_PROC_* (#fr_ldap_rcode_t) values on failure.
+ */
+fr_ldap_rcode_t rlm_ldap_find_user_async(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t *conn,
+					 char const *attrs[], int *msgid, rlm_rcode_t *rcode)
+{
+	static char const *tmp_attrs[] = { NULL };
+
+	fr_ldap_rcode_t	status;
+	char const	*filter = NULL;
+	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const	*base_dn;
+	char	    	base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	LDAPControl	*serverctrls[] = { inst->userobj_sort_ctrl, NULL };
+
+	rad_assert(!conn->rebound);
+
+	if (!attrs) attrs = tmp_attrs;
+
+	if (user_search_expand(inst, request, &base_dn, base_dn_buff, sizeof(base_dn_buff),
+			       &filter, filter_buff, sizeof(filter_buff)) < 0) {
+		*rcode = RLM_MODULE_INVALID;
+		return LDAP_PROC_ERROR;
+	}
+
+	status = fr_ldap_search_async(msgid, request, &conn, base_dn,
+				      inst->userobj_scope, filter, attrs, serverctrls, NULL);
+	if (status != LDAP_PROC_SUCCESS) *rcode = RLM_MODULE_FAIL;
+
+	return status;
+}
+
+/** Process the result of a search for a user object
+ *
+ * Checks the search returned a single user object, and adds its DN to the
+ * control list as LDAP-UserDN.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the search was performed on.
+ * @param[in] status of the search.
+ * @param[in,out] result of the search.  Freed, and set to NULL, on error.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return The user's DN or NULL on error.
+ */
+char const *rlm_ldap_find_user_result(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_connection_t *conn,
+				      fr_ldap_rcode_t status, LDAPMessage **result, rlm_rcode_t *rcode)
+{
+	VALUE_PAIR	*vp = NULL;
+	LDAPMessage	*entry = NULL;
+	int		ldap_errno;
+	int		cnt;
+	char		*dn = NULL;
+
+	*rcode = RLM_MODULE_FAIL;
+
 	switch (status) {
 	case LDAP_PROC_SUCCESS:
 		break;
@@ -138,52 +239,55 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 	case LDAP_PROC_BAD_DN:
 	case LDAP_PROC_NO_RESULT:
 		*rcode = RLM_MODULE_NOTFOUND;
-		return NULL;
+		goto finish;
 
 	default:
-		*rcode = RLM_MODULE_FAIL;
-		return NULL;
+		goto finish;
 	}
 
-	rad_assert(*pconn);
+	rad_assert(conn);
+
+	cnt = ldap_count_entries(conn->handle, *result);
+	if (cnt == 0) {
+		RDEBUG("Search returned no results");
+		*rcode = RLM_MODULE_NOTFOUND;
+		goto finish;
+	}
 
 	/*
 	 *	Forbid the use of unsorted search results that
 	 *	contain multiple entries, as it's a potential
 	 *	security issue, and likely non deterministic.
 	 */
-	if (!inst->userobj_sort_ctrl) {
-		cnt = ldap_count_entries((*pconn)->handle, *result);
-		if (cnt > 1) {
-			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
-				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
-			REDEBUG("The following entries were returned:");
-			RINDENT();
-			for (entry = ldap_first_entry((*pconn)->handle, *result);
-			     entry;
-			     entry = ldap_next_entry((*pconn)->handle, entry)) {
-				dn = ldap_get_dn((*pconn)->handle, entry);
-				REDEBUG("%s", dn);
-				ldap_memfree(dn);
-			}
-			REXDENT();
-			*rcode = RLM_MODULE_INVALID;
-			goto finish;
+	if (!inst->userobj_sort_ctrl && (cnt > 1)) {
+		REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
+			"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
+		REDEBUG("The following entries were returned:");
+		RINDENT();
+		for (entry = ldap_first_entry(conn->handle, *result);
+		     entry;
+		     entry = ldap_next_entry(conn->handle, entry)) {
+			dn = ldap_get_dn(conn->handle, entry);
+			REDEBUG("%s", dn);
+			ldap_memfree(dn);
 		}
+		REXDENT();
+		*rcode = RLM_MODULE_INVALID;
+		goto finish;
 	}
 
-	entry = ldap_first_entry((*pconn)->handle, *result);
+	entry = ldap_first_entry(conn->handle, *result);
 	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 		REDEBUG("Failed retrieving entry: %s",
 			ldap_err2string(ldap_errno));
 
 		goto finish;
 	}
 
-	dn = ldap_get_dn((*pconn)->handle, entry);
+	dn = ldap_get_dn(conn->handle, entry);
 	if (!dn) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
 
 		goto finish;
@@ -199,7 +303,7 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 	ldap_memfree(dn);
 
 finish:
-	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
+	if ((*rcode != RLM_MODULE_OK) && *result) {
 		ldap_msgfree(*result);
 		*result = NULL;
 	}
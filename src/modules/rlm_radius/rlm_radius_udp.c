@@ -57,6 +57,7 @@ typedef struct rlm_radius_udp_t {
 	bool			recv_buff_is_set;	//!< Whether we were provided with a recv_buf
 	bool			send_buff_is_set;	//!< Whether we were provided with a send_buf
 	bool			replicate;		//!< Copied from parent->replicate
+	bool			pass_through;		//!< Forward unmodified packets without re-encoding them.
 } rlm_radius_udp_t;
 
 
@@ -153,6 +154,7 @@ struct rlm_radius_udp_request_t {
 	uint32_t		initial_delay_time;	//!< Initial value of Acct-Delay-Time.
 	bool			manual_delay_time;	//!< Whether or not we manually added an Acct-Delay-Time.
 	bool			yielded;		//!< whether it yielded
+	bool			pass_through;		//!< Copy the attributes from the original packet.
 
 	int			code;			//!< Packet code.
 	rlm_radius_udp_connection_t	*c;		//!< The connection state machine.
@@ -183,6 +185,8 @@ static const CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, rlm_radius_udp_t, max_packet_size), .dflt = "4096" },
 
+	{ FR_CONF_OFFSET("pass_through", FR_TYPE_BOOL, rlm_radius_udp_t, pass_through), .dflt = "no" },
+
 	{ FR_CONF_OFFSET("src_ipaddr", FR_TYPE_COMBO_IP_ADDR, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("src_ipv4addr", FR_TYPE_IPV4_ADDR, rlm_radius_udp_t, src_ipaddr) },
 	{ FR_CONF_OFFSET("src_ipv6addr", FR_TYPE_IPV6_ADDR, rlm_radius_udp_t, src_ipaddr) },
@@ -1352,6 +1356,135 @@ static void response_timeout(fr_event_list_t *el, struct timeval *now, void *uct
 }
 
 
+/** Check whether a request can be proxied by copying the original packet
+ *
+ * The attributes in the original packet can only be used if policy hasn't
+ * added, removed, or changed any of the decoded attributes.  Attributes
+ * which are encrypted with the shared secret are re-encoded, but only if
+ * they're at the top level, so they're easy to find in the original packet.
+ *
+ * @param request	to check.
+ * @return
+ *	- true if the original attributes can be copied.
+ *	- false if the request must be encoded from its attributes.
+ */
+static bool pass_through_ok(REQUEST *request)
+{
+	RADIUS_PACKET const	*packet = request->packet;
+	VALUE_PAIR const	*vp;
+	uint8_t			fingerprint[FR_PAIR_LIST_FINGERPRINT_LEN];
+
+	if (!packet->data || !packet->vps_fingerprinted) return false;
+	if ((packet->data_len < 20) || (packet->data[0] != packet->code)) return false;
+
+	fr_pair_list_fingerprint(fingerprint, packet->vps);
+	if (memcmp(fingerprint, packet->vps_fingerprint, sizeof(fingerprint)) != 0) return false;
+
+	for (vp = packet->vps; vp; vp = vp->next) {
+		if (vp->da->flags.encrypt && !fr_dict_attr_is_top_level(vp->da)) return false;
+	}
+
+	return true;
+}
+
+/** Copy the attributes from the original packet into the connection's buffer
+ *
+ * Message-Authenticator is skipped, the caller adds a new one if it's needed.
+ * Attributes which are encrypted with the client's shared secret are
+ * re-encoded from their decoded value, using the home server's secret,
+ * and the request authenticator which the caller has placed in the buffer.
+ *
+ * @param c		the connection.
+ * @param u		the request to encode.
+ * @param buflen	the amount of the buffer we can use.
+ * @return
+ *	- >0 the length of the packet.
+ *	- 0 if the packet needs to be encoded from its attributes instead.
+ */
+static ssize_t encode_pass_through(rlm_radius_udp_connection_t *c, rlm_radius_udp_request_t *u, size_t buflen)
+{
+	REQUEST			*request = u->link->request;
+	uint8_t const		*attr, *end;
+	uint8_t			*p, *out_end;
+	size_t			data_len;
+	fr_radius_ctx_t		packet_ctx;
+	fr_dict_attr_t const	*root = fr_dict_root(dict_radius);
+	static uint8_t const	zero_vector[AUTH_VECTOR_LEN] = { 0 };
+
+	data_len = (request->packet->data[2] << 8) | request->packet->data[3];
+	if (data_len > request->packet->data_len) return 0;
+	if (data_len > buflen) return 0;
+
+	memset(&packet_ctx, 0, sizeof(packet_ctx));
+	packet_ctx.secret = c->inst->secret;
+
+	/*
+	 *	Access-Request and Status-Server already have a
+	 *	random authenticator in the buffer.  The others are
+	 *	signed over a zero one.
+	 */
+	if ((u->code == FR_CODE_ACCESS_REQUEST) || (u->code == FR_CODE_STATUS_SERVER)) {
+		packet_ctx.vector = c->buffer + 4;
+	} else {
+		memset(c->buffer + 4, 0, AUTH_VECTOR_LEN);
+		packet_ctx.vector = zero_vector;
+	}
+
+	c->buffer[0] = u->code;
+	c->buffer[1] = u->rr->id;
+
+	p = c->buffer + 20;
+	out_end = c->buffer + buflen;
+	end = request->packet->data + data_len;
+
+	for (attr = request->packet->data + 20; attr < end; attr += attr[1]) {
+		fr_dict_attr_t const	*da;
+		VALUE_PAIR		*vp;
+		fr_cursor_t		cursor;
+		ssize_t			slen;
+		int			skip;
+		uint8_t const		*q;
+
+		if (((end - attr) < 2) || (attr[1] < 2) || ((attr + attr[1]) > end)) return 0;
+
+		if (attr[0] == FR_MESSAGE_AUTHENTICATOR) continue;
+
+		da = fr_dict_attr_child_by_num(root, attr[0]);
+		if (!da || !da->flags.encrypt) {
+			if ((size_t) (out_end - p) < attr[1]) return 0;
+
+			memcpy(p, attr, attr[1]);
+			p += attr[1];
+			continue;
+		}
+
+		/*
+		 *	Find the decoded value for this instance of
+		 *	the attribute, and encrypt it again.
+		 */
+		skip = 0;
+		for (q = request->packet->data + 20; q < attr; q += q[1]) {
+			if (q[0] == attr[0]) skip++;
+		}
+
+		for (vp = fr_cursor_iter_by_da_init(&cursor, &request->packet->vps, da);
+		     vp && skip;
+		     vp = fr_cursor_next(&cursor)) skip--;
+		if (!vp) return 0;
+
+		slen = fr_radius_encode_pair(p, out_end - p, &cursor, &packet_ctx);
+		if (slen <= 0) return 0;
+
+		p += slen;
+	}
+
+	data_len = p - c->buffer;
+	c->buffer[2] = (data_len >> 8) & 0xff;
+	c->buffer[3] = data_len & 0xff;
+
+	return data_len;
+}
+
 /** Write a packet to a connection
  *
  * @param c the conneciton
@@ -1438,11 +1571,23 @@ static int conn_write(rlm_radius_udp_connection_t *c, rlm_radius_udp_request_t *
 
 	/*
 	 *	Encode it, leaving room for Proxy-State, too.
+	 *
+	 *	If policy didn't change the request, we can skip
+	 *	the encoder, and use the attributes from the
+	 *	original packet.
 	 */
-	packet_len = fr_radius_encode(c->buffer, buflen - proxy_state, NULL,
-				      c->inst->secret, 0, u->code, u->rr->id,
-				      request->packet->vps);
-	if (packet_len <= 0) return -1;
+	packet_len = 0;
+	if (u->pass_through) {
+		packet_len = encode_pass_through(c, u, buflen - proxy_state);
+		if (packet_len > 0) RDEBUG3("Copied attributes from the original packet");
+	}
+
+	if (!packet_len) {
+		packet_len = fr_radius_encode(c->buffer, buflen - proxy_state, NULL,
+					      c->inst->secret, 0, u->code, u->rr->id,
+					      request->packet->vps);
+		if (packet_len <= 0) return -1;
+	}
 
 	/*
 	 *	This hack cleans up the debug output a bit.
@@ -2403,6 +2548,7 @@ static rlm_rcode_t mod_push(void *instance, REQUEST *request, rlm_radius_link_t
 	u->thread = t;
 	u->heap_id = -1;
 	u->timer.retry = &inst->parent->retry[u->code];
+	u->pass_through = inst->pass_through && pass_through_ok(request);
 	fr_dlist_entry_init(&u->entry);
 
 	talloc_set_destructor(u, udp_request_free);
@@ -2599,6 +2745,12 @@ static int mod_instantiate(rlm_radius_t *parent, void *instance, CONF_SECTION *c
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 64);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
 
+	/*
+	 *	Tell proto_radius to fingerprint the attributes it
+	 *	decodes, so that we can tell if they've changed.
+	 */
+	if (inst->pass_through) fr_radius_pass_through = true;
+
 	return 0;
 }
 
@@ -51,6 +51,13 @@ DIAG_ON(strict-prototypes)
 
 #include "rlm_sql.h"
 
+/*
+ *	MySQL 8 removed my_bool, and uses bool in MYSQL_BIND.
+ */
+#if (MYSQL_VERSION_ID >= 80000) && !defined(MARIADB_BASE_VERSION)
+typedef bool my_bool;
+#endif
+
 typedef enum {
 	SERVER_WARNINGS_AUTO = 0,
 	SERVER_WARNINGS_YES,
@@ -68,6 +75,15 @@ typedef struct rlm_sql_mysql_conn {
 	MYSQL		db;
 	MYSQL		*sock;
 	MYSQL_RES	*result;
+
+	MYSQL_STMT	**stmts;	//!< Prepared statements, indexed by statement id.
+	MYSQL_STMT	*stmt;		//!< Statement the current result belongs to.
+	MYSQL_RES	*stmt_meta;	//!< Column names for the current statement result.
+	MYSQL_BIND	*stmt_bind;	//!< Result bindings for the current statement.
+	unsigned long	*stmt_lengths;	//!< Length of each column in the current row.
+	my_bool		*stmt_is_null;	//!< Whether each column in the current row is NULL.
+	char		*stmt_error;	//!< Error from a statement which failed to prepare.  The
+					///< statement is closed, so the error can't be read later.
 } rlm_sql_mysql_conn_t;
 
 typedef struct rlm_sql_mysql_config {
@@ -108,8 +124,16 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t*, rlm_sql_config_t*);
 
 static int _sql_socket_destructor(rlm_sql_mysql_conn_t *conn)
 {
+	size_t i;
+
 	DEBUG2("Socket destructor called, closing socket");
 
+	if (conn->stmt_meta) mysql_free_result(conn->stmt_meta);
+
+	for (i = 0; i < talloc_array_length(conn->stmts); i++) {
+		if (conn->stmts[i]) mysql_stmt_close(conn->stmts[i]);
+	}
+
 	if (conn->sock){
 		mysql_close(conn->sock);
 	}
@@ -333,6 +357,8 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 		return RLM_SQL_RECONNECT;
 	}
 
+	TALLOC_FREE(conn->stmt_error);
+
 	mysql_query(conn->sock, query);
 	rcode = sql_check_error(conn->sock, 0);
 	if (rcode != RLM_SQL_OK) {
@@ -374,11 +400,169 @@ retry_store_result:
 	return RLM_SQL_OK;
 }
 
+/** Free the result of the current prepared statement, keeping the statement for reuse
+ *
+ */
+static void sql_stmt_free_result(rlm_sql_mysql_conn_t *conn)
+{
+	if (conn->stmt_meta) {
+		mysql_free_result(conn->stmt_meta);
+		conn->stmt_meta = NULL;
+	}
+	(void) mysql_stmt_free_result(conn->stmt);
+
+	TALLOC_FREE(conn->stmt_bind);
+	TALLOC_FREE(conn->stmt_lengths);
+	TALLOC_FREE(conn->stmt_is_null);
+	conn->stmt = NULL;
+}
+
+/** Determine an action from the last error on a prepared statement
+ *
+ * Statements don't survive the connection being lost, but in that case
+ * the connection is closed, and the statements with it.
+ */
+static sql_rcode_t sql_stmt_check_error(MYSQL_STMT *ms)
+{
+	sql_rcode_t rcode;
+
+	rcode = sql_check_error(NULL, mysql_stmt_errno(ms));
+	if (rcode == RLM_SQL_OK) rcode = RLM_SQL_ERROR;
+
+	return rcode;
+}
+
+static sql_rcode_t sql_stmt_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+				  rlm_sql_stmt_t const *stmt, char * const *values, bool select)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	size_t			num = talloc_array_length(conn->stmts);
+	MYSQL_STMT		*ms;
+	MYSQL_BIND		*params = NULL;
+	sql_rcode_t		rcode;
+	unsigned int		fields, i;
+
+	if (!conn->sock) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	TALLOC_FREE(conn->stmt_error);
+
+	if ((size_t) stmt->id >= num) {
+		MEM(conn->stmts = talloc_realloc(conn, conn->stmts, MYSQL_STMT *, stmt->id + 1));
+		memset(conn->stmts + num, 0, sizeof(conn->stmts[0]) * ((stmt->id + 1) - num));
+	}
+
+	ms = conn->stmts[stmt->id];
+	if (!ms) {
+		ms = mysql_stmt_init(conn->sock);
+		if (!ms) return sql_check_error(conn->sock, CR_OUT_OF_MEMORY);
+
+		if (mysql_stmt_prepare(ms, stmt->query, strlen(stmt->query)) != 0) {
+			rcode = sql_stmt_check_error(ms);
+			ERROR("Failed preparing statement: %s", mysql_stmt_error(ms));
+			MEM(conn->stmt_error = talloc_typed_asprintf(conn, "ERROR %u (%s): %s",
+								     mysql_stmt_errno(ms), mysql_stmt_error(ms),
+								     mysql_stmt_sqlstate(ms)));
+			mysql_stmt_close(ms);
+			return rcode;
+		}
+		conn->stmts[stmt->id] = ms;
+	}
+	conn->stmt = ms;
+
+	if (stmt->num_params > 0) {
+		MEM(params = talloc_zero_array(conn, MYSQL_BIND, stmt->num_params));
+		for (i = 0; i < (unsigned int) stmt->num_params; i++) {
+			params[i].buffer_type = MYSQL_TYPE_STRING;
+			params[i].buffer = values[i];
+			params[i].buffer_length = strlen(values[i]);
+		}
+
+		if (mysql_stmt_bind_param(ms, params) != 0) {
+		error:
+			TALLOC_FREE(params);
+			return sql_stmt_check_error(ms);
+		}
+	}
+
+	if (mysql_stmt_execute(ms) != 0) goto error;
+	TALLOC_FREE(params);
+
+	if (!select) return RLM_SQL_OK;
+
+	/*
+	 *	Buffer the whole result on the client, as
+	 *	sql_store_result() does for normal queries.
+	 */
+	if (mysql_stmt_store_result(ms) != 0) return sql_stmt_check_error(ms);
+
+	conn->stmt_meta = mysql_stmt_result_metadata(ms);
+	fields = mysql_stmt_field_count(ms);
+	if (fields == 0) return RLM_SQL_OK;
+
+	/*
+	 *	Columns are bound with no buffers, so each is
+	 *	fetched individually once its length is known.
+	 */
+	MEM(conn->stmt_bind = talloc_zero_array(conn, MYSQL_BIND, fields));
+	MEM(conn->stmt_lengths = talloc_zero_array(conn, unsigned long, fields));
+	MEM(conn->stmt_is_null = talloc_zero_array(conn, my_bool, fields));
+	for (i = 0; i < fields; i++) {
+		conn->stmt_bind[i].buffer_type = MYSQL_TYPE_STRING;
+		conn->stmt_bind[i].length = &conn->stmt_lengths[i];
+		conn->stmt_bind[i].is_null = &conn->stmt_is_null[i];
+	}
+
+	if (mysql_stmt_bind_result(ms, conn->stmt_bind) != 0) return sql_stmt_check_error(ms);
+
+	return RLM_SQL_OK;
+}
+
+static sql_rcode_t sql_stmt_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle)
+{
+	rlm_sql_mysql_conn_t	*conn = handle->conn;
+	unsigned int		num_fields, i;
+	int			ret;
+
+	TALLOC_FREE(handle->row);		/* Clear previous row set */
+
+	if (!conn->stmt_bind) return RLM_SQL_NO_MORE_ROWS;
+
+	ret = mysql_stmt_fetch(conn->stmt);
+	if (ret == MYSQL_NO_DATA) return RLM_SQL_NO_MORE_ROWS;
+	if ((ret != 0) && (ret != MYSQL_DATA_TRUNCATED)) return sql_stmt_check_error(conn->stmt);
+
+	num_fields = mysql_stmt_field_count(conn->stmt);
+
+	MEM(*out = handle->row = talloc_zero_array(handle, char *, num_fields + 1));
+	for (i = 0; i < num_fields; i++) {
+		MYSQL_BIND	bind;
+
+		if (conn->stmt_is_null[i]) continue;
+
+		MEM(handle->row[i] = talloc_zero_array(handle->row, char, conn->stmt_lengths[i] + 1));
+		if (conn->stmt_lengths[i] == 0) continue;
+
+		memset(&bind, 0, sizeof(bind));
+		bind.buffer_type = MYSQL_TYPE_STRING;
+		bind.buffer = handle->row[i];
+		bind.buffer_length = conn->stmt_lengths[i] + 1;
+
+		if (mysql_stmt_fetch_column(conn->stmt, &bind, i, 0) != 0) return RLM_SQL_ERROR;
+	}
+
+	return RLM_SQL_OK;
+}
+
 static int sql_num_fields(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	int num = 0;
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+	if (conn->stmt) return mysql_stmt_field_count(conn->stmt);
+
 #if MYSQL_VERSION_ID >= 32224
 	/*
 	 *	Count takes a connection handle
@@ -421,6 +605,8 @@ static int sql_num_rows(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *confi
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+	if (conn->stmt) return mysql_stmt_num_rows(conn->stmt);
+
 	if (conn->result) {
 		return mysql_num_rows(conn->result);
 	}
@@ -448,7 +634,7 @@ static sql_rcode_t sql_fields(char const **out[], rlm_sql_handle_t *handle, rlm_
 	 *	https://bugs.mysql.com/bug.php?id=32318
 	 * 	Hints that we don't have to free field_info.
 	 */
-	field_info = mysql_fetch_fields(conn->result);
+	field_info = mysql_fetch_fields(conn->stmt ? conn->stmt_meta : conn->result);
 	if (!field_info) return RLM_SQL_ERROR;
 
 	MEM(names = talloc_array(handle, char const *, fields));
@@ -470,6 +656,8 @@ static sql_rcode_t sql_fetch_row(rlm_sql_row_t *out, rlm_sql_handle_t *handle, r
 
 	*out = NULL;
 
+	if (conn->stmt) return sql_stmt_fetch_row(out, handle);
+
 	/*
 	 *  Check pointer before de-referencing it.
 	 */
@@ -515,6 +703,8 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_conf
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+	if (conn->stmt) sql_stmt_free_result(conn);
+
 	if (conn->result) {
 		mysql_free_result(conn->result);
 		conn->result = NULL;
@@ -617,14 +807,25 @@ static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
 	rad_assert(conn && conn->sock);
 	rad_assert(outlen > 0);
 
-	error = mysql_error(conn->sock);
-
 	/*
-	 *	Grab the error now in case it gets cleared on the next operation.
+	 *	Errors from prepared statements are recorded against
+	 *	the statement, not the connection.
 	 */
-	if (error && (error[0] != '\0')) {
-		error = talloc_typed_asprintf(ctx, "ERROR %u (%s): %s", mysql_errno(conn->sock), error,
-					mysql_sqlstate(conn->sock));
+	if (conn->stmt_error) {
+		error = talloc_typed_strdup(ctx, conn->stmt_error);
+	} else if (conn->stmt && mysql_stmt_errno(conn->stmt)) {
+		error = talloc_typed_asprintf(ctx, "ERROR %u (%s): %s", mysql_stmt_errno(conn->stmt),
+					      mysql_stmt_error(conn->stmt), mysql_stmt_sqlstate(conn->stmt));
+	} else {
+		error = mysql_error(conn->sock);
+
+		/*
+		 *	Grab the error now in case it gets cleared on the next operation.
+		 */
+		if (error && (error[0] != '\0')) {
+			error = talloc_typed_asprintf(ctx, "ERROR %u (%s): %s", mysql_errno(conn->sock), error,
+						mysql_sqlstate(conn->sock));
+		}
 	}
 
 	/*
@@ -683,6 +884,14 @@ static sql_rcode_t sql_finish_query(rlm_sql_handle_t *handle, rlm_sql_config_t *
 	int			ret;
 	MYSQL_RES		*result;
 
+	/*
+	 *	Prepared statements only ever have one result set.
+	 */
+	if (conn->stmt) {
+		sql_free_result(handle, config);
+		return RLM_SQL_OK;
+	}
+
 	/*
 	 *	If there's no result associated with the
 	 *	connection handle, assume the first result in the
@@ -726,6 +935,8 @@ static int sql_affected_rows(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 {
 	rlm_sql_mysql_conn_t *conn = handle->conn;
 
+	if (conn->stmt) return mysql_stmt_affected_rows(conn->stmt);
+
 	return mysql_affected_rows(conn->sock);
 }
 
@@ -759,6 +970,7 @@ rlm_sql_driver_t rlm_sql_mysql = {
 	.sql_socket_init		= sql_socket_init,
 	.sql_query			= sql_query,
 	.sql_select_query		= sql_select_query,
+	.sql_stmt_query			= sql_stmt_query,
 	.sql_store_result		= sql_store_result,
 	.sql_num_fields			= sql_num_fields,
 	.sql_num_rows			= sql_num_rows,
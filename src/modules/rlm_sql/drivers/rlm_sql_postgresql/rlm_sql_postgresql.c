@@ -69,6 +69,8 @@ typedef struct rlm_sql_postgres_conn {
 	int		num_fields;
 	int		affected_rows;
 	char		**row;
+	bool		*prepared;	//!< Which statements have been prepared on this connection,
+					//!< indexed by statement id.
 } rlm_sql_postgres_conn_t;
 
 static CONF_PARSER driver_config[] = {
@@ -192,38 +194,14 @@ static int CC_HINT(nonnull) sql_socket_init(rlm_sql_handle_t *handle, rlm_sql_co
 	return 0;
 }
 
-static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
-					      char const *query)
+/** Check the status of a query result, and record how many rows it affected
+ *
+ */
+static sql_rcode_t sql_result_status(rlm_sql_postgres_conn_t *conn)
 {
-	rlm_sql_postgres_conn_t *conn = handle->conn;
 	ExecStatusType status;
 	int numfields = 0;
 
-	if (!conn->db) {
-		ERROR("Socket not connected");
-		return RLM_SQL_RECONNECT;
-	}
-
-	/*
-	 *  Returns a PGresult pointer or possibly a null pointer.
-	 *  A non-null pointer will generally be returned except in
-	 *  out-of-memory conditions or serious errors such as inability
-	 *  to send the command to the server. If a null pointer is
-	 *  returned, it should be treated like a PGRES_FATAL_ERROR
-	 *  result.
-	 */
-	conn->result = PQexec(conn->db, query);
-
-	/*
-	 *  As this error COULD be a connection error OR an out-of-memory
-	 *  condition return value WILL be wrong SOME of the time
-	 *  regardless! Pick your poison...
-	 */
-	if (!conn->result) {
-		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
-		return RLM_SQL_RECONNECT;
-	}
-
 	status = PQresultStatus(conn->result);
 	DEBUG("Status: %s", PQresStatus(status));
 
@@ -283,11 +261,221 @@ static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED r
 	return RLM_SQL_ERROR;
 }
 
+static CC_HINT(nonnull) sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+					      char const *query)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	/*
+	 *  Returns a PGresult pointer or possibly a null pointer.
+	 *  A non-null pointer will generally be returned except in
+	 *  out-of-memory conditions or serious errors such as inability
+	 *  to send the command to the server. If a null pointer is
+	 *  returned, it should be treated like a PGRES_FATAL_ERROR
+	 *  result.
+	 */
+	conn->result = PQexec(conn->db, query);
+
+	/*
+	 *  As this error COULD be a connection error OR an out-of-memory
+	 *  condition return value WILL be wrong SOME of the time
+	 *  regardless! Pick your poison...
+	 */
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_result_status(conn);
+}
+
+/** Send a query without waiting for the result
+ *
+ * The connection is left in blocking mode, so the query is written to the
+ * socket before we return.  Only reading the result is asynchronous.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_async(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+						    char const *query)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (conn->result) {
+		PQclear(conn->result);
+		conn->result = NULL;
+	}
+
+	if (!PQsendQuery(conn->db, query)) {
+		ERROR("Failed sending query: %s", PQerrorMessage(conn->db));
+		return (PQstatus(conn->db) == CONNECTION_BAD) ? RLM_SQL_RECONNECT : RLM_SQL_ERROR;
+	}
+
+	return RLM_SQL_OK;
+}
+
+/** Read whatever data is available on the socket, and check if the query has finished
+ *
+ * If the query contained multiple statements, the first failure is returned,
+ * or the result of the last statement if they all succeeded.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_query_async_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+	PGresult		*result;
+
+	if (!PQconsumeInput(conn->db)) {
+		ERROR("Failed reading query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	while (!PQisBusy(conn->db)) {
+		result = PQgetResult(conn->db);
+		if (!result) {
+			if (!conn->result) {
+				ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+				return RLM_SQL_RECONNECT;
+			}
+
+			return sql_result_status(conn);
+		}
+
+		if (conn->result) {
+			switch (PQresultStatus(conn->result)) {
+			case PGRES_BAD_RESPONSE:
+			case PGRES_NONFATAL_ERROR:
+			case PGRES_FATAL_ERROR:
+				PQclear(result);
+				continue;
+
+			default:
+				PQclear(conn->result);
+				break;
+			}
+		}
+		conn->result = result;
+	}
+
+	return RLM_SQL_YIELD;
+}
+
+static int sql_socket_fd(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+
+	return PQsocket(conn->db);
+}
+
 static sql_rcode_t sql_select_query(rlm_sql_handle_t * handle, rlm_sql_config_t *config, char const *query)
 {
 	return sql_query(handle, config, query);
 }
 
+/** Prepare a statement on this connection, if it hasn't been already
+ *
+ * Statements are named after their ids.  The types of the parameters
+ * are inferred by the server, in the same way as for quoted literals.
+ */
+static sql_rcode_t sql_stmt_prepare(rlm_sql_postgres_conn_t *conn, rlm_sql_stmt_t const *stmt,
+				    char *name, size_t namelen)
+{
+	size_t		num = talloc_array_length(conn->prepared);
+	sql_rcode_t	rcode;
+
+	snprintf(name, namelen, "fr_stmt_%i", stmt->id);
+
+	if (((size_t) stmt->id < num) && conn->prepared[stmt->id]) return RLM_SQL_OK;
+
+	if ((size_t) stmt->id >= num) {
+		MEM(conn->prepared = talloc_realloc(conn, conn->prepared, bool, stmt->id + 1));
+		memset(conn->prepared + num, 0, sizeof(conn->prepared[0]) * ((stmt->id + 1) - num));
+	}
+
+	DEBUG2("Preparing statement %s: %s", name, stmt->query);
+
+	conn->result = PQprepare(conn->db, name, stmt->query, stmt->num_params, NULL);
+	if (!conn->result) {
+		ERROR("Failed preparing statement: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	rcode = sql_result_status(conn);
+	if (rcode == RLM_SQL_OK) {
+		conn->prepared[stmt->id] = true;
+		PQclear(conn->result);
+		conn->result = NULL;
+	}
+
+	return rcode;
+}
+
+static CC_HINT(nonnull) sql_rcode_t sql_stmt_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+						   rlm_sql_stmt_t const *stmt, char * const *values,
+						   UNUSED bool select)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+	char			name[32];
+	sql_rcode_t		rcode;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	rcode = sql_stmt_prepare(conn, stmt, name, sizeof(name));
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	conn->result = PQexecPrepared(conn->db, name, stmt->num_params, (char const * const *) values,
+				      NULL, NULL, 0);
+	if (!conn->result) {
+		ERROR("Failed getting query result: %s", PQerrorMessage(conn->db));
+		return RLM_SQL_RECONNECT;
+	}
+
+	return sql_result_status(conn);
+}
+
+/** Send a prepared statement without waiting for the result
+ *
+ * If the statement hasn't been prepared on this connection yet, that's
+ * done synchronously, which only happens once per connection.
+ */
+static CC_HINT(nonnull) sql_rcode_t sql_stmt_query_async(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+							 rlm_sql_stmt_t const *stmt, char * const *values)
+{
+	rlm_sql_postgres_conn_t *conn = handle->conn;
+	char			name[32];
+	sql_rcode_t		rcode;
+
+	if (!conn->db) {
+		ERROR("Socket not connected");
+		return RLM_SQL_RECONNECT;
+	}
+
+	if (conn->result) {
+		PQclear(conn->result);
+		conn->result = NULL;
+	}
+
+	rcode = sql_stmt_prepare(conn, stmt, name, sizeof(name));
+	if (rcode != RLM_SQL_OK) return rcode;
+
+	if (!PQsendQueryPrepared(conn->db, name, stmt->num_params, (char const * const *) values, NULL, NULL, 0)) {
+		ERROR("Failed sending statement: %s", PQerrorMessage(conn->db));
+		return (PQstatus(conn->db) == CONNECTION_BAD) ? RLM_SQL_RECONNECT : RLM_SQL_ERROR;
+	}
+
+	return RLM_SQL_OK;
+}
+
 static sql_rcode_t sql_fields(char const **out[], rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_postgres_conn_t *conn = handle->conn;
@@ -528,6 +716,7 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.name				= "rlm_sql_postgresql",
 	.magic				= RLM_MODULE_INIT,
 //	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY,	/* Needs more testing */
+	.flags				= RLM_SQL_FLAGS_NUMBERED_PARAMS,
 	.inst_size			= sizeof(rlm_sql_postgres_t),
 	.load				= mod_load,
 	.config				= driver_config,
@@ -535,12 +724,17 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 	.sql_socket_init		= sql_socket_init,
 	.sql_query			= sql_query,
 	.sql_select_query		= sql_select_query,
+	.sql_stmt_query			= sql_stmt_query,
+	.sql_stmt_query_async		= sql_stmt_query_async,
 	.sql_num_fields			= sql_num_fields,
 	.sql_fields			= sql_fields,
 	.sql_fetch_row			= sql_fetch_row,
 	.sql_error			= sql_error,
 	.sql_finish_query		= sql_free_result,
 	.sql_finish_select_query	= sql_free_result,
+	.sql_query_async		= sql_query_async,
+	.sql_query_async_result		= sql_query_async_result,
+	.sql_socket_fd			= sql_socket_fd,
 	.sql_affected_rows		= sql_affected_rows,
 	.sql_escape_func		= sql_escape_func
 };
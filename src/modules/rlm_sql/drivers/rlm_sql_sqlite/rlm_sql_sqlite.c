@@ -53,6 +53,9 @@ typedef struct rlm_sql_sqlite_conn {
 	sqlite3 *db;
 	sqlite3_stmt *statement;
 	int col_count;
+	sqlite3_stmt **stmts;		//!< Prepared statements, indexed by statement id.
+	bool statement_cached;		//!< statement is one of stmts, and should be reset
+					//!< rather than finalized.
 } rlm_sql_sqlite_conn_t;
 
 typedef struct rlm_sql_sqlite {
@@ -385,6 +388,12 @@ static int _sql_socket_destructor(rlm_sql_sqlite_conn_t *conn)
 	DEBUG2("Socket destructor called, closing socket");
 
 	if (conn->db) {
+		size_t i;
+
+		for (i = 0; i < talloc_array_length(conn->stmts); i++) {
+			if (conn->stmts[i]) (void) sqlite3_finalize(conn->stmts[i]);
+		}
+
 		status = sqlite3_close(conn->db);
 		if (status != SQLITE_OK) WARN("Got SQLite error when closing socket: %s",
 					      sqlite3_errmsg(conn->db));
@@ -473,6 +482,7 @@ static sql_rcode_t sql_select_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_con
 #else
 	status = sqlite3_prepare(conn->db, query, strlen(query), &conn->statement, &z_tail);
 #endif
+	conn->statement_cached = false;
 
 	conn->col_count = 0;
 
@@ -493,6 +503,7 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 #else
 	status = sqlite3_prepare(conn->db, query, strlen(query), &conn->statement, &z_tail);
 #endif
+	conn->statement_cached = false;
 	rcode = sql_check_error(conn->db, status);
 	if (rcode != RLM_SQL_OK) return rcode;
 
@@ -500,6 +511,56 @@ static sql_rcode_t sql_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *
 	return sql_check_error(conn->db, status);
 }
 
+/** Run a statement, preparing it on this connection the first time it's used
+ *
+ * The prepared statement is kept until the connection is closed, and is
+ * reset when the result is freed.
+ */
+static sql_rcode_t sql_stmt_query(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config,
+				  rlm_sql_stmt_t const *stmt, char * const *values, bool select)
+{
+	rlm_sql_sqlite_conn_t	*conn = handle->conn;
+	size_t			num = talloc_array_length(conn->stmts);
+	sqlite3_stmt		*statement;
+	sql_rcode_t		rcode;
+	int			status, i;
+
+	if ((size_t) stmt->id >= num) {
+		MEM(conn->stmts = talloc_realloc(conn, conn->stmts, sqlite3_stmt *, stmt->id + 1));
+		memset(conn->stmts + num, 0, sizeof(conn->stmts[0]) * ((stmt->id + 1) - num));
+	}
+
+	statement = conn->stmts[stmt->id];
+	if (!statement) {
+		char const *z_tail;
+
+#ifdef HAVE_SQLITE3_PREPARE_V2
+		status = sqlite3_prepare_v2(conn->db, stmt->query, strlen(stmt->query), &statement, &z_tail);
+#else
+		status = sqlite3_prepare(conn->db, stmt->query, strlen(stmt->query), &statement, &z_tail);
+#endif
+		rcode = sql_check_error(conn->db, status);
+		if (rcode != RLM_SQL_OK) return rcode;
+
+		conn->stmts[stmt->id] = statement;
+	}
+
+	conn->statement = statement;
+	conn->statement_cached = true;
+	conn->col_count = 0;
+
+	for (i = 0; i < stmt->num_params; i++) {
+		status = sqlite3_bind_text(statement, i + 1, values[i], -1, SQLITE_TRANSIENT);
+		rcode = sql_check_error(conn->db, status);
+		if (rcode != RLM_SQL_OK) return rcode;
+	}
+
+	if (select) return RLM_SQL_OK;
+
+	status = sqlite3_step(statement);
+	return sql_check_error(conn->db, status);
+}
+
 static int sql_num_fields(rlm_sql_handle_t *handle, UNUSED rlm_sql_config_t *config)
 {
 	rlm_sql_sqlite_conn_t *conn = handle->conn;
@@ -620,8 +681,14 @@ static sql_rcode_t sql_free_result(rlm_sql_handle_t *handle, UNUSED rlm_sql_conf
 	if (conn->statement) {
 		TALLOC_FREE(handle->row);
 
-		(void) sqlite3_finalize(conn->statement);
+		if (conn->statement_cached) {
+			(void) sqlite3_reset(conn->statement);
+			(void) sqlite3_clear_bindings(conn->statement);
+		} else {
+			(void) sqlite3_finalize(conn->statement);
+		}
 		conn->statement = NULL;
+		conn->statement_cached = false;
 		conn->col_count = 0;
 	}
 
@@ -813,6 +880,7 @@ rlm_sql_driver_t rlm_sql_sqlite = {
 	.sql_socket_init		= sql_socket_init,
 	.sql_query			= sql_query,
 	.sql_select_query		= sql_select_query,
+	.sql_stmt_query			= sql_stmt_query,
 	.sql_num_fields			= sql_num_fields,
 	.sql_affected_rows		= sql_affected_rows,
 	.sql_fetch_row			= sql_fetch_row,
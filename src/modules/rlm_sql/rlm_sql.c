@@ -32,6 +32,7 @@ RCSID("$Id$")
 #include <ctype.h>
 
 #include <freeradius-devel/server/base.h>
+#include <freeradius-devel/server/command.h>
 #include <freeradius-devel/server/modules.h>
 #include <freeradius-devel/server/map_proc.h>
 #include <freeradius-devel/util/token.h>
@@ -68,6 +69,8 @@ static const CONF_PARSER type_config[] = {
 static const CONF_PARSER acct_config[] = {
 	{ FR_CONF_OFFSET("reference", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.reference), .dflt = ".query" },
 	{ FR_CONF_OFFSET("logfile", FR_TYPE_STRING | FR_TYPE_XLAT, rlm_sql_config_t, accounting.logfile) },
+	{ FR_CONF_OFFSET("batch_size", FR_TYPE_UINT32, rlm_sql_config_t, accounting.batch_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("batch_timeout", FR_TYPE_TIMEVAL, rlm_sql_config_t, accounting.batch_timeout), .dflt = "0.005" },
 
 	{ FR_CONF_POINTER("type", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) type_config },
 	CONF_PARSER_TERMINATOR
@@ -109,6 +112,11 @@ static const CONF_PARSER module_config[] = {
 	 */
 	{ FR_CONF_OFFSET("query_timeout", FR_TYPE_UINT32, rlm_sql_config_t, query_timeout) },
 
+	/*
+	 *	So does this.
+	 */
+	{ FR_CONF_OFFSET("prepared_statements", FR_TYPE_BOOL, rlm_sql_config_t, prepared_statements), .dflt = "no" },
+
 	{ FR_CONF_POINTER("accounting", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) acct_config },
 
 	{ FR_CONF_POINTER("post-auth", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) postauth_config },
@@ -677,11 +685,15 @@ static int sql_get_grouplist(rlm_sql_t const *inst, rlm_sql_handle_t **handle, R
 	entry = *phead = NULL;
 
 	if (!inst->config->groupmemb_query || !*inst->config->groupmemb_query) return 0;
-	if (xlat_aeval(request, &expanded, request, inst->config->groupmemb_query,
-			 inst->sql_escape_func, *handle) < 0) return -1;
+	if (inst->groupmemb_stmt) {
+		ret = rlm_sql_stmt_query(inst, request, handle, inst->groupmemb_stmt, true);
+	} else {
+		if (xlat_aeval(request, &expanded, request, inst->config->groupmemb_query,
+				 inst->sql_escape_func, *handle) < 0) return -1;
 
-	ret = rlm_sql_select_query(inst, request, handle, expanded);
-	talloc_free(expanded);
+		ret = rlm_sql_select_query(inst, request, handle, expanded);
+		talloc_free(expanded);
+	}
 	if (ret != RLM_SQL_OK) return -1;
 
 	while (rlm_sql_fetch_row(&row, inst, request, handle) == RLM_SQL_OK) {
@@ -847,14 +859,15 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t const *inst, REQUEST *reques
 			/*
 			 *	Expand the group query
 			 */
-			if (xlat_aeval(request, &expanded, request, inst->config->authorize_group_check_query,
-					 inst->sql_escape_func, *handle) < 0) {
+			if (!inst->authorize_group_check_stmt &&
+			    (xlat_aeval(request, &expanded, request, inst->config->authorize_group_check_query,
+					inst->sql_escape_func, *handle) < 0)) {
 				REDEBUG("Error generating query");
 				rcode = RLM_MODULE_FAIL;
 				goto finish;
 			}
 
-			rows = sql_getvpdata(request, inst, request, handle, &check_tmp, expanded);
+			rows = sql_getvpdata(request, inst, request, handle, &check_tmp, inst->authorize_group_check_stmt, expanded);
 			TALLOC_FREE(expanded);
 			if (rows < 0) {
 				REDEBUG("Error retrieving check pairs for group %s", entry->name);
@@ -899,14 +912,15 @@ static rlm_rcode_t rlm_sql_process_groups(rlm_sql_t const *inst, REQUEST *reques
 			/*
 			 *	Now get the reply pairs since the paircmp matched
 			 */
-			if (xlat_aeval(request, &expanded, request, inst->config->authorize_group_reply_query,
-					 inst->sql_escape_func, *handle) < 0) {
+			if (!inst->authorize_group_reply_stmt &&
+			    (xlat_aeval(request, &expanded, request, inst->config->authorize_group_reply_query,
+					inst->sql_escape_func, *handle) < 0)) {
 				REDEBUG("Error generating query");
 				rcode = RLM_MODULE_FAIL;
 				goto finish;
 			}
 
-			rows = sql_getvpdata(request->reply, inst, request, handle, &reply_tmp, expanded);
+			rows = sql_getvpdata(request->reply, inst, request, handle, &reply_tmp, inst->authorize_group_reply_stmt, expanded);
 			TALLOC_FREE(expanded);
 			if (rows < 0) {
 				REDEBUG("Error retrieving reply pairs for group %s", entry->name);
@@ -949,11 +963,50 @@ finish:
 }
 
 
+static int cmd_show_batch(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_sql_t		*inst = ctx;
+	rlm_sql_batch_stats_t	copy;
+
+	pthread_mutex_lock(&inst->batch_stats->mutex);
+	copy.flushes = inst->batch_stats->flushes;
+	copy.entries = inst->batch_stats->entries;
+	copy.max_entries = inst->batch_stats->max_entries;
+	copy.fallbacks = inst->batch_stats->fallbacks;
+	copy.latency = inst->batch_stats->latency;
+	copy.max_latency = inst->batch_stats->max_latency;
+	pthread_mutex_unlock(&inst->batch_stats->mutex);
+
+	fprintf(fp, "flushes\t%" PRIu64 "\n", copy.flushes);
+	fprintf(fp, "entries\t%" PRIu64 "\n", copy.entries);
+	fprintf(fp, "avg_entries\t%.1f\n", copy.flushes ? (double) copy.entries / copy.flushes : 0);
+	fprintf(fp, "max_entries\t%u\n", copy.max_entries);
+	fprintf(fp, "fallbacks\t%" PRIu64 "\n", copy.fallbacks);
+	fprintf(fp, "avg_latency_usec\t%.1f\n", copy.flushes ? (double) copy.latency / (copy.flushes * 1000) : 0);
+	fprintf(fp, "max_latency_usec\t%.1f\n", (double) copy.max_latency / 1000);
+
+	return 0;
+}
+
+static fr_cmd_table_t cmd_table[] = {
+	{
+		.parent = "show module",
+		.add_name = true,
+		.name = "batch",
+		.func = cmd_show_batch,
+		.help = "Show statistics for batched accounting queries.",
+		.read_only = true,
+	},
+
+	CMD_TABLE_END
+};
+
 static int mod_detach(void *instance)
 {
 	rlm_sql_t	*inst = talloc_get_type_abort(instance, rlm_sql_t);
 
 	if (inst->pool) fr_pool_free(inst->pool);
+	if (inst->batch_stats) pthread_mutex_destroy(&inst->batch_stats->mutex);
 
 	/*
 	 *	We need to explicitly free all children, so if the driver
@@ -1078,6 +1131,63 @@ static int mod_bootstrap(void *instance, CONF_SECTION *conf)
 }
 
 
+/** Convert a query template to a prepared statement, if we can
+ *
+ */
+static rlm_sql_stmt_t *sql_stmt_alloc(rlm_sql_t *inst, char const *name, char const *fmt)
+{
+	rlm_sql_stmt_t *stmt;
+
+	if (!fmt || !*fmt) return NULL;
+
+	stmt = rlm_sql_stmt_alloc(inst, fmt);
+	if (!stmt) {
+		DEBUG2("Not preparing %s, it contains expansions outside of quoted strings", name);
+		return NULL;
+	}
+
+	DEBUG2("Preparing %s as: %s", name, stmt->query);
+
+	return stmt;
+}
+
+/** Convert the queries in an accounting or post-auth section to prepared statements
+ *
+ * The statements are added to the CONF_PAIRs as CONF_DATA, so they can be
+ * found from whatever the section's "reference" resolves to.
+ */
+static void sql_stmt_section(rlm_sql_t *inst, sql_acct_section_t *section, CONF_SECTION *cs)
+{
+	CONF_ITEM	*ci = NULL;
+	CONF_PAIR	*cp;
+	rlm_sql_stmt_t	*stmt;
+
+	/*
+	 *	Anything written to the query log needs the
+	 *	expanded query.
+	 */
+	if ((inst->config->logfile && *inst->config->logfile) || (section->logfile && *section->logfile)) return;
+
+	while ((ci = cf_item_next(cs, ci))) {
+		if (cf_item_is_section(ci)) {
+			sql_stmt_section(inst, section, cf_item_to_section(ci));
+			continue;
+		}
+		if (!cf_item_is_pair(ci)) continue;
+
+		cp = cf_item_to_pair(ci);
+
+		/*
+		 *	The other items at the top level are things
+		 *	like "reference" and "logfile".
+		 */
+		if ((cs == section->cs) && (strcmp(cf_pair_attr(cp), "query") != 0)) continue;
+
+		stmt = sql_stmt_alloc(inst, cf_pair_attr(cp), cf_pair_value(cp));
+		if (stmt) cf_data_add(cp, stmt, NULL, false);
+	}
+}
+
 static int mod_instantiate(void *instance, CONF_SECTION *conf)
 {
 	rlm_sql_t *inst = instance;
@@ -1125,6 +1235,31 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->config->postauth.cs = cf_section_find(conf, "post-auth", NULL);
 	inst->config->postauth.reference_cp = (cf_pair_find(inst->config->postauth.cs, "reference") != NULL);
 
+	if (inst->config->prepared_statements && !inst->driver->sql_stmt_query) {
+		WARN("Driver %s doesn't support prepared statements, ignoring \"prepared_statements\"",
+		     inst->driver->name);
+		inst->config->prepared_statements = false;
+	}
+
+	if (inst->config->prepared_statements) {
+		inst->authorize_check_stmt = sql_stmt_alloc(inst, "authorize_check_query",
+							    inst->config->authorize_check_query);
+		inst->authorize_reply_stmt = sql_stmt_alloc(inst, "authorize_reply_query",
+							    inst->config->authorize_reply_query);
+		inst->authorize_group_check_stmt = sql_stmt_alloc(inst, "authorize_group_check_query",
+								  inst->config->authorize_group_check_query);
+		inst->authorize_group_reply_stmt = sql_stmt_alloc(inst, "authorize_group_reply_query",
+								  inst->config->authorize_group_reply_query);
+		inst->groupmemb_stmt = sql_stmt_alloc(inst, "group_membership_query", inst->config->groupmemb_query);
+
+		if (inst->config->accounting.cs) {
+			sql_stmt_section(inst, &inst->config->accounting, inst->config->accounting.cs);
+		}
+		if (inst->config->postauth.cs) {
+			sql_stmt_section(inst, &inst->config->postauth, inst->config->postauth.cs);
+		}
+	}
+
 	/*
 	 *	Cache the SQL-User-Name fr_dict_attr_t, so we can be slightly
 	 *	more efficient about creating SQL-User-Name attributes.
@@ -1161,6 +1296,23 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	inst->pool = module_connection_pool_init(inst->cs, inst, mod_conn_create, NULL, NULL, NULL, NULL);
 	if (!inst->pool) return -1;
 
+	if (inst->config->accounting.batch_size) {
+		FR_TIMEVAL_BOUND_CHECK("batch_timeout", &inst->config->accounting.batch_timeout, >=, 0, 1000);
+		FR_TIMEVAL_BOUND_CHECK("batch_timeout", &inst->config->accounting.batch_timeout, <=, 1, 0);
+
+		MEM(inst->batch_stats = talloc_zero(inst, rlm_sql_batch_stats_t));
+		if (pthread_mutex_init(&inst->batch_stats->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			TALLOC_FREE(inst->batch_stats);
+			return -1;
+		}
+
+		if (fr_command_register_hook(NULL, inst->name, inst, cmd_table) < 0) {
+			PERROR("Failed registering radmin commands");
+			return -1;
+		}
+	}
+
 	return RLM_MODULE_OK;
 }
 
@@ -1220,14 +1372,15 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 		fr_cursor_t	cursor;
 		VALUE_PAIR	*vp;
 
-		if (xlat_aeval(request, &expanded, request, inst->config->authorize_check_query,
-				 inst->sql_escape_func, handle) < 0) {
+		if (!inst->authorize_check_stmt &&
+		    (xlat_aeval(request, &expanded, request, inst->config->authorize_check_query,
+				inst->sql_escape_func, handle) < 0)) {
 			REDEBUG("Failed generating query");
 			rcode = RLM_MODULE_FAIL;
 			goto error;
 		}
 
-		rows = sql_getvpdata(request, inst, request, &handle, &check_tmp, expanded);
+		rows = sql_getvpdata(request, inst, request, &handle, &check_tmp, inst->authorize_check_stmt, expanded);
 		TALLOC_FREE(expanded);
 		if (rows < 0) {
 			REDEBUG("Failed getting check attributes");
@@ -1267,14 +1420,15 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 		/*
 		 *	Now get the reply pairs since the paircmp matched
 		 */
-		if (xlat_aeval(request, &expanded, request, inst->config->authorize_reply_query,
-				 inst->sql_escape_func, handle) < 0) {
+		if (!inst->authorize_reply_stmt &&
+		    (xlat_aeval(request, &expanded, request, inst->config->authorize_reply_query,
+				inst->sql_escape_func, handle) < 0)) {
 			REDEBUG("Error generating query");
 			rcode = RLM_MODULE_FAIL;
 			goto error;
 		}
 
-		rows = sql_getvpdata(request->reply, inst, request, &handle, &reply_tmp, expanded);
+		rows = sql_getvpdata(request->reply, inst, request, &handle, &reply_tmp, inst->authorize_reply_stmt, expanded);
 		TALLOC_FREE(expanded);
 		if (rows < 0) {
 			REDEBUG("SQL query error getting reply attributes");
@@ -1412,32 +1566,360 @@ error:
 	return rcode;
 }
 
-/*
- *	Generic function for failing between a bunch of queries.
+/** State for running a set of redundant queries
  *
- *	Uses the same principle as rlm_linelog, expanding the 'reference' config
- *	item using xlat to figure out what query it should execute.
+ */
+typedef struct {
+	rlm_sql_t const		*inst;			//!< Module instance.
+	sql_acct_section_t	*section;		//!< Section the queries were taken from.
+
+	rlm_sql_handle_t	*handle;		//!< Connection the queries are run on.
+
+	CONF_PAIR		*pair;			//!< Query template we're currently running.
+	char const		*attr;			//!< Name of the query templates.
+	char			*query;			//!< The expanded query.
+	rlm_sql_stmt_t const	*stmt;			//!< Or the template as a prepared statement.
+
+	int			fd;			//!< We're waiting on for the result.
+	int			reconnects;		//!< Number of times we reconnected the handle.
+	bool			timed_out;		//!< The query didn't finish within query_timeout.
+	bool			timeout_set;		//!< Whether the query timeout is armed.
+	sql_rcode_t		sql_ret;		//!< Result of the query.
+
+	fr_dlist_t		entry;			//!< Entry in the thread's batch.
+	rlm_sql_thread_t	*thread;		//!< Thread the batch belongs to.
+	REQUEST			*request;		//!< Request which is waiting for the batch.
+	CONF_PAIR		*first_pair;		//!< First query template, for when we have to run
+							//!< the queries again outside of the transaction.
+	bool			queued;			//!< Still waiting for the batch to be flushed.
+	rlm_rcode_t		rcode;			//!< Result of running the queries.
+} sql_acct_ctx_t;
+
+/** Expand the current query template
  *
- *	If the reference matches multiple config items, and a query fails or
- *	doesn't update any rows, the next matching config item is used.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there's no query to run.  rcode is set.
+ */
+static int acct_query_expand(REQUEST *request, sql_acct_ctx_t *ctx, rlm_rcode_t *rcode)
+{
+	rlm_sql_t const	*inst = ctx->inst;
+	char const	*value;
+
+	value = cf_pair_value(ctx->pair);
+	if (!value) {
+		RDEBUG("Ignoring null query");
+		*rcode = RLM_MODULE_NOOP;
+		return -1;
+	}
+
+	/*
+	 *	The parameters are expanded when the statement is run.
+	 */
+	ctx->stmt = cf_data_value(cf_data_find(ctx->pair, rlm_sql_stmt_t, NULL));
+	if (ctx->stmt) return 0;
+
+	if (xlat_aeval(request, &ctx->query, request, value, inst->sql_escape_func, ctx->handle) < 0) {
+		*rcode = RLM_MODULE_FAIL;
+		return -1;
+	}
+
+	if (!*ctx->query) {
+		RDEBUG("Ignoring null query");
+		*rcode = RLM_MODULE_NOOP;
+		return -1;
+	}
+
+	rlm_sql_query_log(inst, request, ctx->section, ctx->query);
+
+	return 0;
+}
+
+/** Process the result of a query
  *
+ * @return
+ *	- true if we're done.  rcode is set.
+ *	- false if the next query template should be tried.
  */
-static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+static bool acct_query_done(REQUEST *request, sql_acct_ctx_t *ctx, sql_rcode_t sql_ret, rlm_rcode_t *rcode)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	rlm_sql_t const	*inst = ctx->inst;
+	int		numaffected = 0;
 
-	rlm_sql_handle_t	*handle = NULL;
-	int			sql_ret;
-	int			numaffected = 0;
+	TALLOC_FREE(ctx->query);
+	RDEBUG("SQL query returned: %s", fr_int2str(sql_rcode_table, sql_ret, "<INVALID>"));
+
+	switch (sql_ret) {
+	/*
+	 *  Query was a success! Now we just need to check if it did anything.
+	 */
+	case RLM_SQL_OK:
+		break;
+
+	/*
+	 *  A general, unrecoverable server fault.
+	 */
+	case RLM_SQL_ERROR:
+	/*
+	 *  If we get RLM_SQL_RECONNECT it means all connections in the pool
+	 *  were exhausted, and we couldn't create a new connection,
+	 *  so we do not need to call fr_pool_connection_release.
+	 */
+	case RLM_SQL_RECONNECT:
+	default:
+		*rcode = RLM_MODULE_FAIL;
+		return true;
+
+	/*
+	 *  Query was invalid, this is a terminal error, but we still need
+	 *  to do cleanup, as the connection handle is still valid.
+	 */
+	case RLM_SQL_QUERY_INVALID:
+		*rcode = RLM_MODULE_INVALID;
+		return true;
+
+	/*
+	 *  Driver found an error (like a unique key constraint violation)
+	 *  that hinted it might be a good idea to try an alternative query.
+	 */
+	case RLM_SQL_ALT_QUERY:
+		goto next;
+	}
+	rad_assert(ctx->handle);
+
+	/*
+	 *  We need to have updated something for the query to have been
+	 *  counted as successful.
+	 */
+	numaffected = (inst->driver->sql_affected_rows)(ctx->handle, inst->config);
+	(inst->driver->sql_finish_query)(ctx->handle, inst->config);
+	RDEBUG("%i record(s) updated", numaffected);
+
+	if (numaffected > 0) {	/* A query succeeded, were done! */
+		*rcode = RLM_MODULE_OK;
+		return true;
+	}
+
+next:
+	/*
+	 *  We assume all entries with the same name form a redundant
+	 *  set of queries.
+	 */
+	ctx->pair = cf_pair_find_next(ctx->section->cs, ctx->pair, ctx->attr);
+	if (!ctx->pair) {
+		RDEBUG("No additional queries configured");
+		*rcode = RLM_MODULE_NOOP;
+		return true;
+	}
+
+	RDEBUG("Trying next query...");
+
+	return false;
+}
+
+static void acct_finish(REQUEST *request, sql_acct_ctx_t *ctx)
+{
+	rlm_sql_t const *inst = ctx->inst;
+
+	talloc_free(ctx->query);
+	fr_pool_connection_release(inst->pool, request, ctx->handle);
+	sql_unset_user(inst, request);
+	talloc_free(ctx);
+}
+
+static rlm_rcode_t acct_async_next(REQUEST *request, sql_acct_ctx_t *ctx, sql_rcode_t sql_ret);
+
+/** Send the current query, without waiting for the result
+ *
+ */
+static sql_rcode_t acct_async_send(REQUEST *request, sql_acct_ctx_t *ctx)
+{
+	if (ctx->stmt) return rlm_sql_stmt_query_async(ctx->inst, request, &ctx->handle, ctx->stmt);
+
+	return rlm_sql_query_async(ctx->inst, request, &ctx->handle, ctx->query);
+}
+
+/** Remove the events we registered while waiting for a query result
+ *
+ */
+static void acct_async_unwatch(REQUEST *request, sql_acct_ctx_t *ctx)
+{
+	(void) unlang_event_fd_delete(request, ctx, ctx->fd);
+	if (ctx->timeout_set) (void) unlang_event_timeout_delete(request, ctx);
+	ctx->timeout_set = false;
+}
+
+/** The connection's socket is readable, see if the whole result has arrived
+ *
+ */
+static void acct_async_read(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx, UNUSED int fd)
+{
+	sql_acct_ctx_t *ctx = talloc_get_type_abort(rctx, sql_acct_ctx_t);
+
+	ctx->sql_ret = rlm_sql_query_async_result(ctx->inst, request, &ctx->handle);
+	if (ctx->sql_ret == RLM_SQL_YIELD) return;
+
+	acct_async_unwatch(request, ctx);
+	unlang_resumable(request);
+}
+
+static void acct_async_error(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx, UNUSED int fd)
+{
+	sql_acct_ctx_t *ctx = talloc_get_type_abort(rctx, sql_acct_ctx_t);
+
+	RERROR("Error on connection socket");
+
+	ctx->sql_ret = RLM_SQL_RECONNECT;
+	acct_async_unwatch(request, ctx);
+	unlang_resumable(request);
+}
+
+static void acct_async_timeout(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx,
+			       UNUSED struct timeval *fired)
+{
+	sql_acct_ctx_t *ctx = talloc_get_type_abort(rctx, sql_acct_ctx_t);
+
+	/*
+	 *	The timer event is freed once we return.
+	 */
+	ctx->timeout_set = false;
+	ctx->timed_out = true;
+	acct_async_unwatch(request, ctx);
+	unlang_resumable(request);
+}
+
+static rlm_rcode_t acct_async_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx)
+{
+	sql_acct_ctx_t	*ctx = talloc_get_type_abort(rctx, sql_acct_ctx_t);
+	rlm_sql_t const	*inst = ctx->inst;
+	sql_rcode_t	sql_ret = ctx->sql_ret;
+
+	/*
+	 *	The query is still running, so the connection
+	 *	can't be used for anything else.
+	 */
+	if (ctx->timed_out) {
+		REDEBUG("Query timed out after %u seconds", inst->config->query_timeout);
+		fr_pool_connection_close(inst->pool, request, ctx->handle);
+		ctx->handle = NULL;
+		acct_finish(request, ctx);
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	The connection failed while we were waiting for the
+	 *	result.  Send the query again on a new one.
+	 */
+	if (sql_ret == RLM_SQL_RECONNECT) {
+		if (ctx->reconnects++ <= (int) fr_pool_state(inst->pool)->num) {
+			ctx->handle = fr_pool_connection_reconnect(inst->pool, request, ctx->handle);
+			if (ctx->handle) sql_ret = acct_async_send(request, ctx);
+		} else {
+			REDEBUG("Hit reconnection limit");
+			fr_pool_connection_close(inst->pool, request, ctx->handle);
+			ctx->handle = NULL;
+		}
+	}
+
+	return acct_async_next(request, ctx, sql_ret);
+}
+
+static void acct_async_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx,
+			      fr_state_signal_t action)
+{
+	sql_acct_ctx_t	*ctx = talloc_get_type_abort(rctx, sql_acct_ctx_t);
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	RDEBUG2("Cancelling query");
+
+	/*
+	 *	There's no way of telling the database we're no
+	 *	longer interested in the result.
+	 */
+	acct_async_unwatch(request, ctx);
+	fr_pool_connection_close(ctx->inst->pool, request, ctx->handle);
+	ctx->handle = NULL;
+	acct_finish(request, ctx);
+}
+
+/** Wait for the result of the query we just sent, or move onto the next query
+ *
+ * @param[in] request	The current request.
+ * @param[in] ctx	for the set of queries.
+ * @param[in] sql_ret	from sending the query, or from reading its result.
+ * @return
+ *	- RLM_MODULE_YIELD if we're waiting for a result.
+ *	- the result of the set of queries.
+ */
+static rlm_rcode_t acct_async_next(REQUEST *request, sql_acct_ctx_t *ctx, sql_rcode_t sql_ret)
+{
+	rlm_sql_t const	*inst = ctx->inst;
+	rlm_rcode_t	rcode = RLM_MODULE_OK;
+	struct timeval	when;
+
+	for (;;) {
+		if (sql_ret == RLM_SQL_YIELD) break;
+
+		if (acct_query_done(request, ctx, sql_ret, &rcode)) goto finish;
+		if (acct_query_expand(request, ctx, &rcode) < 0) goto finish;
+
+		sql_ret = acct_async_send(request, ctx);
+	}
+
+	ctx->fd = (inst->driver->sql_socket_fd)(ctx->handle, inst->config);
+	ctx->sql_ret = RLM_SQL_YIELD;
+
+	if (unlang_event_fd_add(request, acct_async_read, NULL, acct_async_error, ctx, ctx->fd) < 0) {
+		RPEDEBUG("Failed adding event for connection socket");
+	error:
+		fr_pool_connection_close(inst->pool, request, ctx->handle);
+		ctx->handle = NULL;
+		rcode = RLM_MODULE_FAIL;
+		goto finish;
+	}
+
+	if (inst->config->query_timeout) {
+		gettimeofday(&when, NULL);
+		when.tv_sec += inst->config->query_timeout;
+
+		if (unlang_event_module_timeout_add(request, acct_async_timeout, ctx, &when) < 0) {
+			RPEDEBUG("Failed adding query timeout");
+			(void) unlang_event_fd_delete(request, ctx, ctx->fd);
+			goto error;
+		}
+		ctx->timeout_set = true;
+	}
 
+	return unlang_module_yield(request, acct_async_resume, acct_async_signal, ctx);
+
+finish:
+	acct_finish(request, ctx);
+
+	return rcode;
+}
+
+/** Find the set of queries to run for this request
+ *
+ * Expands the section's reference, and allocates a ctx pointing
+ * at the first query template.
+ *
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in] section	to take the queries from.
+ * @param[out] rcode	Set if there's nothing to run.
+ * @return
+ *	- The new ctx.
+ *	- NULL if there are no queries to run.
+ */
+static sql_acct_ctx_t *acct_ctx_alloc(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section,
+				      rlm_rcode_t *rcode)
+{
+	sql_acct_ctx_t		*ctx;
 	CONF_ITEM		*item;
-	CONF_PAIR 		*pair;
-	char const		*attr = NULL;
-	char const		*value;
 
 	char			path[FR_MAX_STRING_LEN];
 	char			*p = path;
-	char			*expanded = NULL;
 
 	rad_assert(section);
 
@@ -1446,9 +1928,8 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	}
 
 	if (xlat_eval(p, sizeof(path) - (p - path), request, section->reference, NULL, NULL) < 0) {
-		rcode = RLM_MODULE_FAIL;
-
-		goto finish;
+		*rcode = RLM_MODULE_FAIL;
+		return NULL;
 	}
 
 	/*
@@ -1458,146 +1939,324 @@ static int acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_sect
 	item = cf_reference_item(NULL, section->cs, path);
 	if (!item) {
 		RWDEBUG("No such configuration item %s", path);
-		rcode = RLM_MODULE_NOOP;
-
-		goto finish;
+		*rcode = RLM_MODULE_NOOP;
+		return NULL;
 	}
 	if (cf_item_is_section(item)){
 		RWDEBUG("Sections are not supported as references");
-		rcode = RLM_MODULE_NOOP;
+		*rcode = RLM_MODULE_NOOP;
+		return NULL;
+	}
 
-		goto finish;
+	MEM(ctx = talloc_zero(request, sql_acct_ctx_t));
+	ctx->inst = inst;
+	ctx->section = section;
+	ctx->pair = ctx->first_pair = cf_item_to_pair(item);
+	ctx->attr = cf_pair_attr(ctx->pair);
+	ctx->request = request;
+
+	RDEBUG2("Using query template '%s'", ctx->attr);
+
+	return ctx;
+}
+
+/** Run the queries synchronously, until one of them updates something
+ *
+ * @param[in] request	The current request.
+ * @param[in] ctx	for the set of queries.  ctx->handle must be valid.
+ * @param[out] sql_error	If not NULL, set to true if any query failed.  Failures
+ *			which mean the next query should be tried instead,
+ *			like an INSERT for a row which already exists, don't count.
+ * @return the result of the set of queries.
+ */
+static rlm_rcode_t acct_run(REQUEST *request, sql_acct_ctx_t *ctx, bool *sql_error)
+{
+	rlm_rcode_t	rcode = RLM_MODULE_OK;
+	sql_rcode_t	sql_ret;
+
+	if (acct_query_expand(request, ctx, &rcode) < 0) return rcode;
+
+	for (;;) {
+		sql_ret = ctx->stmt ? rlm_sql_stmt_query(ctx->inst, request, &ctx->handle, ctx->stmt, false) :
+				      rlm_sql_query(ctx->inst, request, &ctx->handle, ctx->query);
+		if (sql_error && (sql_ret != RLM_SQL_OK) && (sql_ret != RLM_SQL_ALT_QUERY)) *sql_error = true;
+
+		if (acct_query_done(request, ctx, sql_ret, &rcode)) break;
+		if (acct_query_expand(request, ctx, &rcode) < 0) break;
 	}
 
-	pair = cf_item_to_pair(item);
-	attr = cf_pair_attr(pair);
+	return rcode;
+}
 
-	RDEBUG2("Using query template '%s'", attr);
+/*
+ *	Generic function for failing between a bunch of queries.
+ *
+ *	Uses the same principle as rlm_linelog, expanding the 'reference' config
+ *	item using xlat to figure out what query it should execute.
+ *
+ *	If the reference matches multiple config items, and a query fails or
+ *	doesn't update any rows, the next matching config item is used.
+ *
+ *	If the driver supports it, the request yields while each query runs.
+ */
+static rlm_rcode_t acct_redundant(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	sql_acct_ctx_t		*ctx;
 
-	handle = fr_pool_connection_get(inst->pool, request);
-	if (!handle) {
-		rcode = RLM_MODULE_FAIL;
+	ctx = acct_ctx_alloc(inst, request, section, &rcode);
+	if (!ctx) return rcode;
 
-		goto finish;
+	ctx->handle = fr_pool_connection_get(inst->pool, request);
+	if (!ctx->handle) {
+		talloc_free(ctx);
+		return RLM_MODULE_FAIL;
 	}
 
 	sql_set_user(inst, request, NULL);
 
-	while (true) {
-		value = cf_pair_value(pair);
-		if (!value) {
-			RDEBUG("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
+	if (inst->driver->sql_query_async) {
+		if (acct_query_expand(request, ctx, &rcode) < 0) goto finish;
 
-			goto finish;
-		}
+		return acct_async_next(request, ctx, acct_async_send(request, ctx));
+	}
 
-		if (xlat_aeval(request, &expanded, request, value, inst->sql_escape_func, handle) < 0) {
-			rcode = RLM_MODULE_FAIL;
+	rcode = acct_run(request, ctx, NULL);
 
-			goto finish;
-		}
+finish:
+	acct_finish(request, ctx);
 
-		if (!*expanded) {
-			RDEBUG("Ignoring null query");
-			rcode = RLM_MODULE_NOOP;
+	return rcode;
+}
 
-			goto finish;
-		}
+#ifdef WITH_ACCOUNTING
+/** Run a transaction control statement, e.g. BEGIN or COMMIT
+ *
+ */
+static sql_rcode_t acct_batch_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+				    char const *query)
+{
+	sql_rcode_t ret;
 
-		rlm_sql_query_log(inst, request, section, expanded);
+	ret = rlm_sql_query(inst, request, handle, query);
+	if (ret == RLM_SQL_OK) (inst->driver->sql_finish_query)(*handle, inst->config);
 
-		sql_ret = rlm_sql_query(inst, request, &handle, expanded);
-		TALLOC_FREE(expanded);
-		RDEBUG("SQL query returned: %s", fr_int2str(sql_rcode_table, sql_ret, "<INVALID>"));
+	return ret;
+}
 
-		switch (sql_ret) {
-		/*
-		 *  Query was a success! Now we just need to check if it did anything.
-		 */
-		case RLM_SQL_OK:
-			break;
+/** Run the queries for every request in the batch, then resume the requests
+ *
+ * All of the queries are run in a single transaction.  If any of them
+ * fail, the transaction is rolled back, and each request's queries are
+ * run again individually, so that one bad request doesn't cause the
+ * rest of the batch to fail.
+ *
+ * @param[in] t		Thread whose batch we're flushing.
+ * @param[in] current	Request which filled the batch.  It's still running,
+ *			so it isn't marked as resumable.
+ */
+static void acct_batch_flush(rlm_sql_thread_t *t, REQUEST *current)
+{
+	rlm_sql_t const		*inst = t->inst;
+	rlm_sql_batch_stats_t	*stats = inst->batch_stats;
+	sql_acct_ctx_t		*ctx, *first;
+	rlm_sql_handle_t	*handle;
+	REQUEST			*request;
+	bool			sql_error = false;
+	uint32_t		num = t->batch_len;
+	fr_time_t		start, latency;
 
-		/*
-		 *  A general, unrecoverable server fault.
-		 */
-		case RLM_SQL_ERROR:
-		/*
-		 *  If we get RLM_SQL_RECONNECT it means all connections in the pool
-		 *  were exhausted, and we couldn't create a new connection,
-		 *  so we do not need to call fr_pool_connection_release.
-		 */
-		case RLM_SQL_RECONNECT:
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
+	if (t->batch_ev) fr_event_timer_delete(t->el, &t->batch_ev);
 
-		/*
-		 *  Query was invalid, this is a terminal error, but we still need
-		 *  to do cleanup, as the connection handle is still valid.
-		 */
-		case RLM_SQL_QUERY_INVALID:
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+	first = fr_dlist_head(&t->batch);
+	if (!first) return;
 
-		/*
-		 *  Driver found an error (like a unique key constraint violation)
-		 *  that hinted it might be a good idea to try an alternative query.
-		 */
-		case RLM_SQL_ALT_QUERY:
-			goto next;
-		}
-		rad_assert(handle);
+	/*
+	 *	Log the transaction against the first request in
+	 *	the batch, that's as good as any other.
+	 */
+	request = first->request;
+	start = fr_time();
 
-		/*
-		 *  We need to have updated something for the query to have been
-		 *  counted as successful.
-		 */
-		numaffected = (inst->driver->sql_affected_rows)(handle, inst->config);
-		(inst->driver->sql_finish_query)(handle, inst->config);
-		RDEBUG("%i record(s) updated", numaffected);
+	RDEBUG2("Flushing batch of %u accounting request(s)", num);
+
+	handle = fr_pool_connection_get(inst->pool, request);
+	if (!handle) {
+		ctx = NULL;
+		while ((ctx = fr_dlist_next(&t->batch, ctx))) ctx->rcode = RLM_MODULE_FAIL;
+		goto resume;
+	}
+
+	if (acct_batch_query(inst, request, &handle, "BEGIN") != RLM_SQL_OK) {
+		sql_error = true;
+		goto individual;
+	}
+
+	ctx = NULL;
+	while ((ctx = fr_dlist_next(&t->batch, ctx))) {
+		ctx->handle = handle;
+		ctx->rcode = acct_run(ctx->request, ctx, &sql_error);
 
-		if (numaffected > 0) break;	/* A query succeeded, were done! */
-	next:
 		/*
-		 *  We assume all entries with the same name form a redundant
-		 *  set of queries.
+		 *	If the handle was reconnected, everything we
+		 *	did before that was lost with the transaction.
 		 */
-		pair = cf_pair_find_next(section->cs, pair, attr);
+		if (ctx->handle != handle) sql_error = true;
+		handle = ctx->handle;
+		ctx->handle = NULL;
 
-		if (!pair) {
-			RDEBUG("No additional queries configured");
-			rcode = RLM_MODULE_NOOP;
+		if (sql_error) break;
+	}
 
-			goto finish;
+	if (!sql_error && (acct_batch_query(inst, request, &handle, "COMMIT") == RLM_SQL_OK)) goto done;
+
+	RWDEBUG("Batch failed, running queries individually");
+	if (handle) (void) acct_batch_query(inst, request, &handle, "ROLLBACK");
+
+individual:
+	ctx = NULL;
+	while ((ctx = fr_dlist_next(&t->batch, ctx))) {
+		if (!handle) handle = fr_pool_connection_get(inst->pool, ctx->request);
+		if (!handle) {
+			ctx->rcode = RLM_MODULE_FAIL;
+			continue;
 		}
 
-		RDEBUG("Trying next query...");
+		TALLOC_FREE(ctx->query);
+		ctx->pair = ctx->first_pair;
+		ctx->handle = handle;
+		ctx->rcode = acct_run(ctx->request, ctx, NULL);
+		handle = ctx->handle;
+		ctx->handle = NULL;
 	}
 
-
-finish:
-	talloc_free(expanded);
+done:
 	fr_pool_connection_release(inst->pool, request, handle);
-	sql_unset_user(inst, request);
+
+	latency = fr_time() - start;
+
+	pthread_mutex_lock(&stats->mutex);
+	stats->flushes++;
+	stats->entries += num;
+	if (num > stats->max_entries) stats->max_entries = num;
+	if (sql_error) stats->fallbacks++;
+	stats->latency += latency;
+	if (latency > stats->max_latency) stats->max_latency = latency;
+	pthread_mutex_unlock(&stats->mutex);
+
+resume:
+	while ((ctx = fr_dlist_head(&t->batch))) {
+		fr_dlist_remove(&t->batch, ctx);
+		ctx->queued = false;
+
+		if (ctx->request != current) unlang_resumable(ctx->request);
+	}
+	t->batch_len = 0;
+}
+
+/** The batch wasn't filled within batch_timeout, flush what we have
+ *
+ */
+static void acct_batch_timeout(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *uctx)
+{
+	rlm_sql_thread_t *t = talloc_get_type_abort(uctx, rlm_sql_thread_t);
+
+	t->batch_ev = NULL;
+	acct_batch_flush(t, NULL);
+}
+
+static rlm_rcode_t acct_batch_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx)
+{
+	sql_acct_ctx_t	*ctx = talloc_get_type_abort(rctx, sql_acct_ctx_t);
+	rlm_rcode_t	rcode = ctx->rcode;
+
+	sql_unset_user(ctx->inst, request);
+	talloc_free(ctx);
 
 	return rcode;
 }
 
-#ifdef WITH_ACCOUNTING
+static void acct_batch_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *rctx,
+			      fr_state_signal_t action)
+{
+	sql_acct_ctx_t		*ctx = talloc_get_type_abort(rctx, sql_acct_ctx_t);
+	rlm_sql_thread_t	*t = ctx->thread;
+
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	if (ctx->queued) {
+		RDEBUG2("Removing request from batch");
+
+		fr_dlist_remove(&t->batch, ctx);
+		if ((--t->batch_len == 0) && t->batch_ev) fr_event_timer_delete(t->el, &t->batch_ev);
+	}
+
+	sql_unset_user(ctx->inst, request);
+	talloc_free(ctx);
+}
+
+/** Add the request to this thread's batch
+ *
+ * The request yields until the batch is flushed, either because it's
+ * full, or because batch_timeout has passed since the first request
+ * was added.
+ */
+static rlm_rcode_t acct_batch_add(rlm_sql_t const *inst, rlm_sql_thread_t *t, REQUEST *request,
+				  sql_acct_section_t *section)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	sql_acct_ctx_t		*ctx;
+	struct timeval		when;
+
+	ctx = acct_ctx_alloc(inst, request, section, &rcode);
+	if (!ctx) return rcode;
+
+	sql_set_user(inst, request, NULL);
+
+	ctx->thread = t;
+	ctx->queued = true;
+	fr_dlist_insert_tail(&t->batch, ctx);
+
+	/*
+	 *	The batch is full, run the queries now.
+	 */
+	if (++t->batch_len >= section->batch_size) {
+		acct_batch_flush(t, request);
+		return acct_batch_resume(request, NULL, NULL, ctx);
+	}
+
+	if (!t->batch_ev) {
+		gettimeofday(&when, NULL);
+		fr_timeval_add(&when, &when, &section->batch_timeout);
+
+		if (fr_event_timer_insert(t, t->el, &t->batch_ev, &when, acct_batch_timeout, t) < 0) {
+			RPEDEBUG("Failed adding batch timer");
+			acct_batch_flush(t, request);
+			return acct_batch_resume(request, NULL, NULL, ctx);
+		}
+	}
+
+	RDEBUG2("Waiting for batch to be flushed (%u queued)", t->batch_len);
+
+	return unlang_module_yield(request, acct_batch_resume, acct_batch_signal, ctx);
+}
 
 /*
  *	Accounting: Insert or update session data in our sql table
  */
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_sql_t const *inst = instance;
 
-	if (inst->config->accounting.reference_cp) {
-		return acct_redundant(inst, request, &inst->config->accounting);
+	if (!inst->config->accounting.reference_cp) return RLM_MODULE_NOOP;
+
+	if (inst->config->accounting.batch_size) {
+		return acct_batch_add(inst, talloc_get_type_abort(thread, rlm_sql_thread_t), request,
+				      &inst->config->accounting);
 	}
 
-	return RLM_MODULE_NOOP;
+	return acct_redundant(inst, request, &inst->config->accounting);
 }
 
 #endif
@@ -1622,6 +2281,23 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
  */
 
 
+/** Initialise the thread's accounting batch
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_sql_thread_t *t = thread;
+
+	(void) talloc_set_type(t, rlm_sql_thread_t);
+
+	t->inst = talloc_get_type_abort(instance, rlm_sql_t);
+	t->el = el;
+
+	fr_dlist_init(&t->batch, sql_acct_ctx_t, entry);
+
+	return 0;
+}
+
 /* globally exported name */
 rad_module_t rlm_sql = {
 	.magic		= RLM_MODULE_INIT,
@@ -1632,6 +2308,9 @@ rad_module_t rlm_sql = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+
+	.thread_inst_size = sizeof(rlm_sql_thread_t),
+	.thread_instantiate = mod_thread_instantiate,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
 #ifdef WITH_ACCOUNTING
@@ -32,6 +32,7 @@ RCSIDH(rlm_sql_h, "$Id$")
 #  define LOG_PREFIX_ARGS inst->name
 #endif
 
+#include <freeradius-devel/io/time.h>
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/server/pool.h>
 #include <freeradius-devel/server/modpriv.h>
@@ -49,6 +50,7 @@ typedef enum {
 	RLM_SQL_RECONNECT = 1,		//!< Stale connection, should reconnect.
 	RLM_SQL_ALT_QUERY,		//!< Key constraint violation, use an alternative query.
 	RLM_SQL_NO_MORE_ROWS,		//!< No more rows available
+	RLM_SQL_YIELD,			//!< Query has been sent, but the result isn't available yet.
 } sql_rcode_t;
 
 typedef enum {
@@ -80,6 +82,11 @@ typedef struct sql_acct_section {
 	char const		*logfile;
 
 	char const		**query;			/* for xlat parsing */
+
+	uint32_t		batch_size;			//!< Flush queued queries when this many
+								//!< requests are waiting.  0 disables batching.
+	struct timeval		batch_timeout;			//!< Flush queued queries after this long,
+								//!< even if the batch isn't full.
 } sql_acct_section_t;
 
 typedef struct sql_config {
@@ -122,6 +129,9 @@ typedef struct sql_config {
 	char const		*connect_query;			//!< Query executed after establishing
 								//!< new connection.
 
+	bool			prepared_statements;		//!< Convert query templates to statements
+								//!< with bound parameters, where possible.
+
 	void			*driver;			//!< Where drivers should write a
 								//!< pointer to their configurations.
 
@@ -147,12 +157,30 @@ typedef struct rlm_sql_handle {
 								//!< when log strings need to be copied.
 } rlm_sql_handle_t;
 
+/** A query template, converted to a statement with bound parameters
+ *
+ * Each single quoted string in the template which consists entirely of
+ * an expansion, e.g. '%{User-Name}', is replaced with a placeholder.
+ * The expansions are evaluated without escaping, and their values passed
+ * to the database separately.
+ */
+typedef struct {
+	int			id;				//!< Unique within the module instance.  Drivers
+								//!< use it to find their prepared copy of the
+								//!< statement on a connection.
+	char const		*query;				//!< Query text, with placeholders.
+	char const		**params;			//!< Expansions producing the value of each parameter.
+	int			num_params;			//!< Number of parameters.
+} rlm_sql_stmt_t;
+
 extern const FR_NAME_NUMBER sql_rcode_table[];
 /*
  *	Capabilities flags for drivers
  */
 #define RLM_SQL_RCODE_FLAGS_ALT_QUERY	1			//!< Can distinguish between other errors and those
 								//!< resulting from a unique key violation.
+#define RLM_SQL_FLAGS_NUMBERED_PARAMS	2			//!< Statement placeholders are numbered ($1, $2...),
+								//!< instead of being '?'.
 
 /** Retrieve errors from the last query operation
  *
@@ -203,9 +231,57 @@ typedef struct rlm_sql_driver_t {
 	sql_rcode_t (*sql_finish_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 	sql_rcode_t (*sql_finish_select_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
 
+	/*
+	 *	Optional.  If the driver provides these, queries are sent
+	 *	without waiting for the result, and the request yields
+	 *	until the connection's socket becomes readable.
+	 */
+	sql_rcode_t (*sql_query_async)(rlm_sql_handle_t *handle, rlm_sql_config_t *config, char const *query);
+	sql_rcode_t (*sql_query_async_result)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+	int (*sql_socket_fd)(rlm_sql_handle_t *handle, rlm_sql_config_t *config);
+
+	/*
+	 *	Optional.  Run a statement with bound parameters.  The driver
+	 *	prepares the statement the first time it's used on a connection.
+	 *
+	 *	Drivers which provide sql_query_async must also provide
+	 *	sql_stmt_query_async if they provide sql_stmt_query.
+	 */
+	sql_rcode_t (*sql_stmt_query)(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+				      rlm_sql_stmt_t const *stmt, char * const *values, bool select);
+	sql_rcode_t (*sql_stmt_query_async)(rlm_sql_handle_t *handle, rlm_sql_config_t *config,
+					    rlm_sql_stmt_t const *stmt, char * const *values);
+
 	xlat_escape_t	sql_escape_func;
 } rlm_sql_driver_t;
 
+/** Counters for batched accounting queries
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects the counters, batches are flushed
+							//!< by every worker.
+	uint64_t		flushes;		//!< Number of batches committed.
+	uint64_t		entries;		//!< Number of requests in those batches.
+	uint32_t		max_entries;		//!< Largest batch we've flushed.
+	uint64_t		fallbacks;		//!< Batches where the transaction failed, and
+							//!< the queries were run individually.
+	fr_time_t		latency;		//!< Total time spent flushing batches.
+	fr_time_t		max_latency;		//!< Longest time spent flushing a batch.
+} rlm_sql_batch_stats_t;
+
+/** Per-worker state
+ *
+ */
+typedef struct {
+	rlm_sql_t const		*inst;			//!< Module instance.
+	fr_event_list_t		*el;			//!< Worker's event list.
+
+	fr_dlist_head_t		batch;			//!< Accounting requests waiting to be flushed.
+	uint32_t		batch_len;		//!< Number of requests in the batch.
+	fr_event_timer_t const	*batch_ev;		//!< Flushes the batch when batch_timeout expires.
+} rlm_sql_thread_t;
+
 struct sql_inst {
 	rlm_sql_config_t	myconfig; /* HACK */
 	fr_pool_t		*pool;
@@ -227,6 +303,15 @@ struct sql_inst {
 
 	char const		*name;			//!< Module instance name.
 	fr_dict_attr_t const	*group_da;		//!< Group dictionary attribute.
+
+	rlm_sql_batch_stats_t	*batch_stats;		//!< Counters for batched accounting queries.
+
+	int			num_stmts;		//!< Number of prepared statements we've created.
+	rlm_sql_stmt_t const	*authorize_check_stmt;	//!< Prepared authorize_check_query.
+	rlm_sql_stmt_t const	*authorize_reply_stmt;	//!< Prepared authorize_reply_query.
+	rlm_sql_stmt_t const	*authorize_group_check_stmt;	//!< Prepared authorize_group_check_query.
+	rlm_sql_stmt_t const	*authorize_group_reply_stmt;	//!< Prepared authorize_group_reply_query.
+	rlm_sql_stmt_t const	*groupmemb_stmt;	//!< Prepared group_membership_query.
 };
 
 typedef struct sql_grouplist {
@@ -237,12 +322,18 @@ typedef struct sql_grouplist {
 void		*mod_conn_create(TALLOC_CTX *ctx, void *instance, struct timeval const *timeout);
 int		sql_fr_pair_list_afrom_str(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **first_pair, rlm_sql_row_t row);
 int		sql_read_realms(rlm_sql_handle_t *handle);
-int		sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, VALUE_PAIR **pair, char const *query);
+int		sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, VALUE_PAIR **pair,
+			      rlm_sql_stmt_t const *stmt, char const *query);
 int		sql_read_clients(rlm_sql_handle_t *handle);
 int		sql_dict_init(rlm_sql_handle_t *handle);
 void 		rlm_sql_query_log(rlm_sql_t const *inst, REQUEST *request, sql_acct_section_t *section, char const *query) CC_HINT(nonnull (1, 2, 4));
 sql_rcode_t	rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
 sql_rcode_t	rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
+sql_rcode_t	rlm_sql_query_async(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query) CC_HINT(nonnull (1, 3, 4));
+sql_rcode_t	rlm_sql_query_async_result(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle) CC_HINT(nonnull (1, 3));
+rlm_sql_stmt_t	*rlm_sql_stmt_alloc(rlm_sql_t *inst, char const *fmt);
+sql_rcode_t	rlm_sql_stmt_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, rlm_sql_stmt_t const *stmt, bool select) CC_HINT(nonnull (1, 2, 3, 4));
+sql_rcode_t	rlm_sql_stmt_query_async(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, rlm_sql_stmt_t const *stmt) CC_HINT(nonnull (1, 2, 3, 4));
 int		rlm_sql_fetch_row(rlm_sql_row_t *out, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle);
 void		rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, bool force_debug);
 int		sql_set_user(rlm_sql_t const *inst, REQUEST *request, char const *username);
@@ -50,6 +50,7 @@ const FR_NAME_NUMBER sql_rcode_table[] = {
 	{ "query invalid",	RLM_SQL_QUERY_INVALID	},
 	{ "no connection",	RLM_SQL_RECONNECT	},
 	{ "no more rows",	RLM_SQL_NO_MORE_ROWS	},
+	{ "in progress",	RLM_SQL_YIELD		},
 	{ NULL, 0 }
 };
 
@@ -307,6 +308,59 @@ void rlm_sql_print_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle
 	talloc_free_children(handle->log_ctx);
 }
 
+/** Log errors from a failed query, and clean up after it
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle the query was run on.
+ * @param ret returned by the driver.
+ * @return ret, or #RLM_SQL_ALT_QUERY if the driver can't distinguish between
+ *	constraint violations and other errors.
+ */
+static sql_rcode_t sql_query_error(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t *handle, sql_rcode_t ret)
+{
+	switch (ret) {
+	/*
+	 *	These are bad and should make rlm_sql return invalid
+	 */
+	case RLM_SQL_QUERY_INVALID:
+		rlm_sql_print_error(inst, request, handle, false);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	/*
+	 *	Server or client errors.
+	 *
+	 *	If the driver claims to be able to distinguish between
+	 *	duplicate row errors and other errors, and we hit a
+	 *	general error treat it as a failure.
+	 *
+	 *	Otherwise rewrite it to RLM_SQL_ALT_QUERY.
+	 */
+	case RLM_SQL_ERROR:
+		if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
+			rlm_sql_print_error(inst, request, handle, false);
+			(inst->driver->sql_finish_query)(handle, inst->config);
+			break;
+		}
+		ret = RLM_SQL_ALT_QUERY;
+		/* FALL-THROUGH */
+
+	/*
+	 *	Driver suggested using an alternative query
+	 */
+	case RLM_SQL_ALT_QUERY:
+		rlm_sql_print_error(inst, request, handle, true);
+		(inst->driver->sql_finish_query)(handle, inst->config);
+		break;
+
+	default:
+		break;
+	}
+
+	return ret;
+}
+
 /** Call the driver's sql_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
@@ -365,43 +419,67 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 			/* Reconnection succeeded, try again with the new handle */
 			continue;
 
-		/*
-		 *	These are bad and should make rlm_sql return invalid
-		 */
-		case RLM_SQL_QUERY_INVALID:
-			rlm_sql_print_error(inst, request, *handle, false);
-			(inst->driver->sql_finish_query)(*handle, inst->config);
+		default:
+			ret = sql_query_error(inst, request, *handle, ret);
 			break;
+		}
 
-		/*
-		 *	Server or client errors.
-		 *
-		 *	If the driver claims to be able to distinguish between
-		 *	duplicate row errors and other errors, and we hit a
-		 *	general error treat it as a failure.
-		 *
-		 *	Otherwise rewrite it to RLM_SQL_ALT_QUERY.
-		 */
-		case RLM_SQL_ERROR:
-			if (inst->driver->flags & RLM_SQL_RCODE_FLAGS_ALT_QUERY) {
-				rlm_sql_print_error(inst, request, *handle, false);
-				(inst->driver->sql_finish_query)(*handle, inst->config);
-				break;
-			}
-			ret = RLM_SQL_ALT_QUERY;
-			/* FALL-THROUGH */
+		return ret;
+	}
 
-		/*
-		 *	Driver suggested using an alternative query
-		 */
-		case RLM_SQL_ALT_QUERY:
-			rlm_sql_print_error(inst, request, *handle, true);
-			(inst->driver->sql_finish_query)(*handle, inst->config);
-			break;
+	ROPTIONAL(RERROR, ERROR, "Hit reconnection limit");
 
-		}
+	return RLM_SQL_ERROR;
+}
 
-		return ret;
+/** Call the driver's sql_query_async method, reconnecting if necessary.
+ *
+ * The query is sent, but we don't wait for the result.  The caller should
+ * wait for the socket returned by the driver's sql_socket_fd method to become
+ * readable, and then call #rlm_sql_query_async_result.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle to query the database with. *handle should not be NULL, as this indicates
+ *	  previous reconnection attempt has failed.
+ * @param query to execute. Should not be zero length.
+ * @return
+ *	- #RLM_SQL_YIELD if the query was sent.
+ *	- #RLM_SQL_RECONNECT if a new handle is required (also sets *handle = NULL).
+ *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
+ *	- #RLM_SQL_ALT_QUERY on constraints violation.
+ */
+sql_rcode_t rlm_sql_query_async(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle, char const *query)
+{
+	int ret = RLM_SQL_ERROR;
+	int i, count;
+
+	rad_assert(*handle);
+	rad_assert(inst->driver->sql_query_async);
+
+	if (query[0] == '\0') {
+		if (request) REDEBUG("Zero length query");
+		return RLM_SQL_QUERY_INVALID;
+	}
+
+	count = inst->pool ? fr_pool_state(inst->pool)->num : 0;
+
+	for (i = 0; i < (count + 1); i++) {
+		ROPTIONAL(RDEBUG2, DEBUG2, "Sending query: %s", query);
+
+		ret = (inst->driver->sql_query_async)(*handle, inst->config, query);
+		switch (ret) {
+		case RLM_SQL_OK:
+			return RLM_SQL_YIELD;
+
+		case RLM_SQL_RECONNECT:
+			*handle = fr_pool_connection_reconnect(inst->pool, request, *handle);
+			if (!*handle) return RLM_SQL_RECONNECT;
+			continue;
+
+		default:
+			return sql_query_error(inst, request, *handle, ret);
+		}
 	}
 
 	ROPTIONAL(RERROR, ERROR, "Hit reconnection limit");
@@ -409,6 +487,40 @@ sql_rcode_t rlm_sql_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handl
 	return RLM_SQL_ERROR;
 }
 
+/** Read the result of a query sent with #rlm_sql_query_async
+ *
+ * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
+ *	after they're done with the result.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.
+ * @param handle the query was sent on.
+ * @return
+ *	- #RLM_SQL_YIELD if the result isn't available yet.
+ *	- #RLM_SQL_OK on success.
+ *	- #RLM_SQL_RECONNECT if the connection failed.  The caller should reconnect
+ *	  the handle, and send the query again.
+ *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
+ *	- #RLM_SQL_ALT_QUERY on constraints violation.
+ */
+sql_rcode_t rlm_sql_query_async_result(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle)
+{
+	sql_rcode_t ret;
+
+	rad_assert(*handle);
+
+	ret = (inst->driver->sql_query_async_result)(*handle, inst->config);
+	switch (ret) {
+	case RLM_SQL_YIELD:
+	case RLM_SQL_OK:
+	case RLM_SQL_RECONNECT:
+		return ret;
+
+	default:
+		return sql_query_error(inst, request, *handle, ret);
+	}
+}
+
 /** Call the driver's sql_select_query method, reconnecting if necessary.
  *
  * @note Caller must call ``(inst->driver->sql_finish_select_query)(handle, inst->config);``
@@ -483,6 +595,273 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sq
 }
 
 
+/** Find the end of an expansion
+ *
+ * @param[in] p	the '%' which starts the expansion.
+ * @return
+ *	- The character after the closing brace.
+ *	- NULL if the expansion isn't terminated.
+ */
+static char const *sql_stmt_xlat_end(char const *p)
+{
+	int depth = 0;
+
+	for (p++; *p; p++) {
+		switch (*p) {
+		case '\\':
+			if (!p[1]) return NULL;
+			p++;
+			break;
+
+		case '{':
+			depth++;
+			break;
+
+		case '}':
+			if (--depth == 0) return p + 1;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/** Convert a query template to a statement with bound parameters
+ *
+ * Only templates where every expansion is a complete single quoted
+ * string, e.g. '%{User-Name}', can be converted.  Expansions anywhere
+ * else may produce SQL, not just values, so those queries have to be
+ * built for each request.
+ *
+ * @param[in] inst	Module instance.  The statement is allocated in its context.
+ * @param[in] fmt	Query template to convert.
+ * @return
+ *	- The new statement.
+ *	- NULL if the template can't be converted.
+ */
+rlm_sql_stmt_t *rlm_sql_stmt_alloc(rlm_sql_t *inst, char const *fmt)
+{
+	rlm_sql_stmt_t	*stmt;
+	char		*query;
+	char const	*p = fmt, *end;
+	bool		in_string = false;
+
+	MEM(stmt = talloc_zero(inst, rlm_sql_stmt_t));
+	MEM(query = talloc_typed_strdup(stmt, ""));
+
+	while (*p) {
+		switch (*p) {
+		/*
+		 *	Escapes are processed when the template is
+		 *	expanded, so the query text would be different.
+		 */
+		case '\\':
+			goto error;
+
+		case '%':
+			if (p[1] != '%') goto error;
+
+			MEM(query = talloc_strndup_append_buffer(query, p, 1));
+			p += 2;
+			continue;
+
+		case '\'':
+			/*
+			 *	A string which is only an expansion, and
+			 *	isn't joined to a neighbouring string with
+			 *	a doubled quote.
+			 */
+			if (!in_string && ((p == fmt) || (p[-1] != '\'')) && (p[1] == '%') && (p[2] == '{') &&
+			    (end = sql_stmt_xlat_end(p + 1)) && (end[0] == '\'') && (end[1] != '\'')) {
+				MEM(stmt->params = talloc_realloc(stmt, stmt->params, char const *, stmt->num_params + 1));
+				MEM(stmt->params[stmt->num_params++] = talloc_bstrndup(stmt, p + 1, end - (p + 1)));
+
+				if (inst->driver->flags & RLM_SQL_FLAGS_NUMBERED_PARAMS) {
+					MEM(query = talloc_asprintf_append_buffer(query, "$%i", stmt->num_params));
+				} else {
+					MEM(query = talloc_strdup_append_buffer(query, "?"));
+				}
+
+				p = end + 1;
+				continue;
+			}
+
+			in_string = !in_string;
+			break;
+
+		default:
+			break;
+		}
+
+		MEM(query = talloc_strndup_append_buffer(query, p, 1));
+		p++;
+	}
+
+	if (in_string) {
+	error:
+		talloc_free(stmt);
+		return NULL;
+	}
+
+	stmt->query = query;
+	stmt->id = inst->num_stmts++;
+
+	return stmt;
+}
+
+/** Expand the values of a statement's parameters
+ *
+ */
+static int sql_stmt_values(char ***out, rlm_sql_t const *inst, REQUEST *request, rlm_sql_stmt_t const *stmt)
+{
+	char	**values;
+	int	i;
+
+	MEM(values = talloc_zero_array(request, char *, stmt->num_params + 1));
+
+	for (i = 0; i < stmt->num_params; i++) {
+		if (xlat_aeval(values, &values[i], request, stmt->params[i], NULL, NULL) < 0) {
+			talloc_free(values);
+			return -1;
+		}
+		RDEBUG3("Parameter %i: \"%s\"", i + 1, values[i]);
+	}
+
+	*out = values;
+
+	return 0;
+}
+
+/** Call the driver's sql_stmt_query method, reconnecting if necessary.
+ *
+ * @note Caller must call ``(inst->driver->sql_finish_query)(handle, inst->config);``
+ *	or ``sql_finish_select_query`` after they're done with the result.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.  Used to expand the statement's parameters.
+ * @param handle to query the database with. *handle should not be NULL, as this indicates
+ *	  previous reconnection attempt has failed.
+ * @param stmt to execute.
+ * @param select whether we're going to fetch rows from the result.
+ * @return
+ *	- #RLM_SQL_OK on success.
+ *	- #RLM_SQL_RECONNECT if a new handle is required (also sets *handle = NULL).
+ *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
+ *	- #RLM_SQL_ALT_QUERY on constraints violation.
+ */
+sql_rcode_t rlm_sql_stmt_query(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+			       rlm_sql_stmt_t const *stmt, bool select)
+{
+	int	ret = RLM_SQL_ERROR;
+	int	i, count;
+	char	**values;
+
+	rad_assert(*handle);
+	rad_assert(inst->driver->sql_stmt_query);
+
+	if (sql_stmt_values(&values, inst, request, stmt) < 0) return RLM_SQL_ERROR;
+
+	count = fr_pool_state(inst->pool)->num;
+
+	for (i = 0; i < (count + 1); i++) {
+		RDEBUG2("Executing %sstatement: %s", select ? "select " : "", stmt->query);
+
+		ret = (inst->driver->sql_stmt_query)(*handle, inst->config, stmt, values, select);
+		switch (ret) {
+		case RLM_SQL_OK:
+			break;
+
+		case RLM_SQL_RECONNECT:
+			*handle = fr_pool_connection_reconnect(inst->pool, request, *handle);
+			if (!*handle) goto finish;
+			continue;
+
+		default:
+			if (select) {
+				rlm_sql_print_error(inst, request, *handle, false);
+				(inst->driver->sql_finish_select_query)(*handle, inst->config);
+				break;
+			}
+			ret = sql_query_error(inst, request, *handle, ret);
+			break;
+		}
+
+		goto finish;
+	}
+
+	RERROR("Hit reconnection limit");
+	ret = RLM_SQL_ERROR;
+
+finish:
+	talloc_free(values);
+
+	return ret;
+}
+
+/** Call the driver's sql_stmt_query_async method, reconnecting if necessary.
+ *
+ * Works in the same way as #rlm_sql_query_async.
+ *
+ * @param inst #rlm_sql_t instance data.
+ * @param request Current request.  Used to expand the statement's parameters.
+ * @param handle to query the database with. *handle should not be NULL, as this indicates
+ *	  previous reconnection attempt has failed.
+ * @param stmt to execute.
+ * @return
+ *	- #RLM_SQL_YIELD if the query was sent.
+ *	- #RLM_SQL_RECONNECT if a new handle is required (also sets *handle = NULL).
+ *	- #RLM_SQL_QUERY_INVALID, #RLM_SQL_ERROR on invalid query or connection error.
+ *	- #RLM_SQL_ALT_QUERY on constraints violation.
+ */
+sql_rcode_t rlm_sql_stmt_query_async(rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
+				     rlm_sql_stmt_t const *stmt)
+{
+	int	ret = RLM_SQL_ERROR;
+	int	i, count;
+	char	**values;
+
+	rad_assert(*handle);
+	rad_assert(inst->driver->sql_stmt_query_async);
+
+	if (sql_stmt_values(&values, inst, request, stmt) < 0) return RLM_SQL_ERROR;
+
+	count = fr_pool_state(inst->pool)->num;
+
+	for (i = 0; i < (count + 1); i++) {
+		RDEBUG2("Sending statement: %s", stmt->query);
+
+		ret = (inst->driver->sql_stmt_query_async)(*handle, inst->config, stmt, values);
+		switch (ret) {
+		case RLM_SQL_OK:
+			ret = RLM_SQL_YIELD;
+			break;
+
+		case RLM_SQL_RECONNECT:
+			*handle = fr_pool_connection_reconnect(inst->pool, request, *handle);
+			if (!*handle) goto finish;
+			continue;
+
+		default:
+			ret = sql_query_error(inst, request, *handle, ret);
+			break;
+		}
+
+		goto finish;
+	}
+
+	RERROR("Hit reconnection limit");
+	ret = RLM_SQL_ERROR;
+
+finish:
+	talloc_free(values);
+
+	return ret;
+}
+
+
 /*************************************************************************
  *
  *	Function: sql_getvpdata
@@ -491,7 +870,7 @@ sql_rcode_t rlm_sql_select_query(rlm_sql_t const *inst, REQUEST *request, rlm_sq
  *
  *************************************************************************/
 int sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_sql_handle_t **handle,
-		  VALUE_PAIR **pair, char const *query)
+		  VALUE_PAIR **pair, rlm_sql_stmt_t const *stmt, char const *query)
 {
 	rlm_sql_row_t	row;
 	int		rows = 0;
@@ -499,7 +878,11 @@ int sql_getvpdata(TALLOC_CTX *ctx, rlm_sql_t const *inst, REQUEST *request, rlm_
 
 	rad_assert(request);
 
-	rcode = rlm_sql_select_query(inst, request, handle, query);
+	if (stmt) {
+		rcode = rlm_sql_stmt_query(inst, request, handle, stmt, true);
+	} else {
+		rcode = rlm_sql_select_query(inst, request, handle, query);
+	}
 	if (rcode != RLM_SQL_OK) return -1; /* error handled by rlm_sql_select_query */
 
 	while (rlm_sql_fetch_row(&row, inst, request, handle) == RLM_SQL_OK) {
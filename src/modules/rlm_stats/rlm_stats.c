@@ -27,8 +27,15 @@ RCSID("$Id$")
 #include <freeradius-devel/server/modules.h>
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/server/rad_assert.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 /*
  *	@todo - also get the statistics from the network side for
  *		that, though, we need a way to find other network
@@ -42,25 +49,50 @@ RCSID("$Id$")
 #define PTHREAD_MUTEX_UNLOCK pthread_mutex_unlock
 
 #else
-#define PTHREAD_MUTEX_LOCK
-#define PTHREAD_MUTEX_UNLOCK
+#define PTHREAD_MUTEX_LOCK(_x)
+#define PTHREAD_MUTEX_UNLOCK(_x)
 #endif
 
+/*
+ *	Latency bucket "b" holds requests which took less than 2^b
+ *	microseconds, and at least half that.  The last bucket holds
+ *	everything slower.
+ */
+#define STATS_LATENCY_BUCKETS	(32)
+
+/*
+ *	How many slots we look at in the source / destination tables
+ *	before replacing the oldest one.
+ */
+#define STATS_PROBE		(8)
+
+#define STATS_MAX_ENTRIES	(1 << 20)
+
+/** Counters written only by the thread which owns them
+ *
+ * Other threads read them via the sequence counter, which is odd
+ * while the owner is in the middle of an update.
+ */
+typedef struct rlm_stats_block_t {
+	atomic_uint		seq;				//!< Incremented before and after each update.
+	uint64_t		stats[FR_MAX_PACKET_CODE];	//!< Packet counts.
+	uint64_t		latency[FR_MAX_PACKET_CODE][STATS_LATENCY_BUCKETS];	//!< Request latency histograms.
+} rlm_stats_block_t;
+
 typedef struct rlm_stats_t {
 #ifdef HAVE_PTHREAD_H
-	pthread_mutex_t		mutex;
+	pthread_mutex_t		mutex;				//!< Protects the thread list, and "retired".
 #endif
+	uint32_t		max_entries;			//!< Size of each source / destination table.
 
-	fr_dict_attr_t const	*type_da;			//!< FreeRADIUS-Stats4-Type
-	fr_dict_attr_t const	*ipv4_da;			//!< FreeRADIUS-Stats4-IPv4-Address
-	fr_dict_attr_t const	*ipv6_da;			//!< FreeRADIUS-Stats4-IPv6-Address
 	fr_dlist_head_t		list;				//!< for threads to know about each other
 
-	uint64_t		stats[FR_MAX_PACKET_CODE];
+	rlm_stats_block_t	retired;			//!< Counters from threads which have exited.
 } rlm_stats_t;
 
 typedef struct rlm_stats_data_t {
-	fr_ipaddr_t		ipaddr;				//!< IP address of this thing
+	atomic_uint		seq;				//!< Incremented before and after each update.
+	fr_ipaddr_t		ipaddr;				//!< IP address of this thing, AF_UNSPEC for an empty slot.
 	fr_time_t		created;			//!< when it was created
 	fr_time_t		last_packet;			//!< when we last saw a packet
 	uint64_t		stats[FR_MAX_PACKET_CODE];	//!< actual statistic
@@ -69,25 +101,17 @@ typedef struct rlm_stats_data_t {
 typedef struct rlm_stats_thread_t {
 	rlm_stats_t		*inst;
 
-	fr_time_t		last_global_update;
 	fr_dlist_t		entry;				//!< for threads to know about each other
 
-	fr_time_t		last_manage;			//!< when we deleted old things
-
-#ifdef HAVE_PTHREAD_H
-	pthread_mutex_t		src_mutex;
-#endif
-	rbtree_t		*src;				//!< stats by source
+	uint32_t		mask;				//!< Number of slots in src and dst - 1.
+	rlm_stats_data_t	*src;				//!< stats by source
+	rlm_stats_data_t	*dst;				//!< stats by destination
 
-#ifdef HAVE_PTHREAD_H
-	pthread_mutex_t		dst_mutex;
-#endif
-	rbtree_t		*dst;				//!< stats by destination
-
-	uint64_t		stats[FR_MAX_PACKET_CODE];
+	rlm_stats_block_t	block;				//!< global stats for this thread
 } rlm_stats_thread_t;
 
 static const CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_stats_t, max_entries), .dflt = "1024" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -111,61 +135,258 @@ fr_dict_attr_autoload_t rlm_stats_dict_attr[] = {
 	{ NULL }
 };
 
-static void coalesce(uint64_t final_stats[FR_MAX_PACKET_CODE], rlm_stats_thread_t *t,
-		     size_t mutex_offset, size_t tree_offset,
-		     rlm_stats_data_t *mydata)
+/** Start an update of counters owned by this thread
+ *
+ */
+static inline void stats_write_begin(atomic_uint *seq)
 {
-	rlm_stats_data_t *stats;
-	rlm_stats_thread_t *other;
-#ifdef HAVE_PTHREAD_H
-	pthread_mutex_t *mutex;
-#endif
-	rbtree_t **tree;
-	uint64_t local_stats[FR_MAX_PACKET_CODE];
+	atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+/** Finish an update of counters owned by this thread
+ *
+ */
+static inline void stats_write_end(atomic_uint *seq)
+{
+	atomic_store_explicit(seq, atomic_load_explicit(seq, memory_order_relaxed) + 1, memory_order_release);
+}
+
+/** Take a consistent copy of counters owned by another thread
+ *
+ *  The owner never waits for us.  Instead, we retry if it updated
+ *  the counters while we were copying them.
+ */
+static void stats_read(void *out, void const *in, size_t len, atomic_uint *seq)
+{
+	unsigned int before, after;
+
+	do {
+		while ((before = atomic_load_explicit(seq, memory_order_acquire)) & 1);
+
+		memcpy(out, in, len);
+
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(seq, memory_order_relaxed);
+	} while (before != after);
+}
+
+static uint32_t stats_ipaddr_hash(fr_ipaddr_t const *ipaddr)
+{
+	uint32_t hash;
+
+	hash = fr_hash(&ipaddr->af, sizeof(ipaddr->af));
+	if (ipaddr->af == AF_INET) return fr_hash_update(&ipaddr->addr.v4, sizeof(ipaddr->addr.v4), hash);
+
+	hash = fr_hash_update(&ipaddr->addr.v6, sizeof(ipaddr->addr.v6), hash);
+	return fr_hash_update(&ipaddr->scope_id, sizeof(ipaddr->scope_id), hash);
+}
+
+/** Count a packet against a source or destination address
+ *
+ *  Only the owning thread calls this.  The table never grows.  If the
+ *  address isn't found in the first few slots, the least recently
+ *  used of them is given to the new address.
+ */
+static void stats_data_update(rlm_stats_data_t *table, uint32_t mask, fr_ipaddr_t const *ipaddr, fr_time_t now,
+			      int src_code, int dst_code)
+{
+	uint32_t		i, slot;
+	rlm_stats_data_t	*stats, *oldest = NULL;
+
+	slot = stats_ipaddr_hash(ipaddr);
+
+	for (i = 0; i < STATS_PROBE; i++) {
+		stats = &table[(slot + i) & mask];
+
+		if (stats->ipaddr.af == AF_UNSPEC) break;
+
+		if (fr_ipaddr_cmp(&stats->ipaddr, ipaddr) == 0) goto update;
 
-	tree = (rbtree_t **) (((uint8_t *) t) + tree_offset);
+		if (!oldest || (stats->last_packet < oldest->last_packet)) oldest = stats;
+	}
+
+	if (i == STATS_PROBE) stats = oldest;
 
 	/*
-	 *	Bootstrap with my statistics, where we don't need a
-	 *	lock.
+	 *	A new entry, or one which we're replacing.
 	 */
-	stats = rbtree_finddata(*tree, mydata);
-	if (!stats) {
-		memset(final_stats, 0, sizeof(uint64_t) * FR_MAX_PACKET_CODE);
-	} else {
-		memcpy(final_stats, stats->stats, sizeof(stats->stats));
+	stats_write_begin(&stats->seq);
+	memset(stats->stats, 0, sizeof(stats->stats));
+	stats->ipaddr = *ipaddr;
+	stats->created = now;
+	stats->last_packet = now;
+	stats->stats[src_code]++;
+	stats->stats[dst_code]++;
+	stats_write_end(&stats->seq);
+	return;
+
+update:
+	stats_write_begin(&stats->seq);
+	stats->last_packet = now;
+	stats->stats[src_code]++;
+	stats->stats[dst_code]++;
+	stats_write_end(&stats->seq);
+}
+
+/** Add the counters for one address in one thread's table
+ *
+ */
+static void stats_data_read(uint64_t final_stats[FR_MAX_PACKET_CODE], rlm_stats_data_t *table, uint32_t mask,
+			    fr_ipaddr_t const *ipaddr)
+{
+	uint32_t		i, slot;
+	rlm_stats_data_t	*stats, local;
+
+	slot = stats_ipaddr_hash(ipaddr);
+
+	for (i = 0; i < STATS_PROBE; i++) {
+		int j;
+
+		stats = &table[(slot + i) & mask];
+		stats_read(&local.ipaddr, &stats->ipaddr,
+			   sizeof(*stats) - offsetof(rlm_stats_data_t, ipaddr), &stats->seq);
+
+		if (local.ipaddr.af == AF_UNSPEC) return;
+
+		if (fr_ipaddr_cmp(&local.ipaddr, ipaddr) != 0) continue;
+
+		for (j = 0; j < FR_MAX_PACKET_CODE; j++) {
+			final_stats[j] += local.stats[j];
+		}
+		return;
 	}
+}
+
+static void coalesce(uint64_t final_stats[FR_MAX_PACKET_CODE], rlm_stats_t *inst,
+		     size_t table_offset, fr_ipaddr_t const *ipaddr)
+{
+	rlm_stats_thread_t *other;
+
+	memset(final_stats, 0, sizeof(uint64_t) * FR_MAX_PACKET_CODE);
 
 	/*
-	 *	Loop over all of the other thread instances, locking
-	 *	them, and adding their statistics in.
+	 *	The mutex only stops threads from going away while
+	 *	we look at them.  It doesn't block their updates.
 	 */
-	for (other = fr_dlist_head(&t->inst->list);
+	PTHREAD_MUTEX_LOCK(&inst->mutex);
+	for (other = fr_dlist_head(&inst->list);
 	     other != NULL;
-	     other = fr_dlist_next(&t->inst->list, other)) {
-		int i;
+	     other = fr_dlist_next(&inst->list, other)) {
+		rlm_stats_data_t *table;
 
-		if (other == t) continue;
+		table = *(rlm_stats_data_t **) (((uint8_t *) other) + table_offset);
+		stats_data_read(final_stats, table, other->mask, ipaddr);
+	}
+	PTHREAD_MUTEX_UNLOCK(&inst->mutex);
+}
 
-		tree = (rbtree_t **) (((uint8_t *) other) + tree_offset);
-#ifdef HAVE_PTHREAD_H
-		mutex = (pthread_mutex_t *) (((uint8_t *) other) + mutex_offset);
-#endif
-		PTHREAD_MUTEX_LOCK(mutex);
-		stats = rbtree_finddata(*tree, mydata);
-		if (!stats) {
-			PTHREAD_MUTEX_UNLOCK(mutex);
-			continue;
-		}
-		memcpy(&local_stats, stats->stats, sizeof(stats->stats));
-		PTHREAD_MUTEX_UNLOCK(mutex);
+/** Add up the global counters and histograms of every thread
+ *
+ */
+static void coalesce_global(rlm_stats_block_t *final, rlm_stats_t *inst)
+{
+	rlm_stats_thread_t *other;
+	rlm_stats_block_t local;
+	int i, j;
+
+	PTHREAD_MUTEX_LOCK(&inst->mutex);
+	memcpy(final->stats, inst->retired.stats, sizeof(final->stats));
+	memcpy(final->latency, inst->retired.latency, sizeof(final->latency));
+
+	for (other = fr_dlist_head(&inst->list);
+	     other != NULL;
+	     other = fr_dlist_next(&inst->list, other)) {
+		stats_read(&local.stats, &other->block.stats,
+			   sizeof(local) - offsetof(rlm_stats_block_t, stats), &other->block.seq);
 
 		for (i = 0; i < FR_MAX_PACKET_CODE; i++) {
-			final_stats[i] += local_stats[i];
+			final->stats[i] += local.stats[i];
+
+			for (j = 0; j < STATS_LATENCY_BUCKETS; j++) {
+				final->latency[i][j] += local.latency[i][j];
+			}
 		}
 	}
+	PTHREAD_MUTEX_UNLOCK(&inst->mutex);
+}
+
+static int stats_latency_bucket(fr_time_t latency)
+{
+	int		b = 0;
+	uint64_t	usec = latency / 1000;
+
+	while (usec && (b < (STATS_LATENCY_BUCKETS - 1))) {
+		usec >>= 1;
+		b++;
+	}
+
+	return b;
 }
 
+/** Estimate a percentile, in microseconds, from a latency histogram
+ *
+ *  We interpolate linearly within the bucket which holds the
+ *  percentile.
+ */
+static uint64_t stats_latency_percentile(uint64_t const latency[STATS_LATENCY_BUCKETS], unsigned int percent)
+{
+	int		b;
+	uint64_t	total = 0, target, seen = 0;
+	uint64_t	low, high;
+
+	for (b = 0; b < STATS_LATENCY_BUCKETS; b++) total += latency[b];
+	if (!total) return 0;
+
+	target = ((total * percent) + 99) / 100;
+	if (!target) target = 1;
+
+	for (b = 0; b < STATS_LATENCY_BUCKETS; b++) {
+		if ((seen + latency[b]) >= target) break;
+		seen += latency[b];
+	}
+
+	low = b ? ((uint64_t) 1 << (b - 1)) : 0;
+	if (b == (STATS_LATENCY_BUCKETS - 1)) return low;
+
+	high = (uint64_t) 1 << b;
+
+	return low + (((high - low) * (target - seen)) / latency[b]);
+}
+
+/** Add one attribute for each non-zero counter
+ *
+ *  The attribute name is "FreeRADIUS-Stats4-<packet code><suffix>"
+ */
+static int stats_add_pairs(REQUEST *request, fr_cursor_t *cursor, uint64_t const counters[FR_MAX_PACKET_CODE],
+			   char const *suffix)
+{
+	int i;
+	char buffer[64];
+
+	strcpy(buffer, "FreeRADIUS-Stats4-");
+
+	for (i = 0; i < FR_MAX_PACKET_CODE; i++) {
+		fr_dict_attr_t const *da;
+		VALUE_PAIR *vp;
+
+		if (!counters[i] || !fr_packet_codes[i]) continue;
+
+		snprintf(buffer + 18, sizeof(buffer) - 18, "%s%s", fr_packet_codes[i], suffix);
+		da = fr_dict_attr_by_name(dict_radius, buffer);
+		if (!da) continue;
+
+		vp = fr_pair_afrom_da(request->reply, da);
+		if (!vp) return -1;
+
+		vp->vp_uint64 = counters[i];
+
+		fr_cursor_append(cursor, vp);
+		(void) fr_cursor_tail(cursor);
+	}
+
+	return 0;
+}
 
 /*
  *	Do the statistics
@@ -177,18 +398,21 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 	rlm_stats_thread_t *t = thread;
 	rlm_stats_t *inst = instance;
 	VALUE_PAIR *vp;
-	rlm_stats_data_t mydata, *stats;
 	fr_cursor_t cursor;
-	char buffer[64];
-	uint64_t local_stats[sizeof(inst->stats) / sizeof(inst->stats[0])];
+	uint64_t local_stats[FR_MAX_PACKET_CODE];
+	rlm_stats_block_t *global = NULL;
 
 	/*
 	 *	Increment counters only in "send foo" sections.
 	 *
 	 *	i.e. only when we have a reply to send.
+	 *
+	 *	Everything here is written only by this thread, so
+	 *	there are no locks.
 	 */
 	if (request->request_state == REQUEST_SEND) {
 		int src_code, dst_code;
+		fr_time_t now = fr_time();
 
 		src_code = request->packet->code;
 		if (src_code >= FR_MAX_PACKET_CODE) src_code = 0;
@@ -196,65 +420,18 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 		dst_code = request->reply->code;
 		if (dst_code >= FR_MAX_PACKET_CODE) dst_code = 0;
 
-		t->stats[src_code]++;
-		t->stats[dst_code]++;
-
-		/*
-		 *	Update source statistics
-		 */
-		mydata.ipaddr = request->packet->src_ipaddr;
-		stats = rbtree_finddata(t->src, &mydata);
-		if (!stats) {
-			MEM(stats = talloc_zero(t, rlm_stats_data_t));
-
-			stats->ipaddr = request->packet->src_ipaddr;
-			stats->created = request->async->recv_time;
-
-			PTHREAD_MUTEX_LOCK(&t->src_mutex);
-			(void) rbtree_insert(t->src, stats);
-			PTHREAD_MUTEX_UNLOCK(&t->src_mutex);
-		}
-
-		stats->last_packet = request->async->recv_time;
-		stats->stats[src_code]++;
-		stats->stats[dst_code]++;
-
-		/*
-		 *	Update destination statistics
-		 */
-		mydata.ipaddr = request->packet->dst_ipaddr;
-		stats = rbtree_finddata(t->dst, &mydata);
-		if (!stats) {
-			MEM(stats = talloc_zero(t, rlm_stats_data_t));
-
-			stats->ipaddr = request->packet->dst_ipaddr;
-			stats->created = request->async->recv_time;
-
-			PTHREAD_MUTEX_LOCK(&t->dst_mutex);
-			(void) rbtree_insert(t->dst, stats);
-			PTHREAD_MUTEX_UNLOCK(&t->dst_mutex);
-		}
-
-		stats->last_packet = request->async->recv_time;
-		stats->stats[src_code]++;
-		stats->stats[dst_code]++;
-
-		/*
-		 *	@todo - periodically clean up old entries.
-		 */
-
-		if ((t->last_global_update + NANOSEC) > request->async->recv_time) {
-			return RLM_MODULE_UPDATED;
+		stats_write_begin(&t->block.seq);
+		t->block.stats[src_code]++;
+		t->block.stats[dst_code]++;
+		if (now > request->async->recv_time) {
+			t->block.latency[src_code][stats_latency_bucket(now - request->async->recv_time)]++;
 		}
+		stats_write_end(&t->block.seq);
 
-		t->last_global_update = request->async->recv_time;
-
-		PTHREAD_MUTEX_LOCK(&inst->mutex);
-		for (i = 0; i < FR_MAX_PACKET_CODE; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		PTHREAD_MUTEX_UNLOCK(&inst->mutex);
+		stats_data_update(t->src, t->mask, &request->packet->src_ipaddr, request->async->recv_time,
+				  src_code, dst_code);
+		stats_data_update(t->dst, t->mask, &request->packet->dst_ipaddr, request->async->recv_time,
+				  src_code, dst_code);
 
 		return RLM_MODULE_UPDATED;
 	}
@@ -285,18 +462,11 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 	switch (stats_type) {
 	case FR_FREERADIUS_STATS4_TYPE_VALUE_GLOBAL:			/* global */
 		/*
-		 *	Merge our stats with the global stats, and then copy
-		 *	the global stats to a thread-local variable.
-		 *
-		 *	The copy helps minimize mutex contention.
+		 *	Too large for the stack.
 		 */
-		PTHREAD_MUTEX_LOCK(&inst->mutex);
-		for (i = 0; i < FR_MAX_PACKET_CODE; i++) {
-			inst->stats[i] += t->stats[i];
-			t->stats[i] = 0;
-		}
-		memcpy(&local_stats, inst->stats, sizeof(inst->stats));
-		PTHREAD_MUTEX_UNLOCK(&inst->mutex);
+		MEM(global = talloc(request, rlm_stats_block_t));
+		coalesce_global(global, inst);
+		memcpy(local_stats, global->stats, sizeof(local_stats));
 		vp = NULL;
 		break;
 
@@ -305,10 +475,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 		if (!vp) vp = fr_pair_find_by_da(request->packet->vps, attr_freeradius_stats4_ipv6_address, TAG_ANY);
 		if (!vp) return RLM_MODULE_NOOP;
 
-		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t,
-			 offsetof(rlm_stats_thread_t, src_mutex), offsetof(rlm_stats_thread_t, src),
-			 &mydata);
+		coalesce(local_stats, inst, offsetof(rlm_stats_thread_t, src), &vp->vp_ip);
 		break;
 
 	case FR_FREERADIUS_STATS4_TYPE_VALUE_LISTENER:			/* dst */
@@ -316,10 +483,7 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 		if (!vp) vp = fr_pair_find_by_da(request->packet->vps, attr_freeradius_stats4_ipv6_address, TAG_ANY);
 		if (!vp) return RLM_MODULE_NOOP;
 
-		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t,
-			 offsetof(rlm_stats_thread_t, dst_mutex), offsetof(rlm_stats_thread_t, dst),
-			 &mydata);
+		coalesce(local_stats, inst, offsetof(rlm_stats_thread_t, dst), &vp->vp_ip);
 		break;
 
 	default:
@@ -335,38 +499,32 @@ static rlm_rcode_t CC_HINT(nonnull) mod_stats(void *instance, void *thread, REQU
 		}
 	}
 
-	strcpy(buffer, "FreeRADIUS-Stats4-");
-
-	for (i = 0; i < FR_MAX_PACKET_CODE; i++) {
-		fr_dict_attr_t const *da;
-
-		if (!local_stats[i]) continue;
+	if (stats_add_pairs(request, &cursor, local_stats, "") < 0) {
+	fail:
+		talloc_free(global);
+		return RLM_MODULE_FAIL;
+	}
 
-		strlcpy(buffer + 18, fr_packet_codes[i], sizeof(buffer) - 18);
-		da = fr_dict_attr_by_name(dict_radius, buffer);
-		if (!da) continue;
+	/*
+	 *	Latency percentiles are only kept globally.
+	 */
+	if (global) {
+		uint64_t p50[FR_MAX_PACKET_CODE], p99[FR_MAX_PACKET_CODE];
 
-		vp = fr_pair_afrom_da(request->reply, da);
-		if (!vp) return RLM_MODULE_FAIL;
+		for (i = 0; i < FR_MAX_PACKET_CODE; i++) {
+			p50[i] = stats_latency_percentile(global->latency[i], 50);
+			p99[i] = stats_latency_percentile(global->latency[i], 99);
+		}
 
-		vp->vp_uint64 = local_stats[i];
+		if ((stats_add_pairs(request, &cursor, p50, "-P50") < 0) ||
+		    (stats_add_pairs(request, &cursor, p99, "-P99") < 0)) goto fail;
 
-		fr_cursor_append(&cursor, vp);
-		(void) fr_cursor_tail(&cursor);
+		talloc_free(global);
 	}
 
 	return RLM_MODULE_OK;
 }
 
-
-static int data_cmp(const void *one, const void *two)
-{
-	rlm_stats_data_t const *a = one;
-	rlm_stats_data_t const *b = two;
-
-	return fr_ipaddr_cmp(&a->ipaddr, &b->ipaddr);
-}
-
 /** Instantiate thread data for the submodule.
  *
  */
@@ -379,12 +537,14 @@ static int mod_thread_instantiate(UNUSED CONF_SECTION const *cs, void *instance,
 
 	t->inst = inst;
 
-#ifdef HAVE_PTHREAD_H
-	pthread_mutex_init(&t->src_mutex, NULL);
-	pthread_mutex_init(&t->dst_mutex, NULL);
-#endif
-	t->src = rbtree_talloc_create(t, data_cmp, rlm_stats_data_t, NULL, RBTREE_FLAG_NONE);
-	t->dst = rbtree_talloc_create(t, data_cmp, rlm_stats_data_t, NULL, RBTREE_FLAG_NONE);
+	/*
+	 *	The tables never grow, so other threads can read them
+	 *	without locks.
+	 */
+	t->mask = inst->max_entries - 1;
+	t->src = talloc_zero_array(t, rlm_stats_data_t, inst->max_entries);
+	t->dst = talloc_zero_array(t, rlm_stats_data_t, inst->max_entries);
+	if (!t->src || !t->dst) return -1;
 
 	PTHREAD_MUTEX_LOCK(&inst->mutex);
 	fr_dlist_insert_head(&inst->list, t);
@@ -401,11 +561,15 @@ static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
 {
 	rlm_stats_thread_t *t = talloc_get_type_abort(thread, rlm_stats_thread_t);
 	rlm_stats_t *inst = t->inst;
-	int i;
+	int i, j;
 
 	PTHREAD_MUTEX_LOCK(&inst->mutex);
 	for (i = 0; i < FR_MAX_PACKET_CODE; i++) {
-		inst->stats[i] += t->stats[i];
+		inst->retired.stats[i] += t->block.stats[i];
+
+		for (j = 0; j < STATS_LATENCY_BUCKETS; j++) {
+			inst->retired.latency[i][j] += t->block.latency[i][j];
+		}
 	}
 	fr_dlist_remove(&inst->list, t);
 	PTHREAD_MUTEX_UNLOCK(&inst->mutex);
@@ -421,6 +585,19 @@ static int mod_instantiate(void *instance, UNUSED CONF_SECTION *conf)
 	pthread_mutex_init(&inst->mutex, NULL);
 #endif
 
+	/*
+	 *	Round the table size up to a power of 2.
+	 */
+	if (inst->max_entries < STATS_PROBE) inst->max_entries = STATS_PROBE;
+	if (inst->max_entries > STATS_MAX_ENTRIES) inst->max_entries = STATS_MAX_ENTRIES;
+	inst->max_entries--;
+	inst->max_entries |= inst->max_entries >> 1;
+	inst->max_entries |= inst->max_entries >> 2;
+	inst->max_entries |= inst->max_entries >> 4;
+	inst->max_entries |= inst->max_entries >> 8;
+	inst->max_entries |= inst->max_entries >> 16;
+	inst->max_entries++;
+
 	fr_dlist_init(&inst->list, rlm_stats_thread_t, entry);
 
 	return 0;
@@ -197,6 +197,13 @@ bool const fr_request_packets[FR_CODE_MAX + 1] = {
 	[FR_CODE_DISCONNECT_REQUEST] = true,
 };
 
+/** Whether anything may proxy the packets we received, instead of encoding new ones
+ *
+ * Set when an rlm_radius instance has "pass_through" enabled.  Decoders only
+ * fingerprint the decoded attributes if it's true.
+ */
+bool fr_radius_pass_through = false;
+
 /*
  *	For request packets which have the Request Authenticator being
  *	all zeros.  We need to decode attributes using a Request
@@ -55,6 +55,7 @@ extern char const *fr_packet_codes[FR_MAX_PACKET_CODE];
 extern size_t const fr_radius_attr_sizes[FR_TYPE_MAX + 1][2];
 extern FR_NAME_NUMBER const fr_request_types[];
 extern bool const fr_request_packets[FR_CODE_MAX + 1];
+extern bool fr_radius_pass_through;
 
 typedef enum {
 	DECODE_FAIL_NONE = 0,
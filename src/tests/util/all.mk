@@ -1,8 +1,8 @@
-SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk 
+SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk ohash_bench.mk event_test.mk event_bench.mk twheel_bench.mk pair_list_bench.mk
 
 #
 #  These require pthread.
 #
 ifneq "$(findstring thread,${CFLAGS})" ""
-SUBMAKEFILES += channel_test.mk worker_test.mk radius1_test.mk schedule_test.mk radius_schedule_test.mk
+SUBMAKEFILES += channel_test.mk channel_bench.mk worker_test.mk radius1_test.mk schedule_test.mk radius_schedule_test.mk
 endif
@@ -0,0 +1,520 @@
+/*
+ * channel_bench.c	Benchmark channel signalling
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/channel.h>
+#include <freeradius-devel/io/control.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/syserror.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
+
+#include <sys/event.h>
+
+#define MAX_MESSAGES		(2048)
+#define MAX_CONTROL_PLANE	(1024)
+#define MAX_KEVENTS		(10)
+
+#define MPRINT1 if (debug_lvl) printf
+
+static int			debug_lvl = 0;
+static int			kq_master, kq_worker;
+static fr_atomic_queue_t	*aq_master, *aq_worker;
+static fr_control_t		*control_master, *control_worker;
+static int			max_messages = 100000;
+static int			max_outstanding = 1;
+static int			delay = 0;		//!< usec between requests sent by the master.
+static int			work = 0;		//!< usec of work done by the worker for each request.
+
+static uint64_t			num_replies;
+static fr_time_t		latency_total;
+static fr_time_t		latency_max;
+static fr_time_elapsed_t	latency;
+
+/*
+ *	Loads used by the sweep.
+ */
+static struct {
+	int	outstanding;
+	int	delay;
+	int	work;
+} loads[] = {
+	{ 1,	100,	0 },
+	{ 1,	10,	0 },
+	{ 1,	0,	0 },
+	{ 16,	0,	0 },
+	{ 64,	0,	0 },
+	{ 256,	0,	0 },
+	{ 64,	0,	1 },
+	{ 256,	0,	1 },
+};
+
+/**********************************************************************/
+typedef struct rad_request REQUEST;
+
+REQUEST *request_alloc(UNUSED TALLOC_CTX *ctx)
+{
+	return NULL;
+}
+
+void request_verify(UNUSED char const *file, UNUSED int line, UNUSED REQUEST const *request)
+{
+}
+
+void talloc_const_free(void const *ptr)
+{
+	void *tmp;
+	if (!ptr) return;
+
+	memcpy(&tmp, &ptr, sizeof(tmp));
+	talloc_free(tmp);
+}
+/**********************************************************************/
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: channel_bench [OPTS]\n");
+	fprintf(stderr, "  -d <usec>              Delay between requests sent by the master.\n");
+	fprintf(stderr, "  -m <messages>          Send number of messages.\n");
+	fprintf(stderr, "  -o <outstanding>       Keep number of messages outstanding.\n");
+	fprintf(stderr, "  -s                     Run over a range of loads.\n");
+	fprintf(stderr, "  -w <usec>              Time the worker spends on each request.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void spin(fr_time_t usec)
+{
+	fr_time_t end;
+
+	if (!usec) return;
+
+	end = fr_time() + (usec * 1000);
+	while (fr_time() < end);
+}
+
+/** Read all of the replies from the worker, and track their latency
+ *
+ */
+static int drain_replies(fr_channel_t *channel)
+{
+	int		num = 0;
+	fr_time_t	now, rtt;
+	fr_channel_data_t *reply;
+
+	while ((reply = fr_channel_recv_reply(channel)) != NULL) {
+		now = fr_time();
+		rtt = now - reply->reply.request_time;
+
+		fr_time_elapsed_update(&latency, reply->reply.request_time, now);
+		latency_total += rtt;
+		if (rtt > latency_max) latency_max = rtt;
+
+		num_replies++;
+		num++;
+		fr_message_done(&reply->m);
+	}
+
+	return num;
+}
+
+static void *channel_master(void *arg)
+{
+	bool			running, signaled_close;
+	int			rcode, i, num_events;
+	int			num_outstanding, num_messages;
+	fr_message_set_t	*ms;
+	TALLOC_CTX		*ctx;
+	fr_channel_t		*channel = arg;
+	fr_channel_t		*new_channel;
+	fr_channel_event_t	ce;
+	struct kevent		events[MAX_KEVENTS];
+
+	MEM(ctx = talloc_init("channel_master"));
+
+	ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
+	if (!ms) {
+		fprintf(stderr, "Failed creating message set\n");
+		exit(EXIT_FAILURE);
+	}
+
+	rcode = fr_channel_signal_open(channel);
+	if (rcode < 0) {
+		fprintf(stderr, "Failed signaling open: %s\n", fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	num_outstanding = num_messages = 0;
+
+	running = true;
+	signaled_close = false;
+
+	while (running) {
+		int num_to_send;
+		struct timespec ts, *tsp;
+		fr_channel_data_t *cd, *reply;
+
+		num_outstanding -= drain_replies(channel);
+
+		/*
+		 *	With a delay, we send one message at a time.
+		 *	Otherwise, we fill up the channel.
+		 */
+		num_to_send = max_outstanding - num_outstanding;
+		if ((num_messages + num_to_send) > max_messages) num_to_send = max_messages - num_messages;
+		if (delay && (num_to_send > 1)) num_to_send = 1;
+
+		for (i = 0; i < num_to_send; i++) {
+			cd = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
+			rad_assert(cd != NULL);
+
+			num_outstanding++;
+			num_messages++;
+
+			cd->m.when = fr_time();
+
+			rcode = fr_channel_send_request(channel, cd, &reply);
+			if (rcode < 0) {
+				fprintf(stderr, "Failed sending request: %s\n", fr_strerror());
+				exit(EXIT_FAILURE);
+			}
+
+			rad_assert(reply == NULL);
+		}
+
+		if (!signaled_close && (num_messages >= max_messages) && (num_outstanding == 0)) {
+			MPRINT1("Master signaling worker to exit.\n");
+			rcode = fr_channel_signal_worker_close(channel);
+			if (rcode < 0) {
+				fprintf(stderr, "Failed signaling close: %s\n", fr_syserror(errno));
+				exit(EXIT_FAILURE);
+			}
+
+			signaled_close = true;
+		}
+
+		/*
+		 *	Sleep until the next packet is due, or until
+		 *	the worker sends us a reply.
+		 */
+		tsp = NULL;
+		if ((num_messages < max_messages) && (num_outstanding < max_outstanding)) {
+			ts.tv_sec = 0;
+			ts.tv_nsec = delay * 1000;
+			tsp = &ts;
+		}
+
+		num_events = kevent(kq_master, NULL, 0, events, MAX_KEVENTS, tsp);
+		if (num_events < 0) {
+			if (errno == EINTR) continue;
+
+			fprintf(stderr, "Failed waiting for kevent: %s\n", fr_syserror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		if (num_events == 0) continue;
+
+		for (i = 0; i < num_events; i++) {
+			(void) fr_channel_service_kevent(channel, control_master, &events[i]);
+		}
+
+		while (true) {
+			uint32_t id;
+			size_t data_size;
+			char data[256];
+
+			data_size = fr_control_message_pop(aq_master, &id, data, sizeof(data));
+			if (!data_size) break;
+
+			rad_assert(id == FR_CONTROL_ID_CHANNEL);
+
+			ce = fr_channel_service_message(fr_time(), &new_channel, data, data_size);
+			switch (ce) {
+			case FR_CHANNEL_DATA_READY_NETWORK:
+				num_outstanding -= drain_replies(channel);
+				break;
+
+			case FR_CHANNEL_CLOSE:
+				rad_assert(signaled_close == true);
+				running = false;
+				break;
+
+			case FR_CHANNEL_NOOP:
+				break;
+
+			default:
+				fprintf(stderr, "Master got unexpected CE %d\n", ce);
+				rad_assert(0 == 1);
+				break;
+			}
+		}
+	}
+
+	fr_message_set_gc(ms);
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+static void *channel_worker(void *arg)
+{
+	bool running = true;
+	int rcode, num_events;
+	fr_message_set_t *ms;
+	TALLOC_CTX *ctx;
+	fr_channel_t *channel = arg;
+	fr_channel_event_t ce;
+	struct kevent events[MAX_KEVENTS];
+
+	MEM(ctx = talloc_init("channel_worker"));
+
+	ms = fr_message_set_create(ctx, MAX_MESSAGES, sizeof(fr_channel_data_t), MAX_MESSAGES * 1024);
+	if (!ms) {
+		fprintf(stderr, "Failed creating message set\n");
+		exit(EXIT_FAILURE);
+	}
+
+	while (running) {
+		int i;
+		fr_channel_t *new_channel;
+
+		num_events = kevent(kq_worker, NULL, 0, events, MAX_KEVENTS, NULL);
+		if (num_events < 0) {
+			if (errno == EINTR) continue;
+
+			fprintf(stderr, "Failed waiting for kevent: %s\n", fr_syserror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		for (i = 0; i < num_events; i++) {
+			(void) fr_channel_service_kevent(channel, control_worker, &events[i]);
+		}
+
+		while (true) {
+			uint32_t id;
+			size_t data_size;
+			char data[256];
+			fr_channel_data_t *cd, *reply;
+
+			data_size = fr_control_message_pop(aq_worker, &id, data, sizeof(data));
+			if (!data_size) break;
+
+			rad_assert(id == FR_CONTROL_ID_CHANNEL);
+
+			ce = fr_channel_service_message(fr_time(), &new_channel, data, data_size);
+			switch (ce) {
+			case FR_CHANNEL_OPEN:
+			case FR_CHANNEL_NOOP:
+				break;
+
+			case FR_CHANNEL_CLOSE:
+				running = false;
+				(void) fr_channel_worker_ack_close(channel);
+				break;
+
+			case FR_CHANNEL_DATA_READY_WORKER:
+				cd = fr_channel_recv_request(channel);
+				while (cd) {
+					spin(work);
+
+					reply = (fr_channel_data_t *) fr_message_alloc(ms, NULL, 100);
+					rad_assert(reply != NULL);
+
+					reply->m.when = fr_time();
+					reply->reply.request_time = cd->m.when;
+					reply->reply.processing_time = reply->m.when - cd->m.when;
+					reply->reply.cpu_time = reply->reply.processing_time;
+					fr_message_done(&cd->m);
+
+					rcode = fr_channel_send_reply(channel, reply, &cd);
+					if (rcode < 0) {
+						fprintf(stderr, "Failed sending reply: %s\n", fr_strerror());
+						exit(EXIT_FAILURE);
+					}
+				}
+				break;
+
+			default:
+				fprintf(stderr, "\tWorker got unexpected CE %d\n", ce);
+				rad_assert(0 == 1);
+				break;
+			}
+		}
+	}
+
+	fr_message_set_gc(ms);
+	talloc_free(ctx);
+
+	return NULL;
+}
+
+/** Run one benchmark, and print the results
+ *
+ */
+static void bench_run(void)
+{
+	TALLOC_CTX		*ctx;
+	fr_channel_t		*channel;
+	pthread_attr_t		attr;
+	pthread_t		master_id, worker_id;
+	fr_time_t		start, end;
+	fr_channel_stats_t	to_worker, from_worker;
+	double			seconds;
+
+	MEM(ctx = talloc_init("channel_bench"));
+
+	num_replies = 0;
+	latency_total = latency_max = 0;
+	memset(&latency, 0, sizeof(latency));
+
+	kq_master = kqueue();
+	rad_assert(kq_master >= 0);
+
+	kq_worker = kqueue();
+	rad_assert(kq_worker >= 0);
+
+	aq_master = fr_atomic_queue_create(ctx, MAX_CONTROL_PLANE);
+	rad_assert(aq_master != NULL);
+
+	aq_worker = fr_atomic_queue_create(ctx, MAX_CONTROL_PLANE);
+	rad_assert(aq_worker != NULL);
+
+	control_master = fr_control_create(ctx, kq_master, aq_master, 1024);
+	rad_assert(control_master != NULL);
+
+	control_worker = fr_control_create(ctx, kq_worker, aq_worker, 1025);
+	rad_assert(control_worker != NULL);
+
+	channel = fr_channel_create(ctx, control_master, control_worker);
+	if (!channel) {
+		fprintf(stderr, "channel_bench: Failed to create channel\n");
+		exit(EXIT_FAILURE);
+	}
+
+	(void) pthread_attr_init(&attr);
+	(void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+
+	start = fr_time();
+
+	(void) pthread_create(&master_id, &attr, channel_master, channel);
+	(void) pthread_create(&worker_id, &attr, channel_worker, channel);
+
+	(void) pthread_join(master_id, NULL);
+	(void) pthread_join(worker_id, NULL);
+
+	end = fr_time();
+
+	close(kq_master);
+	close(kq_worker);
+
+	fr_channel_stats(channel, &to_worker, &from_worker);
+	rad_assert(num_replies == to_worker.packets);
+
+	seconds = ((double) (end - start)) / NANOSEC;
+
+	printf("%11d %5d %4d %10.0f %9.3f %9.3f %9.3f %10.2f %10.2f\n",
+	       max_outstanding, delay, work,
+	       num_replies / seconds,
+	       (double) to_worker.signals / to_worker.packets,
+	       (double) from_worker.signals / from_worker.packets,
+	       (double) (to_worker.signals + from_worker.signals) / to_worker.packets,
+	       ((double) latency_total / num_replies) / 1000,
+	       (double) latency_max / 1000);
+
+	if (debug_lvl) {
+		fr_channel_debug(channel, stdout);
+		fr_time_elapsed_fprint(stdout, &latency, "latency", 1);
+	}
+
+	talloc_free(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	size_t			i;
+	bool			sweep = false;
+
+	fr_time_start();
+
+	while ((c = getopt(argc, argv, "d:hm:o:sw:x")) != EOF) switch (c) {
+		case 'd':
+			delay = atoi(optarg);
+			break;
+
+		case 'm':
+			max_messages = atoi(optarg);
+			break;
+
+		case 'o':
+			max_outstanding = atoi(optarg);
+			break;
+
+		case 's':
+			sweep = true;
+			break;
+
+		case 'w':
+			work = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (max_outstanding < 1) max_outstanding = 1;
+	if (max_outstanding > (MAX_MESSAGES / 2)) max_outstanding = MAX_MESSAGES / 2;
+	if (max_outstanding > max_messages) max_outstanding = max_messages;
+
+	printf("outstanding delay work        pps  sig/req  sig/rep  wake/pkt  lat(usec)   max(usec)\n");
+
+	if (!sweep) {
+		bench_run();
+		exit(EXIT_SUCCESS);
+	}
+
+	for (i = 0; i < (sizeof(loads) / sizeof(loads[0])); i++) {
+		max_outstanding = loads[i].outstanding;
+		delay = loads[i].delay;
+		work = loads[i].work;
+
+		if (max_outstanding > max_messages) max_outstanding = max_messages;
+
+		bench_run();
+	}
+
+	exit(EXIT_SUCCESS);
+}
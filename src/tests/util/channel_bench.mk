@@ -0,0 +1,6 @@
+TARGET := channel_bench
+
+SOURCES		:= channel_bench.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
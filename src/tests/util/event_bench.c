@@ -0,0 +1,253 @@
+/*
+ * event_bench.c	Compare fd dispatch cost of the event list backends
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+/*
+ *	Dispatch at least this many events for each size.
+ */
+#define MIN_EVENTS		(1000000)
+
+static int			debug_lvl = 0;
+
+/*
+ *	Number of registered fds used when no size is given.
+ */
+static uint32_t sizes[] = {
+	10,
+	1000,
+	10000,
+};
+
+static struct {
+	fr_event_backend_t	backend;
+	char const		*name;
+} backends[] = {
+	{ FR_EVENT_BACKEND_KQUEUE,	"kqueue" },
+	{ FR_EVENT_BACKEND_EPOLL,	"epoll" },
+};
+
+typedef struct {
+	int		fd[2];			//!< fd[0] is in the event list, fd[1] is written to.
+	uint64_t	*dispatched;		//!< Incremented by the read callback.
+} bench_pair_t;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: event_bench [OPTS]\n");
+	fprintf(stderr, "  -a <active>            Make this many fds readable on each loop iteration.\n");
+	fprintf(stderr, "  -n <fds>               Run with one number of fds, instead of the default range.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS bench_fail(char const *what)
+{
+	fprintf(stderr, "event_bench: %s: %s\n", what, fr_strerror());
+	exit(EXIT_FAILURE);
+}
+
+static void bench_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	bench_pair_t	*pair = uctx;
+	uint8_t		buffer[64];
+
+	if (read(fd, buffer, sizeof(buffer)) <= 0) {
+		fprintf(stderr, "event_bench: Failed reading from fd %i: %s\n", fd, fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	(*pair->dispatched)++;
+}
+
+/** Allow enough fds for the largest run
+ *
+ */
+static void bench_fd_limit(uint32_t num)
+{
+	struct rlimit	limit;
+	rlim_t		want = ((rlim_t) num * 2) + 64;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) < 0) return;
+	if (limit.rlim_cur >= want) return;
+
+	limit.rlim_cur = (limit.rlim_max < want) ? limit.rlim_max : want;
+	(void) setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+static void bench_run(uint32_t num, uint32_t active)
+{
+	size_t		b;
+	uint32_t	i, r, rounds;
+	bench_pair_t	*pairs;
+	uint32_t	*order;
+	uint64_t	dispatched;
+	uint8_t		byte = 0;
+
+	if (active > num) active = num;
+
+	pairs = talloc_zero_array(NULL, bench_pair_t, num);
+	order = talloc_array(NULL, uint32_t, num);
+	rad_assert(pairs && order);
+
+	for (i = 0; i < num; i++) {
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, pairs[i].fd) < 0) {
+			fprintf(stderr, "event_bench: Failed creating socket pair %u of %u: %s\n",
+				i, num, fr_syserror(errno));
+			exit(EXIT_FAILURE);
+		}
+		pairs[i].dispatched = &dispatched;
+		order[i] = i;
+	}
+
+	/*
+	 *	Make a different set of fds readable each time round,
+	 *	so that the kernel can't keep the same ones hot.
+	 */
+	for (i = num - 1; i > 0; i--) {
+		uint32_t	tmp, j = fr_rand() % (i + 1);
+
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	rounds = MIN_EVENTS / active;
+	if (!rounds) rounds = 1;
+
+	if (debug_lvl) printf("%u fds, %u active, %u rounds\n", num, active, rounds);
+
+	for (b = 0; b < (sizeof(backends) / sizeof(backends[0])); b++) {
+		fr_event_list_t	*el;
+		fr_time_t	start, elapsed;
+		uint32_t	next = 0;
+
+		if (fr_event_list_backend_set(backends[b].backend) < 0) {
+			if (debug_lvl) printf("%-8s not available\n", backends[b].name);
+			continue;
+		}
+
+		el = fr_event_list_alloc(NULL, NULL, NULL);
+		if (!el) bench_fail("Failed allocating event list");
+
+		for (i = 0; i < num; i++) {
+			if (fr_event_fd_insert(el, el, pairs[i].fd[0], bench_read, NULL, NULL, &pairs[i]) < 0) {
+				bench_fail("Failed inserting fd");
+			}
+		}
+
+		dispatched = 0;
+		start = fr_time();
+		for (r = 0; r < rounds; r++) {
+			for (i = 0; i < active; i++) {
+				if (write(pairs[order[next]].fd[1], &byte, sizeof(byte)) < 0) {
+					fprintf(stderr, "event_bench: Failed writing: %s\n", fr_syserror(errno));
+					exit(EXIT_FAILURE);
+				}
+				next = (next + 1) % num;
+			}
+
+			/*
+			 *	The writes are all done, so everything
+			 *	is ready before we look.
+			 */
+			while (dispatched < ((uint64_t) (r + 1) * active)) {
+				if (fr_event_corral(el, false) < 0) bench_fail("Failed corralling events");
+				fr_event_service(el);
+			}
+		}
+		elapsed = fr_time() - start;
+
+		printf("%-8s %9u %9u %13.1f %13.1f\n", backends[b].name, num, active,
+		       (double) elapsed / dispatched, (double) elapsed / rounds);
+
+		talloc_free(el);
+	}
+
+	for (i = 0; i < num; i++) {
+		close(pairs[i].fd[0]);
+		close(pairs[i].fd[1]);
+	}
+
+	talloc_free(pairs);
+	talloc_free(order);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	size_t		i;
+	uint32_t	num = 0;
+	uint32_t	active = 8;
+
+	fr_time_start();
+
+	while ((c = getopt(argc, argv, "a:hn:x")) != EOF) switch (c) {
+		case 'a':
+			active = atoi(optarg);
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (active < 1) active = 1;
+
+	bench_fd_limit(num ? num : sizes[(sizeof(sizes) / sizeof(sizes[0])) - 1]);
+
+	printf("backend        fds    active     event(ns)     round(ns)\n");
+
+	if (num) {
+		bench_run(num, active);
+		exit(EXIT_SUCCESS);
+	}
+
+	for (i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); i++) {
+		bench_run(sizes[i], active);
+	}
+
+	exit(EXIT_SUCCESS);
+}
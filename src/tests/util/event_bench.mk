@@ -0,0 +1,6 @@
+TARGET := event_bench
+
+SOURCES		:= event_bench.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,211 @@
+/*
+ * event_test.c	Tests for event list fd error handling
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+/*
+ *	How many times we look for events before giving up.
+ */
+#define MAX_LOOPS		(1000)
+
+static int			debug_lvl = 0;
+
+static struct {
+	fr_event_backend_t	backend;
+	char const		*name;
+} backends[] = {
+	{ FR_EVENT_BACKEND_KQUEUE,	"kqueue" },
+	{ FR_EVENT_BACKEND_EPOLL,	"epoll" },
+};
+
+typedef struct {
+	int		reads;			//!< Number of times the read callback was run.
+	int		refused;		//!< Number of reads which returned ECONNREFUSED.
+	int		errors;			//!< Number of times the error callback was run.
+} test_ctx_t;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: event_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS test_fail(char const *backend, char const *what)
+{
+	fprintf(stderr, "event_test: %s: %s\n", backend, what);
+	exit(EXIT_FAILURE);
+}
+
+static void test_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	test_ctx_t	*ctx = uctx;
+	uint8_t		buffer[64];
+
+	ctx->reads++;
+
+	if ((recv(fd, buffer, sizeof(buffer), 0) < 0) && (errno == ECONNREFUSED)) ctx->refused++;
+}
+
+static void test_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, UNUSED int fd_errno, void *uctx)
+{
+	test_ctx_t	*ctx = uctx;
+
+	ctx->errors++;
+}
+
+/** Create a UDP socket connected to a port which nothing is listening on
+ *
+ */
+static int test_socket(void)
+{
+	struct sockaddr_in	addr;
+	socklen_t		len = sizeof(addr);
+	int			closed, fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	/*
+	 *	Get a free port from the kernel, then close the
+	 *	socket so that nothing is listening on it.
+	 */
+	closed = socket(AF_INET, SOCK_DGRAM, 0);
+	if (closed < 0) return -1;
+
+	if ((bind(closed, (struct sockaddr *) &addr, len) < 0) ||
+	    (getsockname(closed, (struct sockaddr *) &addr, &len) < 0)) {
+		close(closed);
+		return -1;
+	}
+	close(closed);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) return -1;
+
+	if (connect(fd, (struct sockaddr *) &addr, len) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/** Send to the closed port, and wait for the read callback to see the error
+ *
+ */
+static void test_send(fr_event_list_t *el, char const *backend, int fd, test_ctx_t *ctx)
+{
+	int	refused = ctx->refused;
+	int	i;
+	uint8_t	byte = 0;
+
+	if (send(fd, &byte, sizeof(byte), 0) < 0) {
+		fprintf(stderr, "event_test: %s: Failed sending: %s\n", backend, fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; (i < MAX_LOOPS) && (ctx->refused == refused) && !ctx->errors; i++) {
+		if (fr_event_corral(el, false) < 0) test_fail(backend, fr_strerror());
+		fr_event_service(el);
+		if (ctx->refused == refused) usleep(1000);
+	}
+
+	if (ctx->errors) test_fail(backend, "Error callback was run for ECONNREFUSED");
+	if (ctx->refused == refused) test_fail(backend, "Read callback didn't see ECONNREFUSED");
+}
+
+/** An ICMP port unreachable must be delivered to the read callback, and not close the socket
+ *
+ */
+static void test_udp_refused(fr_event_backend_t backend, char const *name)
+{
+	fr_event_list_t	*el;
+	test_ctx_t	ctx = { 0 };
+	int		fd;
+
+	if (fr_event_list_backend_set(backend) < 0) {
+		if (debug_lvl) printf("%-8s not available\n", name);
+		return;
+	}
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	if (!el) test_fail(name, fr_strerror());
+
+	fd = test_socket();
+	if (fd < 0) {
+		fprintf(stderr, "event_test: %s: Failed creating socket: %s\n", name, fr_syserror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_event_fd_insert(el, el, fd, test_read, NULL, test_error, &ctx) < 0) test_fail(name, fr_strerror());
+
+	/*
+	 *	The second send checks that the fd is still
+	 *	in the event list after the first error.
+	 */
+	test_send(el, name, fd, &ctx);
+	test_send(el, name, fd, &ctx);
+
+	if (fr_event_fd_delete(el, fd, FR_EVENT_FILTER_IO) < 0) test_fail(name, "fd was removed from the event list");
+
+	if (debug_lvl) printf("%-8s ok, %i reads\n", name, ctx.reads);
+
+	talloc_free(el);
+	close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+	int	c;
+	size_t	i;
+
+	while ((c = getopt(argc, argv, "hx")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	for (i = 0; i < (sizeof(backends) / sizeof(backends[0])); i++) {
+		test_udp_refused(backends[i].backend, backends[i].name);
+	}
+
+	exit(EXIT_SUCCESS);
+}
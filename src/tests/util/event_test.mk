@@ -0,0 +1,6 @@
+TARGET := event_test
+
+SOURCES		:= event_test.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,292 @@
+/*
+ * ohash_bench.c	Compare the open addressing hash table with an rbtree
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/ohash.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/rbtree.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+/*
+ *	Do at least this many operations for each size, so that
+ *	small tables are timed over a reasonable period.
+ */
+#define MIN_OPERATIONS		(1000000)
+
+static int			debug_lvl = 0;
+
+/*
+ *	Table sizes used when no size is given.
+ */
+static uint32_t sizes[] = {
+	1000,
+	100000,
+	1000000,
+};
+
+/*
+ *	The same key as the worker "dedup" table: the listener, and
+ *	the packet context.
+ */
+typedef struct {
+	void const	*listen;
+	void const	*packet_ctx;
+} bench_entry_t;
+
+typedef struct {
+	fr_time_t	insert;
+	fr_time_t	find;
+	fr_time_t	miss;
+	fr_time_t	remove;
+} bench_time_t;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: ohash_bench [OPTS]\n");
+	fprintf(stderr, "  -l <listeners>         Spread the entries over this many listeners.\n");
+	fprintf(stderr, "  -n <entries>           Run with one table size, instead of the default range.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS bench_fail(int line)
+{
+	fprintf(stderr, "ohash_bench: Table returned the wrong result at line %d\n", line);
+	exit(EXIT_FAILURE);
+}
+
+static uint32_t entry_hash(void const *data)
+{
+	uint32_t hash;
+	bench_entry_t const *e = data;
+
+	hash = fr_hash(&e->listen, sizeof(e->listen));
+	return fr_hash_update(&e->packet_ctx, sizeof(e->packet_ctx), hash);
+}
+
+static int entry_cmp(void const *one, void const *two)
+{
+	int ret;
+	bench_entry_t const *a = one, *b = two;
+
+	ret = (a->listen > b->listen) - (a->listen < b->listen);
+	if (ret) return ret;
+
+	return (a->packet_ctx > b->packet_ctx) - (a->packet_ctx < b->packet_ctx);
+}
+
+static void bench_rbtree(bench_entry_t *entries, bench_entry_t *missing, uint32_t num, uint32_t rounds, bench_time_t *t)
+{
+	uint32_t	i, r;
+	rbtree_t	*tree;
+	fr_time_t	start;
+
+	memset(t, 0, sizeof(*t));
+
+	for (r = 0; r < rounds; r++) {
+		tree = rbtree_create(NULL, entry_cmp, NULL, RBTREE_FLAG_NONE);
+		rad_assert(tree != NULL);
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (!rbtree_insert(tree, &entries[i])) bench_fail(__LINE__);
+		}
+		t->insert += fr_time() - start;
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (rbtree_finddata(tree, &entries[i]) != &entries[i]) bench_fail(__LINE__);
+		}
+		t->find += fr_time() - start;
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (rbtree_finddata(tree, &missing[i]) != NULL) bench_fail(__LINE__);
+		}
+		t->miss += fr_time() - start;
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (!rbtree_deletebydata(tree, &entries[i])) bench_fail(__LINE__);
+		}
+		t->remove += fr_time() - start;
+
+		rad_assert(rbtree_num_elements(tree) == 0);
+		talloc_free(tree);
+	}
+}
+
+static void bench_ohash(bench_entry_t *entries, bench_entry_t *missing, uint32_t num, uint32_t rounds, bench_time_t *t)
+{
+	uint32_t	i, r;
+	fr_ohash_t	*oh;
+	fr_time_t	start;
+
+	memset(t, 0, sizeof(*t));
+
+	for (r = 0; r < rounds; r++) {
+		oh = fr_ohash_create(NULL, entry_hash, entry_cmp, 0);
+		rad_assert(oh != NULL);
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (fr_ohash_insert(oh, &entries[i]) < 0) bench_fail(__LINE__);
+		}
+		t->insert += fr_time() - start;
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (fr_ohash_find(oh, &entries[i]) != &entries[i]) bench_fail(__LINE__);
+		}
+		t->find += fr_time() - start;
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (fr_ohash_find(oh, &missing[i]) != NULL) bench_fail(__LINE__);
+		}
+		t->miss += fr_time() - start;
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (!fr_ohash_remove(oh, &entries[i])) bench_fail(__LINE__);
+		}
+		t->remove += fr_time() - start;
+
+		rad_assert(fr_ohash_num_elements(oh) == 0);
+		talloc_free(oh);
+	}
+}
+
+static void bench_print(char const *name, uint32_t num, uint32_t rounds, bench_time_t const *t)
+{
+	double ops = (double) num * rounds;
+
+	printf("%-8s %9u %11.1f %11.1f %11.1f %11.1f\n", name, num,
+	       t->insert / ops, t->find / ops, t->miss / ops, t->remove / ops);
+}
+
+static void bench_run(uint32_t num, uint32_t num_listeners)
+{
+	uint32_t	i, rounds;
+	uint8_t		*listeners;
+	uint8_t		*packet_ctx;
+	bench_entry_t	*entries, *missing;
+	bench_time_t	t;
+
+	/*
+	 *	The keys are pointers, so use real addresses spread
+	 *	over a real allocation, the same as the worker.
+	 */
+	listeners = talloc_zero_array(NULL, uint8_t, num_listeners * 64);
+	packet_ctx = talloc_zero_array(NULL, uint8_t, (size_t) num * 2 * 64);
+	entries = talloc_array(NULL, bench_entry_t, num);
+	missing = talloc_array(NULL, bench_entry_t, num);
+	rad_assert(listeners && packet_ctx && entries && missing);
+
+	for (i = 0; i < num; i++) {
+		entries[i].listen = listeners + ((i % num_listeners) * 64);
+		entries[i].packet_ctx = packet_ctx + ((size_t) i * 64);
+
+		missing[i].listen = entries[i].listen;
+		missing[i].packet_ctx = packet_ctx + (((size_t) num + i) * 64);
+	}
+
+	/*
+	 *	Shuffle the entries so that the lookups don't walk
+	 *	memory in order.
+	 */
+	for (i = num - 1; i > 0; i--) {
+		bench_entry_t	tmp;
+		uint32_t	j = fr_rand() % (i + 1);
+
+		tmp = entries[i];
+		entries[i] = entries[j];
+		entries[j] = tmp;
+	}
+
+	rounds = MIN_OPERATIONS / num;
+	if (!rounds) rounds = 1;
+
+	if (debug_lvl) printf("%u entries, %u listeners, %u rounds\n", num, num_listeners, rounds);
+
+	bench_rbtree(entries, missing, num, rounds, &t);
+	bench_print("rbtree", num, rounds, &t);
+
+	bench_ohash(entries, missing, num, rounds, &t);
+	bench_print("ohash", num, rounds, &t);
+
+	talloc_free(listeners);
+	talloc_free(packet_ctx);
+	talloc_free(entries);
+	talloc_free(missing);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	size_t		i;
+	uint32_t	num = 0;
+	uint32_t	num_listeners = 4;
+
+	fr_time_start();
+
+	while ((c = getopt(argc, argv, "hl:n:x")) != EOF) switch (c) {
+		case 'l':
+			num_listeners = atoi(optarg);
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (num_listeners < 1) num_listeners = 1;
+
+	printf("table      entries   insert(ns)    find(ns)    miss(ns)  remove(ns)\n");
+
+	if (num) {
+		bench_run(num, num_listeners);
+		exit(EXIT_SUCCESS);
+	}
+
+	for (i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); i++) {
+		bench_run(sizes[i], num_listeners);
+	}
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,353 @@
+/*
+ * pair_list_bench.c	Compare walking pair lists with using an indexed pair list
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/radius/defs.h>
+#include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/base.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+/*
+ *	Do at least this many packets for each size.
+ */
+#define MIN_PACKETS		(20000)
+
+static int			debug_lvl = 0;
+static char const		*secret = "testing123";
+
+static fr_dict_t		*dict_radius;
+
+extern fr_dict_autoload_t pair_list_bench_dict[];
+fr_dict_autoload_t pair_list_bench_dict[] = {
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+/*
+ *	Packet sizes (number of attributes) used when no size is given.
+ */
+static uint32_t sizes[] = {
+	30,
+	60,
+	100,
+};
+
+typedef struct {
+	char const		*name;
+	char const		*value;
+	fr_dict_attr_t const	*da;
+} bench_attr_t;
+
+/*
+ *	What a NAS typically sends in an Accounting-Request.
+ */
+static bench_attr_t acct_attrs[] = {
+	{ "Acct-Status-Type",		"Interim-Update" },
+	{ "User-Name",			"bob@example.org" },
+	{ "NAS-IP-Address",		"192.0.2.1" },
+	{ "NAS-Identifier",		"nas01.example.org" },
+	{ "NAS-Port",			"4194304" },
+	{ "NAS-Port-Id",		"xe-0/0/1.100:100-200" },
+	{ "NAS-Port-Type",		"Ethernet" },
+	{ "Service-Type",		"Framed-User" },
+	{ "Framed-Protocol",		"PPP" },
+	{ "Framed-IP-Address",		"198.51.100.17" },
+	{ "Class",			"0x6163636f756e74696e672d636c617373" },
+	{ "Called-Station-Id",		"00-11-22-33-44-55:example" },
+	{ "Calling-Station-Id",		"66-77-88-99-aa-bb" },
+	{ "Acct-Delay-Time",		"0" },
+	{ "Acct-Input-Octets",		"1928374" },
+	{ "Acct-Output-Octets",		"29384756" },
+	{ "Acct-Input-Gigawords",	"1" },
+	{ "Acct-Output-Gigawords",	"3" },
+	{ "Acct-Session-Id",		"0a1b2c3d4e5f6789" },
+	{ "Acct-Multi-Session-Id",	"9876f5e4d3c2b1a0" },
+	{ "Acct-Authentic",		"RADIUS" },
+	{ "Acct-Session-Time",		"3600" },
+	{ "Acct-Input-Packets",		"18273" },
+	{ "Acct-Output-Packets",	"28374" },
+	{ "Acct-Link-Count",		"1" },
+	{ "Acct-Interim-Interval",	"300" },
+	{ "Event-Timestamp",		"1533131233" },
+	{ "Connect-Info",		"1000BASE-T" },
+	{ "Idle-Timeout",		"600" },
+	{ "Session-Timeout",		"86400" },
+};
+
+/*
+ *	Padding, to get to the requested number of attributes.
+ */
+static bench_attr_t extra_attr = { "Proxy-State", "0x0102030405060708" };
+
+/*
+ *	Attributes which policies look for, but which aren't in the packet.
+ */
+static bench_attr_t missing_attrs[] = {
+	{ "Reply-Message" },
+	{ "State" },
+	{ "Framed-MTU" },
+	{ "Acct-Terminate-Cause" },
+	{ "Chargeable-User-Identity" },
+};
+
+#define NUM_ELEMENTS(_x) (sizeof(_x) / sizeof((_x)[0]))
+
+typedef struct {
+	fr_time_t	decode;
+	fr_time_t	add;
+	fr_time_t	append;
+	fr_time_t	scan;
+	fr_time_t	index;
+} bench_time_t;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: pair_list_bench [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <attributes>        Run with one packet size, instead of the default range.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS bench_fail(int line)
+{
+	fprintf(stderr, "pair_list_bench: Lookup returned the wrong result at line %d\n", line);
+	fr_perror("pair_list_bench");
+	exit(EXIT_FAILURE);
+}
+
+static int bench_attrs_resolve(bench_attr_t *attrs, size_t num)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		attrs[i].da = fr_dict_attr_by_name(dict_radius, attrs[i].name);
+		if (!attrs[i].da) {
+			fr_strerror_printf("Attribute \"%s\" not found in the RADIUS dictionary", attrs[i].name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static VALUE_PAIR *bench_pair_alloc(TALLOC_CTX *ctx, bench_attr_t const *attr)
+{
+	VALUE_PAIR *vp;
+
+	vp = fr_pair_afrom_da(ctx, attr->da);
+	if (!vp) bench_fail(__LINE__);
+
+	if (fr_pair_value_from_str(vp, attr->value, -1, '"', false) < 0) bench_fail(__LINE__);
+
+	return vp;
+}
+
+/*
+ *	Encode an Accounting-Request with the given number of attributes.
+ */
+static ssize_t bench_packet_alloc(uint8_t *packet, size_t packet_len, uint32_t num)
+{
+	TALLOC_CTX	*ctx = talloc_init("bench_packet");
+	VALUE_PAIR	*vps = NULL;
+	fr_cursor_t	cursor;
+	uint32_t	i;
+	ssize_t		slen;
+
+	fr_cursor_init(&cursor, &vps);
+	for (i = 0; i < num; i++) {
+		if (i < NUM_ELEMENTS(acct_attrs)) {
+			fr_cursor_append(&cursor, bench_pair_alloc(ctx, &acct_attrs[i]));
+		} else {
+			fr_cursor_append(&cursor, bench_pair_alloc(ctx, &extra_attr));
+		}
+	}
+
+	slen = fr_radius_encode(packet, packet_len, NULL, secret, strlen(secret),
+				FR_CODE_ACCOUNTING_REQUEST, 0, vps);
+	talloc_free(ctx);
+
+	return slen;
+}
+
+static void bench_run(uint32_t num)
+{
+	uint8_t		packet[4096];
+	ssize_t		packet_len;
+	uint32_t	i, r, rounds;
+	size_t		j;
+	bench_time_t	t;
+	fr_time_t	start;
+	uint32_t	found = (num < NUM_ELEMENTS(acct_attrs)) ? num : NUM_ELEMENTS(acct_attrs);
+
+	memset(&t, 0, sizeof(t));
+
+	packet_len = bench_packet_alloc(packet, sizeof(packet), num);
+	if (packet_len < 0) bench_fail(__LINE__);
+
+	rounds = MIN_PACKETS;
+
+	if (debug_lvl) printf("%u attributes, %zd bytes, %u rounds\n", num, packet_len, rounds);
+
+	for (r = 0; r < rounds; r++) {
+		TALLOC_CTX	*ctx = talloc_init("bench_round");
+		VALUE_PAIR	*vps = NULL, *added = NULL, *appended = NULL;
+		fr_pair_list_t	list;
+
+		/*
+		 *	Decode the packet.
+		 */
+		start = fr_time();
+		if (fr_radius_decode(ctx, packet, packet_len, packet, secret, 0, &vps) < 0) bench_fail(__LINE__);
+		t.decode += fr_time() - start;
+
+		/*
+		 *	Look up each attribute in the packet, and
+		 *	the ones which aren't, by walking the list.
+		 */
+		start = fr_time();
+		for (j = 0; j < found; j++) {
+			if (!fr_pair_find_by_da(vps, acct_attrs[j].da, TAG_ANY)) bench_fail(__LINE__);
+		}
+		for (j = 0; j < NUM_ELEMENTS(missing_attrs); j++) {
+			if (fr_pair_find_by_da(vps, missing_attrs[j].da, TAG_ANY)) bench_fail(__LINE__);
+		}
+		t.scan += fr_time() - start;
+
+		/*
+		 *	The same lookups, using the index.  This
+		 *	includes the time taken to build the index.
+		 */
+		start = fr_time();
+		fr_pair_list_init(&list, &vps);
+		for (j = 0; j < found; j++) {
+			if (!fr_pair_list_find_by_da(&list, acct_attrs[j].da, TAG_ANY)) bench_fail(__LINE__);
+		}
+		for (j = 0; j < NUM_ELEMENTS(missing_attrs); j++) {
+			if (fr_pair_list_find_by_da(&list, missing_attrs[j].da, TAG_ANY)) bench_fail(__LINE__);
+		}
+		fr_pair_list_done(&list);
+		t.index += fr_time() - start;
+
+		/*
+		 *	Move the decoded pairs to new lists one at
+		 *	a time, as the decoders used to.
+		 */
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			VALUE_PAIR *vp = vps;
+
+			vps = vp->next;
+			vp->next = NULL;
+			fr_pair_add(&added, vp);
+		}
+		t.add += fr_time() - start;
+
+		start = fr_time();
+		fr_pair_list_init(&list, &appended);
+		for (i = 0; i < num; i++) {
+			VALUE_PAIR *vp = added;
+
+			added = vp->next;
+			vp->next = NULL;
+			fr_pair_list_append(&list, vp);
+		}
+		fr_pair_list_done(&list);
+		t.append += fr_time() - start;
+
+		if (vps || added) bench_fail(__LINE__);
+
+		talloc_free(ctx);
+	}
+
+	printf("%10u %11.1f %11.1f %11.1f %11.1f %11.1f\n", num,
+	       (double) t.decode / rounds,
+	       (double) t.scan / rounds, (double) t.index / rounds,
+	       (double) t.add / rounds, (double) t.append / rounds);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	size_t		i;
+	uint32_t	num = 0;
+	char const	*dict_dir = DICTDIR;
+	fr_dict_t	*dict_internal = NULL;
+	TALLOC_CTX	*autofree = talloc_autofree_context();
+
+	fr_time_start();
+
+	while ((c = getopt(argc, argv, "D:hn:x")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (fr_dict_global_init(autofree, dict_dir) < 0) {
+	error:
+		fr_perror("pair_list_bench");
+		exit(EXIT_FAILURE);
+	}
+
+	if (fr_dict_internal_afrom_file(&dict_internal, NULL) < 0) goto error;
+	if (fr_radius_init() < 0) goto error;
+	if (fr_dict_autoload(pair_list_bench_dict) < 0) goto error;
+
+	if ((bench_attrs_resolve(acct_attrs, NUM_ELEMENTS(acct_attrs)) < 0) ||
+	    (bench_attrs_resolve(&extra_attr, 1) < 0) ||
+	    (bench_attrs_resolve(missing_attrs, NUM_ELEMENTS(missing_attrs)) < 0)) goto error;
+
+	/*
+	 *	Times are per packet, in nanoseconds.
+	 */
+	printf("attributes  decode(ns)    scan(ns)   index(ns)     add(ns)  append(ns)\n");
+
+	if (num) {
+		bench_run(num);
+	} else {
+		for (i = 0; i < NUM_ELEMENTS(sizes); i++) bench_run(sizes[i]);
+	}
+
+	fr_dict_autofree(pair_list_bench_dict);
+	fr_radius_free();
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,6 @@
+TARGET := pair_list_bench
+
+SOURCES		:= pair_list_bench.c
+
+TGT_PREREQS	:= libfreeradius-radius.a libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
@@ -33,6 +33,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/syserror.h>
 
 #include <sys/event.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -46,24 +47,50 @@ RCSID("$Id$")
 
 #define MPRINT1 if (debug_lvl) printf
 
+/*
+ *	Each listener has a ring of packet contexts.  A context is
+ *	used for one packet, from the time it is read until the reply
+ *	is written.  The benchmark clients limit the number of
+ *	outstanding packets to less than this.
+ */
+#define NUM_PACKET_CTX		(4096)
+
 typedef struct {
 	uint8_t			vector[16];
 	uint8_t			id;
 	struct			sockaddr_storage src;
 	socklen_t		salen;
+	fr_time_t		recv_time;
 } fr_test_packet_ctx_t;
 
 typedef struct fr_listen_test_t {
 	int			sockfd;
 	fr_ipaddr_t		ipaddr;
 	uint16_t		port;
+
+	uint32_t		next;		//!< next packet ctx to use
+	fr_test_packet_ctx_t	tpc[NUM_PACKET_CTX];
 } fr_listen_test_t;
 
+/*
+ *	A client thread for the benchmark.
+ */
+typedef struct fr_test_client_t {
+	pthread_t		pthread_id;
+	int			sockfd;
+	uint64_t		sent;
+	uint64_t		received;
+} fr_test_client_t;
+
 static int			debug_lvl = 0;
 static fr_ipaddr_t		my_ipaddr;
 static int			my_port;
 static char const		*secret = "testing123";
-static fr_test_packet_ctx_t	tpc;
+
+static int			num_clients = 0;
+static int			window = 32;
+static int			worker_select = FR_NETWORK_WORKER_SELECT_CPU_TIME;
+static volatile bool		clients_running;
 
 static fr_io_final_t test_process(UNUSED void const *instance, REQUEST *request, fr_io_action_t action)
 {
@@ -88,15 +115,16 @@ static ssize_t test_encode(void const *instance, REQUEST *request, uint8_t *buff
 {
 	FR_MD5_CTX context;
 	fr_listen_test_t const *pc = instance;
+	fr_test_packet_ctx_t const *tpc = request->async->packet_ctx;
 
 	MPRINT1("\t\tENCODE >>> request %"PRIu64"- data %p %p room %zd\n", request->number, pc, buffer, buffer_len);
 
 	buffer[0] = FR_CODE_ACCESS_ACCEPT;
-	buffer[1] = tpc.id;
+	buffer[1] = tpc->id;
 	buffer[2] = 0;
 	buffer[3] = 20;
 
-	memcpy(buffer + 4, tpc.vector, 16);
+	memcpy(buffer + 4, tpc->vector, 16);
 
 	fr_md5_init(&context);
 	fr_md5_update(&context, buffer, 20);
@@ -123,6 +151,20 @@ static int test_open(void *ctx, UNUSED void const *master_ctx)
 		exit(EXIT_FAILURE);
 	}
 
+	/*
+	 *	Each network thread gets its own socket, all bound to
+	 *	the same address and port.  The kernel distributes
+	 *	packets between them.
+	 */
+	{
+		int on = 1;
+
+		if (setsockopt(io_ctx->sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			fprintf(stderr, "radius_test: Failed setting SO_REUSEPORT: %s\n", fr_syserror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	if (fr_socket_bind(io_ctx->sockfd, &io_ctx->ipaddr, &io_ctx->port, NULL) < 0) {
 		fr_perror("radius_test: Failed binding to socket");
 		exit(EXIT_FAILURE);
@@ -131,43 +173,48 @@ static int test_open(void *ctx, UNUSED void const *master_ctx)
 	return 0;
 }
 
-static fr_time_t start_time;
-
-static ssize_t test_read(void *ctx, UNUSED void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover, uint32_t *priority, bool *is_dup)
+static ssize_t test_read(void *ctx, void **packet_ctx, fr_time_t **recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover, uint32_t *priority, bool *is_dup)
 {
 	ssize_t			data_size;
-	fr_listen_test_t const	*io_ctx = talloc_get_type_abort(ctx, fr_listen_test_t);
+	fr_listen_test_t	*io_ctx = talloc_get_type_abort(ctx, fr_listen_test_t);
+	fr_test_packet_ctx_t	*tpc;
+
+	tpc = &io_ctx->tpc[io_ctx->next % NUM_PACKET_CTX];
 
-	tpc.salen = sizeof(tpc.src);
+	tpc->salen = sizeof(tpc->src);
 	*leftover = 0;
 	*is_dup = false;
 
-	data_size = recvfrom(io_ctx->sockfd, buffer, buffer_len, 0, (struct sockaddr *) &tpc.src, &tpc.salen);
+	data_size = recvfrom(io_ctx->sockfd, buffer, buffer_len, 0, (struct sockaddr *) &tpc->src, &tpc->salen);
 	if (data_size <= 0) return data_size;
 
+	if (data_size < 20) return 0;
+
 	/*
 	 *	@todo - check if it's RADIUS.
 	 */
-	tpc.id = buffer[1];
-	memcpy(tpc.vector, buffer + 4, sizeof(tpc.vector));
+	tpc->id = buffer[1];
+	memcpy(tpc->vector, buffer + 4, sizeof(tpc->vector));
 
-	start_time = fr_time();
-	*recv_time = &start_time;
+	tpc->recv_time = fr_time();
+	*recv_time = &tpc->recv_time;
 	*priority = 0;
+	*packet_ctx = tpc;
+
+	io_ctx->next++;
 
 	return data_size;
 }
 
 
-static ssize_t test_write(void *ctx, UNUSED void *packet_ctx,  UNUSED fr_time_t request_time,
+static ssize_t test_write(void *ctx, void *packet_ctx,  UNUSED fr_time_t request_time,
 			  uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
 	ssize_t			data_size;
 	fr_listen_test_t	*io_ctx = talloc_get_type_abort(ctx, fr_listen_test_t);
+	fr_test_packet_ctx_t	*tpc = packet_ctx;
 
-	tpc.salen = sizeof(tpc.src);
-
-	data_size = sendto(io_ctx->sockfd, buffer, buffer_len, 0, (struct sockaddr *)&tpc.src, tpc.salen);
+	data_size = sendto(io_ctx->sockfd, buffer, buffer_len, 0, (struct sockaddr *)&tpc->src, tpc->salen);
 	if (data_size <= 0) return data_size;
 
 	/*
@@ -205,12 +252,151 @@ static fr_app_t test_app = {
 	.entry_point_set = entry_point_set,
 };
 
+/** Send packets to the server as fast as it will answer them
+ *
+ *  Each client has its own socket, and therefore its own source
+ *  port.  SO_REUSEPORT on the server side hashes the clients across
+ *  the listeners, and therefore across the network threads.
+ */
+static void *test_client(void *arg)
+{
+	fr_test_client_t	*client = arg;
+	uint8_t			packet[20];
+	uint8_t			reply[4096];
+	uint8_t			id = 0;
+	int			i;
+	struct pollfd		pfd;
+
+	memset(packet, 0, sizeof(packet));
+	packet[0] = FR_CODE_ACCESS_REQUEST;
+	packet[3] = sizeof(packet);
+
+	pfd.fd = client->sockfd;
+	pfd.events = POLLIN;
+
+	while (clients_running) {
+		for (i = 0; i < window; i++) {
+			packet[1] = id++;
+			memset(packet + 4, packet[1], 16);
+
+			if (send(client->sockfd, packet, sizeof(packet), 0) == sizeof(packet)) client->sent++;
+		}
+
+		for (i = 0; i < window; i++) {
+			if (poll(&pfd, 1, 100) <= 0) break;
+
+			if (recv(client->sockfd, reply, sizeof(reply), 0) >= 20) client->received++;
+		}
+	}
+
+	return NULL;
+}
+
+/** Run one round of the benchmark, or just listen for external packets
+ *
+ * @param[in] ctx		to allocate listeners in.
+ * @param[in] num_networks	number of network threads, and listeners.
+ * @param[in] num_workers	number of worker threads.
+ * @param[in] duration		how long to run for, in seconds.
+ */
+static void test_run(TALLOC_CTX *ctx, int num_networks, int num_workers, int duration)
+{
+	int			i;
+	fr_schedule_t		*sched;
+	fr_test_client_t	*clients = NULL;
+	uint64_t		received = 0;
+	fr_time_t		start, end;
+
+	sched = fr_schedule_create(ctx, NULL, &default_log, debug_lvl, num_networks, num_workers,
+				   worker_select, NULL, NULL);
+	if (!sched) {
+		fprintf(stderr, "radius_schedule_test: Failed to create scheduler\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 *	One listener per network thread.
+	 */
+	for (i = 0; i < num_networks; i++) {
+		fr_listen_t		*listen;
+		fr_listen_test_t	*app_io_inst;
+
+		listen = talloc_zero(ctx, fr_listen_t);
+		listen->app_io = &app_io;
+		listen->app = &test_app;
+		listen->app_io_instance = app_io_inst = talloc_zero(ctx, fr_listen_test_t);
+
+		app_io_inst->ipaddr = my_ipaddr;
+		app_io_inst->port = my_port;
+
+		if (listen->app_io->open(listen->app_io_instance, listen->app_io_instance) < 0) exit(EXIT_FAILURE);
+
+		(void) fr_schedule_listen_add(sched, listen);
+	}
+
+	/*
+	 *	No clients, just wait for someone else to send us packets.
+	 */
+	if (!num_clients) {
+		sleep(duration);
+		goto done;
+	}
+
+	clients = talloc_zero_array(ctx, fr_test_client_t, num_clients);
+	clients_running = true;
+
+	for (i = 0; i < num_clients; i++) {
+		struct sockaddr_storage	dst;
+		socklen_t		dst_len;
+
+		clients[i].sockfd = socket(my_ipaddr.af, SOCK_DGRAM, 0);
+		if ((clients[i].sockfd < 0) ||
+		    (fr_ipaddr_to_sockaddr(&my_ipaddr, my_port, &dst, &dst_len) < 0) ||
+		    (connect(clients[i].sockfd, (struct sockaddr *) &dst, dst_len) < 0)) {
+			fprintf(stderr, "radius_schedule_test: Failed creating client socket: %s\n", fr_syserror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		if (fr_schedule_pthread_create(&clients[i].pthread_id, test_client, &clients[i]) < 0) {
+			fr_perror("radius_schedule_test");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	start = fr_time();
+	sleep(duration);
+	clients_running = false;
+	end = fr_time();
+
+	for (i = 0; i < num_clients; i++) {
+		(void) pthread_join(clients[i].pthread_id, NULL);
+		close(clients[i].sockfd);
+		received += clients[i].received;
+	}
+
+	printf("networks %d workers %d (%s) clients %d window %d: %" PRIu64 " replies in %.3fs = %.0f packets/s\n",
+	       num_networks, num_workers, fr_int2str(fr_network_worker_select_table, worker_select, "?"),
+	       num_clients, window, received,
+	       ((double) (end - start)) / NANOSEC,
+	       ((double) received * NANOSEC) / (end - start));
+
+done:
+	(void) fr_schedule_destroy(sched);
+	talloc_free(clients);
+}
+
 static void NEVER_RETURNS usage(void)
 {
-	fprintf(stderr, "usage: schedule_test [OPTS]\n");
-	fprintf(stderr, "  -n <num>               Start num network threads\n");
+	fprintf(stderr, "usage: radius_schedule_test [OPTS]\n");
+	fprintf(stderr, "  -c <num>               Benchmark mode: start num client threads, and measure\n");
+	fprintf(stderr, "                         packets/s with 1 through the number of network threads.\n");
+	fprintf(stderr, "  -d <num>               Run each test for num seconds.\n");
 	fprintf(stderr, "  -i <address>[:port]    Set IP address and optional port.\n");
+	fprintf(stderr, "  -n <num>               Start num network threads\n");
+	fprintf(stderr, "  -p <policy>            How to choose a worker (cpu-time, outstanding, latency, least-loaded).\n");
 	fprintf(stderr, "  -s <secret>            Set shared secret.\n");
+	fprintf(stderr, "  -w <num>               Start num worker threads\n");
+	fprintf(stderr, "  -W <num>               Number of outstanding packets per benchmark client.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
 	exit(EXIT_FAILURE);
@@ -218,16 +404,12 @@ static void NEVER_RETURNS usage(void)
 
 int main(int argc, char *argv[])
 {
-	int			c;
+	int			c, i;
 	int			num_networks = 1;
 	int			num_workers = 2;
+	int			duration = 10;
 	uint16_t		port16 = 0;
 	TALLOC_CTX		*autofree = talloc_autofree_context();
-	fr_schedule_t		*sched;
-	fr_listen_t		listen = { .app_io = &app_io, .app = &test_app };
-	fr_listen_test_t	*app_io_inst;
-
-	listen.app_io_instance = app_io_inst = talloc_zero(autofree, fr_listen_test_t);
 
 	fr_time_start();
 
@@ -240,7 +422,17 @@ int main(int argc, char *argv[])
 	my_ipaddr.addr.v4.s_addr = htonl(INADDR_LOOPBACK);
 	my_port = 1812;
 
-	while ((c = getopt(argc, argv, "i:n:s:w:x")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "c:d:i:n:p:s:w:W:x")) != EOF) switch (c) {
+		case 'c':
+			num_clients = atoi(optarg);
+			if ((num_clients <= 0) || (num_clients > 256)) usage();
+			break;
+
+		case 'd':
+			duration = atoi(optarg);
+			if ((duration <= 0) || (duration > 3600)) usage();
+			break;
+
 		case 'i':
 			if (fr_inet_pton_port(&my_ipaddr, &port16, optarg, -1, AF_INET, true, false) < 0) {
 				fr_perror("Failed parsing ipaddr");
@@ -254,6 +446,11 @@ int main(int argc, char *argv[])
 			if ((num_networks <= 0) || (num_networks > 16)) usage();
 			break;
 
+		case 'p':
+			worker_select = fr_str2int(fr_network_worker_select_table, optarg, -1);
+			if (worker_select < 0) usage();
+			break;
+
 		case 's':
 			secret = optarg;
 			break;
@@ -263,6 +460,11 @@ int main(int argc, char *argv[])
 			if ((num_workers <= 0) || (num_workers > 1024)) usage();
 			break;
 
+		case 'W':
+			window = atoi(optarg);
+			if ((window <= 0) || (window > 1024)) usage();
+			break;
+
 		case 'x':
 			debug_lvl++;
 			fr_debug_lvl++;
@@ -273,39 +475,29 @@ int main(int argc, char *argv[])
 			usage();
 	}
 
-#if 0
-	argc -= (optind - 1);
-	argv += (optind - 1);
-#endif
-
-	app_io_inst->ipaddr = my_ipaddr;
-	app_io_inst->port = my_port;
-
-	sched = fr_schedule_create(autofree, NULL, &default_log, debug_lvl, num_networks, num_workers, NULL, NULL);
-	if (!sched) {
-		fprintf(stderr, "schedule_test: Failed to create scheduler\n");
-		exit(EXIT_FAILURE);
-	}
-
-	if (listen.app_io->open(listen.app_io_instance, listen.app_io_instance) < 0) exit(EXIT_FAILURE);
-
-#if 0
 	/*
-	 *	Set up the KQ filter for reading.
+	 *	The packet contexts are re-used in a ring, so we can't
+	 *	have more outstanding packets than there are contexts.
 	 */
-	EV_SET(&events[0], sockfd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, NULL);
-	if (kevent(kq_master, events, 1, NULL, 0, NULL) < 0) {
-		fr_perror("Failed setting KQ for EVFILT_READ");
+	if ((num_clients * window) >= NUM_PACKET_CTX) {
+		fprintf(stderr, "radius_schedule_test: clients * window must be less than %d\n", NUM_PACKET_CTX);
 		exit(EXIT_FAILURE);
 	}
-#endif
 
 	(void) fr_fault_setup(autofree, NULL, argv[0]);
-	(void) fr_schedule_listen_add(sched, &listen);
 
-	sleep(10);
+	if (!num_clients) {
+		test_run(autofree, num_networks, num_workers, duration);
+		exit(EXIT_SUCCESS);
+	}
 
-	(void) fr_schedule_destroy(sched);
+	/*
+	 *	Show how throughput scales with the number of network
+	 *	threads.
+	 */
+	for (i = 1; i <= num_networks; i++) {
+		test_run(autofree, i, num_workers, duration);
+	}
 
 	exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,268 @@
+/*
+ * twheel_bench.c	Compare the timer wheel with a binary heap
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * @copyright 2018 The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/server/rad_assert.h>
+#include <freeradius-devel/util/heap.h>
+#include <freeradius-devel/util/rand.h>
+#include <freeradius-devel/util/twheel.h>
+
+#ifdef HAVE_GETOPT_H
+#  include <getopt.h>
+#endif
+
+/*
+ *	Do at least this many operations for each size, so that
+ *	small sets of timers are timed over a reasonable period.
+ */
+#define MIN_OPERATIONS		(1000000)
+
+static int			debug_lvl = 0;
+
+/*
+ *	Numbers of outstanding timers used when no size is given.
+ */
+static uint32_t sizes[] = {
+	1000,
+	100000,
+	1000000,
+};
+
+/*
+ *	Most requests complete long before their timers would fire,
+ *	so most timers are cancelled.  This percentage is left to expire.
+ */
+static uint32_t expire_pct = 10;
+
+typedef struct {
+	fr_time_t		when;
+	int32_t			heap_id;
+	fr_twheel_entry_t	tw_entry;
+	bool			cancel;
+} bench_timer_t;
+
+typedef struct {
+	fr_time_t	insert;
+	fr_time_t	cancel;
+	fr_time_t	expire;
+} bench_time_t;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: twheel_bench [OPTS]\n");
+	fprintf(stderr, "  -e <percent>           Percentage of timers which expire, instead of being cancelled.\n");
+	fprintf(stderr, "  -n <timers>            Run with one number of timers, instead of the default range.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(EXIT_FAILURE);
+}
+
+static void NEVER_RETURNS bench_fail(int line)
+{
+	fprintf(stderr, "twheel_bench: Timers returned the wrong result at line %d\n", line);
+	exit(EXIT_FAILURE);
+}
+
+static int timer_cmp(void const *one, void const *two)
+{
+	bench_timer_t const *a = one, *b = two;
+
+	return (a->when > b->when) - (a->when < b->when);
+}
+
+static void bench_heap(bench_timer_t *timers, uint32_t num, uint32_t rounds, fr_time_t end, bench_time_t *t)
+{
+	uint32_t	i, r;
+	fr_heap_t	*hp;
+	fr_time_t	start;
+	bench_timer_t	*timer;
+
+	memset(t, 0, sizeof(*t));
+
+	for (r = 0; r < rounds; r++) {
+		hp = fr_heap_create(NULL, timer_cmp, bench_timer_t, heap_id);
+		rad_assert(hp != NULL);
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (fr_heap_insert(hp, &timers[i]) < 0) bench_fail(__LINE__);
+		}
+		t->insert += fr_time() - start;
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (!timers[i].cancel) continue;
+			if (fr_heap_extract(hp, &timers[i]) < 0) bench_fail(__LINE__);
+		}
+		t->cancel += fr_time() - start;
+
+		/*
+		 *	Expire everything which is left, the same way
+		 *	fr_event_timer_run() does.
+		 */
+		start = fr_time();
+		while ((timer = fr_heap_peek(hp)) != NULL) {
+			if (timer->when > end) bench_fail(__LINE__);
+			if (fr_heap_extract(hp, timer) < 0) bench_fail(__LINE__);
+		}
+		t->expire += fr_time() - start;
+
+		if (fr_heap_num_elements(hp) != 0) bench_fail(__LINE__);
+		talloc_free(hp);
+	}
+}
+
+static void bench_twheel(bench_timer_t *timers, uint32_t num, uint32_t rounds, fr_time_t base, fr_time_t end,
+			 bench_time_t *t)
+{
+	uint32_t	i, r;
+	fr_twheel_t	*tw;
+	fr_time_t	start, last;
+	bench_timer_t	*timer;
+
+	memset(t, 0, sizeof(*t));
+
+	for (r = 0; r < rounds; r++) {
+		tw = fr_twheel_create(NULL, bench_timer_t, tw_entry, base);
+		rad_assert(tw != NULL);
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (fr_twheel_insert(tw, &timers[i], timers[i].when) < 0) bench_fail(__LINE__);
+		}
+		t->insert += fr_time() - start;
+
+		start = fr_time();
+		for (i = 0; i < num; i++) {
+			if (!timers[i].cancel) continue;
+			if (fr_twheel_extract(tw, &timers[i]) < 0) bench_fail(__LINE__);
+		}
+		t->cancel += fr_time() - start;
+
+		last = 0;
+		start = fr_time();
+		while ((timer = fr_twheel_peek(tw, end)) != NULL) {
+			if (timer->when > end) bench_fail(__LINE__);
+			if (timer->when < last) bench_fail(__LINE__);	/* Must expire in order */
+			last = timer->when;
+			if (fr_twheel_extract(tw, timer) < 0) bench_fail(__LINE__);
+		}
+		t->expire += fr_time() - start;
+
+		if (fr_twheel_num_elements(tw) != 0) bench_fail(__LINE__);
+		talloc_free(tw);
+	}
+}
+
+static void bench_print(char const *name, uint32_t num, uint32_t rounds, bench_time_t const *t)
+{
+	double ops = (double) num * rounds;
+
+	printf("%-8s %9u %11.1f %11.1f %11.1f\n", name, num,
+	       t->insert / ops,
+	       (expire_pct < 100) ? t->cancel / (ops * (100 - expire_pct) / 100) : 0.0,
+	       expire_pct ? t->expire / (ops * expire_pct / 100) : 0.0);
+}
+
+static void bench_run(uint32_t num)
+{
+	uint32_t	i, rounds;
+	bench_timer_t	*timers;
+	bench_time_t	t;
+	fr_time_t	base = ((fr_time_t) time(NULL)) * NANOSEC;
+	fr_time_t	end = base;
+
+	timers = talloc_zero_array(NULL, bench_timer_t, num);
+	rad_assert(timers);
+
+	/*
+	 *	A mix of timeouts like the ones the server uses.
+	 *	Retransmits of up to a few seconds, and request
+	 *	timeouts of up to 30s.
+	 */
+	for (i = 0; i < num; i++) {
+		if (fr_rand() & 1) {
+			timers[i].when = base + (((fr_time_t) (fr_rand() % 3000) + 1) * 1000000);
+		} else {
+			timers[i].when = base + (((fr_time_t) (fr_rand() % 30000) + 1) * 1000000);
+		}
+		timers[i].cancel = ((fr_rand() % 100) >= expire_pct);
+		if (timers[i].when > end) end = timers[i].when;
+	}
+
+	rounds = MIN_OPERATIONS / num;
+	if (!rounds) rounds = 1;
+
+	if (debug_lvl) printf("%u timers, %u rounds\n", num, rounds);
+
+	bench_heap(timers, num, rounds, end, &t);
+	bench_print("heap", num, rounds, &t);
+
+	bench_twheel(timers, num, rounds, base, end, &t);
+	bench_print("twheel", num, rounds, &t);
+
+	talloc_free(timers);
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	size_t		i;
+	uint32_t	num = 0;
+
+	fr_time_start();
+
+	while ((c = getopt(argc, argv, "e:hn:x")) != EOF) switch (c) {
+		case 'e':
+			expire_pct = atoi(optarg);
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (expire_pct > 100) expire_pct = 100;
+
+	printf("struct      timers  insert(ns)  cancel(ns)  expire(ns)\n");
+
+	if (num) {
+		bench_run(num);
+		exit(EXIT_SUCCESS);
+	}
+
+	for (i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); i++) {
+		bench_run(sizes[i]);
+	}
+
+	exit(EXIT_SUCCESS);
+}
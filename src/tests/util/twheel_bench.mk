@@ -0,0 +1,6 @@
+TARGET := twheel_bench
+
+SOURCES		:= twheel_bench.c
+
+TGT_PREREQS	:= $(LIBFREERADIUS_SERVER) libfreeradius-io.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)